@@ -0,0 +1,145 @@
+#include <math.h>
+#include <string.h>
+#include "au-timestamps.h"
+#include "h265const.h"
+
+void AuTimestampsInit(struct AuTimestamps* ts, struct OutputContextList* out) {
+  memset(ts, 0, sizeof(*ts));
+  ts->out = out;
+}
+
+void AuTimestampsRestore(struct AuTimestamps* ts,
+                         const struct AuTimestampsState* state) {
+  ts->state = *state;
+  ts->state.au_started = 0;
+}
+
+static int64_t Ticks90k(double seconds) {
+  return (int64_t)floor(seconds * 90000 + 0.5);
+}
+
+// Clock ticks per POC step
+static uint32_t PocTicks(const struct h265_decode_t* dec) {
+  const struct H265SeqParameterSet* sps = &dec->seq_param_set;
+  const struct H265VuiParameters* vui = &sps->vui_param;
+  const struct H265VideoParameterSet* vps = &dec->video_param_set;
+  if (sps->vui_parameters_present_flag && vui->vui_timing_info_present_flag)
+    return vui->vui_poc_proportional_to_timing_flag
+               ? vui->vui_num_ticks_poc_diff_one_minus1 + 1
+               : 1;
+  if (vps->vps_timing_info_present_flag &&
+      vps->vps_poc_proportional_to_timing_flag)
+    return vps->vps_num_ticks_poc_diff_one_minus1 + 1;
+  return 1;
+}
+
+static void CollectSei(struct AuTimestampsState* st,
+                       const struct h265_decode_t* dec) {
+  const struct H265VuiParameters* vui = &dec->seq_param_set.vui_param;
+  const struct H265HrdParameters* hrd = &vui->hrd_parameters;
+  const struct H265SeiMessages* sei = &dec->sei;
+  // CpbDpbDelaysPresentFlag
+  if (!vui->vui_hrd_parameters_present_flag ||
+      (!hrd->nal_hrd_parameters_present_flag &&
+       !hrd->vcl_hrd_parameters_present_flag))
+    return;
+  if (sei->buffering_period_present) {
+    st->has_buffering_period = 1;
+    st->initial_cpb_removal_delay =
+        hrd->nal_hrd_parameters_present_flag
+            ? sei->buffering_period.nal_initial_cpb_removal_delay[0]
+            : sei->buffering_period.vcl_initial_cpb_removal_delay[0];
+  }
+  if (sei->pic_timing_present) {
+    st->has_pic_timing = 1;
+    st->au_cpb_removal_delay_minus1 =
+        sei->pic_timing.au_cpb_removal_delay_minus1;
+    st->pic_dpb_output_delay = sei->pic_timing.pic_dpb_output_delay;
+  }
+}
+
+static void Write(const struct AuTimestamp* a, struct OutputContextList* out) {
+  struct OutputContextDict dict[1];
+  out->put_dict(out, dict);
+  dict->put_uint(dict, "access_unit", a->access_unit);
+  dict->put_hex(dict, "offset", a->offset);
+  dict->put_enum(dict, "nal_unit_type",
+                 GetH265NalType((enum H265NalType)a->nal_unit_type),
+                 a->nal_unit_type);
+  dict->put_int(dict, "poc", a->poc);
+  if (a->timed) {
+    dict->put_int(dict, "dts", a->dts);
+    dict->put_int(dict, "pts", a->pts);
+    dict->put_str(dict, "timing", a->from_sei ? "sei" : "poc");
+  }
+  dict->end(dict);
+}
+
+int AuTimestampsPushNal(struct AuTimestamps* ts,
+                        const struct h265_decode_t* dec,
+                        const struct NalUnit* nal,
+                        int err) {
+  struct AuTimestampsState* st = &ts->state;
+  struct AuTimestamp* a = &ts->last;
+  uint32_t type = dec->nal_unit_header.nal_unit_type;
+  const struct H265SeqParameterSet* sps = &dec->seq_param_set;
+  double tick, dts, pts;
+  uint8_t irap, cvs_start;
+  if (dec->new_access_unit || !st->au_started) {
+    st->au_started = 1;
+    st->au_offset = nal->offset;
+    st->has_buffering_period = 0;
+    st->has_pic_timing = 0;
+  }
+  if (err != 0)
+    return 0;
+  if (type == H265_NAL_TYPE_PREFIX_SEI_NUT)
+    CollectSei(st, dec);
+  if (!(type <= H265_NAL_TYPE_RASL_R ||
+        (type >= H265_NAL_TYPE_BLA_W_LP && type <= H265_NAL_TYPE_CRA_NUT)) ||
+      !dec->slice_segment.header.first_slice_segment_in_pic_flag)
+    return 0;
+
+  irap = type >= H265_NAL_TYPE_BLA_W_LP;
+  // NoRaslOutputFlag: an IDR or BLA picture, or the first CRA picture
+  cvs_start =
+      irap && (type != H265_NAL_TYPE_CRA_NUT || !st->poc.seen_picture);
+  a->poc = h265_pic_order_cnt(&st->poc, dec);
+  tick = h265_clock_tick(dec);
+  if (cvs_start) {
+    st->cvs_start = st->au_count ? st->last_dts + tick : 0;
+    st->cvs_poc = a->poc;
+    st->cvs_access_units = 0;
+  }
+  if (st->has_pic_timing) {
+    // C.2.3 without concatenation: the first buffering period starts at its
+    // initial removal delay, later ones count from the previous one
+    if (st->has_buffering_period && !st->seen_buffering_period)
+      dts = st->initial_cpb_removal_delay / 90000.0;
+    else
+      dts = st->bp_removal + tick * (st->au_cpb_removal_delay_minus1 + 1.0);
+    if (st->has_buffering_period) {
+      st->seen_buffering_period = 1;
+      st->bp_removal = dts;
+    }
+    pts = dts + tick * st->pic_dpb_output_delay;
+  } else {
+    uint32_t reorder =
+        sps->sps_max_num_reorder_pics[sps->sps_max_sub_layers_minus1];
+    dts = st->cvs_start + tick * st->cvs_access_units;
+    pts = st->cvs_start +
+          tick * ((double)(a->poc - st->cvs_poc) * PocTicks(dec) + reorder);
+  }
+  a->access_unit = st->au_count++;
+  a->offset = st->au_offset;
+  a->nal_unit_type = (uint8_t)type;
+  a->timed = tick > 0;
+  a->from_sei = st->has_pic_timing;
+  a->dts = Ticks90k(dts);
+  a->pts = Ticks90k(pts);
+  st->cvs_access_units++;
+  st->last_dts = dts;
+  if (ts->out)
+    Write(a, ts->out);
+  return 1;
+}
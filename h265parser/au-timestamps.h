@@ -0,0 +1,79 @@
+#ifndef AU_TIMESTAMPS_H_
+#define AU_TIMESTAMPS_H_
+
+#include <stdint.h>
+#include "h265parser.h"
+#include "nal-input.h"
+#include "output-context.h"
+
+// Decode and presentation times of access units, in the 90 kHz units of
+// transport stream timestamps, from the clock tick of the VUI or VPS timing:
+//
+//   with picture timing SEI messages carrying CPB and DPB delays, DTS is the
+//   nominal CPB removal time of C.2.3 counted from the access unit of the
+//   last buffering period, and PTS adds pic_dpb_output_delay clock ticks as
+//   the DPB output time of C.5.2.3
+//
+//   without, each access unit of a coded video sequence decodes one clock
+//   tick after the previous one, and PTS is the start of the sequence plus
+//   sps_max_num_reorder_pics ticks plus its POC, minus the POC of the IRAP
+//   picture, in ticks of vui_num_ticks_poc_diff_one_minus1 + 1 where the POC
+//   is proportional to timing, one tick otherwise
+//
+// Streams without timing information get POC values only.
+
+// One access unit, stamped at its first slice segment
+struct AuTimestamp {
+  uint64_t access_unit;  // in decoding order from 0
+  uint64_t offset;       // of its first NAL unit
+  int32_t poc;
+  uint8_t nal_unit_type;  // of its slice segments
+  uint8_t timed;          // 0 without timing information
+  uint8_t from_sei;       // times of picture timing SEI, else of the POC
+  int64_t dts;
+  int64_t pts;
+};
+
+// Everything carried from one access unit to the next, a plain struct for
+// the seek index to keep
+struct AuTimestampsState {
+  struct H265PocState poc;
+  uint64_t au_count;
+  uint8_t au_started;
+  uint64_t au_offset;
+  // timing SEI of the access unit being collected
+  uint8_t has_buffering_period;
+  uint8_t has_pic_timing;
+  uint32_t initial_cpb_removal_delay;
+  uint32_t au_cpb_removal_delay_minus1;
+  uint32_t pic_dpb_output_delay;
+  // nominal CPB removal time of the last buffering period, seconds
+  uint8_t seen_buffering_period;
+  double bp_removal;
+  // the coded video sequence in decoding order
+  double cvs_start;
+  int32_t cvs_poc;
+  uint64_t cvs_access_units;
+  double last_dts;
+};
+
+struct AuTimestamps {
+  struct OutputContextList* out;  // NULL: nothing written
+  struct AuTimestampsState state;
+  struct AuTimestamp last;  // the access unit stamped last
+};
+
+void AuTimestampsInit(struct AuTimestamps* ts, struct OutputContextList* out);
+// Continues from |state|, taken as an access unit started, with the first
+// NAL unit of that access unit.
+void AuTimestampsRestore(struct AuTimestamps* ts,
+                         const struct AuTimestampsState* state);
+// Called after h265_parse_nal with each NAL unit and what it returned.
+// Returns 1 when |nal| is the first slice segment of a picture: ts->last
+// then holds its access unit, which was also written to the output.
+int AuTimestampsPushNal(struct AuTimestamps* ts,
+                        const struct h265_decode_t* dec,
+                        const struct NalUnit* nal,
+                        int err);
+
+#endif
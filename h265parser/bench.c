@@ -0,0 +1,358 @@
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <windows.h>
+#define NULL_DEVICE "NUL"
+#define stat _stat64
+#else
+#include <time.h>
+#define NULL_DEVICE "/dev/null"
+#endif
+#include "bench.h"
+#include "bitstream.h"
+#include "h265-events.h"
+#include "h265parser.h"
+#include "nal-filter.h"
+#include "nal-input.h"
+#include "output-context.h"
+
+enum BenchMode {
+  BENCH_SCAN = 0,      // NAL unit boundaries only
+  BENCH_UNESCAPE = 1,  // and remove_03
+  BENCH_PARSE = 2,     // and h265_parse_nal, output disabled
+  BENCH_JSON = 3,      // and JSON output to the null device
+  BENCH_LENGTH = 4,    // as parse, on a 4-byte length prefixed corpus
+  BENCH_EVENTS = 5,    // as parse, delivered to a subscriber of H265Events
+  BENCH_FLAT = 6,      // as parse, read through a buffer refilled by memmove
+  BENCH_FILTER = 7,    // as json, of the NAL units a filter selects
+  BENCH_MODES = 8
+};
+
+static const char* kModeNames[BENCH_MODES] = {
+    "scan", "unescape", "parse", "json", "length", "events", "flat", "filter"};
+
+const char* kBenchModes =
+    "scan,unescape,parse,json,length,events,flat,filter";
+
+// Of the random access corpus: IRAP pictures, the lowest sub-layer, a
+// slice header condition and the NAL units the header doesn't decide
+static const char* const kDefaultFilters[] = {
+    "is_irap",
+    "nuh_temporal_id_plus1 == 1",
+    "slice_type == B && slice_qp_delta > 1",
+    "is_slice && slice_qp_delta < 0"};
+
+struct BenchResult {
+  uint64_t bytes;
+  uint64_t nal_units;
+  uint64_t records;  // written by the filter mode
+  uint64_t errors;
+  double seconds;
+};
+
+static double Now(void) {
+#ifdef _WIN32
+  LARGE_INTEGER count, frequency;
+  QueryPerformanceCounter(&count);
+  QueryPerformanceFrequency(&frequency);
+  return (double)count.QuadPart / frequency.QuadPart;
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+#endif
+}
+
+static int Corpus(const struct BenchConfig* cfg,
+                  uint64_t size,
+                  uint8_t length_size,
+                  char* path,
+                  size_t path_size) {
+  // Generated through a temporary file, so an interrupted run leaves no
+  // truncated corpus behind.
+  struct GeneratorConfig gen = cfg->gen;
+  struct GeneratorStats stats;
+  struct stat st;
+  char name[256], tmp[1040];
+  FILE* fp;
+  int ret;
+  gen.total_bytes = size;
+  gen.length_size = length_size;
+  GeneratorName(&gen, name, sizeof(name));
+  snprintf(path, path_size, "%s/%s.%s", cfg->corpus_dir, name,
+           length_size ? "lp" : "hevc");
+  if (stat(path, &st) == 0 && (uint64_t)st.st_size + 8 > size &&
+      (uint64_t)st.st_size <= size)
+    return 0;
+  fprintf(stderr, "generating %s\n", path);
+  snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+  fp = fopen(tmp, "wb");
+  if (!fp) {
+    fprintf(stderr, "couldn't create %s\n", tmp);
+    return -1;
+  }
+  ret = GeneratorWrite(&gen, fp, &stats);
+  if (fclose(fp) != 0)
+    ret = -1;
+  if (ret != 0) {
+    fprintf(stderr, "couldn't write %s\n", tmp);
+    remove(tmp);
+    return -1;
+  }
+#ifdef _WIN32
+  remove(path);
+#endif
+  return rename(tmp, path);
+}
+
+// The events subscriber: reads a few fields, as a consumer of them would
+struct BenchSink {
+  uint64_t parameter_sets;
+  uint64_t slices;
+  uint64_t slice_bytes;
+  int64_t qp_delta;
+};
+
+static void SinkVps(void* opaque, const struct H265VideoParameterSet* vps) {
+  (void)vps;
+  ((struct BenchSink*)opaque)->parameter_sets++;
+}
+
+static void SinkSps(void* opaque, const struct H265SeqParameterSet* sps) {
+  (void)sps;
+  ((struct BenchSink*)opaque)->parameter_sets++;
+}
+
+static void SinkPps(void* opaque, const struct H265PicParameterSet* pps) {
+  (void)pps;
+  ((struct BenchSink*)opaque)->parameter_sets++;
+}
+
+static void SinkSlice(void* opaque,
+                      const struct NalUnitHeader* nal_unit_header,
+                      const struct H265SliceSegmentHeader* header,
+                      const struct NalUnit* nal) {
+  struct BenchSink* sink = (struct BenchSink*)opaque;
+  (void)nal_unit_header;
+  sink->slices++;
+  sink->slice_bytes += nal->size;
+  sink->qp_delta += header->slice_qp_delta;
+}
+
+static int RunOnce(enum BenchMode mode,
+                   const char* path,
+                   const struct NalFilter* filter,
+                   struct h265_decode_t* dec,
+                   struct BenchResult* r) {
+  struct NalInput input;
+  struct NalUnit nal;
+  struct OutputConfig out_cfg;
+  struct OutputContextList out_list[1];
+  struct H265Events events;
+  struct H265Subscriber sub;
+  struct BenchSink counts;
+  FILE* sink = NULL;
+  FILE* fp = fopen(path, "rb");
+  double start;
+  int ret;
+  if (!fp) {
+    fprintf(stderr, "couldn't open %s\n", path);
+    return -1;
+  }
+  if (mode == BENCH_LENGTH)
+    ret = NalInputOpenLengthPrefixed(&input, fp, 4);
+  else
+    ret = NalInputOpenAnnexB(&input, fp);
+  if (ret == 0 && mode == BENCH_FLAT)
+    ret = NalInputUseFlatBuffer(&input);
+  out_cfg.print_hex = 1;
+  out_cfg.explain_enum = 1;
+  if (ret == 0 && (mode == BENCH_JSON || mode == BENCH_FILTER)) {
+    sink = fopen(NULL_DEVICE, "w");
+    if (!sink)
+      ret = -1;
+    else
+      OutputContextInitList(out_list, sink, 1, &out_cfg);
+  }
+  if (ret != 0) {
+    NalInputClose(&input);
+    fclose(fp);
+    return -1;
+  }
+  memset(dec, 0, sizeof(*dec));
+  memset(r, 0, sizeof(*r));
+  memset(&counts, 0, sizeof(counts));
+  memset(&sub, 0, sizeof(sub));
+  sub.opaque = &counts;
+  sub.on_vps = SinkVps;
+  sub.on_sps = SinkSps;
+  sub.on_pps = SinkPps;
+  sub.on_slice = SinkSlice;
+  H265EventsInit(&events);
+  H265EventsSubscribe(&events, &sub);
+
+  start = Now();
+  while ((ret = input.next(&input, &nal)) > 0) {
+    struct BitStream bs;
+    struct OutputContextDict out_dict[1];
+    uint32_t nal_len;
+    int err;
+    r->nal_units++;
+    r->bytes += nal.prefix_bytes + nal.size;
+    if (mode == BENCH_SCAN)
+      continue;
+    if (mode == BENCH_EVENTS) {
+      if (H265EventsPushNal(&events, dec, &nal) != 0)
+        r->errors++;
+      continue;
+    }
+    nal_len = remove_03(nal.data, nal.size);
+    if (mode == BENCH_UNESCAPE)
+      continue;
+    if (mode == BENCH_FILTER) {
+      if (!NalFilterSelect(filter, dec, nal.data, nal_len, 1, &err)) {
+        if (err != 0)
+          r->errors++;
+        continue;
+      }
+      r->records++;
+    }
+    if (mode == BENCH_JSON || mode == BENCH_FILTER) {
+      out_list->put_dict(out_list, out_dict);
+      out_dict->put_uint(out_dict, "nal_length", nal_len);
+    } else {
+      OutputContextInitDict(out_dict, NULL, -1, &out_cfg);
+    }
+    BsInit(&bs, nal.data, nal_len);
+    if (h265_parse_nal(dec, &bs, out_dict) != 0)
+      r->errors++;
+    out_dict->end(out_dict);
+  }
+  if (sink) {
+    out_list->end(out_list);
+    fflush(sink);
+  }
+  r->seconds = Now() - start;
+
+  if (sink)
+    fclose(sink);
+  NalInputClose(&input);
+  fclose(fp);
+  return ret < 0 ? -1 : 0;
+}
+
+static int ParseModes(const char* list, uint8_t* enabled) {
+  const char* p = list;
+  memset(enabled, 0, BENCH_MODES);
+  while (*p) {
+    size_t n = strcspn(p, ",");
+    uint32_t i;
+    for (i = 0; i < BENCH_MODES; i++) {
+      if (strlen(kModeNames[i]) == n && strncmp(p, kModeNames[i], n) == 0)
+        break;
+    }
+    if (i == BENCH_MODES) {
+      fprintf(stderr, "unknown benchmark mode %.*s\n", (int)n, p);
+      return -1;
+    }
+    enabled[i] = 1;
+    p += n;
+    if (*p)
+      p++;
+  }
+  return 0;
+}
+
+// Runs |mode| on the corpus |path| and writes the fastest run.
+static int Measure(const struct BenchConfig* cfg,
+                   enum BenchMode mode,
+                   const char* path,
+                   const char* expr,
+                   const struct NalFilter* filter,
+                   struct h265_decode_t* dec,
+                   FILE* out) {
+  struct BenchResult best, r;
+  uint32_t run;
+  const char* name;
+  int ret = 0;
+  memset(&best, 0, sizeof(best));
+  for (run = 0; run < cfg->repeat && ret == 0; run++) {
+    ret = RunOnce(mode, path, filter, dec, &r);
+    if (run == 0 || r.seconds < best.seconds)
+      best = r;
+  }
+  if (ret != 0)
+    return ret;
+  name = strrchr(path, '/');
+  name = name ? name + 1 : path;
+  fprintf(out, "{\"corpus\":\"%s\",\"mode\":\"%s\",", name,
+          kModeNames[mode]);
+  if (expr)
+    fprintf(out, "\"filter\":\"%s\",\"records\":%llu,", expr,
+            (unsigned long long)best.records);
+  fprintf(out,
+          "\"bytes\":%llu,\"nal_units\":%llu,\"errors\":%llu,\"runs\":%u,"
+          "\"seconds\":%.6f,\"mb_per_s\":%.1f,\"nal_per_s\":%.0f}\n",
+          (unsigned long long)best.bytes, (unsigned long long)best.nal_units,
+          (unsigned long long)best.errors, cfg->repeat, best.seconds,
+          best.seconds > 0 ? best.bytes / best.seconds / 1e6 : 0.0,
+          best.seconds > 0 ? best.nal_units / best.seconds : 0.0);
+  fflush(out);
+  return 0;
+}
+
+int BenchRun(const struct BenchConfig* cfg, FILE* out) {
+  uint8_t enabled[BENCH_MODES];
+  struct h265_decode_t* dec;
+  struct NalFilter* filters;
+  const char* const* exprs = cfg->filters;
+  uint32_t filter_count = cfg->filter_count, f;
+  const char* p;
+  int ret = 0;
+  if (!filter_count) {
+    exprs = kDefaultFilters;
+    filter_count = sizeof(kDefaultFilters) / sizeof(kDefaultFilters[0]);
+  }
+  if (ParseModes(cfg->modes ? cfg->modes : kBenchModes, enabled) != 0 ||
+      GeneratorCheck(&cfg->gen) != 0)
+    return -1;
+  dec = (struct h265_decode_t*)malloc(sizeof(*dec));
+  filters = (struct NalFilter*)malloc(filter_count * sizeof(*filters));
+  for (f = 0; f < filter_count && dec && filters && ret == 0; f++)
+    ret = NalFilterCompile(&filters[f], exprs[f]);
+  if (!dec || !filters || ret != 0) {
+    free(dec);
+    free(filters);
+    return -1;
+  }
+  for (p = cfg->sizes; *p && ret == 0; p += *p == ',') {
+    char size_str[32], path[1024];
+    size_t n = strcspn(p, ",");
+    uint64_t size;
+    uint32_t mode;
+    snprintf(size_str, sizeof(size_str), "%.*s",
+             (int)(n < sizeof(size_str) ? n : sizeof(size_str) - 1), p);
+    p += n;
+    size = GeneratorParseSize(size_str);
+    if (!size) {
+      fprintf(stderr, "invalid corpus size %s\n", size_str);
+      ret = -1;
+      break;
+    }
+    for (mode = 0; mode < BENCH_MODES && ret == 0; mode++) {
+      if (!enabled[mode])
+        continue;
+      ret = Corpus(cfg, size, mode == BENCH_LENGTH ? 4 : 0, path,
+                   sizeof(path));
+      if (ret == 0 && mode != BENCH_FILTER)
+        ret = Measure(cfg, (enum BenchMode)mode, path, NULL, NULL, dec, out);
+      for (f = 0; f < filter_count && ret == 0 && mode == BENCH_FILTER; f++)
+        ret = Measure(cfg, BENCH_FILTER, path, exprs[f], &filters[f], dec,
+                      out);
+    }
+  }
+  free(filters);
+  free(dec);
+  return ret;
+}
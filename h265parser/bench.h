@@ -0,0 +1,38 @@
+#ifndef BENCH_H_
+#define BENCH_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include "generator.h"
+
+// Benchmark driver: runs each parse mode over generated corpora and writes
+// one JSON object per line and (corpus, mode) to |out|:
+//
+//   {"corpus":"...","mode":"parse","bytes":N,"nal_units":N,"errors":N,
+//    "runs":N,"seconds":S,"mb_per_s":X,"nal_per_s":Y}
+//
+// "seconds" is the fastest of the runs; MB are 10^6 bytes of input. The
+// "filter" mode writes JSON of the NAL units a filter expression selects,
+// one result per expression with its "filter" and the "records" written.
+// Corpora are generated into the corpus directory on first use and reused
+// afterwards, their names identify the generator settings.
+
+extern const char* kBenchModes;
+
+#define BENCH_MAX_FILTERS 8
+
+struct BenchConfig {
+  const char* corpus_dir;
+  const char* sizes;  // comma separated, e.g. "1M,64M,1G,50G"
+  const char* modes;  // comma separated subset of kBenchModes
+  uint32_t repeat;
+  // of the filter mode, by default a few with selectivities from 1 to 50%
+  // on the default corpus
+  const char* filters[BENCH_MAX_FILTERS];
+  uint32_t filter_count;
+  struct GeneratorConfig gen;  // total_bytes is set for each corpus
+};
+
+int BenchRun(const struct BenchConfig* cfg, FILE* out);
+
+#endif
@@ -15,11 +15,14 @@ void BsInit(struct BitStream* bs, uint8_t* buffer, uint32_t input_size) {
   bs->pos = 0;
   bs->shift = 8;
   bs->size = input_size * 8;
+  bs->overread = 0;
 }
 
 uint32_t BsGet(struct BitStream* bs, uint32_t n) {
-  if (n > 32)
+  if (n > 32) {
+    bs->overread = 1;
     return 0;
+  }
   bs->pos += n;
   bs->shift += n;
   while (bs->shift > 8) {
@@ -28,8 +31,7 @@ uint32_t BsGet(struct BitStream* bs, uint32_t n) {
       bs->value |= *bs->buffer_ptr++;
       bs->shift -= 8;
     } else {
-      // BsSeek(bs, bs->pos - n);
-      // return 0;
+      bs->overread = 1;
       bs->value <<= 8;
       bs->shift -= 8;
     }
@@ -38,10 +40,14 @@ uint32_t BsGet(struct BitStream* bs, uint32_t n) {
 }
 
 void BsSeek(struct BitStream* bs, uint32_t new_pos) {
-  bs->pos = (new_pos / 32) * 32;
+  uint8_t* buffer = bs->buffer_end - bs->size / 8;
+  if (new_pos > bs->size)
+    new_pos = bs->size;
+  bs->buffer_ptr = buffer + new_pos / 8;
+  bs->pos = (new_pos / 8) * 8;
   bs->shift = 8;
   bs->value = 0;
-  BsGet(bs, new_pos % 32);
+  BsGet(bs, new_pos % 8);
 }
 
 uint32_t BsPeek(struct BitStream* bs, uint32_t n) {
@@ -50,13 +56,34 @@ uint32_t BsPeek(struct BitStream* bs, uint32_t n) {
 }
 
 uint32_t BsRemain(struct BitStream* bs) {
-  return bs->size - bs->pos;
+  // 0 once a read went past the end
+  return bs->pos < bs->size ? bs->size - bs->pos : 0;
 }
 
 int BsEof(struct BitStream* bs) {
   return BsRemain(bs) == 0;
 }
 
+int BsMoreRbspData(struct BitStream* bs) {
+  // 7.2 more_rbsp_data(): true while the read position is before the
+  // rbsp_stop_one_bit, i.e. the last set bit of the (unescaped) payload.
+  uint8_t* buffer = bs->buffer_end - bs->size / 8;
+  uint8_t* last = bs->buffer_end;
+  uint32_t stop_pos;
+  uint8_t b;
+  while (last > buffer && last[-1] == 0)
+    last--;
+  if (last == buffer)
+    return 0;
+  b = last[-1];
+  stop_pos = (uint32_t)(last - buffer) * 8 - 1;
+  while (!(b & 1)) {
+    b >>= 1;
+    stop_pos--;
+  }
+  return bs->pos < stop_pos;
+}
+
 uint32_t BsUe(struct BitStream* bs) {
   static const uint8_t exp_golomb_bits[256] = {
       8, 7, 6, 6, 5, 5, 5, 5, 4, 4, 4, 4, 4, 4, 4, 4, 3, 3, 3, 3, 3, 3, 3, 3,
@@ -81,8 +108,17 @@ uint32_t BsUe(struct BitStream* bs) {
   // same.
   while (!done) {
     bits_left = BsRemain(bs);
+    if (bits_left == 0) {
+      bs->overread = 1;
+      return 0;
+    }
     if (bits_left < 8) {
       read = BsPeek(bs, bits_left) << (8 - bits_left);
+      if (read == 0) {
+        // no leading one bit before the end
+        bs->overread = 1;
+        return 0;
+      }
       done = 1;
     } else {
       read = BsPeek(bs, 8);
@@ -97,6 +133,11 @@ uint32_t BsUe(struct BitStream* bs) {
   coded = exp_golomb_bits[read];
   BsGet(bs, coded);
   bits += coded;
+  if (bits > 31) {
+    // above the 32 bit range of ue(v)
+    bs->overread = 1;
+    return 0;
+  }
 
   //  printf("ue - bits %d\n", bits);
   return BsGet(bs, bits + 1) - 1;
@@ -1,5 +1,5 @@
 #ifndef BITSTREAM_H
-#define BITSTERAM_H
+#define BITSTREAM_H
 
 #include <stdint.h>
 
@@ -10,6 +10,9 @@ struct BitStream {
   uint32_t pos;
   uint32_t shift;
   uint32_t size;
+  // a read went past the end, or was longer than 32 bits; the bits past the
+  // end read as zeros, and a ue(v) or se(v) that doesn't fit reads as 0
+  uint8_t overread;
 };
 
 void BsInit(struct BitStream *bs, uint8_t *buffer, uint32_t input_size);
@@ -18,6 +21,7 @@ uint32_t BsGet(struct BitStream *bs, uint32_t n);
 uint32_t BsPeek(struct BitStream *bs, uint32_t n);
 uint32_t BsRemain(struct BitStream *bs);
 int BsEof(struct BitStream *bs);
+int BsMoreRbspData(struct BitStream *bs);
 uint32_t BsUe(struct BitStream *bs);
 int32_t BsSe(struct BitStream *bs);
 
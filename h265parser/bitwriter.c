@@ -0,0 +1,82 @@
+#include "bitwriter.h"
+
+void BsWriterInit(struct BitWriter* bw, uint8_t* buffer, uint32_t capacity) {
+  bw->buffer = buffer;
+  bw->capacity = capacity;
+  bw->value = 0;
+  bw->bits = 0;
+  bw->pos = 0;
+  bw->overflow = 0;
+}
+
+void BsPut(struct BitWriter* bw, uint32_t value, uint32_t n) {
+  if (n == 0 || n > 32)
+    return;
+  bw->value = (bw->value << n) | (value & (0xFFFFFFFFULL >> (32 - n)));
+  bw->bits += n;
+  while (bw->bits >= 8) {
+    uint32_t byte = bw->pos / 8;
+    bw->bits -= 8;
+    if (byte < bw->capacity)
+      bw->buffer[byte] = (uint8_t)(bw->value >> bw->bits);
+    else
+      bw->overflow = 1;
+    bw->pos += 8;
+  }
+}
+
+void BsPutUe(struct BitWriter* bw, uint32_t value) {
+  // 9.2: leading zero bits, then value + 1 in as many bits plus one
+  uint64_t code = (uint64_t)value + 1;
+  uint32_t len = 0;
+  while ((code >> len) > 1)
+    len++;
+  BsPut(bw, 0, len);
+  if (len == 32) {
+    BsPut(bw, 1, 1);
+    BsPut(bw, (uint32_t)code, 32);
+  } else {
+    BsPut(bw, (uint32_t)code, len + 1);
+  }
+}
+
+void BsPutSe(struct BitWriter* bw, int32_t value) {
+  // 9.2.2, Table 9-3
+  if (value > 0)
+    BsPutUe(bw, (uint32_t)value * 2 - 1);
+  else
+    BsPutUe(bw, (uint32_t)(-(int64_t)value) * 2);
+}
+
+void BsPutTrailingBits(struct BitWriter* bw) {
+  BsPut(bw, 1, 1);
+  if (bw->bits)
+    BsPut(bw, 0, 8 - bw->bits);
+}
+
+int BsAligned(struct BitWriter* bw) {
+  return bw->bits == 0;
+}
+
+uint32_t BsBytes(struct BitWriter* bw) {
+  return bw->pos / 8 < bw->capacity ? bw->pos / 8 : bw->capacity;
+}
+
+uint32_t BsEscape(uint8_t* dst,
+                  const uint8_t* src,
+                  uint32_t len,
+                  uint32_t* zeros) {
+  // 7.4.2: no 0x000000, 0x000001, 0x000002 or 0x000003 within the NAL unit
+  uint8_t* p = dst;
+  uint32_t i, z = *zeros;
+  for (i = 0; i < len; i++) {
+    if (z >= 2 && src[i] <= 3) {
+      *p++ = 3;
+      z = 0;
+    }
+    *p++ = src[i];
+    z = src[i] == 0 ? z + 1 : 0;
+  }
+  *zeros = z;
+  return (uint32_t)(p - dst);
+}
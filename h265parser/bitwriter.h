@@ -0,0 +1,37 @@
+#ifndef BITWRITER_H
+#define BITWRITER_H
+
+#include <stdint.h>
+
+// Writing counterpart of BitStream, for generated and rewritten streams.
+struct BitWriter {
+  uint8_t *buffer;
+  uint32_t capacity;
+  uint64_t value;
+  uint32_t bits;  // pending bits in value
+  uint32_t pos;   // bits written
+  uint8_t overflow;
+};
+
+void BsWriterInit(struct BitWriter *bw, uint8_t *buffer, uint32_t capacity);
+void BsPut(struct BitWriter *bw, uint32_t value, uint32_t n);
+void BsPutUe(struct BitWriter *bw, uint32_t value);
+void BsPutSe(struct BitWriter *bw, int32_t value);
+// rbsp_trailing_bits() / byte_alignment(): a one bit, then zero bits up to
+// the next byte boundary.
+void BsPutTrailingBits(struct BitWriter *bw);
+int BsAligned(struct BitWriter *bw);
+// Bytes written so far; a partial last byte is not counted.
+uint32_t BsBytes(struct BitWriter *bw);
+
+// Copies |len| RBSP bytes to |dst| with emulation_prevention_three_byte
+// inserted, and returns the number of bytes written. |dst| must hold
+// len * 3 / 2 + 1 bytes. |zeros| carries the count of trailing zero bytes
+// between calls so that one NAL unit can be escaped in pieces; it starts at
+// 0.
+uint32_t BsEscape(uint8_t *dst,
+                  const uint8_t *src,
+                  uint32_t len,
+                  uint32_t *zeros);
+
+#endif
@@ -0,0 +1,242 @@
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <io.h>
+#include <windows.h>
+#define fileno _fileno
+#define fsync _commit
+#define fseeko _fseeki64
+#define ftello _ftelli64
+#else
+#include <time.h>
+#include <unistd.h>
+#endif
+#include "checkpoint.h"
+
+static const char kMagic[8] = {'H', '2', '6', '5', 'C', 'K', 'P', 'T'};
+#define CHECKPOINT_VERSION 1
+
+struct CheckpointHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t region_count;
+  uint64_t input_offset;
+  uint64_t output_offset;
+  uint64_t output_empty;
+};
+
+static double Now(void) {
+  // monotonic time in seconds
+#ifdef _WIN32
+  LARGE_INTEGER count, frequency;
+  QueryPerformanceCounter(&count);
+  QueryPerformanceFrequency(&frequency);
+  return (double)count.QuadPart / frequency.QuadPart;
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+#endif
+}
+
+// FNV-1a, to tell a damaged snapshot
+static uint64_t Hash(uint64_t h, const void* data, uint32_t size) {
+  const uint8_t* p = (const uint8_t*)data;
+  uint32_t i;
+  for (i = 0; i < size; i++)
+    h = (h ^ p[i]) * 0x100000001b3ULL;
+  return h;
+}
+
+static int Sync(FILE* fp) {
+  if (fflush(fp) != 0)
+    return -1;
+  return fsync(fileno(fp)) == 0 ? 0 : -1;
+}
+
+void CheckpointInit(struct Checkpoint* cp, const char* path, double interval) {
+  memset(cp, 0, sizeof(*cp));
+  cp->path = path;
+  cp->interval = interval;
+  cp->last = Now();
+}
+
+void CheckpointAddRegion(struct Checkpoint* cp,
+                         const char* name,
+                         void* data,
+                         uint32_t size) {
+  struct CheckpointRegion* r;
+  if (cp->region_count == CHECKPOINT_MAX_REGIONS)
+    return;
+  r = &cp->regions[cp->region_count++];
+  memset(r->name, 0, sizeof(r->name));
+  strncpy(r->name, name, sizeof(r->name));
+  r->data = data;
+  r->size = size;
+}
+
+int CheckpointLoad(struct Checkpoint* cp, struct CheckpointPosition* pos) {
+  struct CheckpointHeader header;
+  struct CheckpointRegion region;
+  uint64_t hash, stored;
+  uint32_t i;
+  uint8_t* data[CHECKPOINT_MAX_REGIONS];
+  int ret = -1;
+  FILE* fp = fopen(cp->path, "rb");
+  if (!fp)
+    return 0;
+  memset(data, 0, sizeof(data));
+  if (fread(&header, sizeof(header), 1, fp) != 1 ||
+      memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 ||
+      header.version != CHECKPOINT_VERSION) {
+    fprintf(stderr, "%s is not a checkpoint\n", cp->path);
+    goto done;
+  }
+  if (header.region_count != cp->region_count) {
+    fprintf(stderr, "%s was taken with other options\n", cp->path);
+    goto done;
+  }
+  hash = Hash(0xcbf29ce484222325ULL, &header, sizeof(header));
+  // read everything before restoring anything
+  for (i = 0; i < cp->region_count; i++) {
+    const struct CheckpointRegion* r = &cp->regions[i];
+    if (fread(region.name, sizeof(region.name), 1, fp) != 1 ||
+        fread(&region.size, sizeof(region.size), 1, fp) != 1) {
+      fprintf(stderr, "%s is truncated\n", cp->path);
+      goto done;
+    }
+    if (memcmp(region.name, r->name, sizeof(r->name)) != 0 ||
+        region.size != r->size) {
+      fprintf(stderr, "%s was taken with other options or another build\n",
+              cp->path);
+      goto done;
+    }
+    data[i] = (uint8_t*)malloc(r->size ? r->size : 1);
+    if (!data[i] || fread(data[i], 1, r->size, fp) != r->size) {
+      fprintf(stderr, "%s is truncated\n", cp->path);
+      goto done;
+    }
+    hash = Hash(hash, region.name, sizeof(region.name));
+    hash = Hash(hash, &region.size, sizeof(region.size));
+    hash = Hash(hash, data[i], r->size);
+  }
+  if (fread(&stored, sizeof(stored), 1, fp) != 1 || stored != hash) {
+    fprintf(stderr, "%s is damaged\n", cp->path);
+    goto done;
+  }
+  for (i = 0; i < cp->region_count; i++)
+    memcpy(cp->regions[i].data, data[i], cp->regions[i].size);
+  pos->input_offset = header.input_offset;
+  pos->output_offset = header.output_offset;
+  pos->output_empty = (uint8_t)header.output_empty;
+  ret = 1;
+done:
+  for (i = 0; i < cp->region_count; i++)
+    free(data[i]);
+  fclose(fp);
+  return ret;
+}
+
+int CheckpointDue(const struct Checkpoint* cp) {
+  return cp->interval <= 0 || Now() - cp->last >= cp->interval;
+}
+
+int CheckpointSave(struct Checkpoint* cp,
+                   FILE* out,
+                   uint64_t input_offset,
+                   int output_empty) {
+  struct CheckpointHeader header;
+  int64_t output_offset;
+  char tmp[4096];
+  uint64_t hash;
+  uint32_t i;
+  int ok;
+  FILE* fp;
+
+  // the output the snapshot counts on must survive it
+  if (Sync(out) != 0 || (output_offset = ftello(out)) < 0) {
+    fprintf(stderr, "couldn't flush the output for a checkpoint\n");
+    return -1;
+  }
+  if (strlen(cp->path) + 5 > sizeof(tmp))
+    return -1;
+  strcpy(tmp, cp->path);
+  strcat(tmp, ".tmp");
+  fp = fopen(tmp, "wb");
+  if (!fp) {
+    fprintf(stderr, "couldn't create %s\n", tmp);
+    return -1;
+  }
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = CHECKPOINT_VERSION;
+  header.region_count = cp->region_count;
+  header.input_offset = input_offset;
+  header.output_offset = (uint64_t)output_offset;
+  header.output_empty = output_empty != 0;
+  ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+  hash = Hash(0xcbf29ce484222325ULL, &header, sizeof(header));
+  for (i = 0; i < cp->region_count; i++) {
+    const struct CheckpointRegion* r = &cp->regions[i];
+    ok = ok && fwrite(r->name, sizeof(r->name), 1, fp) == 1 &&
+         fwrite(&r->size, sizeof(r->size), 1, fp) == 1 &&
+         fwrite(r->data, 1, r->size, fp) == r->size;
+    hash = Hash(hash, r->name, sizeof(r->name));
+    hash = Hash(hash, &r->size, sizeof(r->size));
+    hash = Hash(hash, r->data, r->size);
+    cp->bytes += sizeof(r->name) + sizeof(r->size) + r->size;
+  }
+  ok = ok && fwrite(&hash, sizeof(hash), 1, fp) == 1 && Sync(fp) == 0;
+  if (fclose(fp) != 0)
+    ok = 0;
+#ifdef _WIN32
+  ok = ok && MoveFileExA(tmp, cp->path, MOVEFILE_REPLACE_EXISTING);
+#else
+  ok = ok && rename(tmp, cp->path) == 0;
+#endif
+  if (!ok) {
+    fprintf(stderr, "couldn't write %s\n", cp->path);
+    remove(tmp);
+    return -1;
+  }
+  cp->bytes += sizeof(header) + sizeof(hash);
+  cp->taken++;
+  cp->last = Now();
+  return 0;
+}
+
+void CheckpointRemove(struct Checkpoint* cp) {
+  remove(cp->path);
+}
+
+FILE* CheckpointOpenOutput(const char* path,
+                           const struct CheckpointPosition* pos) {
+  FILE* fp;
+  int64_t size;
+  if (!pos)
+    return fopen(path, "wb");
+  fp = fopen(path, "r+b");
+  if (!fp) {
+    fprintf(stderr, "couldn't open %s to resume it\n", path);
+    return NULL;
+  }
+  if (fseeko(fp, 0, SEEK_END) != 0 || (size = ftello(fp)) < 0 ||
+      (uint64_t)size < pos->output_offset) {
+    fprintf(stderr, "%s is shorter than at the checkpoint\n", path);
+    fclose(fp);
+    return NULL;
+  }
+  // what was written after the snapshot is written again
+  fflush(fp);
+#ifdef _WIN32
+  if (_chsize_s(fileno(fp), (int64_t)pos->output_offset) != 0 ||
+#else
+  if (ftruncate(fileno(fp), (off_t)pos->output_offset) != 0 ||
+#endif
+      fseeko(fp, (int64_t)pos->output_offset, SEEK_SET) != 0) {
+    fprintf(stderr, "couldn't truncate %s\n", path);
+    fclose(fp);
+    return NULL;
+  }
+  return fp;
+}
@@ -0,0 +1,69 @@
+#ifndef CHECKPOINT_H_
+#define CHECKPOINT_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+// Periodic snapshots of a run, so that a run killed part way resumes from
+// the last one and writes the same output as a run that wasn't. A snapshot
+// is taken ahead of the first access unit that starts after the interval
+// elapsed: the input offset of that access unit, the length of the output
+// file so far, and the state registered as regions, copied as they are in
+// memory. Its cost is one write of the regions and an fsync of the output
+// and the snapshot, at most once per interval.
+//
+// Regions are raw structures, so only the same build of the same options
+// can resume; their names and sizes are checked. The snapshot is written to
+// FILE.tmp and renamed over FILE, which always holds a whole one.
+
+#define CHECKPOINT_MAX_REGIONS 8
+
+struct CheckpointRegion {
+  char name[8];
+  void* data;
+  uint32_t size;
+};
+
+// Where the run was when the snapshot was taken
+struct CheckpointPosition {
+  uint64_t input_offset;   // of the start code or length field
+  uint64_t output_offset;  // length of the output file
+  uint8_t output_empty;    // no element was written to the output list
+};
+
+struct Checkpoint {
+  const char* path;
+  double interval;  // seconds, 0: at each access unit
+  double last;
+  struct CheckpointRegion regions[CHECKPOINT_MAX_REGIONS];
+  uint32_t region_count;
+  uint64_t taken;
+  uint64_t bytes;
+};
+
+void CheckpointInit(struct Checkpoint* cp, const char* path, double interval);
+// Adds |size| bytes at |data| to each snapshot; |name| identifies them.
+void CheckpointAddRegion(struct Checkpoint* cp,
+                         const char* name,
+                         void* data,
+                         uint32_t size);
+// Restores the regions and |pos| from the snapshot. Returns 1 if there was
+// one, 0 if there wasn't and -1 if it doesn't match the regions.
+int CheckpointLoad(struct Checkpoint* cp, struct CheckpointPosition* pos);
+// 1 once the interval elapsed since the last snapshot
+int CheckpointDue(const struct Checkpoint* cp);
+// Flushes the output file |out| and writes a snapshot of the run about to
+// read the input at |input_offset|; returns -1 if it couldn't.
+int CheckpointSave(struct Checkpoint* cp,
+                   FILE* out,
+                   uint64_t input_offset,
+                   int output_empty);
+// Removes the snapshot once the run finished.
+void CheckpointRemove(struct Checkpoint* cp);
+
+// Opens the output file of a run: created, or for a resumed run cut back to
+// the length it had at the snapshot and positioned there.
+FILE* CheckpointOpenOutput(const char* path,
+                           const struct CheckpointPosition* pos);
+
+#endif
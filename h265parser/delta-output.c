@@ -0,0 +1,770 @@
+#include <stdlib.h>
+#include <string.h>
+#include "delta-output.h"
+
+#define DELTA_NONE 0xFFFFFFFFu
+
+static const char kHeaderKey[] = "nal_unit_header";
+
+// Record capture
+
+static struct DeltaEntry* Append(struct DeltaOutput* d,
+                                 const char* key,
+                                 enum DeltaType type) {
+  struct DeltaRecord* r = &d->current;
+  struct DeltaEntry* e;
+  if (r->count == r->capacity) {
+    uint32_t capacity = r->capacity ? r->capacity * 2 : 256;
+    e = (struct DeltaEntry*)realloc(r->entries, capacity * sizeof(*e));
+    if (!e)
+      return NULL;
+    r->entries = e;
+    r->capacity = capacity;
+  }
+  e = &r->entries[r->count++];
+  e->key = key;
+  e->type = (uint8_t)type;
+  e->next = 0;
+  e->val = 0;
+  e->enum_val = 0;
+  return e;
+}
+
+static int64_t CopyString(struct DeltaOutput* d, const char* s) {
+  struct DeltaRecord* r = &d->current;
+  uint32_t n = (uint32_t)strlen(s) + 1;
+  int64_t offset = r->strings_size;
+  if (r->strings_capacity - r->strings_size < n) {
+    uint32_t capacity = r->strings_capacity ? r->strings_capacity : 1024;
+    char* p;
+    while (capacity - r->strings_size < n)
+      capacity *= 2;
+    p = (char*)realloc(r->strings, capacity);
+    if (!p)
+      return -1;
+    r->strings = p;
+    r->strings_capacity = capacity;
+  }
+  memcpy(r->strings + r->strings_size, s, n);
+  r->strings_size += n;
+  return offset;
+}
+
+static void Failed(struct DeltaOutput* d) {
+  if (!d->failed)
+    fprintf(stderr, "delta output: out of memory, record dropped\n");
+  d->failed = 1;
+}
+
+static void PutValue(struct DeltaOutput* d,
+                     const char* key,
+                     enum DeltaType type,
+                     int64_t val) {
+  struct DeltaEntry* e = Append(d, key, type);
+  if (!e) {
+    Failed(d);
+    return;
+  }
+  e->val = val;
+}
+
+static void PutString(struct DeltaOutput* d,
+                      const char* key,
+                      enum DeltaType type,
+                      const char* str,
+                      int64_t enum_val) {
+  int64_t offset = CopyString(d, str);
+  struct DeltaEntry* e = offset < 0 ? NULL : Append(d, key, type);
+  if (!e) {
+    Failed(d);
+    return;
+  }
+  e->val = offset;
+  e->enum_val = enum_val;
+}
+
+static void InitDict(struct OutputContextDict* ctx, struct DeltaOutput* d);
+static void InitList(struct OutputContextList* ctx, struct DeltaOutput* d);
+
+static void Open(struct DeltaOutput* d, const char* key, enum DeltaType type) {
+  struct DeltaEntry* e;
+  d->depth++;
+  if (d->failed)
+    return;
+  e = Append(d, key, type);
+  if (!e) {
+    Failed(d);
+    return;
+  }
+  e->next = d->open;
+  d->open = d->current.count - 1;
+}
+
+static void Finish(struct DeltaOutput* d);
+
+static void Close(struct DeltaOutput* d) {
+  struct DeltaEntry* open;
+  if (d->depth == 1) {
+    d->depth = 0;
+    Finish(d);
+    return;
+  }
+  d->depth--;
+  if (d->failed)
+    return;
+  if (!Append(d, NULL, DELTA_END)) {
+    Failed(d);
+    return;
+  }
+  open = &d->current.entries[d->open];
+  d->open = open->next;
+  open->next = d->current.count;
+}
+
+static void DictInt(struct OutputContextDict* ctx,
+                    const char* key,
+                    int64_t val) {
+  PutValue((struct DeltaOutput*)ctx->sink, key, DELTA_INT, val);
+}
+
+static void DictUint(struct OutputContextDict* ctx,
+                     const char* key,
+                     uint64_t val) {
+  PutValue((struct DeltaOutput*)ctx->sink, key, DELTA_UINT, (int64_t)val);
+}
+
+static void DictHex(struct OutputContextDict* ctx,
+                    const char* key,
+                    uint64_t val) {
+  PutValue((struct DeltaOutput*)ctx->sink, key, DELTA_HEX, (int64_t)val);
+}
+
+static void DictEnum(struct OutputContextDict* ctx,
+                     const char* key,
+                     const char* str,
+                     int val) {
+  PutString((struct DeltaOutput*)ctx->sink, key, DELTA_ENUM, str, val);
+}
+
+static void DictStr(struct OutputContextDict* ctx,
+                    const char* key,
+                    const char* val) {
+  PutString((struct DeltaOutput*)ctx->sink, key, DELTA_STR, val, 0);
+}
+
+static void DictDict(struct OutputContextDict* ctx,
+                     const char* key,
+                     struct OutputContextDict* dict) {
+  struct DeltaOutput* d = (struct DeltaOutput*)ctx->sink;
+  Open(d, key, DELTA_DICT);
+  InitDict(dict, d);
+}
+
+static void DictList(struct OutputContextDict* ctx,
+                     const char* key,
+                     struct OutputContextList* list) {
+  struct DeltaOutput* d = (struct DeltaOutput*)ctx->sink;
+  Open(d, key, DELTA_LIST);
+  InitList(list, d);
+}
+
+static void DictEnd(struct OutputContextDict* ctx) {
+  Close((struct DeltaOutput*)ctx->sink);
+}
+
+static void ListInt(struct OutputContextList* ctx, int64_t val) {
+  PutValue((struct DeltaOutput*)ctx->sink, NULL, DELTA_INT, val);
+}
+
+static void ListUint(struct OutputContextList* ctx, uint64_t val) {
+  PutValue((struct DeltaOutput*)ctx->sink, NULL, DELTA_UINT, (int64_t)val);
+}
+
+static void ListStr(struct OutputContextList* ctx, const char* val) {
+  PutString((struct DeltaOutput*)ctx->sink, NULL, DELTA_STR, val, 0);
+}
+
+static void ListDict(struct OutputContextList* ctx,
+                     struct OutputContextDict* dict) {
+  struct DeltaOutput* d = (struct DeltaOutput*)ctx->sink;
+  Open(d, NULL, DELTA_DICT);
+  InitDict(dict, d);
+}
+
+static void ListList(struct OutputContextList* ctx,
+                     struct OutputContextList* list) {
+  struct DeltaOutput* d = (struct DeltaOutput*)ctx->sink;
+  Open(d, NULL, DELTA_LIST);
+  InitList(list, d);
+}
+
+static void ListEnd(struct OutputContextList* ctx) {
+  Close((struct DeltaOutput*)ctx->sink);
+}
+
+static void InitDict(struct OutputContextDict* ctx, struct DeltaOutput* d) {
+  memset(ctx, 0, sizeof(*ctx));
+  ctx->sink = d;
+  ctx->config = d->out->config;
+  ctx->put_int = DictInt;
+  ctx->put_uint = DictUint;
+  ctx->put_hex = DictHex;
+  ctx->put_enum = DictEnum;
+  ctx->put_str = DictStr;
+  ctx->put_dict = DictDict;
+  ctx->put_list = DictList;
+  ctx->end = DictEnd;
+}
+
+static void InitList(struct OutputContextList* ctx, struct DeltaOutput* d) {
+  memset(ctx, 0, sizeof(*ctx));
+  ctx->sink = d;
+  ctx->config = d->out->config;
+  ctx->put_int = ListInt;
+  ctx->put_uint = ListUint;
+  ctx->put_str = ListStr;
+  ctx->put_dict = ListDict;
+  ctx->put_list = ListList;
+  ctx->end = ListEnd;
+}
+
+// The top-level list: dicts are records, anything else goes straight out.
+
+static void TopInt(struct OutputContextList* ctx, int64_t val) {
+  struct DeltaOutput* d = (struct DeltaOutput*)ctx->sink;
+  d->out->put_int(d->out, val);
+}
+
+static void TopUint(struct OutputContextList* ctx, uint64_t val) {
+  struct DeltaOutput* d = (struct DeltaOutput*)ctx->sink;
+  d->out->put_uint(d->out, val);
+}
+
+static void TopStr(struct OutputContextList* ctx, const char* val) {
+  struct DeltaOutput* d = (struct DeltaOutput*)ctx->sink;
+  d->out->put_str(d->out, val);
+}
+
+static void TopDict(struct OutputContextList* ctx,
+                    struct OutputContextDict* dict) {
+  struct DeltaOutput* d = (struct DeltaOutput*)ctx->sink;
+  d->current.count = 0;
+  d->current.strings_size = 0;
+  d->open = DELTA_NONE;
+  d->depth = 1;
+  d->failed = 0;
+  InitDict(dict, d);
+}
+
+static void TopList(struct OutputContextList* ctx,
+                    struct OutputContextList* list) {
+  struct DeltaOutput* d = (struct DeltaOutput*)ctx->sink;
+  d->out->put_list(d->out, list);
+}
+
+static void TopEnd(struct OutputContextList* ctx) {
+  struct DeltaOutput* d = (struct DeltaOutput*)ctx->sink;
+  d->out->end(d->out);
+}
+
+void DeltaOutputInit(struct DeltaOutput* d,
+                     struct OutputContextList* out,
+                     uint32_t keyframe_interval) {
+  struct OutputContextList* list = d->list;
+  memset(d, 0, sizeof(*d));
+  d->out = out;
+  d->keyframe_interval = keyframe_interval;
+  d->open = DELTA_NONE;
+  list->indent = 0;
+  list->sink = d;
+  list->config = out->config;
+  list->put_int = TopInt;
+  list->put_uint = TopUint;
+  list->put_str = TopStr;
+  list->put_dict = TopDict;
+  list->put_list = TopList;
+  list->end = TopEnd;
+}
+
+void DeltaOutputClose(struct DeltaOutput* d) {
+  uint32_t i;
+  free(d->current.entries);
+  free(d->current.strings);
+  for (i = 0; i < d->kind_count; i++) {
+    free(d->kinds[i].last.entries);
+    free(d->kinds[i].last.strings);
+  }
+  memset(d->kinds, 0, sizeof(d->kinds));
+  d->kind_count = 0;
+}
+
+// Comparing and writing records
+
+static const char* String(const struct DeltaRecord* r,
+                          const struct DeltaEntry* e) {
+  return r->strings + e->val;
+}
+
+static int SameKey(const char* a, const char* b) {
+  return a == b || (a && b && strcmp(a, b) == 0);
+}
+
+// Whether entry |i| of |a|, with what it contains, equals entry |j| of |b|.
+static int SameEntry(const struct DeltaRecord* a,
+                     uint32_t i,
+                     const struct DeltaRecord* b,
+                     uint32_t j) {
+  uint32_t end = a->entries[i].type == DELTA_DICT ||
+                         a->entries[i].type == DELTA_LIST
+                     ? a->entries[i].next
+                     : i + 1;
+  if (end - i > b->count - j)
+    return 0;
+  for (; i < end; i++, j++) {
+    const struct DeltaEntry* x = &a->entries[i];
+    const struct DeltaEntry* y = &b->entries[j];
+    if (x->type != y->type || !SameKey(x->key, y->key))
+      return 0;
+    switch (x->type) {
+    case DELTA_ENUM:
+      if (x->enum_val != y->enum_val)
+        return 0;
+    // fall through
+    case DELTA_STR:
+      if (strcmp(String(a, x), String(b, y)) != 0)
+        return 0;
+      break;
+    case DELTA_DICT:
+    case DELTA_LIST:
+      if (x->next - i != y->next - j)
+        return 0;
+      break;
+    case DELTA_END:
+      break;
+    default:
+      if (x->val != y->val)
+        return 0;
+    }
+  }
+  return 1;
+}
+
+static uint32_t Next(const struct DeltaRecord* r, uint32_t i) {
+  const struct DeltaEntry* e = &r->entries[i];
+  return e->type == DELTA_DICT || e->type == DELTA_LIST ? e->next : i + 1;
+}
+
+static uint32_t FindHeader(const struct DeltaRecord* r) {
+  uint32_t i;
+  for (i = 0; i < r->count; i = Next(r, i)) {
+    if (r->entries[i].type == DELTA_DICT && r->entries[i].key &&
+        strcmp(r->entries[i].key, kHeaderKey) == 0)
+      return i;
+  }
+  return DELTA_NONE;
+}
+
+// Same keys and types at the top level.
+static int SameLayout(const struct DeltaRecord* a,
+                      const struct DeltaRecord* b) {
+  uint32_t i = 0, j = 0;
+  while (i < a->count && j < b->count) {
+    if (a->entries[i].type != b->entries[j].type ||
+        !SameKey(a->entries[i].key, b->entries[j].key))
+      return 0;
+    i = Next(a, i);
+    j = Next(b, j);
+  }
+  return i == a->count && j == b->count;
+}
+
+static void WriteDict(const struct DeltaRecord* r,
+                      uint32_t i,
+                      struct OutputContextDict* out);
+static void WriteList(const struct DeltaRecord* r,
+                      uint32_t i,
+                      struct OutputContextList* out);
+
+// Writes entry |i| into |out|; returns the index of the entry after it.
+static uint32_t WriteEntry(const struct DeltaRecord* r,
+                           uint32_t i,
+                           struct OutputContextDict* out) {
+  const struct DeltaEntry* e = &r->entries[i];
+  struct OutputContextDict dict[1];
+  struct OutputContextList list[1];
+  switch (e->type) {
+  case DELTA_INT:
+    out->put_int(out, e->key, e->val);
+    break;
+  case DELTA_UINT:
+    out->put_uint(out, e->key, (uint64_t)e->val);
+    break;
+  case DELTA_HEX:
+    out->put_hex(out, e->key, (uint64_t)e->val);
+    break;
+  case DELTA_ENUM:
+    out->put_enum(out, e->key, String(r, e), (int)e->enum_val);
+    break;
+  case DELTA_STR:
+    out->put_str(out, e->key, String(r, e));
+    break;
+  case DELTA_DICT:
+    out->put_dict(out, e->key, dict);
+    WriteDict(r, i + 1, dict);
+    dict->end(dict);
+    break;
+  case DELTA_LIST:
+    out->put_list(out, e->key, list);
+    WriteList(r, i + 1, list);
+    list->end(list);
+    break;
+  }
+  return Next(r, i);
+}
+
+static void WriteDict(const struct DeltaRecord* r,
+                      uint32_t i,
+                      struct OutputContextDict* out) {
+  while (r->entries[i].type != DELTA_END)
+    i = WriteEntry(r, i, out);
+}
+
+static void WriteList(const struct DeltaRecord* r,
+                      uint32_t i,
+                      struct OutputContextList* out) {
+  struct OutputContextDict dict[1];
+  struct OutputContextList list[1];
+  while (r->entries[i].type != DELTA_END) {
+    const struct DeltaEntry* e = &r->entries[i];
+    switch (e->type) {
+    case DELTA_INT:
+      out->put_int(out, e->val);
+      break;
+    case DELTA_UINT:
+    case DELTA_HEX:
+      out->put_uint(out, (uint64_t)e->val);
+      break;
+    case DELTA_ENUM:
+    case DELTA_STR:
+      out->put_str(out, String(r, e));
+      break;
+    case DELTA_DICT:
+      out->put_dict(out, dict);
+      WriteDict(r, i + 1, dict);
+      dict->end(dict);
+      break;
+    case DELTA_LIST:
+      out->put_list(out, list);
+      WriteList(r, i + 1, list);
+      list->end(list);
+      break;
+    }
+    i = Next(r, i);
+  }
+}
+
+static void Finish(struct DeltaOutput* d) {
+  struct DeltaRecord* r = &d->current;
+  struct DeltaRecord swap;
+  struct DeltaKind* kind = NULL;
+  struct OutputContextDict dict[1];
+  uint32_t header, i, j, k;
+  if (d->failed)
+    return;
+  header = FindHeader(r);
+  for (k = 0; header != DELTA_NONE && k < d->kind_count; k++) {
+    if (SameEntry(r, header, &d->kinds[k].last, d->kinds[k].header)) {
+      kind = &d->kinds[k];
+      break;
+    }
+  }
+
+  d->out->put_dict(d->out, dict);
+  if (kind && SameLayout(r, &kind->last) &&
+      (d->keyframe_interval == 0 ||
+       kind->since_keyframe + 1 < d->keyframe_interval)) {
+    dict->put_uint(dict, "delta", 1);
+    for (i = 0, j = 0; i < r->count; i = Next(r, i), j = Next(&kind->last, j)) {
+      if (i == header || !SameEntry(r, i, &kind->last, j))
+        WriteEntry(r, i, dict);
+    }
+    kind->since_keyframe++;
+    d->delta_records++;
+  } else {
+    for (i = 0; i < r->count;)
+      i = WriteEntry(r, i, dict);
+    if (kind)
+      kind->since_keyframe = 0;
+    d->full_records++;
+  }
+  dict->end(dict);
+
+  // the record becomes the predecessor of the next one of its kind
+  if (header == DELTA_NONE)
+    return;
+  if (!kind) {
+    if (d->kind_count < DELTA_MAX_KINDS) {
+      kind = &d->kinds[d->kind_count++];
+    } else {
+      kind = &d->kinds[d->next_evict];
+      d->next_evict = (d->next_evict + 1) % DELTA_MAX_KINDS;
+    }
+    kind->since_keyframe = 0;
+  }
+  swap = kind->last;
+  kind->last = *r;
+  kind->header = header;
+  *r = swap;
+}
+
+// Restoring full records
+
+struct RestoreMember {
+  size_t key;  // offsets into the record text
+  size_t key_size;
+  size_t val;
+  size_t val_size;
+};
+
+struct RestoreRecord {
+  char* text;
+  size_t size;
+  size_t capacity;
+  struct RestoreMember* members;
+  uint32_t count;
+  uint32_t capacity_members;
+};
+
+static int Reserve(struct RestoreRecord* r, size_t size) {
+  char* p;
+  size_t capacity = r->capacity ? r->capacity : 4096;
+  if (size <= r->capacity)
+    return 0;
+  while (capacity < size)
+    capacity *= 2;
+  p = (char*)realloc(r->text, capacity);
+  if (!p)
+    return -1;
+  r->text = p;
+  r->capacity = capacity;
+  return 0;
+}
+
+static int AddChar(struct RestoreRecord* r, int c) {
+  if (Reserve(r, r->size + 1) != 0)
+    return -1;
+  r->text[r->size++] = (char)c;
+  return 0;
+}
+
+static int IsSpace(char c) {
+  return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+}
+
+// Splits the "{...}" in |r->text| into its top-level members.
+static int Split(struct RestoreRecord* r) {
+  const char* t = r->text;
+  size_t i = 1;
+  r->count = 0;
+  for (;;) {
+    struct RestoreMember m;
+    int depth = 0, in_string = 0;
+    while (i < r->size && (IsSpace(t[i]) || t[i] == ','))
+      i++;
+    if (i >= r->size || t[i] == '}')
+      return 0;
+    if (t[i] != '"')
+      return -1;
+    m.key = ++i;
+    while (i < r->size && t[i] != '"')
+      i++;
+    m.key_size = i - m.key;
+    i++;
+    while (i < r->size && (IsSpace(t[i]) || t[i] == ':'))
+      i++;
+    m.val = i;
+    for (; i < r->size; i++) {
+      char c = t[i];
+      if (in_string) {
+        if (c == '\\')
+          i++;
+        else if (c == '"')
+          in_string = 0;
+      } else if (c == '"') {
+        in_string = 1;
+      } else if (c == '{' || c == '[') {
+        depth++;
+      } else if (c == '}' || c == ']') {
+        if (depth-- == 0)
+          break;
+      } else if (c == ',' && depth == 0) {
+        break;
+      }
+    }
+    if (i >= r->size)
+      return -1;
+    m.val_size = i - m.val;
+    while (m.val_size && IsSpace(t[m.val + m.val_size - 1]))
+      m.val_size--;
+    if (r->count == r->capacity_members) {
+      uint32_t capacity = r->capacity_members ? r->capacity_members * 2 : 64;
+      struct RestoreMember* p = (struct RestoreMember*)realloc(
+          r->members, capacity * sizeof(*p));
+      if (!p)
+        return -1;
+      r->members = p;
+      r->capacity_members = capacity;
+    }
+    r->members[r->count++] = m;
+  }
+}
+
+static const struct RestoreMember* Member(const struct RestoreRecord* r,
+                                          const char* key,
+                                          size_t key_size) {
+  uint32_t i;
+  for (i = 0; i < r->count; i++) {
+    const struct RestoreMember* m = &r->members[i];
+    if (m->key_size == key_size && memcmp(r->text + m->key, key, key_size) == 0)
+      return m;
+  }
+  return NULL;
+}
+
+static int SameValue(const struct RestoreRecord* a,
+                     const struct RestoreMember* x,
+                     const struct RestoreRecord* b,
+                     const struct RestoreMember* y) {
+  return x->val_size == y->val_size &&
+         memcmp(a->text + x->val, b->text + y->val, x->val_size) == 0;
+}
+
+// Builds in |out| the record |base| with the values |delta| has.
+static int Apply(const struct RestoreRecord* base,
+                 const struct RestoreRecord* delta,
+                 struct RestoreRecord* out) {
+  size_t at = 0;
+  uint32_t i;
+  out->size = 0;
+  for (i = 0; i < base->count; i++) {
+    const struct RestoreMember* m = &base->members[i];
+    const struct RestoreMember* v =
+        Member(delta, base->text + m->key, m->key_size);
+    const struct RestoreRecord* from = v ? delta : base;
+    if (!v)
+      v = m;
+    if (Reserve(out, out->size + (m->val - at) + v->val_size) != 0)
+      return -1;
+    memcpy(out->text + out->size, base->text + at, m->val - at);
+    out->size += m->val - at;
+    memcpy(out->text + out->size, from->text + v->val, v->val_size);
+    out->size += v->val_size;
+    at = m->val + m->val_size;
+  }
+  if (Reserve(out, out->size + base->size - at) != 0)
+    return -1;
+  memcpy(out->text + out->size, base->text + at, base->size - at);
+  out->size += base->size - at;
+  return Split(out);
+}
+
+static void FreeRecord(struct RestoreRecord* r) {
+  free(r->text);
+  free(r->members);
+  memset(r, 0, sizeof(*r));
+}
+
+int DeltaRestore(FILE* in, FILE* out) {
+  struct RestoreRecord record, restored, *kinds = NULL;
+  uint32_t kind_count = 0, i;
+  int depth = 0, in_string = 0, escape = 0, c, ret = 0;
+  uint64_t records = 0;
+  memset(&record, 0, sizeof(record));
+  memset(&restored, 0, sizeof(restored));
+  while (ret == 0 && (c = getc(in)) != EOF) {
+    if (depth < 2) {
+      // between records
+      if (c == '{' && depth == 1) {
+        record.size = 0;
+        ret = AddChar(&record, c);
+        depth = 2;
+      } else {
+        if (c == '[')
+          depth++;
+        else if (c == ']')
+          depth--;
+        putc(c, out);
+      }
+      continue;
+    }
+    ret = AddChar(&record, c);
+    if (in_string) {
+      if (escape)
+        escape = 0;
+      else if (c == '\\')
+        escape = 1;
+      else if (c == '"')
+        in_string = 0;
+      continue;
+    }
+    if (c == '"') {
+      in_string = 1;
+    } else if (c == '{' || c == '[') {
+      depth++;
+    } else if (c == '}' || c == ']') {
+      const struct RestoreMember* header;
+      struct RestoreRecord* full = &record;
+      if (--depth > 1)
+        continue;
+      records++;
+      if (ret != 0 || Split(&record) != 0) {
+        ret = -1;
+        break;
+      }
+      header = Member(&record, kHeaderKey, sizeof(kHeaderKey) - 1);
+      for (i = 0; header && i < kind_count; i++) {
+        const struct RestoreMember* h =
+            Member(&kinds[i], kHeaderKey, sizeof(kHeaderKey) - 1);
+        if (SameValue(&record, header, &kinds[i], h))
+          break;
+      }
+      if (record.count && record.members[0].key_size == 5 &&
+          memcmp(record.text + record.members[0].key, "delta", 5) == 0) {
+        if (!header || i == kind_count ||
+            Apply(&kinds[i], &record, &restored) != 0) {
+          ret = -1;
+          break;
+        }
+        full = &restored;
+      }
+      fwrite(full->text, 1, full->size, out);
+      if (!header)
+        continue;
+      if (i == kind_count) {
+        struct RestoreRecord* p = (struct RestoreRecord*)realloc(
+            kinds, (kind_count + 1) * sizeof(*p));
+        if (!p) {
+          ret = -1;
+          break;
+        }
+        kinds = p;
+        memset(&kinds[kind_count++], 0, sizeof(*p));
+      }
+      // keep |full| as the kind's record, reusing the buffers it replaces
+      {
+        struct RestoreRecord swap = kinds[i];
+        kinds[i] = *full;
+        *full = swap;
+      }
+    }
+  }
+  if (ret != 0)
+    fprintf(stderr, "delta restore: malformed record %llu\n",
+            (unsigned long long)records);
+  for (i = 0; i < kind_count; i++)
+    FreeRecord(&kinds[i]);
+  free(kinds);
+  FreeRecord(&record);
+  FreeRecord(&restored);
+  return ret;
+}
@@ -0,0 +1,89 @@
+#ifndef DELTA_OUTPUT_H_
+#define DELTA_OUTPUT_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include "output-context.h"
+
+// Output backend writing each record, a dict put into the top-level list,
+// as the changes against the previous record of the same kind. Records of
+// one kind have the same "nal_unit_header", so consecutive slice segment
+// headers of a picture type, or a re-sent SPS, compare with their
+// predecessor. A delta record is
+//
+//   {"delta": 1, "nal_unit_header": {...}, <entries that changed>}
+//
+// A record is written in full, as without this backend, when it is the
+// first of its kind, when its keys differ from its predecessor's, when it
+// has no nal_unit_header, and for every |keyframe_interval|-th record of a
+// kind. Reading can then start at any record, with full records of each
+// kind following shortly. Only the changed entries are formatted.
+//
+// Keys must outlive the output, as string literals do; string values are
+// copied.
+
+#define DELTA_MAX_KINDS 64
+
+enum DeltaType {
+  DELTA_INT = 0,
+  DELTA_UINT = 1,
+  DELTA_HEX = 2,
+  DELTA_ENUM = 3,
+  DELTA_STR = 4,
+  DELTA_DICT = 5,
+  DELTA_LIST = 6,
+  DELTA_END = 7
+};
+
+struct DeltaEntry {
+  const char* key;  // NULL in lists
+  uint8_t type;     // enum DeltaType
+  // DELTA_DICT and DELTA_LIST: index past their DELTA_END, while open the
+  // enclosing open entry
+  uint32_t next;
+  int64_t val;      // the value, or an offset into DeltaRecord.strings
+  int64_t enum_val;
+};
+
+struct DeltaRecord {
+  struct DeltaEntry* entries;
+  uint32_t count;
+  uint32_t capacity;
+  char* strings;
+  uint32_t strings_size;
+  uint32_t strings_capacity;
+};
+
+struct DeltaKind {
+  struct DeltaRecord last;   // the previous record of this kind
+  uint32_t header;           // index of its nal_unit_header entry
+  uint32_t since_keyframe;   // records written since the last full one
+};
+
+struct DeltaOutput {
+  struct OutputContextList list[1];  // records are put into this
+  struct OutputContextList* out;
+  uint32_t keyframe_interval;  // 0: only the first record of a kind is full
+  struct DeltaRecord current;
+  struct DeltaKind kinds[DELTA_MAX_KINDS];
+  uint32_t kind_count;
+  uint32_t next_evict;
+  uint32_t open;   // innermost open DELTA_DICT or DELTA_LIST entry
+  uint32_t depth;  // 0 between records, else the nesting level
+  uint8_t failed;  // out of memory in the current record
+  uint64_t full_records;
+  uint64_t delta_records;
+};
+
+void DeltaOutputInit(struct DeltaOutput* d,
+                     struct OutputContextList* out,
+                     uint32_t keyframe_interval);
+void DeltaOutputClose(struct DeltaOutput* d);
+
+// Reads the output of a DeltaOutput from |in| and writes it to |out| with
+// every delta record restored to the full record, byte for byte what the
+// output would have been without deltas. Returns 0, or -1 on a malformed
+// input or a delta record whose predecessor is missing.
+int DeltaRestore(FILE* in, FILE* out);
+
+#endif
@@ -0,0 +1,52 @@
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+#include <fcntl.h>
+#include <sys/types.h>
+#ifdef _WIN32
+#include <io.h>
+#define read _read
+#define write _write
+#define lseek _lseeki64
+#else
+#include <unistd.h>
+#endif
+#include <stdio.h>
+#include "file-copy.h"
+
+int FileCopyRange(int in_fd, int out_fd, uint64_t offset, uint64_t size) {
+  uint8_t buf[1 << 16];
+#ifdef __linux__
+  loff_t off = (loff_t)offset;
+  while (size) {
+    ssize_t n = copy_file_range(in_fd, &off, out_fd, NULL, size, 0);
+    if (n <= 0)
+      break;
+    size -= (uint64_t)n;
+  }
+  // older kernels and some file systems can't, copy the rest by hand
+  offset = (uint64_t)off;
+#endif
+  if (size && lseek(in_fd, offset, SEEK_SET) < 0)
+    return -1;
+  while (size) {
+    unsigned chunk = size < sizeof(buf) ? (unsigned)size : sizeof(buf);
+    int n = read(in_fd, buf, chunk);
+    if (n <= 0 || FileWriteAll(out_fd, buf, (uint64_t)n) != 0)
+      return -1;
+    size -= (uint64_t)n;
+  }
+  return 0;
+}
+
+int FileWriteAll(int fd, const uint8_t* data, uint64_t size) {
+  while (size) {
+    unsigned chunk = size < (1u << 30) ? (unsigned)size : 1u << 30;
+    int n = write(fd, data, chunk);
+    if (n <= 0)
+      return -1;
+    data += n;
+    size -= (uint64_t)n;
+  }
+  return 0;
+}
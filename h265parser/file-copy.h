@@ -0,0 +1,13 @@
+#ifndef FILE_COPY_H_
+#define FILE_COPY_H_
+
+#include <stdint.h>
+
+// Copies |size| bytes at |offset| of the file |in_fd| to the end of
+// |out_fd|, in the kernel where it can (copy_file_range on Linux) and by
+// read and write otherwise.
+int FileCopyRange(int in_fd, int out_fd, uint64_t offset, uint64_t size);
+// Writes all |size| bytes of |data| to |fd|.
+int FileWriteAll(int fd, const uint8_t* data, uint64_t size);
+
+#endif
@@ -0,0 +1,194 @@
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <io.h>
+#include <windows.h>
+#define read _read
+#else
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+#include "follow-input.h"
+
+static double Now(void) {
+  // monotonic time in seconds
+#ifdef _WIN32
+  LARGE_INTEGER count, frequency;
+  QueryPerformanceCounter(&count);
+  QueryPerformanceFrequency(&frequency);
+  return (double)count.QuadPart / frequency.QuadPart;
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+#endif
+}
+
+int FollowSourceOpen(struct FollowSource* fs,
+                     int fd,
+                     const char* path,
+                     uint32_t latency_ms,
+                     uint32_t idle_ms) {
+  struct stat st;
+  memset(fs, 0, sizeof(*fs));
+  fs->fd = fd;
+  fs->inotify_fd = -1;
+  fs->latency_ms = latency_ms;
+  fs->idle_ms = idle_ms;
+  fs->last_data = Now();
+  if (fstat(fd, &st) != 0)
+    return -1;
+  fs->is_pipe = !path || (st.st_mode & S_IFMT) != S_IFREG;
+#ifdef __linux__
+  if (!fs->is_pipe) {
+    fs->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fs->inotify_fd >= 0 &&
+        inotify_add_watch(fs->inotify_fd, path, IN_MODIFY | IN_CLOSE_WRITE) <
+            0) {
+      close(fs->inotify_fd);
+      fs->inotify_fd = -1;
+    }
+  }
+#endif
+  return 0;
+}
+
+static void Wait(struct FollowSource* fs, uint32_t timeout_ms) {
+  // Returns when the file may have grown or after |timeout_ms|.
+#ifdef __linux__
+  if (fs->inotify_fd >= 0) {
+    char events[4096];
+    struct pollfd pfd;
+    pfd.fd = fs->inotify_fd;
+    pfd.events = POLLIN;
+    if (poll(&pfd, 1, (int)timeout_ms) > 0) {
+      while (read(fs->inotify_fd, events, sizeof(events)) > 0) {
+      }
+    }
+    return;
+  }
+#endif
+  if (timeout_ms > FOLLOW_POLL_MS)
+    timeout_ms = FOLLOW_POLL_MS;
+#ifdef _WIN32
+  Sleep(timeout_ms);
+#else
+  poll(NULL, 0, (int)timeout_ms);
+#endif
+}
+
+size_t FollowSourceRead(void* opaque, uint8_t* dst, size_t size) {
+  struct FollowSource* fs = (struct FollowSource*)opaque;
+  if (size > 0x40000000)
+    size = 0x40000000;
+  for (;;) {
+    double waited_ms;
+    uint32_t timeout_ms = 1000;
+    int n;
+#ifndef _WIN32
+    if (fs->is_pipe && fs->latency_ms && !fs->idle_reported) {
+      struct pollfd pfd;
+      pfd.fd = fs->fd;
+      pfd.events = POLLIN;
+      if (poll(&pfd, 1, (int)fs->latency_ms) == 0) {
+        fs->idle_reported = 1;
+        return NAL_INPUT_READ_IDLE;
+      }
+    }
+#endif
+    n = (int)read(fs->fd, dst, (unsigned int)size);
+    if (n > 0) {
+      uint32_t i = fs->chunk_tail % FOLLOW_MAX_CHUNKS;
+      fs->last_data = Now();
+      fs->idle_reported = 0;
+      fs->bytes += n;
+      fs->chunk_end[i] = fs->bytes;
+      fs->chunk_time[i] = fs->last_data;
+      fs->chunk_tail++;
+      if (fs->chunk_tail - fs->chunk_head > FOLLOW_MAX_CHUNKS)
+        fs->chunk_head++;
+      return n;
+    }
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0 || fs->is_pipe)
+      return 0;
+    // at the current end of a regular file; the latency bound is reported
+    // once per pause of the writer
+    waited_ms = (Now() - fs->last_data) * 1000;
+    if (fs->idle_ms && waited_ms >= fs->idle_ms)
+      return 0;
+    if (fs->latency_ms && !fs->idle_reported && waited_ms >= fs->latency_ms) {
+      fs->idle_reported = 1;
+      return NAL_INPUT_READ_IDLE;
+    }
+    if (fs->latency_ms && !fs->idle_reported &&
+        fs->latency_ms - waited_ms < timeout_ms)
+      timeout_ms = (uint32_t)(fs->latency_ms - waited_ms) + 1;
+    if (fs->idle_ms && fs->idle_ms - waited_ms < timeout_ms)
+      timeout_ms = (uint32_t)(fs->idle_ms - waited_ms) + 1;
+    Wait(fs, timeout_ms);
+  }
+}
+
+void FollowSourceStamp(void* opaque, struct NalUnit* nal) {
+  // Latency runs from the read that delivered the last byte of the NAL unit
+  // to the moment the NAL unit is handed to the parser.
+  struct FollowSource* fs = (struct FollowSource*)opaque;
+  uint64_t nal_end = nal->offset + nal->prefix_bytes + nal->size;
+  double latency;
+  uint32_t bucket = 0, us;
+  while (fs->chunk_head != fs->chunk_tail &&
+         fs->chunk_end[fs->chunk_head % FOLLOW_MAX_CHUNKS] < nal_end)
+    fs->chunk_head++;
+  if (fs->chunk_head == fs->chunk_tail)
+    return;
+  latency = Now() - fs->chunk_time[fs->chunk_head % FOLLOW_MAX_CHUNKS];
+  fs->nal_count++;
+  fs->latency_sum += latency;
+  if (latency > fs->latency_max)
+    fs->latency_max = latency;
+  for (us = (uint32_t)(latency * 1e6); us > 1; us >>= 1)
+    bucket++;
+  if (bucket >= FOLLOW_LATENCY_BUCKETS)
+    bucket = FOLLOW_LATENCY_BUCKETS - 1;
+  fs->latency_histogram[bucket]++;
+}
+
+static double Percentile(struct FollowSource* fs, double fraction) {
+  // upper bound of the bucket holding the percentile, in milliseconds
+  uint64_t target = (uint64_t)(fs->nal_count * fraction), seen = 0;
+  uint32_t i;
+  for (i = 0; i < FOLLOW_LATENCY_BUCKETS; i++) {
+    seen += fs->latency_histogram[i];
+    if (seen > target)
+      break;
+  }
+  return (double)(2ULL << i) / 1000;
+}
+
+void FollowSourcePrintStats(struct FollowSource* fs, FILE* fp) {
+  if (fs->nal_count == 0)
+    return;
+  fprintf(fp,
+          "follow: %llu NAL units, latency avg %.3f ms, p50 < %.3f ms, "
+          "p99 < %.3f ms, max %.3f ms (%s)\n",
+          (unsigned long long)fs->nal_count,
+          fs->latency_sum / fs->nal_count * 1000, Percentile(fs, 0.5),
+          Percentile(fs, 0.99), fs->latency_max * 1000,
+          fs->is_pipe ? "pipe"
+                      : fs->inotify_fd >= 0 ? "inotify" : "polling");
+}
+
+void FollowSourceClose(struct FollowSource* fs) {
+#ifdef __linux__
+  if (fs->inotify_fd >= 0)
+    close(fs->inotify_fd);
+#endif
+  fs->inotify_fd = -1;
+}
@@ -0,0 +1,57 @@
+#ifndef FOLLOW_INPUT_H_
+#define FOLLOW_INPUT_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include "nal-input.h"
+
+// Byte source for files that are still being written, and for pipes. Reads
+// block until data is appended (inotify on Linux, polling elsewhere) instead
+// of ending the input at the current end of file.
+//
+// A NAL unit is complete once the next start code arrives. With a latency
+// bound, the reader reports NAL_INPUT_READ_IDLE once no new data came for
+// that long, and the last NAL unit before a pause in the writer goes out
+// marked partial rather than waiting for the writer to resume; it is never
+// cut short, since it goes out again whole once its end arrives.
+
+#define FOLLOW_POLL_MS 10
+#define FOLLOW_MAX_CHUNKS 1024
+#define FOLLOW_LATENCY_BUCKETS 32
+
+struct FollowSource {
+  int fd;
+  int inotify_fd;  // -1 when polling
+  uint8_t is_pipe;
+  uint32_t latency_ms;  // 0: wait for the next start code
+  uint32_t idle_ms;     // end of input after this long without data, 0: never
+  double last_data;     // time of the last read that returned data
+  uint8_t idle_reported;
+
+  // end offset and arrival time of recent reads, to measure latency
+  uint64_t chunk_end[FOLLOW_MAX_CHUNKS];
+  double chunk_time[FOLLOW_MAX_CHUNKS];
+  uint32_t chunk_head;
+  uint32_t chunk_tail;
+  uint64_t bytes;
+
+  // arrival to emission latency, log2 microsecond buckets
+  uint64_t nal_count;
+  double latency_sum;
+  double latency_max;
+  uint64_t latency_histogram[FOLLOW_LATENCY_BUCKETS];
+};
+
+// |path| is watched for modifications, NULL for pipes and stdin.
+int FollowSourceOpen(struct FollowSource* fs,
+                     int fd,
+                     const char* path,
+                     uint32_t latency_ms,
+                     uint32_t idle_ms);
+// NalInput callbacks, |opaque| is the FollowSource
+size_t FollowSourceRead(void* opaque, uint8_t* dst, size_t size);
+void FollowSourceStamp(void* opaque, struct NalUnit* nal);
+void FollowSourcePrintStats(struct FollowSource* fs, FILE* fp);
+void FollowSourceClose(struct FollowSource* fs);
+
+#endif
@@ -0,0 +1,958 @@
+#include <stdlib.h>
+#include <string.h>
+#include "bitwriter.h"
+#include "generator.h"
+#include "h265const.h"
+
+#define GENERATOR_MAX_SLICES 256
+#define GENERATOR_RBSP_SIZE (64 * 1024)
+#define GENERATOR_LOG2_MAX_POC_LSB 8
+
+// Random access GOP in decoding order: POC offset in the GOP, TemporalId and
+// the reference picture set, negative deltas closest first, then positive
+// deltas closest first.
+static const uint32_t kRaPoc[8] = {8, 4, 2, 1, 3, 6, 5, 7};
+static const uint8_t kRaTid[8] = {0, 1, 2, 3, 3, 2, 3, 3};
+static const int8_t kRaDeltas[8][5] = {
+    {-8},          {-4, 4},     {-2, 2, 6},     {-1, 1, 3, 7},
+    {-1, -3, 1, 5}, {-2, -6, 2}, {-1, -5, 1, 3}, {-1, -3, -7, 1},
+};
+
+static const uint8_t kUuid[16] = {0x68, 0x32, 0x36, 0x35, 0x70, 0x61,
+                                  0x72, 0x73, 0x65, 0x72, 0x2d, 0x67,
+                                  0x65, 0x6e, 0x00, 0x01};
+
+const char* kGeneratorOptions =
+    "size width height ctb tiles wpp weighted gop refs intra-period slices sei "
+    "sei-bytes intra-bytes inter-bytes jitter fps length-size corrupt seed";
+
+struct GeneratorPicture {
+  uint8_t nal_unit_type;
+  uint8_t temporal_id;
+  uint8_t slice_type;
+  uint32_t poc;
+  uint32_t rps_idx;
+  uint32_t num_refs;
+  uint32_t payload_bytes;
+};
+
+struct Generator {
+  const struct GeneratorConfig* cfg;
+  FILE* fp;
+  struct GeneratorStats* stats;
+  uint64_t rng;
+  int error;
+  uint64_t corrupt_rng;
+  uint64_t corrupt_at;  // stream offset of the next flipped bit
+
+  uint32_t coded_width;
+  uint32_t coded_height;
+  uint32_t width_ctbs;
+  uint32_t height_ctbs;
+  uint32_t size_ctbs;
+  uint32_t sub_layers;
+  uint32_t num_rps;
+  uint32_t period;  // pictures from one IDR to the next
+
+  uint32_t slices;
+  uint32_t slice_address[GENERATOR_MAX_SLICES];
+  uint32_t slice_substreams[GENERATOR_MAX_SLICES];
+
+  uint8_t* rbsp;
+  uint8_t* data;       // slice data before escaping
+  uint8_t* escaped;    // escaped slice data of one slice
+  uint8_t* nal;        // escaped NAL unit header and slice header
+  uint32_t* substream_size;
+};
+
+static uint32_t BitLength(uint64_t v) {
+  uint32_t n = 0;
+  while (v) {
+    v >>= 1;
+    n++;
+  }
+  return n;
+}
+
+static uint64_t Random(struct Generator* g) {
+  // xorshift64*
+  g->rng ^= g->rng >> 12;
+  g->rng ^= g->rng << 25;
+  g->rng ^= g->rng >> 27;
+  return g->rng * 0x2545F4914F6CDD1DULL;
+}
+
+static uint64_t SplitMix(uint64_t seed) {
+  // never zero, for xorshift
+  uint64_t v = (seed + 1) * 0x9E3779B97F4A7C15ULL;
+  v = (v ^ (v >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  v = (v ^ (v >> 27)) * 0x94D049BB133111EBULL;
+  v ^= v >> 31;
+  return v ? v : 1;
+}
+
+static void NextCorruption(struct Generator* g) {
+  // uniform in 1 to 2 * |corrupt| - 1 bytes after the last one
+  uint64_t r;
+  g->corrupt_rng ^= g->corrupt_rng >> 12;
+  g->corrupt_rng ^= g->corrupt_rng << 25;
+  g->corrupt_rng ^= g->corrupt_rng >> 27;
+  r = g->corrupt_rng * 0x2545F4914F6CDD1DULL;
+  g->corrupt_at += 1 + (r >> 3) % (2 * (uint64_t)g->cfg->corrupt - 1);
+}
+
+static void Emit(struct Generator* g, const uint8_t* p, uint32_t n) {
+  // Writes |n| bytes, flipping the bits |corrupt| asks for.
+  uint64_t end = g->stats->bytes + n;
+  while (g->cfg->corrupt && g->corrupt_at < end) {
+    uint32_t skip = (uint32_t)(g->corrupt_at - g->stats->bytes);
+    uint8_t b = p[skip] ^ (uint8_t)(1 << (g->corrupt_rng >> 61));
+    fwrite(p, 1, skip, g->fp);
+    fputc(b, g->fp);
+    p += skip + 1;
+    n -= skip + 1;
+    g->stats->bytes += skip + 1;
+    g->stats->flipped++;
+    NextCorruption(g);
+  }
+  fwrite(p, 1, n, g->fp);
+  g->stats->bytes += n;
+}
+
+static void FillRandom(struct Generator* g, uint8_t* dst, uint32_t n) {
+  uint32_t i;
+  for (i = 0; i + 8 <= n; i += 8) {
+    uint64_t r = Random(g);
+    memcpy(dst + i, &r, 8);
+  }
+  if (i < n) {
+    uint64_t r = Random(g);
+    memcpy(dst + i, &r, n - i);
+  }
+}
+
+void GeneratorDefaults(struct GeneratorConfig* cfg) {
+  memset(cfg, 0, sizeof(*cfg));
+  cfg->total_bytes = 64 << 20;
+  cfg->width = 1920;
+  cfg->height = 1080;
+  cfg->ctb_log2 = 6;
+  cfg->tile_columns = 1;
+  cfg->tile_rows = 1;
+  cfg->gop = GENERATOR_GOP_RANDOM_ACCESS;
+  cfg->refs = 2;
+  cfg->intra_period = 32;
+  cfg->slices = 1;
+  cfg->sei = 1;
+  cfg->sei_bytes = 32;
+  cfg->intra_bytes = 100000;
+  cfg->inter_bytes = 12000;
+  cfg->jitter = 20;
+  cfg->fps = 30;
+  cfg->seed = 1;
+}
+
+uint64_t GeneratorParseSize(const char* s) {
+  char* end;
+  uint64_t v = strtoull(s, &end, 10);
+  if (end == s)
+    return 0;
+  switch (*end) {
+  case 'k':
+  case 'K':
+    v <<= 10;
+    end++;
+    break;
+  case 'm':
+  case 'M':
+    v <<= 20;
+    end++;
+    break;
+  case 'g':
+  case 'G':
+    v <<= 30;
+    end++;
+    break;
+  }
+  return *end ? 0 : v;
+}
+
+int GeneratorSetOption(struct GeneratorConfig* cfg,
+                       const char* name,
+                       const char* value) {
+  uint64_t v = GeneratorParseSize(value);
+  if (strcmp(name, "gop") == 0) {
+    if (strcmp(value, "intra") == 0)
+      cfg->gop = GENERATOR_GOP_INTRA;
+    else if (strcmp(value, "lowdelay") == 0)
+      cfg->gop = GENERATOR_GOP_LOW_DELAY;
+    else if (strcmp(value, "randomaccess") == 0)
+      cfg->gop = GENERATOR_GOP_RANDOM_ACCESS;
+    else
+      return -1;
+    return 0;
+  }
+  if (strcmp(name, "tiles") == 0) {
+    unsigned columns, rows;
+    if (sscanf(value, "%ux%u", &columns, &rows) != 2)
+      return -1;
+    cfg->tile_columns = columns;
+    cfg->tile_rows = rows;
+    return 0;
+  }
+  if (strcmp(name, "size") == 0) {
+    cfg->total_bytes = v;
+    return v ? 0 : -1;
+  }
+  if (v > 0xFFFFFFFF || (v == 0 && strcmp(value, "0") != 0))
+    return -1;
+  if (strcmp(name, "width") == 0)
+    cfg->width = (uint32_t)v;
+  else if (strcmp(name, "height") == 0)
+    cfg->height = (uint32_t)v;
+  else if (strcmp(name, "ctb") == 0 && v && !(v & (v - 1)))
+    cfg->ctb_log2 = BitLength(v) - 1;
+  else if (strcmp(name, "wpp") == 0)
+    cfg->wpp = v != 0;
+  else if (strcmp(name, "weighted") == 0)
+    cfg->weighted = v != 0;
+  else if (strcmp(name, "refs") == 0)
+    cfg->refs = (uint32_t)v;
+  else if (strcmp(name, "intra-period") == 0)
+    cfg->intra_period = (uint32_t)v;
+  else if (strcmp(name, "slices") == 0)
+    cfg->slices = (uint32_t)v;
+  else if (strcmp(name, "sei") == 0)
+    cfg->sei = (uint32_t)v;
+  else if (strcmp(name, "sei-bytes") == 0)
+    cfg->sei_bytes = (uint32_t)v;
+  else if (strcmp(name, "intra-bytes") == 0)
+    cfg->intra_bytes = (uint32_t)v;
+  else if (strcmp(name, "inter-bytes") == 0)
+    cfg->inter_bytes = (uint32_t)v;
+  else if (strcmp(name, "jitter") == 0)
+    cfg->jitter = (uint32_t)v;
+  else if (strcmp(name, "fps") == 0)
+    cfg->fps = (uint32_t)v;
+  else if (strcmp(name, "length-size") == 0)
+    cfg->length_size = (uint8_t)v;
+  else if (strcmp(name, "corrupt") == 0)
+    cfg->corrupt = (uint32_t)v;
+  else if (strcmp(name, "seed") == 0)
+    cfg->seed = (uint32_t)v;
+  else
+    return -1;
+  return 0;
+}
+
+int GeneratorCheck(const struct GeneratorConfig* cfg) {
+  uint32_t ctb = 1 << cfg->ctb_log2;
+  const char* problem = NULL;
+  if (cfg->width < 16 || cfg->height < 16 || cfg->width > 16384 ||
+      cfg->height > 16384)
+    problem = "width and height must be 16 to 16384";
+  else if (cfg->ctb_log2 < 4 || cfg->ctb_log2 > 6)
+    problem = "ctb must be 16, 32 or 64";
+  else if (cfg->tile_columns < 1 || cfg->tile_rows < 1 ||
+           cfg->tile_columns > GENERATOR_MAX_TILES ||
+           cfg->tile_rows > GENERATOR_MAX_TILES ||
+           cfg->tile_columns > (cfg->width + ctb - 1) / ctb ||
+           cfg->tile_rows > (cfg->height + ctb - 1) / ctb)
+    problem = "too many tile columns or rows for the picture size";
+  else if (cfg->refs < 1 || cfg->refs > 4)
+    problem = "refs must be 1 to 4";
+  else if (cfg->intra_period < 1)
+    problem = "intra-period must be at least 1";
+  else if (cfg->slices < 1 || cfg->slices > GENERATOR_MAX_SLICES)
+    problem = "slices must be 1 to 256";
+  else if (cfg->sei_bytes < 16 || cfg->sei_bytes > GENERATOR_MAX_SEI_BYTES)
+    problem = "sei-bytes must be 16 to 4096";
+  else if (cfg->jitter > 100)
+    problem = "jitter must be 0 to 100";
+  else if (cfg->fps < 1)
+    problem = "fps must be at least 1";
+  else if (cfg->length_size != 0 && cfg->length_size != 1 &&
+           cfg->length_size != 2 && cfg->length_size != 4)
+    problem = "length-size must be 0, 1, 2 or 4";
+  else if ((uint64_t)(cfg->intra_bytes > cfg->inter_bytes ? cfg->intra_bytes
+                                                          : cfg->inter_bytes) *
+               (100 + cfg->jitter) / 100 / cfg->slices >
+           GENERATOR_MAX_SLICE_BYTES)
+    problem = "slice data above 32 MiB per slice, use more slices";
+  if (problem) {
+    fprintf(stderr, "generator: %s\n", problem);
+    return -1;
+  }
+  return 0;
+}
+
+static void FormatSize(uint64_t v, char* s, size_t size) {
+  if (v && (v & ((1 << 30) - 1)) == 0)
+    snprintf(s, size, "%lluG", (unsigned long long)(v >> 30));
+  else if (v && (v & ((1 << 20) - 1)) == 0)
+    snprintf(s, size, "%lluM", (unsigned long long)(v >> 20));
+  else if (v && (v & ((1 << 10) - 1)) == 0)
+    snprintf(s, size, "%lluK", (unsigned long long)(v >> 10));
+  else
+    snprintf(s, size, "%llu", (unsigned long long)v);
+}
+
+void GeneratorName(const struct GeneratorConfig* cfg, char* name, size_t size) {
+  // settings not spelled out in the name go into a hash
+  static const char* kGopNames[3] = {"intra", "ld", "ra"};
+  uint32_t fields[12], i, hash = 2166136261u;
+  fields[0] = cfg->ctb_log2;
+  fields[1] = cfg->refs;
+  fields[2] = cfg->intra_period;
+  fields[3] = cfg->sei;
+  fields[4] = cfg->sei_bytes;
+  fields[5] = cfg->intra_bytes;
+  fields[6] = cfg->inter_bytes;
+  fields[7] = cfg->jitter;
+  fields[8] = cfg->fps;
+  fields[9] = cfg->length_size;
+  fields[10] = cfg->wpp;
+  fields[11] = 1;  // generator version
+  for (i = 0; i < 12 * 4; i++) {
+    hash ^= (fields[i / 4] >> (8 * (i % 4))) & 0xFF;
+    hash *= 16777619u;
+  }
+  char total[32], corrupt[32] = "";
+  FormatSize(cfg->total_bytes, total, sizeof(total));
+  if (cfg->corrupt)
+    snprintf(corrupt, sizeof(corrupt), "-err%u", cfg->corrupt);
+  snprintf(name, size, "%ux%u-%s-t%ux%u%s%s-s%u-%s%s-seed%u-%08x", cfg->width,
+           cfg->height, kGopNames[cfg->gop], cfg->tile_columns,
+           cfg->tile_rows, cfg->wpp ? "-wpp" : "", cfg->weighted ? "-wp" : "",
+           cfg->slices, total, corrupt, cfg->seed, hash);
+}
+
+static void Layout(struct Generator* g) {
+  // Slices are made of whole tiles, or of whole CTB rows without tiles, so
+  // that every slice starts a new substream.
+  const struct GeneratorConfig* cfg = g->cfg;
+  uint32_t columns = cfg->tile_columns, rows = cfg->tile_rows;
+  uint32_t tiles = columns * rows, s, t;
+  uint32_t ctb = 1 << cfg->ctb_log2;
+  g->coded_width = (cfg->width + 7) & ~7u;
+  g->coded_height = (cfg->height + 7) & ~7u;
+  g->width_ctbs = (g->coded_width + ctb - 1) / ctb;
+  g->height_ctbs = (g->coded_height + ctb - 1) / ctb;
+  g->size_ctbs = g->width_ctbs * g->height_ctbs;
+  if (tiles > 1) {
+    g->slices = cfg->slices < tiles ? cfg->slices : tiles;
+    for (s = 0; s < g->slices; s++) {
+      uint32_t first = s * tiles / g->slices;
+      uint32_t last = (s + 1) * tiles / g->slices;
+      // (6-3) and (6-4) with uniform_spacing_flag
+      g->slice_address[s] = (first / columns) * g->height_ctbs / rows *
+                                g->width_ctbs +
+                            (first % columns) * g->width_ctbs / columns;
+      g->slice_substreams[s] = 0;
+      for (t = first; t < last; t++) {
+        uint32_t r = t / columns;
+        uint32_t height = (r + 1) * g->height_ctbs / rows -
+                          r * g->height_ctbs / rows;
+        g->slice_substreams[s] += cfg->wpp ? height : 1;
+      }
+    }
+  } else {
+    g->slices = cfg->slices < g->height_ctbs ? cfg->slices : g->height_ctbs;
+    for (s = 0; s < g->slices; s++) {
+      uint32_t first = s * g->height_ctbs / g->slices;
+      uint32_t last = (s + 1) * g->height_ctbs / g->slices;
+      g->slice_address[s] = first * g->width_ctbs;
+      g->slice_substreams[s] = cfg->wpp ? last - first : 1;
+    }
+  }
+
+  switch (cfg->gop) {
+  case GENERATOR_GOP_INTRA:
+    g->sub_layers = 1;
+    g->num_rps = 1;
+    g->period = cfg->intra_period;
+    break;
+  case GENERATOR_GOP_LOW_DELAY:
+    g->sub_layers = 1;
+    g->num_rps = cfg->refs;
+    g->period = cfg->intra_period;
+    break;
+  case GENERATOR_GOP_RANDOM_ACCESS:
+    g->sub_layers = 4;
+    g->num_rps = 8;
+    // an IDR, then whole GOPs
+    g->period = 1 + (cfg->intra_period + 6) / 8 * 8;
+    break;
+  }
+}
+
+static void Plan(struct Generator* g,
+                 uint64_t picture,
+                 struct GeneratorPicture* pic) {
+  const struct GeneratorConfig* cfg = g->cfg;
+  uint32_t index = (uint32_t)(picture % g->period), k, base;
+  memset(pic, 0, sizeof(*pic));
+  if (index == 0) {
+    pic->nal_unit_type = H265_NAL_TYPE_IDR_W_RADL;
+    pic->slice_type = H265_SLICE_TYPE_I;
+    base = cfg->intra_bytes;
+  } else {
+    pic->nal_unit_type = H265_NAL_TYPE_TRAIL_R;
+    base = cfg->inter_bytes;
+    switch (cfg->gop) {
+    case GENERATOR_GOP_INTRA:
+      pic->slice_type = H265_SLICE_TYPE_I;
+      pic->poc = index;
+      base = cfg->intra_bytes;
+      break;
+    case GENERATOR_GOP_LOW_DELAY:
+      pic->slice_type = H265_SLICE_TYPE_P;
+      pic->poc = index;
+      pic->num_refs = index < cfg->refs ? index : cfg->refs;
+      pic->rps_idx = pic->num_refs - 1;
+      break;
+    case GENERATOR_GOP_RANDOM_ACCESS:
+      k = (index - 1) % 8;
+      pic->slice_type = H265_SLICE_TYPE_B;
+      pic->poc = (index - 1) / 8 * 8 + kRaPoc[k];
+      pic->temporal_id = kRaTid[k];
+      pic->rps_idx = k;
+      for (pic->num_refs = 0;
+           pic->num_refs < 5 && kRaDeltas[k][pic->num_refs] != 0;
+           pic->num_refs++) {
+      }
+      // the highest sub-layer is not referenced
+      if (pic->temporal_id == g->sub_layers - 1)
+        pic->nal_unit_type = H265_NAL_TYPE_TRAIL_N;
+      break;
+    }
+  }
+  pic->payload_bytes =
+      (uint32_t)((uint64_t)base *
+                 (100 - cfg->jitter + Random(g) % (2 * cfg->jitter + 1)) / 100);
+}
+
+static void PutNalHeader(struct BitWriter* bw,
+                         uint8_t nal_unit_type,
+                         uint8_t temporal_id) {
+  BsPut(bw, 0, 1);  // forbidden_zero_bit
+  BsPut(bw, nal_unit_type, 6);
+  BsPut(bw, 0, 6);  // nuh_layer_id
+  BsPut(bw, temporal_id + 1, 3);
+}
+
+static void WriteNal(struct Generator* g,
+                     struct BitWriter* bw,
+                     const uint8_t* tail,
+                     uint32_t tail_size,
+                     int long_start_code) {
+  // Escapes the RBSP in |bw| and writes it with |tail|, already escaped,
+  // after it.
+  uint32_t zeros = 0, size, length_size = g->cfg->length_size;
+  uint8_t prefix[4] = {0, 0, 0, 1};
+  if (bw->overflow) {
+    fprintf(stderr, "generator: RBSP buffer overflow\n");
+    g->error = -1;
+    return;
+  }
+  size = BsEscape(g->nal, g->rbsp, BsBytes(bw), &zeros);
+  if (length_size) {
+    uint32_t i, total = size + tail_size;
+    if (length_size < 4 && total >> (8 * length_size)) {
+      fprintf(stderr, "generator: NAL unit of %u bytes needs length-size 4\n",
+              total);
+      g->error = -1;
+      return;
+    }
+    for (i = 0; i < length_size; i++)
+      prefix[i] = (uint8_t)(total >> (8 * (length_size - 1 - i)));
+    Emit(g, prefix, length_size);
+  } else {
+    Emit(g, long_start_code ? prefix : prefix + 1, long_start_code ? 4 : 3);
+  }
+  Emit(g, g->nal, size);
+  if (tail_size)
+    Emit(g, tail, tail_size);
+  g->stats->nal_units++;
+  if (ferror(g->fp))
+    g->error = -1;
+}
+
+static void PutProfileTierLevel(struct Generator* g, struct BitWriter* bw) {
+  // 7.3.3, Main profile
+  uint32_t samples = g->coded_width * g->coded_height, i;
+  uint8_t level_idc = 186;
+  if (samples <= 36864)
+    level_idc = 30;
+  else if (samples <= 122880)
+    level_idc = 60;
+  else if (samples <= 245760)
+    level_idc = 63;
+  else if (samples <= 552960)
+    level_idc = 90;
+  else if (samples <= 983040)
+    level_idc = 93;
+  else if (samples <= 2228224)
+    level_idc = 123;
+  else if (samples <= 8912896)
+    level_idc = 153;
+  BsPut(bw, 0, 2);           // general_profile_space
+  BsPut(bw, 0, 1);           // general_tier_flag
+  BsPut(bw, 1, 5);           // general_profile_idc
+  BsPut(bw, 0x60000000, 32);  // general_profile_compatibility_flag[1, 2]
+  BsPut(bw, 1, 1);           // general_progressive_source_flag
+  BsPut(bw, 0, 1);           // general_interlaced_source_flag
+  BsPut(bw, 0, 1);           // general_non_packed_constraint_flag
+  BsPut(bw, 1, 1);           // general_frame_only_constraint_flag
+  BsPut(bw, 0, 11);          // general_reserved_zero_43bits
+  BsPut(bw, 0, 32);
+  BsPut(bw, 0, 1);  // general_inbld_flag
+  BsPut(bw, level_idc, 8);
+  for (i = 0; i < g->sub_layers - 1; i++)
+    BsPut(bw, 0, 2);  // sub_layer_{profile,level}_present_flag
+  if (g->sub_layers > 1) {
+    for (i = g->sub_layers - 1; i < 8; i++)
+      BsPut(bw, 0, 2);  // reserved_zero_2bits
+  }
+}
+
+static void PutDpbSize(struct Generator* g, struct BitWriter* bw) {
+  // sub_layer_ordering_info_present_flag is 0, only the highest sub-layer
+  switch (g->cfg->gop) {
+  case GENERATOR_GOP_INTRA:
+    BsPutUe(bw, 0);
+    BsPutUe(bw, 0);
+    break;
+  case GENERATOR_GOP_LOW_DELAY:
+    BsPutUe(bw, g->cfg->refs);
+    BsPutUe(bw, 0);
+    break;
+  case GENERATOR_GOP_RANDOM_ACCESS:
+    BsPutUe(bw, 4);
+    BsPutUe(bw, 3);
+    break;
+  }
+  BsPutUe(bw, 0);  // max_latency_increase_plus1
+}
+
+static void WriteVps(struct Generator* g) {
+  // 7.3.2.1
+  struct BitWriter bw;
+  BsWriterInit(&bw, g->rbsp, GENERATOR_RBSP_SIZE);
+  PutNalHeader(&bw, H265_NAL_TYPE_VPS_NUT, 0);
+  BsPut(&bw, 0, 4);  // vps_video_parameter_set_id
+  BsPut(&bw, 1, 1);  // vps_base_layer_internal_flag
+  BsPut(&bw, 1, 1);  // vps_base_layer_available_flag
+  BsPut(&bw, 0, 6);  // vps_max_layers_minus1
+  BsPut(&bw, g->sub_layers - 1, 3);
+  BsPut(&bw, g->sub_layers == 1, 1);  // vps_temporal_id_nesting_flag
+  BsPut(&bw, 0xFFFF, 16);
+  PutProfileTierLevel(g, &bw);
+  BsPut(&bw, 0, 1);  // vps_sub_layer_ordering_info_present_flag
+  PutDpbSize(g, &bw);
+  BsPut(&bw, 0, 6);   // vps_max_layer_id
+  BsPutUe(&bw, 0);    // vps_num_layer_sets_minus1
+  BsPut(&bw, 1, 1);   // vps_timing_info_present_flag
+  BsPut(&bw, 1000, 32);
+  BsPut(&bw, g->cfg->fps * 1000, 32);
+  BsPut(&bw, 0, 1);  // vps_poc_proportional_to_timing_flag
+  BsPutUe(&bw, 0);   // vps_num_hrd_parameters
+  BsPut(&bw, 0, 1);  // vps_extension_flag
+  BsPutTrailingBits(&bw);
+  WriteNal(g, &bw, NULL, 0, 1);
+}
+
+static void PutRefPicSet(struct BitWriter* bw,
+                         uint32_t idx,
+                         const int8_t* deltas,
+                         uint32_t count) {
+  // 7.3.7, explicitly coded
+  uint32_t negative = 0, i;
+  int32_t prev;
+  while (negative < count && deltas[negative] < 0)
+    negative++;
+  if (idx != 0)
+    BsPut(bw, 0, 1);  // inter_ref_pic_set_prediction_flag
+  BsPutUe(bw, negative);
+  BsPutUe(bw, count - negative);
+  for (i = 0, prev = 0; i < negative; prev = deltas[i++]) {
+    BsPutUe(bw, prev - deltas[i] - 1);
+    BsPut(bw, 1, 1);  // used_by_curr_pic_s0_flag
+  }
+  for (prev = 0; i < count; prev = deltas[i++]) {
+    BsPutUe(bw, deltas[i] - prev - 1);
+    BsPut(bw, 1, 1);  // used_by_curr_pic_s1_flag
+  }
+}
+
+static void WriteSps(struct Generator* g) {
+  // 7.3.2.2
+  const struct GeneratorConfig* cfg = g->cfg;
+  struct BitWriter bw;
+  uint32_t i, j;
+  BsWriterInit(&bw, g->rbsp, GENERATOR_RBSP_SIZE);
+  PutNalHeader(&bw, H265_NAL_TYPE_SPS_NUT, 0);
+  BsPut(&bw, 0, 4);  // sps_video_parameter_set_id
+  BsPut(&bw, g->sub_layers - 1, 3);
+  BsPut(&bw, g->sub_layers == 1, 1);  // sps_temporal_id_nesting_flag
+  PutProfileTierLevel(g, &bw);
+  BsPutUe(&bw, 0);  // sps_seq_parameter_set_id
+  BsPutUe(&bw, 1);  // chroma_format_idc
+  BsPutUe(&bw, g->coded_width);
+  BsPutUe(&bw, g->coded_height);
+  if (g->coded_width != cfg->width || g->coded_height != cfg->height) {
+    BsPut(&bw, 1, 1);  // conformance_window_flag
+    BsPutUe(&bw, 0);
+    BsPutUe(&bw, (g->coded_width - cfg->width) / 2);
+    BsPutUe(&bw, 0);
+    BsPutUe(&bw, (g->coded_height - cfg->height) / 2);
+  } else {
+    BsPut(&bw, 0, 1);
+  }
+  BsPutUe(&bw, 0);  // bit_depth_luma_minus8
+  BsPutUe(&bw, 0);  // bit_depth_chroma_minus8
+  BsPutUe(&bw, GENERATOR_LOG2_MAX_POC_LSB - 4);
+  BsPut(&bw, 0, 1);  // sps_sub_layer_ordering_info_present_flag
+  PutDpbSize(g, &bw);
+  BsPutUe(&bw, 0);                  // log2_min_luma_coding_block_size_minus3
+  BsPutUe(&bw, cfg->ctb_log2 - 3);  // log2_diff_max_min_luma_coding_block_size
+  BsPutUe(&bw, 0);  // log2_min_luma_transform_block_size_minus2
+  BsPutUe(&bw, 3);  // log2_diff_max_min_luma_transform_block_size
+  BsPutUe(&bw, 1);  // max_transform_hierarchy_depth_inter
+  BsPutUe(&bw, 1);  // max_transform_hierarchy_depth_intra
+  BsPut(&bw, 0, 1);  // scaling_list_enabled_flag
+  BsPut(&bw, 1, 1);  // amp_enabled_flag
+  BsPut(&bw, 1, 1);  // sample_adaptive_offset_enabled_flag
+  BsPut(&bw, 0, 1);  // pcm_enabled_flag
+  BsPutUe(&bw, g->num_rps);
+  for (i = 0; i < g->num_rps; i++) {
+    int8_t deltas[4];
+    switch (cfg->gop) {
+    case GENERATOR_GOP_INTRA:
+      PutRefPicSet(&bw, i, deltas, 0);
+      break;
+    case GENERATOR_GOP_LOW_DELAY:
+      for (j = 0; j <= i; j++)
+        deltas[j] = -(int8_t)(j + 1);
+      PutRefPicSet(&bw, i, deltas, i + 1);
+      break;
+    case GENERATOR_GOP_RANDOM_ACCESS:
+      for (j = 0; j < 5 && kRaDeltas[i][j] != 0; j++) {
+      }
+      PutRefPicSet(&bw, i, kRaDeltas[i], j);
+      break;
+    }
+  }
+  BsPut(&bw, 0, 1);  // long_term_ref_pics_present_flag
+  BsPut(&bw, 1, 1);  // sps_temporal_mvp_enabled_flag
+  BsPut(&bw, 1, 1);  // strong_intra_smoothing_enabled_flag
+  BsPut(&bw, 1, 1);  // vui_parameters_present_flag
+  // E.2.1, only timing information
+  BsPut(&bw, 0, 1);  // aspect_ratio_info_present_flag
+  BsPut(&bw, 0, 1);  // overscan_info_present_flag
+  BsPut(&bw, 0, 1);  // video_signal_type_present_flag
+  BsPut(&bw, 0, 1);  // chroma_loc_info_present_flag
+  BsPut(&bw, 0, 1);  // neutral_chroma_indication_flag
+  BsPut(&bw, 0, 1);  // field_seq_flag
+  BsPut(&bw, 0, 1);  // frame_field_info_present_flag
+  BsPut(&bw, 0, 1);  // default_display_window_flag
+  BsPut(&bw, 1, 1);  // vui_timing_info_present_flag
+  BsPut(&bw, 1000, 32);
+  BsPut(&bw, cfg->fps * 1000, 32);
+  BsPut(&bw, 0, 1);  // vui_poc_proportional_to_timing_flag
+  BsPut(&bw, 0, 1);  // vui_hrd_parameters_present_flag
+  BsPut(&bw, 0, 1);  // bitstream_restriction_flag
+  BsPut(&bw, 0, 1);  // sps_extension_present_flag
+  BsPutTrailingBits(&bw);
+  WriteNal(g, &bw, NULL, 0, 1);
+}
+
+static void WritePps(struct Generator* g) {
+  // 7.3.2.3
+  const struct GeneratorConfig* cfg = g->cfg;
+  uint8_t tiles = cfg->tile_columns > 1 || cfg->tile_rows > 1;
+  struct BitWriter bw;
+  BsWriterInit(&bw, g->rbsp, GENERATOR_RBSP_SIZE);
+  PutNalHeader(&bw, H265_NAL_TYPE_PPS_NUT, 0);
+  BsPutUe(&bw, 0);   // pps_pic_parameter_set_id
+  BsPutUe(&bw, 0);   // pps_seq_parameter_set_id
+  BsPut(&bw, 0, 1);  // dependent_slice_segments_enabled_flag
+  BsPut(&bw, 0, 1);  // output_flag_present_flag
+  BsPut(&bw, 0, 3);  // num_extra_slice_header_bits
+  BsPut(&bw, 1, 1);  // sign_data_hiding_enabled_flag
+  BsPut(&bw, 1, 1);  // cabac_init_present_flag
+  BsPutUe(&bw, 0);   // num_ref_idx_l0_default_active_minus1
+  BsPutUe(&bw, 0);   // num_ref_idx_l1_default_active_minus1
+  BsPutSe(&bw, 0);   // init_qp_minus26
+  BsPut(&bw, 0, 1);  // constrained_intra_pred_flag
+  BsPut(&bw, 1, 1);  // transform_skip_enabled_flag
+  BsPut(&bw, 1, 1);  // cu_qp_delta_enabled_flag
+  BsPutUe(&bw, 0);   // diff_cu_qp_delta_depth
+  BsPutSe(&bw, 0);   // pps_cb_qp_offset
+  BsPutSe(&bw, 0);   // pps_cr_qp_offset
+  BsPut(&bw, 0, 1);  // pps_slice_chroma_qp_offsets_present_flag
+  BsPut(&bw, cfg->weighted, 1);  // weighted_pred_flag
+  BsPut(&bw, cfg->weighted, 1);  // weighted_bipred_flag
+  BsPut(&bw, 0, 1);  // transquant_bypass_enabled_flag
+  BsPut(&bw, tiles, 1);
+  BsPut(&bw, cfg->wpp, 1);  // entropy_coding_sync_enabled_flag
+  if (tiles) {
+    BsPutUe(&bw, cfg->tile_columns - 1);
+    BsPutUe(&bw, cfg->tile_rows - 1);
+    BsPut(&bw, 1, 1);  // uniform_spacing_flag
+    BsPut(&bw, 1, 1);  // loop_filter_across_tiles_enabled_flag
+  }
+  BsPut(&bw, 1, 1);  // pps_loop_filter_across_slices_enabled_flag
+  BsPut(&bw, 1, 1);  // deblocking_filter_control_present_flag
+  BsPut(&bw, 1, 1);  // deblocking_filter_override_enabled_flag
+  BsPut(&bw, 0, 1);  // pps_deblocking_filter_disabled_flag
+  BsPutSe(&bw, 0);   // pps_beta_offset_div2
+  BsPutSe(&bw, 0);   // pps_tc_offset_div2
+  BsPut(&bw, 0, 1);  // pps_scaling_list_data_present_flag
+  BsPut(&bw, cfg->weighted, 1);  // lists_modification_present_flag
+  BsPutUe(&bw, 0);   // log2_parallel_merge_level_minus2
+  BsPut(&bw, 0, 1);  // slice_segment_header_extension_present_flag
+  BsPut(&bw, 0, 1);  // pps_extension_present_flag
+  BsPutTrailingBits(&bw);
+  WriteNal(g, &bw, NULL, 0, 1);
+}
+
+static void WriteSei(struct Generator* g, int long_start_code) {
+  // 7.3.5, user_data_unregistered (D.2.7)
+  struct BitWriter bw;
+  uint32_t size = g->cfg->sei_bytes, i;
+  uint8_t data[GENERATOR_MAX_SEI_BYTES];
+  BsWriterInit(&bw, g->rbsp, GENERATOR_RBSP_SIZE);
+  PutNalHeader(&bw, H265_NAL_TYPE_PREFIX_SEI_NUT, 0);
+  BsPut(&bw, 5, 8);  // payloadType
+  for (i = size; i >= 0xFF; i -= 0xFF)
+    BsPut(&bw, 0xFF, 8);
+  BsPut(&bw, i, 8);
+  memcpy(data, kUuid, 16);
+  FillRandom(g, data + 16, size - 16);
+  for (i = 0; i < size; i++)
+    BsPut(&bw, data[i], 8);
+  BsPutTrailingBits(&bw);
+  WriteNal(g, &bw, NULL, 0, long_start_code);
+}
+
+static void PutListsModification(struct BitWriter* bw,
+                                 const struct GeneratorPicture* pic) {
+  // 7.3.6.2, the reference pictures rotated by one
+  uint32_t lists = pic->slice_type == H265_SLICE_TYPE_B ? 2 : 1, l, i;
+  for (l = 0; l < lists; l++) {
+    BsPut(bw, 1, 1);  // ref_pic_list_modification_flag_lX
+    for (i = 0; i < pic->num_refs; i++)
+      BsPut(bw, (i + 1) % pic->num_refs, BitLength(pic->num_refs - 1));
+  }
+}
+
+static void PutPredWeightTable(struct Generator* g,
+                               struct BitWriter* bw,
+                               const struct GeneratorPicture* pic) {
+  // 7.3.6.3; luma weights for the even reference indices, chroma weights
+  // for the first one
+  uint32_t lists = pic->slice_type == H265_SLICE_TYPE_B ? 2 : 1, l, i, j;
+  BsPutUe(bw, 6);  // luma_log2_weight_denom
+  BsPutSe(bw, 0);  // delta_chroma_log2_weight_denom
+  for (l = 0; l < lists; l++) {
+    for (i = 0; i < pic->num_refs; i++)
+      BsPut(bw, i % 2 == 0, 1);  // luma_weight_lX_flag
+    for (i = 0; i < pic->num_refs; i++)
+      BsPut(bw, i == 0, 1);  // chroma_weight_lX_flag
+    for (i = 0; i < pic->num_refs; i++) {
+      if (i % 2 == 0) {
+        BsPutSe(bw, (int32_t)(Random(g) % 33) - 16);  // delta_luma_weight
+        BsPutSe(bw, (int32_t)(Random(g) % 21) - 10);  // luma_offset
+      }
+      for (j = 0; i == 0 && j < 2; j++) {
+        BsPutSe(bw, (int32_t)(Random(g) % 33) - 16);  // delta_chroma_weight
+        BsPutSe(bw, (int32_t)(Random(g) % 21) - 10);  // delta_chroma_offset
+      }
+    }
+  }
+}
+
+static void WriteSlice(struct Generator* g,
+                       const struct GeneratorPicture* pic,
+                       uint32_t slice,
+                       uint32_t payload_bytes,
+                       int long_start_code) {
+  // 7.3.6.1; slice data is random bytes split evenly into the substreams
+  // given by the entry points.
+  const struct GeneratorConfig* cfg = g->cfg;
+  uint32_t substreams = g->slice_substreams[slice];
+  uint32_t i, zeros = 0, escaped = 0, offset_len = 1;
+  struct BitWriter bw;
+  uint8_t irap = pic->nal_unit_type >= H265_NAL_TYPE_BLA_W_LP &&
+                 pic->nal_unit_type <= H265_NAL_TYPE_RSV_IRAP_VCL23;
+
+  if (payload_bytes < substreams)
+    payload_bytes = substreams;
+  FillRandom(g, g->data, payload_bytes);
+  for (i = 0; i < substreams; i++) {
+    uint32_t begin = (uint32_t)((uint64_t)payload_bytes * i / substreams);
+    uint32_t end = (uint32_t)((uint64_t)payload_bytes * (i + 1) / substreams);
+    // entry points count escaped bytes (7.4.7.1)
+    g->substream_size[i] =
+        BsEscape(g->escaped + escaped, g->data + begin, end - begin, &zeros);
+    escaped += g->substream_size[i];
+    if (i + 1 < substreams && BitLength(g->substream_size[i] - 1) > offset_len)
+      offset_len = BitLength(g->substream_size[i] - 1);
+  }
+  g->escaped[escaped++] = 0x80;  // rbsp_slice_segment_trailing_bits()
+
+  BsWriterInit(&bw, g->rbsp, GENERATOR_RBSP_SIZE);
+  PutNalHeader(&bw, pic->nal_unit_type, pic->temporal_id);
+  BsPut(&bw, slice == 0, 1);  // first_slice_segment_in_pic_flag
+  if (irap)
+    BsPut(&bw, 0, 1);  // no_output_of_prior_pics_flag
+  BsPutUe(&bw, 0);     // slice_pic_parameter_set_id
+  if (slice != 0)
+    BsPut(&bw, g->slice_address[slice], BitLength(g->size_ctbs - 1));
+  BsPutUe(&bw, pic->slice_type);
+  if (pic->nal_unit_type != H265_NAL_TYPE_IDR_W_RADL) {
+    BsPut(&bw, pic->poc % (1 << GENERATOR_LOG2_MAX_POC_LSB),
+          GENERATOR_LOG2_MAX_POC_LSB);
+    BsPut(&bw, 1, 1);  // short_term_ref_pic_set_sps_flag
+    if (g->num_rps > 1)
+      BsPut(&bw, pic->rps_idx, BitLength(g->num_rps - 1));
+    BsPut(&bw, 1, 1);  // slice_temporal_mvp_enabled_flag
+  }
+  BsPut(&bw, 1, 1);  // slice_sao_luma_flag
+  BsPut(&bw, 1, 1);  // slice_sao_chroma_flag
+  if (pic->slice_type != H265_SLICE_TYPE_I) {
+    BsPut(&bw, 1, 1);  // num_ref_idx_active_override_flag
+    BsPutUe(&bw, pic->num_refs - 1);
+    if (pic->slice_type == H265_SLICE_TYPE_B)
+      BsPutUe(&bw, pic->num_refs - 1);
+    // every reference picture is used, so NumPicTotalCurr is num_refs
+    if (cfg->weighted && pic->num_refs > 1)
+      PutListsModification(&bw, pic);
+    if (pic->slice_type == H265_SLICE_TYPE_B)
+      BsPut(&bw, 0, 1);  // mvd_l1_zero_flag
+    BsPut(&bw, 0, 1);  // cabac_init_flag
+    if (pic->slice_type == H265_SLICE_TYPE_B)
+      BsPut(&bw, 1, 1);  // collocated_from_l0_flag
+    if (pic->num_refs > 1)
+      BsPutUe(&bw, 0);  // collocated_ref_idx
+    if (cfg->weighted)
+      PutPredWeightTable(g, &bw, pic);
+    BsPutUe(&bw, 0);  // five_minus_max_num_merge_cand
+  }
+  BsPutSe(&bw, (int32_t)(Random(g) % 7) - 3);  // slice_qp_delta
+  BsPut(&bw, 0, 1);  // deblocking_filter_override_flag
+  BsPut(&bw, 1, 1);  // slice_loop_filter_across_slices_enabled_flag
+  if (cfg->tile_columns > 1 || cfg->tile_rows > 1 || cfg->wpp) {
+    BsPutUe(&bw, substreams - 1);  // num_entry_point_offsets
+    if (substreams > 1) {
+      BsPutUe(&bw, offset_len - 1);
+      for (i = 0; i + 1 < substreams; i++)
+        BsPut(&bw, g->substream_size[i] - 1, offset_len);
+    }
+  }
+  BsPutTrailingBits(&bw);  // byte_alignment()
+  WriteNal(g, &bw, g->escaped, escaped, long_start_code);
+}
+
+static void WriteFiller(struct Generator* g, uint64_t bytes) {
+  // 7.3.2.8, as many filler data NAL units as it takes to write |bytes|
+  uint32_t length_size = g->cfg->length_size;
+  uint32_t prefix = length_size ? length_size : 4;
+  uint64_t max_fill = GENERATOR_RBSP_SIZE - 16;
+  if (length_size && length_size < 4 &&
+      (1ULL << (8 * length_size)) - 4 < max_fill)
+    max_fill = (1ULL << (8 * length_size)) - 4;
+  while (bytes >= prefix + 3 && !g->error) {
+    uint64_t fill = bytes - prefix - 3, i;
+    struct BitWriter bw;
+    if (fill > max_fill) {
+      // leave enough for another filler NAL unit
+      fill -= prefix + 3;
+      if (fill > max_fill)
+        fill = max_fill;
+    }
+    BsWriterInit(&bw, g->rbsp, GENERATOR_RBSP_SIZE);
+    PutNalHeader(&bw, H265_NAL_TYPE_FD_NUT, 0);
+    for (i = 0; i < fill; i++)
+      BsPut(&bw, 0xFF, 8);  // ff_byte
+    BsPutTrailingBits(&bw);
+    WriteNal(g, &bw, NULL, 0, 1);
+    bytes -= prefix + 3 + fill;
+  }
+}
+
+int GeneratorWrite(const struct GeneratorConfig* cfg,
+                   FILE* fp,
+                   struct GeneratorStats* stats) {
+  struct Generator* g;
+  uint64_t picture;
+  uint32_t sei_bytes, prefix;
+  int ret;
+  memset(stats, 0, sizeof(*stats));
+  if (GeneratorCheck(cfg) != 0)
+    return -1;
+  g = (struct Generator*)calloc(1, sizeof(*g));
+  if (!g)
+    return -1;
+  g->cfg = cfg;
+  g->fp = fp;
+  g->stats = stats;
+  g->rng = SplitMix(cfg->seed);
+  if (cfg->corrupt) {
+    g->corrupt_rng = SplitMix(~(uint64_t)cfg->seed);
+    NextCorruption(g);
+  }
+  Layout(g);
+  g->rbsp = (uint8_t*)malloc(GENERATOR_RBSP_SIZE);
+  g->nal = (uint8_t*)malloc(GENERATOR_RBSP_SIZE * 3 / 2 + 1);
+  g->data = (uint8_t*)malloc(GENERATOR_MAX_SLICE_BYTES);
+  g->escaped = (uint8_t*)malloc(GENERATOR_MAX_SLICE_BYTES * 3 / 2 + 2);
+  g->substream_size = (uint32_t*)malloc(g->size_ctbs * sizeof(uint32_t));
+  if (!g->rbsp || !g->nal || !g->data || !g->escaped || !g->substream_size)
+    g->error = -1;
+
+  prefix = cfg->length_size ? cfg->length_size : 4;
+  sei_bytes = cfg->sei * (cfg->sei_bytes + 16);
+  for (picture = 0; !g->error; picture++) {
+    struct GeneratorPicture pic;
+    uint64_t remaining = cfg->total_bytes - stats->bytes;
+    uint64_t overhead = sei_bytes + g->slices * 32 + g->size_ctbs * 4;
+    uint32_t s, slice_bytes;
+    Plan(g, picture, &pic);
+    if (pic.nal_unit_type == H265_NAL_TYPE_IDR_W_RADL)
+      overhead += 256;
+    if (pic.payload_bytes + overhead + prefix + 3 > remaining) {
+      // last picture: shrink it to leave room for the filler
+      if (remaining < overhead + prefix + 3 + g->size_ctbs * 2)
+        break;
+      pic.payload_bytes =
+          (uint32_t)(remaining - overhead - prefix - 3) * 2 / 3;
+    }
+    if (pic.nal_unit_type == H265_NAL_TYPE_IDR_W_RADL) {
+      WriteVps(g);
+      WriteSps(g);
+      WritePps(g);
+    }
+    for (s = 0; s < cfg->sei; s++)
+      WriteSei(g, s == 0);
+    slice_bytes = pic.payload_bytes / g->slices;
+    if (slice_bytes > GENERATOR_MAX_SLICE_BYTES)
+      slice_bytes = GENERATOR_MAX_SLICE_BYTES;
+    for (s = 0; s < g->slices && !g->error; s++)
+      WriteSlice(g, &pic, s, slice_bytes, s == 0 && cfg->sei == 0);
+    stats->pictures++;
+  }
+  if (!g->error && stats->bytes < cfg->total_bytes)
+    WriteFiller(g, cfg->total_bytes - stats->bytes);
+  if (fflush(fp) != 0)
+    g->error = -1;
+  ret = g->error;
+  free(g->rbsp);
+  free(g->nal);
+  free(g->data);
+  free(g->escaped);
+  free(g->substream_size);
+  free(g);
+  return ret;
+}
@@ -0,0 +1,85 @@
+#ifndef GENERATOR_H_
+#define GENERATOR_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+// Synthetic H.265 streams for benchmarking and testing the parser. VPS, SPS,
+// PPS, SEI and slice segment headers are syntactically valid and follow the
+// configured picture size, tiles/WPP layout and reference structure; slice
+// data is random bytes of the configured size. The same configuration and
+// seed always give the same stream, byte for byte.
+//
+// The stream is written as it is generated, so its size is only limited by
+// the output. It ends with a filler data NAL unit padding it to exactly
+// |total_bytes| where that is possible.
+//
+// With |corrupt| set, single bits of the stream as written are flipped, on
+// average one every |corrupt| bytes, for testing error resilience. The
+// flips use their own random numbers: the stream is otherwise the same as
+// without them.
+
+#define GENERATOR_MAX_SLICE_BYTES (1024 * 1024 * 32)
+#define GENERATOR_MAX_SEI_BYTES 4096
+#define GENERATOR_MAX_TILES 64  // tile columns, and tile rows
+
+enum GeneratorGop {
+  GENERATOR_GOP_INTRA = 0,          // I pictures only
+  GENERATOR_GOP_LOW_DELAY = 1,      // P pictures referencing |refs| earlier
+  GENERATOR_GOP_RANDOM_ACCESS = 2,  // hierarchical B, GOP of 8, 4 sub-layers
+};
+
+struct GeneratorConfig {
+  uint64_t total_bytes;
+  uint32_t width;
+  uint32_t height;
+  uint32_t ctb_log2;  // 4 to 6
+  uint32_t tile_columns;
+  uint32_t tile_rows;
+  uint8_t wpp;
+  // weighted prediction and reference picture list modification in inter
+  // slices
+  uint8_t weighted;
+  enum GeneratorGop gop;
+  uint32_t refs;          // low delay reference pictures, 1 to 4
+  uint32_t intra_period;  // pictures from one IDR to the next
+  uint32_t slices;        // slice segments per picture
+  uint32_t sei;           // prefix SEI NAL units per picture
+  uint32_t sei_bytes;     // user_data_unregistered payload size
+  uint32_t intra_bytes;   // slice data per intra picture
+  uint32_t inter_bytes;   // slice data per inter picture
+  uint32_t jitter;        // slice data size variation, percent
+  uint32_t fps;
+  uint8_t length_size;  // 0: Annex B, else length prefixed NAL units
+  uint32_t corrupt;     // mean bytes between flipped bits, 0: none
+  uint32_t seed;
+};
+
+struct GeneratorStats {
+  uint64_t bytes;
+  uint64_t nal_units;
+  uint64_t pictures;
+  uint64_t flipped;  // bits flipped by |corrupt|
+};
+
+void GeneratorDefaults(struct GeneratorConfig* cfg);
+// Sets the option |name| (e.g. "width", "gop") from |value|; returns 0, or
+// -1 for an unknown option or invalid value.
+int GeneratorSetOption(struct GeneratorConfig* cfg,
+                       const char* name,
+                       const char* value);
+// Space separated list of the option names, for usage messages.
+extern const char* kGeneratorOptions;
+// Checks the configuration; returns 0 or -1 after printing the problem.
+int GeneratorCheck(const struct GeneratorConfig* cfg);
+// A file name stem identifying the configuration, e.g.
+// "1920x1080-ra-t1x1-s1-64M-seed1".
+void GeneratorName(const struct GeneratorConfig* cfg, char* name, size_t size);
+int GeneratorWrite(const struct GeneratorConfig* cfg,
+                   FILE* fp,
+                   struct GeneratorStats* stats);
+
+// Parses sizes like "4096", "64K", "1M", "50G"; 0 if invalid.
+uint64_t GeneratorParseSize(const char* s);
+
+#endif
@@ -0,0 +1,74 @@
+#include <string.h>
+#include "h265-events.h"
+#include "bitstream.h"
+#include "output-context.h"
+
+void H265EventsInit(struct H265Events* ev) {
+  memset(ev, 0, sizeof(*ev));
+}
+
+int H265EventsSubscribe(struct H265Events* ev, const struct H265Subscriber* s) {
+  if (ev->count == H265_EVENTS_MAX_SUBSCRIBERS)
+    return -1;
+  ev->subscribers[ev->count++] = *s;
+  return 0;
+}
+
+void H265EventsDispatch(struct H265Events* ev,
+                        const struct h265_decode_t* dec,
+                        const struct NalUnit* nal,
+                        int err) {
+  const struct NalUnitHeader* nuh = &dec->nal_unit_header;
+  enum H265NalType type = (enum H265NalType)nuh->nal_unit_type;
+  uint32_t i;
+  for (i = 0; i < ev->count; i++) {
+    const struct H265Subscriber* s = &ev->subscribers[i];
+    if (err == 0) {
+      switch (type) {
+      case H265_NAL_TYPE_VPS_NUT:
+        if (s->on_vps)
+          s->on_vps(s->opaque, &dec->video_param_set);
+        break;
+      case H265_NAL_TYPE_SPS_NUT:
+        if (s->on_sps)
+          s->on_sps(s->opaque, &dec->seq_param_set);
+        break;
+      case H265_NAL_TYPE_PPS_NUT:
+        if (s->on_pps)
+          s->on_pps(s->opaque, &dec->pic_param_set);
+        break;
+      case H265_NAL_TYPE_PREFIX_SEI_NUT:
+      case H265_NAL_TYPE_SUFFIX_SEI_NUT:
+        if (s->on_sei)
+          s->on_sei(s->opaque, nuh, &dec->sei, nal);
+        break;
+      default:
+        // the VCL types h265_parse_nal reads a slice segment header for
+        if (s->on_slice &&
+            (type <= H265_NAL_TYPE_RASL_R ||
+             (type >= H265_NAL_TYPE_BLA_W_LP &&
+              type <= H265_NAL_TYPE_CRA_NUT)))
+          s->on_slice(s->opaque, nuh, &dec->slice_segment.header, nal);
+        break;
+      }
+    }
+    if (s->on_nal)
+      s->on_nal(s->opaque, dec, nal, err);
+  }
+}
+
+int H265EventsPushNal(struct H265Events* ev,
+                      struct h265_decode_t* dec,
+                      struct NalUnit* nal) {
+  struct BitStream bs;
+  struct OutputContextDict none[1];
+  struct OutputConfig config;
+  int err;
+  memset(&config, 0, sizeof(config));
+  OutputContextInitDict(none, NULL, -1, &config);
+  BsInit(&bs, nal->data, remove_03(nal->data, nal->size));
+  err = h265_parse_nal(dec, &bs, none);
+  none->end(none);
+  H265EventsDispatch(ev, dec, nal, err);
+  return err;
+}
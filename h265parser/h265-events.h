@@ -0,0 +1,65 @@
+#ifndef H265_EVENTS_H_
+#define H265_EVENTS_H_
+
+#include <stdint.h>
+#include "h265parser.h"
+#include "nal-input.h"
+
+// Typed results of h265_parse_nal for programs that want the numbers rather
+// than text: subscribers get pointers to the structs the parser filled, in
+// |dec|, which stay valid until the next NAL unit is parsed. Nothing is
+// formatted on the way.
+//
+// JSON output is the subscriber that formats while parsing: its dict is the
+// |out| of h265_parse_nal, and callback-only runs pass a disabled dict, which
+// takes the output free *_decode variants of the parameter sets.
+//
+// Each callback may be NULL. The typed ones are called for NAL units that
+// parsed without error, on_nal for every NAL unit after them.
+
+#define H265_EVENTS_MAX_SUBSCRIBERS 8
+
+struct H265Subscriber {
+  void* opaque;
+  void (*on_vps)(void* opaque, const struct H265VideoParameterSet* vps);
+  void (*on_sps)(void* opaque, const struct H265SeqParameterSet* sps);
+  void (*on_pps)(void* opaque, const struct H265PicParameterSet* pps);
+  // |nal| locates the slice segment NAL unit in the input: nal->offset,
+  // nal->prefix_bytes and nal->size
+  void (*on_slice)(void* opaque,
+                   const struct NalUnitHeader* nal_unit_header,
+                   const struct H265SliceSegmentHeader* header,
+                   const struct NalUnit* nal);
+  // the timing messages of a prefix or suffix SEI NAL unit
+  void (*on_sei)(void* opaque,
+                 const struct NalUnitHeader* nal_unit_header,
+                 const struct H265SeiMessages* sei,
+                 const struct NalUnit* nal);
+  // |err| is what h265_parse_nal returned
+  void (*on_nal)(void* opaque,
+                 const struct h265_decode_t* dec,
+                 const struct NalUnit* nal,
+                 int err);
+};
+
+struct H265Events {
+  struct H265Subscriber subscribers[H265_EVENTS_MAX_SUBSCRIBERS];
+  uint32_t count;
+};
+
+void H265EventsInit(struct H265Events* ev);
+// Returns -1 if there are H265_EVENTS_MAX_SUBSCRIBERS already.
+int H265EventsSubscribe(struct H265Events* ev, const struct H265Subscriber* s);
+// Calls the subscribers for the NAL unit |dec| just parsed from |nal|.
+void H265EventsDispatch(struct H265Events* ev,
+                        const struct h265_decode_t* dec,
+                        const struct NalUnit* nal,
+                        int err);
+// Callback-only parse of a NAL unit from a NalInput: removes the emulation
+// prevention bytes in place, parses without output and dispatches. Returns
+// what h265_parse_nal returned.
+int H265EventsPushNal(struct H265Events* ev,
+                      struct h265_decode_t* dec,
+                      struct NalUnit* nal);
+
+#endif
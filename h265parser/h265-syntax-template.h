@@ -0,0 +1,1005 @@
+// VPS, SPS, PPS, VUI, HRD and profile_tier_level syntax, written once and
+// compiled once per output variant by h265-syntax.c. No include guard: the
+// including file defines the SX_* macros below, includes this file and
+// undefines them again.
+//
+//   SX_FN(name)                 function name of the variant
+//   SX_DICT_PARAM, SX_LIST_PARAM
+//                               trailing output parameter, or nothing
+//   SX_ARG(sink)                trailing output argument, or nothing
+//   SX_DICT_VAR(v), SX_LIST_VAR(v)
+//                               declares a nested output
+//   SX_DICT(out, key, v), SX_LIST(out, key, v), SX_ITEM(list, v)
+//                               starts a nested output in |out|
+//   SX_DICT_END(v), SX_LIST_END(v)
+//   SX_U(out, n, lv, key)       reads n bits into |lv| and outputs it
+//   SX_UE, SX_SE, SX_HEX        the same for ue(v), se(v) and hex output
+//   SX_PUT(out, key, value)     outputs a derived value
+//
+// Keys are bare identifiers, listed in H265_SYNTAX_ELEMENTS.
+
+int SX_FN(profile_tier_level)(uint8_t profilePresentFlag,
+                              uint8_t maxNumSubLayersMinus1,
+                              struct H265ProfileTierLevelSubLayer *general,
+                              struct h265_decode_t *dec, struct BitStream *bs
+                              SX_DICT_PARAM) {
+  // 7.3.3 Profile, tier and level syntax
+  int i, j;
+  struct H265ProfileTierLevelSubLayer sub_layer[8];
+  if (profilePresentFlag) {
+    SX_U(out, 2, general->profile_space, general_profile_space);
+    SX_U(out, 1, general->tier_flag, general_tier_flag);
+    SX_U(out, 5, general->profile_idc, general_profile_idc);
+    for (j = 0; j < 32; j++) {
+      general->profile_compatibility_flag[j] = BsGet(bs, 1);
+    }
+    SX_U(out, 1, general->progressive_source_flag,
+         general_progressive_source_flag);
+    SX_U(out, 1, general->interlaced_source_flag,
+         general_interlaced_source_flag);
+    SX_U(out, 1, general->non_packed_constraint_flag,
+         general_non_packed_constraint_flag);
+    SX_U(out, 1, general->frame_only_constraint_flag,
+         general_frame_only_constraint_flag);
+    if (general->profile_idc == 4 || general->profile_compatibility_flag[4] ||
+        general->profile_idc == 5 || general->profile_compatibility_flag[5] ||
+        general->profile_idc == 6 || general->profile_compatibility_flag[6] ||
+        general->profile_idc == 7 || general->profile_compatibility_flag[7]) {
+      /* The number of bits in this syntax structure is not affected by this
+       * condition */
+      SX_U(out, 1, general->max_12bit_constraint_flag,
+           general_max_12bit_constraint_flag);
+      SX_U(out, 1, general->max_10bit_constraint_flag,
+           general_max_10bit_constraint_flag);
+      SX_U(out, 1, general->max_8bit_constraint_flag,
+           general_max_8bit_constraint_flag);
+      SX_U(out, 1, general->max_422chroma_constraint_flag,
+           general_max_422chroma_constraint_flag);
+      SX_U(out, 1, general->max_420chroma_constraint_flag,
+           general_max_420chroma_constraint_flag);
+      SX_U(out, 1, general->max_monochrome_constraint_flag,
+           general_max_monochrome_constraint_flag);
+      SX_U(out, 1, general->intra_constraint_flag,
+           general_intra_constraint_flag);
+      SX_U(out, 1, general->one_picture_only_constraint_flag,
+           general_one_picture_only_constraint_flag);
+      SX_U(out, 1, general->lower_bit_rate_constraint_flag,
+           general_lower_bit_rate_constraint_flag);
+      // uint8_t general_reserved_zero_34bits = BsGet(bs,34);
+      BsGet(bs, 2);
+      BsGet(bs, 32);
+    } else {
+      // uint8_t general_reserved_zero_43bits = BsGet(bs,43);
+      BsGet(bs, 11);
+      BsGet(bs, 32);
+    }
+    if ((general->profile_idc >= 1 && general->profile_idc <= 5) ||
+        general->profile_compatibility_flag[1] ||
+        general->profile_compatibility_flag[2] ||
+        general->profile_compatibility_flag[3] ||
+        general->profile_compatibility_flag[4] ||
+        general->profile_compatibility_flag[5]) {
+      /* The number of bits in this syntax structure is not affected by this
+       * condition */
+      SX_U(out, 1, general->inbld_flag, general_inbld_flag);
+    } else {
+      BsGet(bs, 1);  // general_reserved_zero_bit
+    }
+  }
+  general->level_idc = BsGet(bs, 8);
+  for (i = 0; i < maxNumSubLayersMinus1; i++) {
+    sub_layer[i].profile_present_flag = BsGet(bs, 1);
+    sub_layer[i].level_present_flag = BsGet(bs, 1);
+  }
+  if (maxNumSubLayersMinus1 > 0) {
+    for (i = maxNumSubLayersMinus1; i < 8; i++) {
+      BsGet(bs, 2);  // reserved_zero_2bits
+    }
+  }
+  for (i = 0; i < maxNumSubLayersMinus1; i++) {
+    if (sub_layer[i].profile_present_flag) {
+      sub_layer[i].profile_space = BsGet(bs, 2);
+      sub_layer[i].tier_flag = BsGet(bs, 1);
+      sub_layer[i].profile_idc = BsGet(bs, 5);
+      for (j = 0; j < 32; j++) {
+        sub_layer[i].profile_compatibility_flag[j] = BsGet(bs, 1);
+      }
+      sub_layer[i].progressive_source_flag = BsGet(bs, 1);
+      sub_layer[i].interlaced_source_flag = BsGet(bs, 1);
+      sub_layer[i].non_packed_constraint_flag = BsGet(bs, 1);
+      sub_layer[i].frame_only_constraint_flag = BsGet(bs, 1);
+      if (sub_layer[i].profile_idc == 4 ||
+          sub_layer[i].profile_compatibility_flag[4] ||
+          sub_layer[i].profile_idc == 5 ||
+          sub_layer[i].profile_compatibility_flag[5] ||
+          sub_layer[i].profile_idc == 6 ||
+          sub_layer[i].profile_compatibility_flag[6] ||
+          sub_layer[i].profile_idc == 7 ||
+          sub_layer[i].profile_compatibility_flag[7]) {
+        /* The number of bits in this syntax structure is not affected by this
+         * condition */
+        sub_layer[i].max_12bit_constraint_flag = BsGet(bs, 1);
+        sub_layer[i].max_10bit_constraint_flag = BsGet(bs, 1);
+        sub_layer[i].max_8bit_constraint_flag = BsGet(bs, 1);
+        sub_layer[i].max_422chroma_constraint_flag = BsGet(bs, 1);
+        sub_layer[i].max_420chroma_constraint_flag = BsGet(bs, 1);
+        sub_layer[i].max_monochrome_constraint_flag = BsGet(bs, 1);
+        sub_layer[i].intra_constraint_flag = BsGet(bs, 1);
+        sub_layer[i].one_picture_only_constraint_flag = BsGet(bs, 1);
+        sub_layer[i].lower_bit_rate_constraint_flag = BsGet(bs, 1);
+        // uint8_t general_reserved_zero_34bits = BsGet(bs,34);
+        BsGet(bs, 2);
+        BsGet(bs, 32);
+      } else {
+        // uint8_t general_reserved_zero_43bits = BsGet(bs,43);
+        BsGet(bs, 11);
+        BsGet(bs, 32);
+      }
+      if ((sub_layer[i].profile_idc >= 1 && sub_layer[i].profile_idc <= 5) ||
+          sub_layer[i].profile_compatibility_flag[1] ||
+          sub_layer[i].profile_compatibility_flag[2] ||
+          sub_layer[i].profile_compatibility_flag[3] ||
+          sub_layer[i].profile_compatibility_flag[4] ||
+          sub_layer[i].profile_compatibility_flag[5]) {
+        /* The number of bits in this syntax structure is not affected by this
+         * condition */
+        sub_layer[i].inbld_flag = BsGet(bs, 1);
+      } else {
+        BsGet(bs, 1);  // reserved_zero_bit
+      }
+    }
+    if (sub_layer[i].level_present_flag)
+      sub_layer[i].level_idc = BsGet(bs, 8);
+  }
+
+  return 0;
+}
+
+int SX_FN(scaling_list_data)(struct h265_decode_t *dec, struct BitStream *bs
+                             SX_DICT_PARAM) {
+  int sizeId;
+  for (sizeId = 0; sizeId < 4; sizeId++) {
+    int matrixId;
+    for (matrixId = 0; matrixId < 6; matrixId += (sizeId == 3) ? 3 : 1) {
+      uint8_t scaling_list_pred_mode_flag = BsGet(bs, 1);
+      if (!scaling_list_pred_mode_flag) {
+        BsUe(bs);  // scaling_list_pred_matrix_id_delta
+      } else {
+        int coefNum = 1 << (4 + (sizeId << 1));
+        if (64 < coefNum)
+          coefNum = 64;
+        if (sizeId > 1) {
+          BsSe(bs);  // scaling_list_dc_coef_minus8
+        }
+        int i;
+        for (i = 0; i < coefNum; i++) {
+          BsSe(bs);  // scaling_list_delta_coef
+        }
+      }
+    }
+  }
+  return 0;
+}
+
+int SX_FN(ref_pic_set)(uint32_t stRpsIdx, struct H265ShortTermRefPicSet *rps,
+                       struct h265_decode_t *dec, struct BitStream *bs
+                       SX_DICT_PARAM) {
+  // 7.3.7 Short-term reference picture set syntax
+  struct H265SeqParameterSet *sps = &dec->seq_param_set;
+  int32_t i, j;
+
+  rps->inter_ref_pic_set_prediction_flag = 0;
+  if (stRpsIdx != 0) {
+    SX_U(out, 1, rps->inter_ref_pic_set_prediction_flag,
+         inter_ref_pic_set_prediction_flag);
+  }
+  if (rps->inter_ref_pic_set_prediction_flag) {
+    uint32_t delta_idx_minus1 = 0;
+    uint8_t delta_rps_sign;
+    uint32_t abs_delta_rps_minus1;
+    uint8_t used_by_curr_pic_flag[H265_MAX_DPB_SIZE + 1];
+    uint8_t use_delta_flag[H265_MAX_DPB_SIZE + 1];
+    const struct H265ShortTermRefPicSet *ref;
+    int32_t deltaRps, dPoc;
+
+    if (stRpsIdx == sps->num_short_term_ref_pic_sets) {
+      SX_UE(out, delta_idx_minus1, delta_idx_minus1);
+    }
+    if (delta_idx_minus1 + 1 > stRpsIdx) {
+      fprintf(stderr, "st_ref_pic_set: delta_idx_minus1 out of range\n");
+      return H265_ERR_INVALID;
+    }
+    // (7-59) ~ (7-60)
+    ref = &sps->st_ref_pic_set[stRpsIdx - (delta_idx_minus1 + 1)];
+    SX_U(out, 1, delta_rps_sign, delta_rps_sign);
+    SX_UE(out, abs_delta_rps_minus1, abs_delta_rps_minus1);
+    deltaRps = (1 - 2 * delta_rps_sign) * (int32_t)(abs_delta_rps_minus1 + 1);
+    for (j = 0; j <= ref->NumDeltaPocs; j++) {
+      used_by_curr_pic_flag[j] = BsGet(bs, 1);
+      use_delta_flag[j] = 1;
+      if (!used_by_curr_pic_flag[j]) {
+        use_delta_flag[j] = BsGet(bs, 1);
+      }
+    }
+
+    // (7-61)
+    i = 0;
+    for (j = ref->NumPositivePics - 1; j >= 0 && i < H265_MAX_DPB_SIZE;
+         j--) {
+      dPoc = ref->DeltaPocS1[j] + deltaRps;
+      if (dPoc < 0 && use_delta_flag[ref->NumNegativePics + j]) {
+        rps->DeltaPocS0[i] = dPoc;
+        rps->UsedByCurrPicS0[i++] =
+            used_by_curr_pic_flag[ref->NumNegativePics + j];
+      }
+    }
+    if (deltaRps < 0 && use_delta_flag[ref->NumDeltaPocs] &&
+        i < H265_MAX_DPB_SIZE) {
+      rps->DeltaPocS0[i] = deltaRps;
+      rps->UsedByCurrPicS0[i++] = used_by_curr_pic_flag[ref->NumDeltaPocs];
+    }
+    for (j = 0; j < ref->NumNegativePics && i < H265_MAX_DPB_SIZE; j++) {
+      dPoc = ref->DeltaPocS0[j] + deltaRps;
+      if (dPoc < 0 && use_delta_flag[j]) {
+        rps->DeltaPocS0[i] = dPoc;
+        rps->UsedByCurrPicS0[i++] = used_by_curr_pic_flag[j];
+      }
+    }
+    rps->NumNegativePics = i;
+
+    // (7-62)
+    i = 0;
+    for (j = ref->NumNegativePics - 1; j >= 0 && i < H265_MAX_DPB_SIZE;
+         j--) {
+      dPoc = ref->DeltaPocS0[j] + deltaRps;
+      if (dPoc > 0 && use_delta_flag[j]) {
+        rps->DeltaPocS1[i] = dPoc;
+        rps->UsedByCurrPicS1[i++] = used_by_curr_pic_flag[j];
+      }
+    }
+    if (deltaRps > 0 && use_delta_flag[ref->NumDeltaPocs] &&
+        i < H265_MAX_DPB_SIZE) {
+      rps->DeltaPocS1[i] = deltaRps;
+      rps->UsedByCurrPicS1[i++] = used_by_curr_pic_flag[ref->NumDeltaPocs];
+    }
+    for (j = 0; j < ref->NumPositivePics && i < H265_MAX_DPB_SIZE; j++) {
+      dPoc = ref->DeltaPocS1[j] + deltaRps;
+      if (dPoc > 0 && use_delta_flag[ref->NumNegativePics + j]) {
+        rps->DeltaPocS1[i] = dPoc;
+        rps->UsedByCurrPicS1[i++] =
+            used_by_curr_pic_flag[ref->NumNegativePics + j];
+      }
+    }
+    rps->NumPositivePics = i;
+  } else {
+    uint32_t num_negative_pics, num_positive_pics;
+    SX_UE(out, num_negative_pics, num_negative_pics);
+    SX_UE(out, num_positive_pics, num_positive_pics);
+    if (num_negative_pics > H265_MAX_DPB_SIZE ||
+        num_positive_pics > H265_MAX_DPB_SIZE - num_negative_pics) {
+      fprintf(stderr, "st_ref_pic_set: too many pictures\n");
+      return H265_ERR_INVALID;
+    }
+    // (7-63) ~ (7-66)
+    for (i = 0; i < (int32_t)num_negative_pics; i++) {
+      uint32_t delta_poc_s0_minus1 = BsUe(bs);
+      rps->DeltaPocS0[i] = (i == 0 ? 0 : rps->DeltaPocS0[i - 1]) -
+                           (int32_t)(delta_poc_s0_minus1 + 1);
+      rps->UsedByCurrPicS0[i] = BsGet(bs, 1);
+    }
+    for (i = 0; i < (int32_t)num_positive_pics; i++) {
+      uint32_t delta_poc_s1_minus1 = BsUe(bs);
+      rps->DeltaPocS1[i] = (i == 0 ? 0 : rps->DeltaPocS1[i - 1]) +
+                           (int32_t)(delta_poc_s1_minus1 + 1);
+      rps->UsedByCurrPicS1[i] = BsGet(bs, 1);
+    }
+    rps->NumNegativePics = num_negative_pics;
+    rps->NumPositivePics = num_positive_pics;
+  }
+  rps->NumDeltaPocs = rps->NumNegativePics + rps->NumPositivePics;
+  SX_PUT(out, NumNegativePics, rps->NumNegativePics);
+  SX_PUT(out, NumPositivePics, rps->NumPositivePics);
+
+  return 0;
+}
+
+int SX_FN(sub_layer_hrd_parameters)(uint8_t subLayerId, uint32_t CpbCnt,
+                                    const struct H265HrdParameters *hrd,
+                                    struct H265SubLayerHrdParameters *sub,
+                                    struct BitStream *bs SX_LIST_PARAM) {
+  // E.2.3 Sub-layer HRD parameters syntax
+  uint32_t i;
+  SX_DICT_VAR(subdict);
+  //  CpbCnt is set equal to cpb_cnt_minus1[ subLayerId ]
+  for (i = 0; i <= CpbCnt && i < H265_MAX_CPB_CNT; i++) {
+    SX_ITEM(out, subdict);
+    SX_UE(subdict, sub->bit_rate_value_minus1[i], bit_rate_value_minus1);
+    SX_UE(subdict, sub->cpb_size_value_minus1[i], cpb_size_value_minus1);
+    if (hrd->sub_pic_hrd_params_present_flag) {
+      SX_UE(subdict, sub->cpb_size_du_value_minus1[i],
+            cpb_size_du_value_minus1);
+      SX_UE(subdict, sub->bit_rate_du_value_minus1[i],
+            bit_rate_du_value_minus1);
+    }
+    SX_U(subdict, 1, sub->cbr_flag[i], cbr_flag);
+    SX_DICT_END(subdict);
+  }
+  return 0;
+}
+
+int SX_FN(hrd_parameters)(uint8_t commonInfPresentFlag,
+                          uint8_t maxNumSubLayersMinus1,
+                          struct H265HrdParameters *hrd,
+                          struct h265_decode_t *dec, struct BitStream *bs
+                          SX_DICT_PARAM) {
+  // E.2.2 HRD parameters syntax
+  int i;
+  SX_LIST_VAR(list);
+  SX_LIST_VAR(sublist);
+  SX_DICT_VAR(subdict);
+  if (commonInfPresentFlag) {
+    SX_U(out, 1, hrd->nal_hrd_parameters_present_flag,
+         nal_hrd_parameters_present_flag);
+    SX_U(out, 1, hrd->vcl_hrd_parameters_present_flag,
+         vcl_hrd_parameters_present_flag);
+    if (hrd->nal_hrd_parameters_present_flag ||
+        hrd->vcl_hrd_parameters_present_flag) {
+      SX_U(out, 1, hrd->sub_pic_hrd_params_present_flag,
+           sub_pic_hrd_params_present_flag);
+      if (hrd->sub_pic_hrd_params_present_flag) {
+        SX_U(out, 8, hrd->tick_divisor_minus2, tick_divisor_minus2);
+        SX_U(out, 5, hrd->du_cpb_removal_delay_increment_length_minus1,
+             du_cpb_removal_delay_increment_length_minus1);
+        SX_U(out, 1, hrd->sub_pic_cpb_params_in_pic_timing_sei_flag,
+             sub_pic_cpb_params_in_pic_timing_sei_flag);
+        SX_U(out, 5, hrd->dpb_output_delay_du_length_minus1,
+             dpb_output_delay_du_length_minus1);
+      }
+      SX_U(out, 4, hrd->bit_rate_scale, bit_rate_scale);
+      SX_U(out, 4, hrd->cpb_size_scale, cpb_size_scale);
+      if (hrd->sub_pic_hrd_params_present_flag) {
+        SX_U(out, 4, hrd->cpb_size_du_scale, cpb_size_du_scale);
+      }
+      SX_U(out, 5, hrd->initial_cpb_removal_delay_length_minus1,
+           initial_cpb_removal_delay_length_minus1);
+      SX_U(out, 5, hrd->au_cpb_removal_delay_length_minus1,
+           au_cpb_removal_delay_length_minus1);
+      SX_U(out, 5, hrd->dpb_output_delay_length_minus1,
+           dpb_output_delay_length_minus1);
+    }
+  }
+  SX_LIST(out, sub_layers, list);
+  for (i = 0; i <= maxNumSubLayersMinus1; i++) {
+    SX_ITEM(list, subdict);
+    SX_U(subdict, 1, hrd->fixed_pic_rate_general_flag[i],
+         fixed_pic_rate_general_flag);
+    // fixed_pic_rate_within_cvs_flag is inferred to be 1 when
+    // fixed_pic_rate_general_flag is 1
+    hrd->fixed_pic_rate_within_cvs_flag[i] = 1;
+    if (!hrd->fixed_pic_rate_general_flag[i]) {
+      SX_U(subdict, 1, hrd->fixed_pic_rate_within_cvs_flag[i],
+           fixed_pic_rate_within_cvs_flag);
+    }
+    hrd->low_delay_hrd_flag[i] = 0;
+    if (hrd->fixed_pic_rate_within_cvs_flag[i]) {
+      SX_UE(subdict, hrd->elemental_duration_in_tc_minus1[i],
+            elemental_duration_in_tc_minus1);
+    } else {
+      SX_U(subdict, 1, hrd->low_delay_hrd_flag[i], low_delay_hrd_flag);
+    }
+    hrd->cpb_cnt_minus1[i] = 0;
+    if (!hrd->low_delay_hrd_flag[i]) {
+      SX_UE(subdict, hrd->cpb_cnt_minus1[i], cpb_cnt_minus1);
+    }
+    if (hrd->cpb_cnt_minus1[i] >= H265_MAX_CPB_CNT) {
+      fprintf(stderr, "hrd_parameters: cpb_cnt_minus1 out of range\n");
+      SX_DICT_END(subdict);
+      SX_LIST_END(list);
+      return H265_ERR_INVALID;
+    }
+    if (hrd->nal_hrd_parameters_present_flag) {
+      SX_LIST(subdict, nal_sub_layer_hrd_parameters, sublist);
+      SX_FN(sub_layer_hrd_parameters)(i, hrd->cpb_cnt_minus1[i], hrd,
+                                      &hrd->nal_sub_layer[i],
+                                      bs SX_ARG(sublist));
+      SX_LIST_END(sublist);
+    }
+    if (hrd->vcl_hrd_parameters_present_flag) {
+      SX_LIST(subdict, vcl_sub_layer_hrd_parameters, sublist);
+      SX_FN(sub_layer_hrd_parameters)(i, hrd->cpb_cnt_minus1[i], hrd,
+                                      &hrd->vcl_sub_layer[i],
+                                      bs SX_ARG(sublist));
+      SX_LIST_END(sublist);
+    }
+    SX_DICT_END(subdict);
+  }
+  SX_LIST_END(list);
+  return 0;
+}
+
+int SX_FN(vui_parameters)(struct h265_decode_t *dec, struct BitStream *bs
+                          SX_DICT_PARAM) {
+  struct H265VuiParameters *vui = &dec->seq_param_set.vui_param;
+  SX_U(out, 1, vui->aspect_ratio_info_present_flag,
+       aspect_ratio_info_present_flag);
+  if (vui->aspect_ratio_info_present_flag) {
+    SX_U(out, 8, vui->aspect_ratio_idc, aspect_ratio_idc);
+    if (vui->aspect_ratio_idc == EXTENDED_SAR) {
+      SX_U(out, 16, vui->sar_width, sar_width);
+      SX_U(out, 16, vui->sar_height, sar_height);
+    }
+  }
+  SX_U(out, 1, vui->overscan_info_present_flag, overscan_info_present_flag);
+  if (vui->overscan_info_present_flag) {
+    SX_U(out, 1, vui->overscan_appropriate_flag, overscan_appropriate_flag);
+  }
+  SX_U(out, 1, vui->video_signal_type_present_flag,
+       video_signal_type_present_flag);
+  if (vui->video_signal_type_present_flag) {
+    SX_U(out, 3, vui->video_format, video_format);
+    SX_U(out, 1, vui->video_full_range_flag, video_full_range_flag);
+    SX_U(out, 1, vui->colour_description_present_flag,
+         colour_description_present_flag);
+    if (vui->colour_description_present_flag) {
+      SX_U(out, 8, vui->colour_primaries, colour_primaries);
+      SX_U(out, 8, vui->transfer_characteristics, transfer_characteristics);
+      SX_U(out, 8, vui->matrix_coeffs, matrix_coeffs);
+    }
+  }
+  SX_U(out, 1, vui->chroma_loc_info_present_flag,
+       chroma_loc_info_present_flag);
+  if (vui->chroma_loc_info_present_flag) {
+    SX_UE(out, vui->chroma_sample_loc_type_top_field,
+          chroma_sample_loc_type_top_field);
+    SX_UE(out, vui->chroma_sample_loc_type_bottom_field,
+          chroma_sample_loc_type_bottom_field);
+  }
+  SX_U(out, 1, vui->neutral_chroma_indication_flag,
+       neutral_chroma_indication_flag);
+  SX_U(out, 1, vui->field_seq_flag, field_seq_flag);
+  SX_U(out, 1, vui->frame_field_info_present_flag,
+       frame_field_info_present_flag);
+  SX_U(out, 1, vui->default_display_window_flag, default_display_window_flag);
+  if (vui->default_display_window_flag) {
+    SX_UE(out, vui->def_disp_win_left_offset, def_disp_win_left_offset);
+    SX_UE(out, vui->def_disp_win_right_offset, def_disp_win_right_offset);
+    SX_UE(out, vui->def_disp_win_top_offset, def_disp_win_top_offset);
+    SX_UE(out, vui->def_disp_win_bottom_offset, def_disp_win_bottom_offset);
+  }
+  SX_U(out, 1, vui->vui_timing_info_present_flag,
+       vui_timing_info_present_flag);
+  if (vui->vui_timing_info_present_flag) {
+    SX_U(out, 32, vui->vui_num_units_in_tick, vui_num_units_in_tick);
+    SX_U(out, 32, vui->vui_time_scale, vui_time_scale);
+    SX_U(out, 1, vui->vui_poc_proportional_to_timing_flag,
+         vui_poc_proportional_to_timing_flag);
+    if (vui->vui_poc_proportional_to_timing_flag) {
+      SX_UE(out, vui->vui_num_ticks_poc_diff_one_minus1,
+            vui_num_ticks_poc_diff_one_minus1);
+    }
+
+    SX_U(out, 1, vui->vui_hrd_parameters_present_flag,
+         vui_hrd_parameters_present_flag);
+    vui->hrd_parameters_pos = bs->pos;
+    if (vui->vui_hrd_parameters_present_flag) {
+      int err;
+      METRICS_FUNC(METRICS_FN_HRD_PARAMETERS,
+                   err = SX_FN(hrd_parameters)(
+                       1, dec->seq_param_set.sps_max_sub_layers_minus1,
+                       &dec->seq_param_set.vui_param.hrd_parameters, dec,
+                       bs SX_ARG(out)));
+      if (err)
+        return err;
+    }
+    vui->hrd_parameters_end = bs->pos;
+  }
+  SX_U(out, 1, vui->bitstream_restriction_flag, bitstream_restriction_flag);
+  if (vui->bitstream_restriction_flag) {
+    SX_U(out, 1, vui->tiles_fixed_structure_flag, tiles_fixed_structure_flag);
+    SX_U(out, 1, vui->motion_vectors_over_pic_boundaries_flag,
+         motion_vectors_over_pic_boundaries_flag);
+    SX_U(out, 1, vui->restricted_ref_pic_lists_flag,
+         restricted_ref_pic_lists_flag);
+    SX_UE(out, vui->min_spatial_segmentation_idc,
+          min_spatial_segmentation_idc);
+    SX_UE(out, vui->max_bytes_per_pic_denom, max_bytes_per_pic_denom);
+    SX_UE(out, vui->max_bits_per_min_cu_denom, max_bits_per_min_cu_denom);
+    SX_UE(out, vui->log2_max_mv_length_horizontal,
+          log2_max_mv_length_horizontal);
+    SX_UE(out, vui->log2_max_mv_length_vertical, log2_max_mv_length_vertical);
+  }
+  return 0;
+}
+
+int SX_FN(seq_parameter_set)(struct h265_decode_t *dec, struct BitStream *bs
+                             SX_DICT_PARAM) {
+  uint32_t i;
+  struct H265SeqParameterSet *sps = &dec->seq_param_set;
+  SX_DICT_VAR(subdict);
+  SX_LIST_VAR(list);
+  dec->slice_plan.valid = 0;
+  SX_U(out, 4, sps->sps_video_parameter_set_id, sps_video_parameter_set_id);
+  SX_U(out, 3, sps->sps_max_sub_layers_minus1, sps_max_sub_layers_minus1);
+  SX_U(out, 1, sps->sps_temporal_id_nesting_flag,
+       sps_temporal_id_nesting_flag);
+
+  SX_DICT(out, profile_tier_level, subdict);
+  METRICS_FUNC(METRICS_FN_PROFILE_TIER_LEVEL,
+               SX_FN(profile_tier_level)(1, sps->sps_max_sub_layers_minus1,
+                                         &sps->general_profile_tier_level,
+                                         dec, bs SX_ARG(subdict)));
+  SX_DICT_END(subdict);
+
+  SX_UE(out, sps->sps_seq_parameter_set_id, sps_seq_parameter_set_id);
+  SX_UE(out, sps->chroma_format_idc, chroma_format_idc);
+  if (sps->chroma_format_idc > 3) {
+    fprintf(stderr, "chroma_format_idc out of range\n");
+    return H265_ERR_INVALID;
+  }
+  sps->separate_colour_plane_flag = 0;
+  if (sps->chroma_format_idc == 3) {
+    SX_U(out, 1, sps->separate_colour_plane_flag, separate_colour_plane_flag);
+  }
+  SX_PUT(out, ChromaArrayType,
+         sps->ChromaArrayType = (sps->separate_colour_plane_flag == 0)
+                                    ? sps->chroma_format_idc
+                                    : 0);
+  SX_UE(out, sps->pic_width_in_luma_samples, pic_width_in_luma_samples);
+  SX_UE(out, sps->pic_height_in_luma_samples, pic_height_in_luma_samples);
+  SX_U(out, 1, sps->conformance_window_flag, conformance_window_flag);
+  if (sps->conformance_window_flag) {
+    SX_UE(out, sps->conf_win_left_offset, conf_win_left_offset);
+    SX_UE(out, sps->conf_win_right_offset, conf_win_right_offset);
+    SX_UE(out, sps->conf_win_top_offset, conf_win_top_offset);
+    SX_UE(out, sps->conf_win_bottom_offset, conf_win_bottom_offset);
+  }
+  SX_UE(out, sps->bit_depth_luma_minus8, bit_depth_luma_minus8);
+  SX_UE(out, sps->bit_depth_chroma_minus8, bit_depth_chroma_minus8);
+  SX_UE(out, sps->log2_max_pic_order_cnt_lsb_minus4,
+        log2_max_pic_order_cnt_lsb_minus4);
+  SX_U(out, 1, sps->sps_sub_layer_ordering_info_present_flag,
+       sps_sub_layer_ordering_info_present_flag);
+  for (i = (sps->sps_sub_layer_ordering_info_present_flag
+                ? 0
+                : dec->seq_param_set.sps_max_sub_layers_minus1);
+       i <= dec->seq_param_set.sps_max_sub_layers_minus1; i++) {
+    sps->sps_max_dec_pic_buffering_minus1[i] = BsUe(bs);
+    sps->sps_max_num_reorder_pics[i] = BsUe(bs);
+    sps->sps_max_latency_increase_plus1[i] = BsUe(bs);
+  }
+  // When not present, the values for the lower sub-layers are inferred to be
+  // equal to those of the highest sub-layer
+  for (i = 0; i < sps->sps_max_sub_layers_minus1; i++) {
+    if (!sps->sps_sub_layer_ordering_info_present_flag) {
+      sps->sps_max_dec_pic_buffering_minus1[i] =
+          sps->sps_max_dec_pic_buffering_minus1[sps->sps_max_sub_layers_minus1];
+      sps->sps_max_num_reorder_pics[i] =
+          sps->sps_max_num_reorder_pics[sps->sps_max_sub_layers_minus1];
+      sps->sps_max_latency_increase_plus1[i] =
+          sps->sps_max_latency_increase_plus1[sps->sps_max_sub_layers_minus1];
+    }
+  }
+  SX_PUT(out, sps_max_dec_pic_buffering_minus1,
+         sps->sps_max_dec_pic_buffering_minus1
+             [sps->sps_max_sub_layers_minus1]);
+  SX_PUT(out, sps_max_num_reorder_pics,
+         sps->sps_max_num_reorder_pics[sps->sps_max_sub_layers_minus1]);
+  SX_UE(out, sps->log2_min_luma_coding_block_size_minus3,
+        log2_min_luma_coding_block_size_minus3);
+  SX_UE(out, sps->log2_diff_max_min_luma_coding_block_size,
+        log2_diff_max_min_luma_coding_block_size);
+  SX_UE(out, sps->log2_min_luma_transform_block_size_minus2,
+        log2_min_luma_transform_block_size_minus2);
+  SX_UE(out, sps->log2_diff_max_min_luma_transform_block_size,
+        log2_diff_max_min_luma_transform_block_size);
+  {
+    // 7.4.3.2.1 ranges the derived variables below rely on
+    uint32_t min_cb = sps->log2_min_luma_coding_block_size_minus3 + 3;
+    uint32_t ctb = min_cb + sps->log2_diff_max_min_luma_coding_block_size;
+    uint32_t min_tb = sps->log2_min_luma_transform_block_size_minus2 + 2;
+    uint32_t max_tb =
+        min_tb + sps->log2_diff_max_min_luma_transform_block_size;
+    const char *invalid = NULL;
+    if (sps->bit_depth_luma_minus8 > 8 || sps->bit_depth_chroma_minus8 > 8)
+      invalid = "bit_depth_luma_minus8 or bit_depth_chroma_minus8";
+    else if (sps->log2_max_pic_order_cnt_lsb_minus4 > 12)
+      invalid = "log2_max_pic_order_cnt_lsb_minus4";
+    else if (sps->log2_min_luma_coding_block_size_minus3 > 3 ||
+             sps->log2_diff_max_min_luma_coding_block_size > 3 || ctb < 4 ||
+             ctb > 6)
+      invalid = "coding block sizes";
+    else if (sps->log2_min_luma_transform_block_size_minus2 > 3 ||
+             sps->log2_diff_max_min_luma_transform_block_size > 3 ||
+             min_tb >= min_cb || max_tb > (ctb < 5 ? ctb : 5))
+      invalid = "transform block sizes";
+    else if (sps->pic_width_in_luma_samples == 0 ||
+             sps->pic_height_in_luma_samples == 0 ||
+             sps->pic_width_in_luma_samples % (1u << min_cb) ||
+             sps->pic_height_in_luma_samples % (1u << min_cb))
+      invalid = "picture size, not a multiple of MinCbSizeY,";
+    if (invalid) {
+      fprintf(stderr, "seq_parameter_set: %s out of range\n", invalid);
+      return H265_ERR_INVALID;
+    }
+  }
+  SX_UE(out, sps->max_transform_hierarchy_depth_inter,
+        max_transform_hierarchy_depth_inter);
+  SX_UE(out, sps->max_transform_hierarchy_depth_intra,
+        max_transform_hierarchy_depth_intra);
+  SX_U(out, 1, sps->scaling_list_enabled_flag, scaling_list_enabled_flag);
+  if (sps->scaling_list_enabled_flag) {
+    SX_U(out, 1, sps->sps_scaling_list_data_present_flag,
+         sps_scaling_list_data_present_flag);
+    if (sps->sps_scaling_list_data_present_flag) {
+      METRICS_FUNC(METRICS_FN_SCALING_LIST_DATA,
+                   SX_FN(scaling_list_data)(dec, bs SX_ARG(out)));
+    }
+  }
+  SX_U(out, 1, sps->amp_enabled_flag, amp_enabled_flag);
+  SX_U(out, 1, sps->sample_adaptive_offset_enabled_flag,
+       sample_adaptive_offset_enabled_flag);
+  SX_U(out, 1, sps->pcm_enabled_flag, pcm_enabled_flag);
+  if (sps->pcm_enabled_flag) {
+    SX_U(out, 4, sps->pcm_sample_bit_depth_luma_minus1,
+         pcm_sample_bit_depth_luma_minus1);
+    SX_U(out, 4, sps->pcm_sample_bit_depth_chroma_minus1,
+         pcm_sample_bit_depth_chroma_minus1);
+    SX_UE(out, sps->log2_min_pcm_luma_coding_block_size_minus3,
+          log2_min_pcm_luma_coding_block_size_minus3);
+    SX_UE(out, sps->log2_diff_max_min_pcm_luma_coding_block_size,
+          log2_diff_max_min_pcm_luma_coding_block_size);
+    SX_U(out, 1, sps->pcm_loop_filter_disabled_flag,
+         pcm_loop_filter_disabled_flag);
+  }
+  SX_UE(out, sps->num_short_term_ref_pic_sets, num_short_term_ref_pic_sets);
+  if (sps->num_short_term_ref_pic_sets > H265_MAX_SHORT_TERM_REF_PIC_SETS) {
+    fprintf(stderr, "num_short_term_ref_pic_sets out of range\n");
+    return H265_ERR_INVALID;
+  }
+  SX_LIST(out, st_ref_pic_set, list);
+  for (i = 0; i < sps->num_short_term_ref_pic_sets; i++) {
+    int err;
+    SX_ITEM(list, subdict);
+    METRICS_FUNC(METRICS_FN_REF_PIC_SET,
+                 err = SX_FN(ref_pic_set)(i, &sps->st_ref_pic_set[i], dec,
+                                          bs SX_ARG(subdict)));
+    SX_DICT_END(subdict);
+    if (err) {
+      SX_LIST_END(list);
+      return err;
+    }
+  }
+  SX_LIST_END(list);
+  SX_U(out, 1, sps->long_term_ref_pics_present_flag,
+       long_term_ref_pics_present_flag);
+  if (sps->long_term_ref_pics_present_flag) {
+    SX_UE(out, sps->num_long_term_ref_pics_sps, num_long_term_ref_pics_sps);
+    if (sps->num_long_term_ref_pics_sps > H265_MAX_LONG_TERM_REF_PICS_SPS) {
+      fprintf(stderr, "num_long_term_ref_pics_sps out of range\n");
+      return H265_ERR_INVALID;
+    }
+    for (i = 0; i < sps->num_long_term_ref_pics_sps; i++) {
+      uint32_t lt_ref_pic_poc_lsb_sps =
+          BsGet(bs, sps->log2_max_pic_order_cnt_lsb_minus4 + 4);
+      uint8_t used_by_curr_pic_lt_sps_flag = BsGet(bs, 1);
+      if (i < H265_MAX_LONG_TERM_REF_PICS_SPS) {
+        sps->lt_ref_pic_poc_lsb_sps[i] = lt_ref_pic_poc_lsb_sps;
+        sps->used_by_curr_pic_lt_sps_flag[i] = used_by_curr_pic_lt_sps_flag;
+      }
+    }
+  }
+  SX_U(out, 1, sps->sps_temporal_mvp_enabled_flag,
+       sps_temporal_mvp_enabled_flag);
+  SX_U(out, 1, sps->strong_intra_smoothing_enabled_flag,
+       strong_intra_smoothing_enabled_flag);
+  sps->vui_parameters_pos = bs->pos;
+  SX_U(out, 1, sps->vui_parameters_present_flag, vui_parameters_present_flag);
+  if (sps->vui_parameters_present_flag) {
+    int err;
+    SX_DICT(out, vui_parameters, subdict);
+    METRICS_FUNC(METRICS_FN_VUI_PARAMETERS,
+                 err = SX_FN(vui_parameters)(dec, bs SX_ARG(subdict)));
+    SX_DICT_END(subdict);
+    if (err)
+      return err;
+  }
+  sps->vui_parameters_end = bs->pos;
+  SX_U(out, 1, sps->sps_extension_present_flag, sps_extension_present_flag);
+  sps->sps_range_extension_flag = 0;
+  sps->sps_multilayer_extension_flag = 0;
+  sps->sps_extension_6bits = 0;
+  if (sps->sps_extension_present_flag) {
+    sps->sps_range_extension_flag = BsGet(bs, 1);
+    sps->sps_multilayer_extension_flag = BsGet(bs, 1);
+    sps->sps_extension_6bits = BsGet(bs, 6);
+  }
+  /*
+  if (sps_range_extension_flag)
+    sps_range_extension()
+    if (sps_multilayer_extension_flag)
+      sps_multilayer_extension() // specified in Annex F
+      if (sps_extension_6bits)
+        while (more_rbsp_data())
+          uint8_t sps_extension_data_flag = BsGet(bs, 1);
+  rbsp_trailing_bits()
+  */
+
+  // P20, Table 6-1
+  if (sps->separate_colour_plane_flag == 0) {
+    switch (sps->chroma_format_idc) {
+    case 0:
+      sps->SubWidthC = 1;
+      sps->SubHeightC = 1;
+      break;
+    case 1:
+      sps->SubWidthC = 2;
+      sps->SubHeightC = 2;
+      break;
+    case 2:
+      sps->SubWidthC = 2;
+      sps->SubHeightC = 1;
+      break;
+    case 3:
+      sps->SubWidthC = 1;
+      sps->SubHeightC = 1;
+      break;
+    }
+  } else if (sps->separate_colour_plane_flag == 1 &&
+             sps->chroma_format_idc == 3) {
+    sps->SubWidthC = 1;
+    sps->SubHeightC = 1;
+  }
+  SX_PUT(out, SubWidthC, sps->SubWidthC);
+  SX_PUT(out, SubHeightC, sps->SubHeightC);
+
+  // P74, (7-10) ~ (7-22)
+  sps->MinCbLog2SizeY = sps->log2_min_luma_coding_block_size_minus3 + 3;
+  sps->CtbLog2SizeY =
+      sps->MinCbLog2SizeY + sps->log2_diff_max_min_luma_coding_block_size;
+  sps->MinCbSizeY = 1 << sps->MinCbLog2SizeY;
+  sps->CtbSizeY = 1 << sps->CtbLog2SizeY;
+  sps->PicWidthInMinCbsY = sps->pic_width_in_luma_samples / sps->MinCbSizeY;
+  sps->PicWidthInCtbsY =
+      (uint32_t)ceil(1.0 * sps->pic_width_in_luma_samples / sps->CtbSizeY);
+  sps->PicHeightInMinCbsY = sps->pic_height_in_luma_samples / sps->MinCbSizeY;
+  sps->PicHeightInCtbsY =
+      (uint32_t)ceil(1.0 * sps->pic_height_in_luma_samples / sps->CtbSizeY);
+  sps->PicSizeInMinCbsY = sps->PicWidthInMinCbsY * sps->PicHeightInMinCbsY;
+  sps->PicSizeInCtbsY = sps->PicWidthInCtbsY * sps->PicHeightInCtbsY;
+  sps->PicSizeInSamplesY =
+      sps->pic_width_in_luma_samples * sps->pic_height_in_luma_samples;
+  sps->PicWidthInSamplesC = sps->pic_width_in_luma_samples / sps->SubWidthC;
+  sps->PicHeightInSamplesC = sps->pic_height_in_luma_samples / sps->SubHeightC;
+  SX_PUT(out, MinCbLog2SizeY, sps->MinCbLog2SizeY);
+  SX_PUT(out, CtbLog2SizeY, sps->CtbLog2SizeY);
+  SX_PUT(out, MinCbSizeY, sps->MinCbSizeY);
+  SX_PUT(out, CtbSizeY, sps->CtbSizeY);
+  SX_PUT(out, PicWidthInMinCbsY, sps->PicWidthInMinCbsY);
+  SX_PUT(out, PicWidthInCtbsY, sps->PicWidthInCtbsY);
+  SX_PUT(out, PicHeightInMinCbsY, sps->PicHeightInMinCbsY);
+  SX_PUT(out, PicHeightInCtbsY, sps->PicHeightInCtbsY);
+  SX_PUT(out, PicSizeInMinCbsY, sps->PicSizeInMinCbsY);
+  SX_PUT(out, PicSizeInCtbsY, sps->PicSizeInCtbsY);
+  SX_PUT(out, PicSizeInSamplesY, sps->PicSizeInSamplesY);
+  SX_PUT(out, PicWidthInSamplesC, sps->PicWidthInSamplesC);
+  SX_PUT(out, PicHeightInSamplesC, sps->PicHeightInSamplesC);
+  return 0;
+}
+
+int SX_FN(video_parameter_set)(struct h265_decode_t *dec, struct BitStream *bs
+                               SX_DICT_PARAM) {
+  uint32_t i, j;
+  struct H265VideoParameterSet *vps = &dec->video_param_set;
+  SX_LIST_VAR(list);
+  SX_DICT_VAR(subdict);
+  SX_U(out, 4, vps->vps_video_parameter_set_id, vps_video_parameter_set_id);
+  SX_U(out, 1, vps->vps_base_layer_internal_flag,
+       vps_base_layer_internal_flag);
+  SX_U(out, 1, vps->vps_base_layer_available_flag,
+       vps_base_layer_available_flag);
+  SX_U(out, 6, vps->vps_max_layers_minus1, vps_max_layers_minus1);
+  SX_U(out, 3, vps->vps_max_sub_layers_minus1, vps_max_sub_layers_minus1);
+  SX_U(out, 1, vps->vps_temporal_id_nesting_flag,
+       vps_temporal_id_nesting_flag);
+  SX_HEX(out, 16, vps->vps_reserved_0xffff_16bits,
+         vps_reserved_0xffff_16bits);
+  METRICS_FUNC(METRICS_FN_PROFILE_TIER_LEVEL,
+               SX_FN(profile_tier_level)(1, vps->vps_max_sub_layers_minus1,
+                                         &vps->general_profile_tier_level,
+                                         dec, bs SX_ARG(out)));
+  SX_U(out, 1, vps->vps_sub_layer_ordering_info_present_flag,
+       vps_sub_layer_ordering_info_present_flag);
+
+  for (i = (vps->vps_sub_layer_ordering_info_present_flag
+                ? 0
+                : vps->vps_max_sub_layers_minus1);
+       i <= vps->vps_max_sub_layers_minus1; i++) {
+    BsUe(bs);  // vps_max_dec_pic_buffering_minus1[i]
+    BsUe(bs);  // vps_max_num_reorder_pics[i]
+    BsUe(bs);  // vps_max_latency_increase_plus1[i]
+  }
+  SX_U(out, 6, vps->vps_max_layer_id, vps_max_layer_id);
+  SX_UE(out, vps->vps_num_layer_sets_minus1, vps_num_layer_sets_minus1);
+  for (i = 1; i <= vps->vps_num_layer_sets_minus1; i++) {
+    for (j = 0; j <= vps->vps_max_layer_id; j++) {
+      BsGet(bs, 1);  // layer_id_included_flag[i][j]
+    }
+  }
+  SX_U(out, 1, vps->vps_timing_info_present_flag,
+       vps_timing_info_present_flag);
+  vps->vps_timing_info_pos = bs->pos;
+  if (vps->vps_timing_info_present_flag) {
+    SX_U(out, 32, vps->vps_num_units_in_tick, vps_num_units_in_tick);
+    SX_U(out, 32, vps->vps_time_scale, vps_time_scale);
+    SX_U(out, 1, vps->vps_poc_proportional_to_timing_flag,
+         vps_poc_proportional_to_timing_flag);
+    if (vps->vps_poc_proportional_to_timing_flag) {
+      SX_UE(out, vps->vps_num_ticks_poc_diff_one_minus1,
+            vps_num_ticks_poc_diff_one_minus1);
+    }
+    SX_UE(out, vps->vps_num_hrd_parameters, vps_num_hrd_parameters);
+
+    SX_LIST(out, hrd_parameters, list);
+    for (i = 0; i < vps->vps_num_hrd_parameters; i++) {
+      BsUe(bs);  // hrd_layer_set_idx[i]
+      uint8_t cprms_present_flag = 0;
+      if (i > 0) {
+        cprms_present_flag = BsGet(bs, 1);
+      }
+      struct H265HrdParameters hrd;
+      memset(&hrd, 0, sizeof(hrd));
+      int err;
+      SX_ITEM(list, subdict);
+      METRICS_FUNC(METRICS_FN_HRD_PARAMETERS,
+                   err = SX_FN(hrd_parameters)(
+                       cprms_present_flag, vps->vps_max_sub_layers_minus1,
+                       &hrd, dec, bs SX_ARG(subdict)));
+      SX_DICT_END(subdict);
+      if (err) {
+        SX_LIST_END(list);
+        return err;
+      }
+    }
+    SX_LIST_END(list);
+  }
+  SX_U(out, 1, vps->vps_extension_flag, vps_extension_flag);
+  return 0;
+}
+
+int SX_FN(pps_range_extension)(struct h265_decode_t *dec, struct BitStream *bs
+                               SX_DICT_PARAM) {
+  uint32_t i;
+  struct H265PicParameterSet *pps = &dec->pic_param_set;
+  if (pps->transform_skip_enabled_flag) {
+    SX_UE(out, pps->log2_max_transform_skip_block_size_minus2,
+          log2_max_transform_skip_block_size_minus2);
+  }
+  SX_U(out, 1, pps->cross_component_prediction_enabled_flag,
+       cross_component_prediction_enabled_flag);
+  SX_U(out, 1, pps->chroma_qp_offset_list_enabled_flag,
+       chroma_qp_offset_list_enabled_flag);
+  if (pps->chroma_qp_offset_list_enabled_flag) {
+    SX_UE(out, pps->diff_cu_chroma_qp_offset_depth,
+          diff_cu_chroma_qp_offset_depth);
+    SX_UE(out, pps->chroma_qp_offset_list_len_minus1,
+          chroma_qp_offset_list_len_minus1);
+    for (i = 0; i <= pps->chroma_qp_offset_list_len_minus1; i++) {
+      BsSe(bs);  // cb_qp_offset_list[i]
+      BsSe(bs);  // cr_qp_offset_list[i]
+    }
+  }
+  SX_UE(out, pps->log2_sao_offset_scale_luma, log2_sao_offset_scale_luma);
+  SX_UE(out, pps->log2_sao_offset_scale_chroma, log2_sao_offset_scale_chroma);
+  return 0;
+}
+
+int SX_FN(pic_parameter_set)(struct h265_decode_t *dec, struct BitStream *bs
+                             SX_DICT_PARAM) {
+  uint32_t i;
+  struct H265PicParameterSet *pps = &dec->pic_param_set;
+  dec->slice_plan.valid = 0;
+  SX_UE(out, pps->pps_pic_parameter_set_id, pps_pic_parameter_set_id);
+  SX_UE(out, pps->pps_seq_parameter_set_id, pps_seq_parameter_set_id);
+  SX_U(out, 1, pps->dependent_slice_segments_enabled_flag,
+       dependent_slice_segments_enabled_flag);
+  SX_U(out, 1, pps->output_flag_present_flag, output_flag_present_flag);
+  SX_U(out, 3, pps->num_extra_slice_header_bits, num_extra_slice_header_bits);
+  SX_U(out, 1, pps->sign_data_hiding_enabled_flag,
+       sign_data_hiding_enabled_flag);
+  SX_U(out, 1, pps->cabac_init_present_flag, cabac_init_present_flag);
+  SX_UE(out, pps->num_ref_idx_l0_default_active_minus1,
+        num_ref_idx_l0_default_active_minus1);
+  SX_UE(out, pps->num_ref_idx_l1_default_active_minus1,
+        num_ref_idx_l1_default_active_minus1);
+  SX_SE(out, pps->init_qp_minus26, init_qp_minus26);
+  SX_U(out, 1, pps->constrained_intra_pred_flag, constrained_intra_pred_flag);
+  SX_U(out, 1, pps->transform_skip_enabled_flag, transform_skip_enabled_flag);
+  SX_U(out, 1, pps->cu_qp_delta_enabled_flag, cu_qp_delta_enabled_flag);
+  if (pps->cu_qp_delta_enabled_flag) {
+    SX_UE(out, pps->diff_cu_qp_delta_depth, diff_cu_qp_delta_depth);
+  }
+  SX_SE(out, pps->pps_cb_qp_offset, pps_cb_qp_offset);
+  SX_SE(out, pps->pps_cr_qp_offset, pps_cr_qp_offset);
+  SX_U(out, 1, pps->pps_slice_chroma_qp_offsets_present_flag,
+       pps_slice_chroma_qp_offsets_present_flag);
+  SX_U(out, 1, pps->weighted_pred_flag, weighted_pred_flag);
+  SX_U(out, 1, pps->weighted_bipred_flag, weighted_bipred_flag);
+  SX_U(out, 1, pps->transquant_bypass_enabled_flag,
+       transquant_bypass_enabled_flag);
+  SX_U(out, 1, pps->tiles_enabled_flag, tiles_enabled_flag);
+  SX_U(out, 1, pps->entropy_coding_sync_enabled_flag,
+       entropy_coding_sync_enabled_flag);
+  if (pps->tiles_enabled_flag) {
+    SX_UE(out, pps->num_tile_columns_minus1, num_tile_columns_minus1);
+    SX_UE(out, pps->num_tile_rows_minus1, num_tile_rows_minus1);
+    if (pps->num_tile_columns_minus1 >= H265_MAX_TILE_COLUMNS ||
+        pps->num_tile_rows_minus1 >= H265_MAX_TILE_ROWS) {
+      fprintf(stderr, "num_tile_columns_minus1 or num_tile_rows_minus1 out "
+              "of range\n");
+      return H265_ERR_INVALID;
+    }
+    SX_U(out, 1, pps->uniform_spacing_flag, uniform_spacing_flag);
+    if (!pps->uniform_spacing_flag) {
+      for (i = 0; i < pps->num_tile_columns_minus1; i++) {
+        uint32_t column_width_minus1 = BsUe(bs);
+        if (i < H265_MAX_TILE_COLUMNS)
+          pps->column_width_minus1[i] = column_width_minus1;
+      }
+      for (i = 0; i < pps->num_tile_rows_minus1; i++) {
+        uint32_t row_height_minus1 = BsUe(bs);
+        if (i < H265_MAX_TILE_ROWS)
+          pps->row_height_minus1[i] = row_height_minus1;
+      }
+    }
+    SX_U(out, 1, pps->loop_filter_across_tiles_enabled_flag,
+         loop_filter_across_tiles_enabled_flag);
+  }
+  SX_U(out, 1, pps->pps_loop_filter_across_slices_enabled_flag,
+       pps_loop_filter_across_slices_enabled_flag);
+  SX_U(out, 1, pps->deblocking_filter_control_present_flag,
+       deblocking_filter_control_present_flag);
+  if (pps->deblocking_filter_control_present_flag) {
+    SX_U(out, 1, pps->deblocking_filter_override_enabled_flag,
+         deblocking_filter_override_enabled_flag);
+    SX_U(out, 1, pps->pps_deblocking_filter_disabled_flag,
+         pps_deblocking_filter_disabled_flag);
+    if (!pps->pps_deblocking_filter_disabled_flag) {
+      SX_SE(out, pps->pps_beta_offset_div2, pps_beta_offset_div2);
+      SX_SE(out, pps->pps_tc_offset_div2, pps_tc_offset_div2);
+    }
+  }
+  SX_U(out, 1, pps->pps_scaling_list_data_present_flag,
+       pps_scaling_list_data_present_flag);
+  if (pps->pps_scaling_list_data_present_flag) {
+    METRICS_FUNC(METRICS_FN_SCALING_LIST_DATA,
+                 SX_FN(scaling_list_data)(dec, bs SX_ARG(out)));
+  }
+  SX_U(out, 1, pps->lists_modification_present_flag,
+       lists_modification_present_flag);
+  SX_UE(out, pps->log2_parallel_merge_level_minus2,
+        log2_parallel_merge_level_minus2);
+  SX_U(out, 1, pps->slice_segment_header_extension_present_flag,
+       slice_segment_header_extension_present_flag);
+  SX_U(out, 1, pps->pps_extension_present_flag, pps_extension_present_flag);
+  pps->pps_range_extension_flag = 0;
+  pps->pps_multilayer_extension_flag = 0;
+  pps->pps_extension_6bits = 0;
+  if (pps->pps_extension_present_flag) {
+    SX_U(out, 1, pps->pps_range_extension_flag, pps_range_extension_flag);
+    SX_U(out, 1, pps->pps_multilayer_extension_flag,
+         pps_multilayer_extension_flag);
+    SX_U(out, 6, pps->pps_extension_6bits, pps_extension_6bits);
+  }
+  if (pps->pps_range_extension_flag)
+    METRICS_FUNC(METRICS_FN_PPS_RANGE_EXTENSION,
+                 SX_FN(pps_range_extension)(dec, bs SX_ARG(out)));
+  /*
+  if( pps_multilayer_extension_flag )
+  pps_multilayer_extension();  // specified in Annex F
+  if( pps_extension_6bits )
+  while( more_rbsp_data( ) )
+  out->put_uint(out, "pps_extension_data_flag", pps->pps_extension_data_flag
+  =BsGet(bs, 1));
+  */
+  return 0;
+}
@@ -0,0 +1,259 @@
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include "h265-syntax.h"
+#include "metrics.h"
+
+const char* kH265SyntaxElementNames[H265_SE_COUNT] = {
+    "",
+#define H265_SE_NAME(name) #name,
+    H265_SYNTAX_ELEMENTS(H265_SE_NAME)
+#undef H265_SE_NAME
+};
+
+void H265SyntaxBinInit(struct H265SyntaxBin* bin, uint8_t* buf, size_t size) {
+  bin->buf = buf;
+  bin->size = size;
+  bin->pos = 0;
+  bin->overflow = 0;
+}
+
+static void BinVarint(struct H265SyntaxBin* bin, uint64_t val) {
+  if (bin->size - bin->pos < 10) {
+    bin->overflow = 1;
+    return;
+  }
+  while (val >= 0x80) {
+    bin->buf[bin->pos++] = (uint8_t)(val | 0x80);
+    val >>= 7;
+  }
+  bin->buf[bin->pos++] = (uint8_t)val;
+}
+
+static void BinTag(struct H265SyntaxBin* bin,
+                   enum H265SyntaxElement element,
+                   enum H265BinType type) {
+  BinVarint(bin, (uint64_t)element << 3 | type);
+}
+
+static void BinUint(struct H265SyntaxBin* bin,
+                    enum H265SyntaxElement element,
+                    uint64_t val) {
+  BinTag(bin, element, H265_BIN_UINT);
+  BinVarint(bin, val);
+}
+
+static void BinInt(struct H265SyntaxBin* bin,
+                   enum H265SyntaxElement element,
+                   int64_t val) {
+  BinTag(bin, element, H265_BIN_INT);
+  BinVarint(bin, ((uint64_t)val << 1) ^ (uint64_t)(val >> 63));
+}
+
+static void BinHex(struct H265SyntaxBin* bin,
+                   enum H265SyntaxElement element,
+                   uint64_t val) {
+  BinTag(bin, element, H265_BIN_HEX);
+  BinVarint(bin, val);
+}
+
+// OutputContextDict output: the functions h265parser.h declares.
+#define SX_FN(name) h265_##name
+#define SX_DICT_PARAM , struct OutputContextDict *out
+#define SX_LIST_PARAM , struct OutputContextList *out
+#define SX_ARG(sink) , sink
+#define SX_DICT_VAR(v) struct OutputContextDict v[1]
+#define SX_LIST_VAR(v) struct OutputContextList v[1]
+#define SX_DICT(out, key, v) (out)->put_dict(out, #key, v)
+#define SX_LIST(out, key, v) (out)->put_list(out, #key, v)
+#define SX_ITEM(list, v) (list)->put_dict(list, v)
+#define SX_DICT_END(v) (v)->end(v)
+#define SX_LIST_END(v) (v)->end(v)
+#define SX_U(out, n, lv, key) (out)->put_uint(out, #key, (lv) = BsGet(bs, n))
+#define SX_UE(out, lv, key) (out)->put_uint(out, #key, (lv) = BsUe(bs))
+#define SX_SE(out, lv, key) (out)->put_int(out, #key, (lv) = BsSe(bs))
+#define SX_HEX(out, n, lv, key) (out)->put_hex(out, #key, (lv) = BsGet(bs, n))
+#define SX_PUT(out, key, value) (out)->put_uint(out, #key, value)
+#include "h265-syntax-template.h"
+#undef SX_FN
+#undef SX_DICT_PARAM
+#undef SX_LIST_PARAM
+#undef SX_ARG
+#undef SX_DICT_VAR
+#undef SX_LIST_VAR
+#undef SX_DICT
+#undef SX_LIST
+#undef SX_ITEM
+#undef SX_DICT_END
+#undef SX_LIST_END
+#undef SX_U
+#undef SX_UE
+#undef SX_SE
+#undef SX_HEX
+#undef SX_PUT
+
+// Decoder structs only, no output calls at all.
+#define SX_FN(name) h265_##name##_decode
+#define SX_DICT_PARAM
+#define SX_LIST_PARAM
+#define SX_ARG(sink)
+#define SX_DICT_VAR(v)
+#define SX_LIST_VAR(v)
+#define SX_DICT(out, key, v)
+#define SX_LIST(out, key, v)
+#define SX_ITEM(list, v)
+#define SX_DICT_END(v)
+#define SX_LIST_END(v)
+#define SX_U(out, n, lv, key) ((lv) = BsGet(bs, n))
+#define SX_UE(out, lv, key) ((lv) = BsUe(bs))
+#define SX_SE(out, lv, key) ((lv) = BsSe(bs))
+#define SX_HEX(out, n, lv, key) ((lv) = BsGet(bs, n))
+#define SX_PUT(out, key, value) ((void)(value))
+#include "h265-syntax-template.h"
+#undef SX_FN
+#undef SX_DICT_PARAM
+#undef SX_LIST_PARAM
+#undef SX_ARG
+#undef SX_DICT_VAR
+#undef SX_LIST_VAR
+#undef SX_DICT
+#undef SX_LIST
+#undef SX_ITEM
+#undef SX_DICT_END
+#undef SX_LIST_END
+#undef SX_U
+#undef SX_UE
+#undef SX_SE
+#undef SX_HEX
+#undef SX_PUT
+
+// Binary output; nested dicts and lists share the one buffer.
+#define SX_FN(name) h265_##name##_binary
+#define SX_DICT_PARAM , struct H265SyntaxBin *out
+#define SX_LIST_PARAM , struct H265SyntaxBin *out
+#define SX_ARG(sink) , sink
+#define SX_DICT_VAR(v) struct H265SyntaxBin *v = out
+#define SX_LIST_VAR(v) struct H265SyntaxBin *v = out
+#define SX_DICT(out, key, v) BinTag(v, H265_SE_##key, H265_BIN_DICT)
+#define SX_LIST(out, key, v) BinTag(v, H265_SE_##key, H265_BIN_LIST)
+#define SX_ITEM(list, v) BinTag(v, H265_SE_NONE, H265_BIN_DICT)
+#define SX_DICT_END(v) BinTag(v, H265_SE_NONE, H265_BIN_END)
+#define SX_LIST_END(v) BinTag(v, H265_SE_NONE, H265_BIN_END)
+#define SX_U(out, n, lv, key) BinUint(out, H265_SE_##key, (lv) = BsGet(bs, n))
+#define SX_UE(out, lv, key) BinUint(out, H265_SE_##key, (lv) = BsUe(bs))
+#define SX_SE(out, lv, key) BinInt(out, H265_SE_##key, (lv) = BsSe(bs))
+#define SX_HEX(out, n, lv, key) BinHex(out, H265_SE_##key, (lv) = BsGet(bs, n))
+#define SX_PUT(out, key, value) BinUint(out, H265_SE_##key, value)
+#include "h265-syntax-template.h"
+#undef SX_FN
+#undef SX_DICT_PARAM
+#undef SX_LIST_PARAM
+#undef SX_ARG
+#undef SX_DICT_VAR
+#undef SX_LIST_VAR
+#undef SX_DICT
+#undef SX_LIST
+#undef SX_ITEM
+#undef SX_DICT_END
+#undef SX_LIST_END
+#undef SX_U
+#undef SX_UE
+#undef SX_SE
+#undef SX_HEX
+#undef SX_PUT
+
+struct BinReader {
+  const uint8_t* p;
+  const uint8_t* end;
+};
+
+static int ReadVarint(struct BinReader* r, uint64_t* val) {
+  uint32_t shift = 0;
+  *val = 0;
+  while (r->p < r->end && shift < 64) {
+    uint8_t b = *r->p++;
+    *val |= (uint64_t)(b & 0x7f) << shift;
+    if (!(b & 0x80))
+      return 0;
+    shift += 7;
+  }
+  return -1;
+}
+
+static int DumpList(struct BinReader* r, struct OutputContextList* out);
+
+// Entries up to the end tag, or to the end of the buffer at the top level.
+static int DumpDict(struct BinReader* r,
+                    struct OutputContextDict* out,
+                    int top) {
+  while (r->p < r->end) {
+    struct OutputContextDict dict[1];
+    struct OutputContextList list[1];
+    uint64_t tag, val;
+    const char* key;
+    int ret = 0;
+    if (ReadVarint(r, &tag) != 0 || (tag >> 3) >= H265_SE_COUNT)
+      return -1;
+    key = kH265SyntaxElementNames[tag >> 3];
+    switch (tag & 7) {
+    case H265_BIN_UINT:
+    case H265_BIN_INT:
+    case H265_BIN_HEX:
+      if (ReadVarint(r, &val) != 0)
+        return -1;
+      if ((tag & 7) == H265_BIN_UINT)
+        out->put_uint(out, key, val);
+      else if ((tag & 7) == H265_BIN_HEX)
+        out->put_hex(out, key, val);
+      else
+        out->put_int(out, key, (int64_t)(val >> 1) ^ -(int64_t)(val & 1));
+      break;
+    case H265_BIN_DICT:
+      out->put_dict(out, key, dict);
+      ret = DumpDict(r, dict, 0);
+      dict->end(dict);
+      break;
+    case H265_BIN_LIST:
+      out->put_list(out, key, list);
+      ret = DumpList(r, list);
+      list->end(list);
+      break;
+    case H265_BIN_END:
+      return top ? -1 : 0;
+    default:
+      return -1;
+    }
+    if (ret != 0)
+      return ret;
+  }
+  return top ? 0 : -1;
+}
+
+static int DumpList(struct BinReader* r, struct OutputContextList* out) {
+  while (r->p < r->end) {
+    struct OutputContextDict dict[1];
+    uint64_t tag;
+    int ret;
+    if (ReadVarint(r, &tag) != 0)
+      return -1;
+    if (tag == H265_BIN_END)
+      return 0;
+    if (tag != H265_BIN_DICT)
+      return -1;
+    out->put_dict(out, dict);
+    ret = DumpDict(r, dict, 0);
+    dict->end(dict);
+    if (ret != 0)
+      return ret;
+  }
+  return -1;
+}
+
+int H265SyntaxBinDump(const uint8_t* buf,
+                      size_t size,
+                      struct OutputContextDict* out) {
+  struct BinReader r;
+  r.p = buf;
+  r.end = buf + size;
+  return DumpDict(&r, out, 1);
+}
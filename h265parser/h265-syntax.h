@@ -0,0 +1,294 @@
+#ifndef H265_SYNTAX_H_
+#define H265_SYNTAX_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "bitstream.h"
+#include "h265parser.h"
+#include "output-context.h"
+
+// The VPS, SPS and PPS syntax in h265-syntax-template.h compiled three
+// ways: with OutputContextDict output (h265_video_parameter_set and the
+// other names declared in h265parser.h), into the decoder structs only
+// (*_decode) and with compact binary output (*_binary).
+
+// Every key the syntax outputs, in the order of first use. Binary output
+// refers to them by position, so new keys go at the end.
+#define H265_SYNTAX_ELEMENTS(X)                                               \
+  X(general_profile_space)                                                    \
+  X(general_tier_flag)                                                        \
+  X(general_profile_idc)                                                      \
+  X(general_progressive_source_flag)                                          \
+  X(general_interlaced_source_flag)                                           \
+  X(general_non_packed_constraint_flag)                                       \
+  X(general_frame_only_constraint_flag)                                       \
+  X(general_max_12bit_constraint_flag)                                        \
+  X(general_max_10bit_constraint_flag)                                        \
+  X(general_max_8bit_constraint_flag)                                         \
+  X(general_max_422chroma_constraint_flag)                                    \
+  X(general_max_420chroma_constraint_flag)                                    \
+  X(general_max_monochrome_constraint_flag)                                   \
+  X(general_intra_constraint_flag)                                            \
+  X(general_one_picture_only_constraint_flag)                                 \
+  X(general_lower_bit_rate_constraint_flag)                                   \
+  X(general_inbld_flag)                                                       \
+  X(inter_ref_pic_set_prediction_flag)                                        \
+  X(delta_idx_minus1)                                                         \
+  X(delta_rps_sign)                                                           \
+  X(abs_delta_rps_minus1)                                                     \
+  X(num_negative_pics)                                                        \
+  X(num_positive_pics)                                                        \
+  X(NumNegativePics)                                                          \
+  X(NumPositivePics)                                                          \
+  X(bit_rate_value_minus1)                                                    \
+  X(cpb_size_value_minus1)                                                    \
+  X(cpb_size_du_value_minus1)                                                 \
+  X(bit_rate_du_value_minus1)                                                 \
+  X(cbr_flag)                                                                 \
+  X(nal_hrd_parameters_present_flag)                                          \
+  X(vcl_hrd_parameters_present_flag)                                          \
+  X(sub_pic_hrd_params_present_flag)                                          \
+  X(tick_divisor_minus2)                                                      \
+  X(du_cpb_removal_delay_increment_length_minus1)                             \
+  X(sub_pic_cpb_params_in_pic_timing_sei_flag)                                \
+  X(dpb_output_delay_du_length_minus1)                                        \
+  X(bit_rate_scale)                                                           \
+  X(cpb_size_scale)                                                           \
+  X(cpb_size_du_scale)                                                        \
+  X(initial_cpb_removal_delay_length_minus1)                                  \
+  X(au_cpb_removal_delay_length_minus1)                                       \
+  X(dpb_output_delay_length_minus1)                                           \
+  X(sub_layers)                                                               \
+  X(fixed_pic_rate_general_flag)                                              \
+  X(fixed_pic_rate_within_cvs_flag)                                           \
+  X(elemental_duration_in_tc_minus1)                                          \
+  X(low_delay_hrd_flag)                                                       \
+  X(cpb_cnt_minus1)                                                           \
+  X(nal_sub_layer_hrd_parameters)                                             \
+  X(vcl_sub_layer_hrd_parameters)                                             \
+  X(aspect_ratio_info_present_flag)                                           \
+  X(aspect_ratio_idc)                                                         \
+  X(sar_width)                                                                \
+  X(sar_height)                                                               \
+  X(overscan_info_present_flag)                                               \
+  X(overscan_appropriate_flag)                                                \
+  X(video_signal_type_present_flag)                                           \
+  X(video_format)                                                             \
+  X(video_full_range_flag)                                                    \
+  X(colour_description_present_flag)                                          \
+  X(colour_primaries)                                                         \
+  X(transfer_characteristics)                                                 \
+  X(matrix_coeffs)                                                            \
+  X(chroma_loc_info_present_flag)                                             \
+  X(chroma_sample_loc_type_top_field)                                         \
+  X(chroma_sample_loc_type_bottom_field)                                      \
+  X(neutral_chroma_indication_flag)                                           \
+  X(field_seq_flag)                                                           \
+  X(frame_field_info_present_flag)                                            \
+  X(default_display_window_flag)                                              \
+  X(def_disp_win_left_offset)                                                 \
+  X(def_disp_win_right_offset)                                                \
+  X(def_disp_win_top_offset)                                                  \
+  X(def_disp_win_bottom_offset)                                               \
+  X(vui_timing_info_present_flag)                                             \
+  X(vui_num_units_in_tick)                                                    \
+  X(vui_time_scale)                                                           \
+  X(vui_poc_proportional_to_timing_flag)                                      \
+  X(vui_num_ticks_poc_diff_one_minus1)                                        \
+  X(vui_hrd_parameters_present_flag)                                          \
+  X(bitstream_restriction_flag)                                               \
+  X(tiles_fixed_structure_flag)                                               \
+  X(motion_vectors_over_pic_boundaries_flag)                                  \
+  X(restricted_ref_pic_lists_flag)                                            \
+  X(min_spatial_segmentation_idc)                                             \
+  X(max_bytes_per_pic_denom)                                                  \
+  X(max_bits_per_min_cu_denom)                                                \
+  X(log2_max_mv_length_horizontal)                                            \
+  X(log2_max_mv_length_vertical)                                              \
+  X(sps_video_parameter_set_id)                                               \
+  X(sps_max_sub_layers_minus1)                                                \
+  X(sps_temporal_id_nesting_flag)                                             \
+  X(profile_tier_level)                                                       \
+  X(sps_seq_parameter_set_id)                                                 \
+  X(chroma_format_idc)                                                        \
+  X(separate_colour_plane_flag)                                               \
+  X(ChromaArrayType)                                                          \
+  X(pic_width_in_luma_samples)                                                \
+  X(pic_height_in_luma_samples)                                               \
+  X(conformance_window_flag)                                                  \
+  X(conf_win_left_offset)                                                     \
+  X(conf_win_right_offset)                                                    \
+  X(conf_win_top_offset)                                                      \
+  X(conf_win_bottom_offset)                                                   \
+  X(bit_depth_luma_minus8)                                                    \
+  X(bit_depth_chroma_minus8)                                                  \
+  X(log2_max_pic_order_cnt_lsb_minus4)                                        \
+  X(sps_sub_layer_ordering_info_present_flag)                                 \
+  X(sps_max_dec_pic_buffering_minus1)                                         \
+  X(sps_max_num_reorder_pics)                                                 \
+  X(log2_min_luma_coding_block_size_minus3)                                   \
+  X(log2_diff_max_min_luma_coding_block_size)                                 \
+  X(log2_min_luma_transform_block_size_minus2)                                \
+  X(log2_diff_max_min_luma_transform_block_size)                              \
+  X(max_transform_hierarchy_depth_inter)                                      \
+  X(max_transform_hierarchy_depth_intra)                                      \
+  X(scaling_list_enabled_flag)                                                \
+  X(sps_scaling_list_data_present_flag)                                       \
+  X(amp_enabled_flag)                                                         \
+  X(sample_adaptive_offset_enabled_flag)                                      \
+  X(pcm_enabled_flag)                                                         \
+  X(pcm_sample_bit_depth_luma_minus1)                                         \
+  X(pcm_sample_bit_depth_chroma_minus1)                                       \
+  X(log2_min_pcm_luma_coding_block_size_minus3)                               \
+  X(log2_diff_max_min_pcm_luma_coding_block_size)                             \
+  X(pcm_loop_filter_disabled_flag)                                            \
+  X(num_short_term_ref_pic_sets)                                              \
+  X(st_ref_pic_set)                                                           \
+  X(long_term_ref_pics_present_flag)                                          \
+  X(num_long_term_ref_pics_sps)                                               \
+  X(sps_temporal_mvp_enabled_flag)                                            \
+  X(strong_intra_smoothing_enabled_flag)                                      \
+  X(vui_parameters_present_flag)                                              \
+  X(vui_parameters)                                                           \
+  X(sps_extension_present_flag)                                               \
+  X(SubWidthC)                                                                \
+  X(SubHeightC)                                                               \
+  X(MinCbLog2SizeY)                                                           \
+  X(CtbLog2SizeY)                                                             \
+  X(MinCbSizeY)                                                               \
+  X(CtbSizeY)                                                                 \
+  X(PicWidthInMinCbsY)                                                        \
+  X(PicWidthInCtbsY)                                                          \
+  X(PicHeightInMinCbsY)                                                       \
+  X(PicHeightInCtbsY)                                                         \
+  X(PicSizeInMinCbsY)                                                         \
+  X(PicSizeInCtbsY)                                                           \
+  X(PicSizeInSamplesY)                                                        \
+  X(PicWidthInSamplesC)                                                       \
+  X(PicHeightInSamplesC)                                                      \
+  X(vps_video_parameter_set_id)                                               \
+  X(vps_base_layer_internal_flag)                                             \
+  X(vps_base_layer_available_flag)                                            \
+  X(vps_max_layers_minus1)                                                    \
+  X(vps_max_sub_layers_minus1)                                                \
+  X(vps_temporal_id_nesting_flag)                                             \
+  X(vps_reserved_0xffff_16bits)                                               \
+  X(vps_sub_layer_ordering_info_present_flag)                                 \
+  X(vps_max_layer_id)                                                         \
+  X(vps_num_layer_sets_minus1)                                                \
+  X(vps_timing_info_present_flag)                                             \
+  X(vps_num_units_in_tick)                                                    \
+  X(vps_time_scale)                                                           \
+  X(vps_poc_proportional_to_timing_flag)                                      \
+  X(vps_num_ticks_poc_diff_one_minus1)                                        \
+  X(vps_num_hrd_parameters)                                                   \
+  X(hrd_parameters)                                                           \
+  X(vps_extension_flag)                                                       \
+  X(log2_max_transform_skip_block_size_minus2)                                \
+  X(cross_component_prediction_enabled_flag)                                  \
+  X(chroma_qp_offset_list_enabled_flag)                                       \
+  X(diff_cu_chroma_qp_offset_depth)                                           \
+  X(chroma_qp_offset_list_len_minus1)                                         \
+  X(log2_sao_offset_scale_luma)                                               \
+  X(log2_sao_offset_scale_chroma)                                             \
+  X(pps_pic_parameter_set_id)                                                 \
+  X(pps_seq_parameter_set_id)                                                 \
+  X(dependent_slice_segments_enabled_flag)                                    \
+  X(output_flag_present_flag)                                                 \
+  X(num_extra_slice_header_bits)                                              \
+  X(sign_data_hiding_enabled_flag)                                            \
+  X(cabac_init_present_flag)                                                  \
+  X(num_ref_idx_l0_default_active_minus1)                                     \
+  X(num_ref_idx_l1_default_active_minus1)                                     \
+  X(init_qp_minus26)                                                          \
+  X(constrained_intra_pred_flag)                                              \
+  X(transform_skip_enabled_flag)                                              \
+  X(cu_qp_delta_enabled_flag)                                                 \
+  X(diff_cu_qp_delta_depth)                                                   \
+  X(pps_cb_qp_offset)                                                         \
+  X(pps_cr_qp_offset)                                                         \
+  X(pps_slice_chroma_qp_offsets_present_flag)                                 \
+  X(weighted_pred_flag)                                                       \
+  X(weighted_bipred_flag)                                                     \
+  X(transquant_bypass_enabled_flag)                                           \
+  X(tiles_enabled_flag)                                                       \
+  X(entropy_coding_sync_enabled_flag)                                         \
+  X(num_tile_columns_minus1)                                                  \
+  X(num_tile_rows_minus1)                                                     \
+  X(uniform_spacing_flag)                                                     \
+  X(loop_filter_across_tiles_enabled_flag)                                    \
+  X(pps_loop_filter_across_slices_enabled_flag)                               \
+  X(deblocking_filter_control_present_flag)                                   \
+  X(deblocking_filter_override_enabled_flag)                                  \
+  X(pps_deblocking_filter_disabled_flag)                                      \
+  X(pps_beta_offset_div2)                                                     \
+  X(pps_tc_offset_div2)                                                       \
+  X(pps_scaling_list_data_present_flag)                                       \
+  X(lists_modification_present_flag)                                          \
+  X(log2_parallel_merge_level_minus2)                                         \
+  X(slice_segment_header_extension_present_flag)                              \
+  X(pps_extension_present_flag)                                               \
+  X(pps_range_extension_flag)                                                 \
+  X(pps_multilayer_extension_flag)                                            \
+  X(pps_extension_6bits)
+
+enum H265SyntaxElement {
+  H265_SE_NONE = 0,  // list items
+#define H265_SE_ENUM(name) H265_SE_##name,
+  H265_SYNTAX_ELEMENTS(H265_SE_ENUM)
+#undef H265_SE_ENUM
+  H265_SE_COUNT
+};
+
+extern const char* kH265SyntaxElementNames[H265_SE_COUNT];
+
+// Binary output is a sequence of LEB128 varints: a tag, element << 3 |
+// type, followed for the value types by the value, zigzag coded for
+// H265_BIN_INT. Dicts and lists run up to their H265_BIN_END tag; dicts in
+// a list have element H265_SE_NONE.
+enum H265BinType {
+  H265_BIN_UINT = 0,
+  H265_BIN_INT = 1,
+  H265_BIN_HEX = 2,
+  H265_BIN_DICT = 3,
+  H265_BIN_LIST = 4,
+  H265_BIN_END = 5
+};
+
+struct H265SyntaxBin {
+  uint8_t* buf;
+  size_t size;
+  size_t pos;
+  uint8_t overflow;  // set when output didn't fit, pos stops growing
+};
+
+void H265SyntaxBinInit(struct H265SyntaxBin* bin, uint8_t* buf, size_t size);
+// Replays binary output into |out|, giving what the OutputContextDict
+// variant would have output. Returns 0, or -1 if |buf| is malformed.
+int H265SyntaxBinDump(const uint8_t* buf,
+                      size_t size,
+                      struct OutputContextDict* out);
+
+// Also called for the st_ref_pic_set() of a slice segment header.
+int h265_ref_pic_set(uint32_t stRpsIdx, struct H265ShortTermRefPicSet *rps,
+                     struct h265_decode_t *dec, struct BitStream *bs,
+                     struct OutputContextDict *out);
+
+int h265_video_parameter_set_decode(struct h265_decode_t *dec,
+                                    struct BitStream *bs);
+int h265_seq_parameter_set_decode(struct h265_decode_t *dec,
+                                  struct BitStream *bs);
+int h265_pic_parameter_set_decode(struct h265_decode_t *dec,
+                                  struct BitStream *bs);
+
+int h265_video_parameter_set_binary(struct h265_decode_t *dec,
+                                    struct BitStream *bs,
+                                    struct H265SyntaxBin *out);
+int h265_seq_parameter_set_binary(struct h265_decode_t *dec,
+                                  struct BitStream *bs,
+                                  struct H265SyntaxBin *out);
+int h265_pic_parameter_set_binary(struct h265_decode_t *dec,
+                                  struct BitStream *bs,
+                                  struct H265SyntaxBin *out);
+
+#endif
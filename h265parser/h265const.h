@@ -1,37 +1,43 @@
 #ifndef H265CONST_H_
-#define H265CONST_H
+#define H265CONST_H_
 
 #define H265_START_CODE 0x000001
 
-// Table 7-1 NAL unit type codes and NAL unit type classes
+// Table 7-1 NAL unit type codes and NAL unit type classes. The enum and
+// GetH265NalType are generated from this list.
+
+#define H265_NAL_TYPES(X)                                                     \
+  X(TRAIL_N, 0)                                                               \
+  X(TRAIL_R, 1)                                                               \
+  X(TSA_N, 2)                                                                 \
+  X(TSA_R, 3)                                                                 \
+  X(STSA_N, 4)                                                                \
+  X(STSA_R, 5)                                                                \
+  X(RADL_N, 6)                                                                \
+  X(RADL_R, 7)                                                                \
+  X(RASL_N, 8)                                                                \
+  X(RASL_R, 9)                                                                \
+  X(BLA_W_LP, 16)                                                             \
+  X(BLA_W_RADL, 17)                                                           \
+  X(BLA_N_LP, 18)                                                             \
+  X(IDR_W_RADL, 19)                                                           \
+  X(IDR_N_LP, 20)                                                             \
+  X(CRA_NUT, 21)                                                              \
+  X(RSV_IRAP_VCL23, 23)                                                       \
+  X(VPS_NUT, 32)                                                              \
+  X(SPS_NUT, 33)                                                              \
+  X(PPS_NUT, 34)                                                              \
+  X(AUD_NUT, 35)                                                              \
+  X(EOS_NUT, 36)                                                              \
+  X(EOB_NUT, 37)                                                              \
+  X(FD_NUT, 38)                                                               \
+  X(PREFIX_SEI_NUT, 39)                                                       \
+  X(SUFFIX_SEI_NUT, 40)
 
 enum H265NalType {
-  H265_NAL_TYPE_TRAIL_N = 0,
-  H265_NAL_TYPE_TRAIL_R = 1,
-  H265_NAL_TYPE_TSA_N = 2,
-  H265_NAL_TYPE_TSA_R = 3,
-  H265_NAL_TYPE_STSA_N = 4,
-  H265_NAL_TYPE_STSA_R = 5,
-  H265_NAL_TYPE_RADL_N = 6,
-  H265_NAL_TYPE_RADL_R = 7,
-  H265_NAL_TYPE_RASL_N = 8,
-  H265_NAL_TYPE_RASL_R = 9,
-  H265_NAL_TYPE_BLA_W_LP = 16,
-  H265_NAL_TYPE_BLA_W_RADL = 17,
-  H265_NAL_TYPE_BLA_N_LP = 18,
-  H265_NAL_TYPE_IDR_W_RADL = 19,
-  H265_NAL_TYPE_IDR_N_LP = 20,
-  H265_NAL_TYPE_CRA_NUT = 21,
-  H265_NAL_TYPE_RSV_IRAP_VCL23 = 23,
-  H265_NAL_TYPE_VPS_NUT = 32,
-  H265_NAL_TYPE_SPS_NUT = 33,
-  H265_NAL_TYPE_PPS_NUT = 34,
-  H265_NAL_TYPE_AUD_NUT = 35,
-  H265_NAL_TYPE_EOS_NUT = 36,
-  H265_NAL_TYPE_EOB_NUT = 37,
-  H265_NAL_TYPE_FD_NUT = 38,
-  H265_NAL_TYPE_PREFIX_SEI_NUT = 39,
-  H265_NAL_TYPE_SUFFIX_SEI_NUT = 40
+#define H265_NAL_TYPE_ENUM(name, value) H265_NAL_TYPE_##name = value,
+  H265_NAL_TYPES(H265_NAL_TYPE_ENUM)
+#undef H265_NAL_TYPE_ENUM
 };
 
 const char *GetH265NalType(enum H265NalType val);
@@ -57,6 +63,12 @@ enum H265SampleRatio {
   EXTENDED_SAR = 255
 };
 
+// Annex D SEI payload types used by the parser
+enum H265SeiPayloadType {
+  H265_SEI_BUFFERING_PERIOD = 0,
+  H265_SEI_PIC_TIMING = 1
+};
+
 enum H265SliceType {
   H265_SLICE_TYPE_B = 0,
   H265_SLICE_TYPE_P = 1,
@@ -1,20 +1,36 @@
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
 #include <math.h>
+#include <time.h>
 #include "bitstream.h"
 #include "h265const.h"
 #include "output-context.h"
+#include "delta-output.h"
 #include "h265parser.h"
-
-struct h265_decode_t {
-  struct NalUnitHeader nal_unit_header;
-  struct H265VideoParameterSet video_param_set;
-  struct H265SeqParameterSet seq_param_set;
-  struct H265PicParameterSet pic_param_set;
-  struct H265SliceSegmentLayer slice_segment;
-};
+#include "h265-syntax.h"
+#include "h265-events.h"
+#include "hrd-simulator.h"
+#include "stream-stats.h"
+#include "segmenter.h"
+#include "ps-rewriter.h"
+#include "hvcc-writer.h"
+#include "slice-data.h"
+#include "checkpoint.h"
+#include "shm-ring.h"
+#include "parse-cache.h"
+#include "nal-filter.h"
+#include "au-timestamps.h"
+#include "seek-index.h"
+#include "nal-input.h"
+#include "ts-demux.h"
+#include "follow-input.h"
+#include "metrics.h"
+#include "generator.h"
+#include "bench.h"
+#include "perf-bench.h"
 
 int CeilLog2(uint64_t value) {
   // http://stackoverflow.com/a/3391294
@@ -89,10 +105,11 @@ uint32_t remove_03(uint8_t *r_ptr, uint32_t len) {
   uint8_t *ptr_end = r_ptr + len;
   while (r_ptr < ptr_end_padded) {
     if (r_ptr[0] == 0 && r_ptr[1] == 0 && r_ptr[2] == 3) {
+      // emulation_prevention_three_byte: keep the two zero bytes, drop 0x03
       removed++;
       r_ptr += 3;
-      w_ptr += 1;
-      *w_ptr++ = 3;
+      *w_ptr++ = 0;
+      *w_ptr++ = 0;
     } else {
       *w_ptr++ = *r_ptr++;
     }
@@ -103,16 +120,22 @@ uint32_t remove_03(uint8_t *r_ptr, uint32_t len) {
   return len - removed;
 }
 
+const char *h265_error_name(int err) {
+  static const char *kNames[H265_ERROR_TYPES] = {
+      "ok", "truncated", "invalid", "nal_header", "no_parameter_set"};
+  return err <= 0 && err > -H265_ERROR_TYPES ? kNames[-err] : "unknown";
+}
+
 int h265_nal_unit_header(struct h265_decode_t *dec, struct BitStream *bs,
                          struct OutputContextDict *out) {
   struct NalUnitHeader *head = &dec->nal_unit_header;
   if (BsRemain(bs) < 16) {
-    fprintf(stderr, "insufficient buffer");
-    return -1;
+    fprintf(stderr, "insufficient buffer\n");
+    return H265_ERR_TRUNCATED;
   }
   if (BsGet(bs, 1) != 0) {
-    fprintf(stderr, "nal_unit_header.forbidden_zero_bit != 0");
-    return -2;
+    fprintf(stderr, "nal_unit_header.forbidden_zero_bit != 0\n");
+    return H265_ERR_NAL_HEADER;
   }
   head->nal_unit_type = (enum H265NalType)BsGet(bs, 6);
   head->nuh_layer_id = BsGet(bs, 6);
@@ -121,822 +144,278 @@ int h265_nal_unit_header(struct h265_decode_t *dec, struct BitStream *bs,
                 head->nal_unit_type);
   out->put_uint(out, "nuh_layer_id", head->nuh_layer_id);
   out->put_uint(out, "nuh_temporal_id_plus1", head->nuh_temporal_id_plus1);
-  return 0;
-}
-
-int h265_profile_tier_level(uint8_t profilePresentFlag,
-                            uint8_t maxNumSubLayersMinus1,
-                            struct h265_decode_t *dec, struct BitStream *bs,
-                            struct OutputContextDict *out) {
-  // 7.3.3 Profile, tier and level syntax
-  int i, j;
-  uint8_t general_profile_idc;
-  struct H265ProfileTierLevelSubLayer sub_layer[8];
-  uint8_t general_profile_compatibility_flag[32];
-  if (profilePresentFlag) {
-    out->put_uint(out, "general_profile_space",
-                  general_profile_idc = BsGet(bs, 2));
-    out->put_uint(out, "general_tier_flag", BsGet(bs, 1));
-    out->put_uint(out, "general_profile_idc", BsGet(bs, 5));
-    for (j = 0; j < 32; j++) {
-      general_profile_compatibility_flag[j] = BsGet(bs, 1);
-    }
-    out->put_uint(out, "general_progressive_source_flag", BsGet(bs, 1));
-    out->put_uint(out, "general_interlaced_source_flag", BsGet(bs, 1));
-    out->put_uint(out, "general_non_packed_constraint_flag", BsGet(bs, 1));
-    out->put_uint(out, "general_frame_only_constraint_flag", BsGet(bs, 1));
-    if (general_profile_idc == 4 || general_profile_compatibility_flag[4] ||
-        general_profile_idc == 5 || general_profile_compatibility_flag[5] ||
-        general_profile_idc == 6 || general_profile_compatibility_flag[6] ||
-        general_profile_idc == 7 || general_profile_compatibility_flag[7]) {
-      /* The number of bits in this syntax structure is not affected by this
-       * condition */
-      out->put_uint(out, "general_max_12bit_constraint_flag", BsGet(bs, 1));
-      out->put_uint(out, "general_max_10bit_constraint_flag", BsGet(bs, 1));
-      out->put_uint(out, "general_max_8bit_constraint_flag", BsGet(bs, 1));
-      out->put_uint(out, "general_max_422chroma_constraint_flag", BsGet(bs, 1));
-      out->put_uint(out, "general_max_420chroma_constraint_flag", BsGet(bs, 1));
-      out->put_uint(out, "general_max_monochrome_constraint_flag",
-                    BsGet(bs, 1));
-      out->put_uint(out, "general_intra_constraint_flag", BsGet(bs, 1));
-      out->put_uint(out, "general_one_picture_only_constraint_flag",
-                    BsGet(bs, 1));
-      out->put_uint(out, "general_lower_bit_rate_constraint_flag",
-                    BsGet(bs, 1));
-      // uint8_t general_reserved_zero_34bits = BsGet(bs,34);
-      BsGet(bs, 2);
-      BsGet(bs, 32);
-    } else {
-      // uint8_t general_reserved_zero_43bits = BsGet(bs,43);
-      BsGet(bs, 11);
-      BsGet(bs, 32);
-    }
-    if ((general_profile_idc >= 1 && general_profile_idc <= 5) ||
-        general_profile_compatibility_flag[1] ||
-        general_profile_compatibility_flag[2] ||
-        general_profile_compatibility_flag[3] ||
-        general_profile_compatibility_flag[4] ||
-        general_profile_compatibility_flag[5]) {
-      /* The number of bits in this syntax structure is not affected by this
-       * condition */
-      out->put_uint(out, "general_inbld_flag", BsGet(bs, 1));
-    } else {
-      uint8_t general_reserved_zero_bit = BsGet(bs, 1);
-    }
+  if (head->nuh_temporal_id_plus1 == 0) {
+    fprintf(stderr, "nal_unit_header.nuh_temporal_id_plus1 == 0\n");
+    return H265_ERR_NAL_HEADER;
   }
-  uint8_t general_level_idc = BsGet(bs, 8);
-  for (i = 0; i < maxNumSubLayersMinus1; i++) {
-    // ============================
-    sub_layer[i].profile_present_flag = BsGet(bs, 1);
-    sub_layer[i].level_present_flag = BsGet(bs, 1);
-  }
-  if (maxNumSubLayersMinus1 > 0) {
-    for (i = maxNumSubLayersMinus1; i < 8; i++) {
-      uint8_t reserved_zero_2bits = BsGet(bs, 2);
-    }
-  }
-  for (i = 0; i < maxNumSubLayersMinus1; i++) {
-    if (sub_layer[i].profile_present_flag) {
-      sub_layer[i].profile_space = BsGet(bs, 2);
-      sub_layer[i].tier_flag = BsGet(bs, 1);
-      sub_layer[i].profile_idc = BsGet(bs, 5);
-      for (j = 0; j < 32; j++) {
-        sub_layer[i].profile_compatibility_flag[j] = BsGet(bs, 1);
-      }
-      sub_layer[i].progressive_source_flag = BsGet(bs, 1);
-      sub_layer[i].interlaced_source_flag = BsGet(bs, 1);
-      sub_layer[i].non_packed_constraint_flag = BsGet(bs, 1);
-      sub_layer[i].frame_only_constraint_flag = BsGet(bs, 1);
-      if (sub_layer[i].profile_idc == 4 ||
-          sub_layer[i].profile_compatibility_flag[4] ||
-          sub_layer[i].profile_idc == 5 ||
-          sub_layer[i].profile_compatibility_flag[5] ||
-          sub_layer[i].profile_idc == 6 ||
-          sub_layer[i].profile_compatibility_flag[6] ||
-          sub_layer[i].profile_idc == 7 ||
-          sub_layer[i].profile_compatibility_flag[7]) {
-        /* The number of bits in this syntax structure is not affected by this
-         * condition */
-        sub_layer[i].max_12bit_constraint_flag = BsGet(bs, 1);
-        sub_layer[i].max_10bit_constraint_flag = BsGet(bs, 1);
-        sub_layer[i].max_8bit_constraint_flag = BsGet(bs, 1);
-        sub_layer[i].max_422chroma_constraint_flag = BsGet(bs, 1);
-        sub_layer[i].max_420chroma_constraint_flag = BsGet(bs, 1);
-        sub_layer[i].max_monochrome_constraint_flag = BsGet(bs, 1);
-        sub_layer[i].intra_constraint_flag = BsGet(bs, 1);
-        sub_layer[i].one_picture_only_constraint_flag = BsGet(bs, 1);
-        sub_layer[i].lower_bit_rate_constraint_flag = BsGet(bs, 1);
-        // uint8_t general_reserved_zero_34bits = BsGet(bs,34);
-        BsGet(bs, 2);
-        BsGet(bs, 32);
-      } else {
-        // uint8_t general_reserved_zero_43bits = BsGet(bs,43);
-        BsGet(bs, 11);
-        BsGet(bs, 32);
-      }
-      if ((sub_layer[i].profile_idc >= 1 && sub_layer[i].profile_idc <= 5) ||
-          sub_layer[i].profile_compatibility_flag ||
-          sub_layer[i].profile_compatibility_flag ||
-          sub_layer[i].profile_compatibility_flag ||
-          sub_layer[i].profile_compatibility_flag ||
-          sub_layer[i].profile_compatibility_flag) {
-        /* The number of bits in this syntax structure is not affected by this
-         * condition */
-        sub_layer[i].inbld_flag = BsGet(bs, 1);
-      } else {
-        uint8_t reserved_zero_bit = BsGet(bs, 1);
-      }
-    }
-    if (sub_layer[i].level_present_flag)
-      sub_layer[i].level_idc = BsGet(bs, 8);
-  }
-
   return 0;
 }
 
-int h265_scaling_list_data(struct h265_decode_t *dec, struct BitStream *bs,
-                           struct OutputContextDict *out) {
-  int sizeId;
-  for (sizeId = 0; sizeId < 4; sizeId++) {
-    int matrixId;
-    for (matrixId = 0; matrixId < 6; matrixId += (sizeId == 3) ? 3 : 1) {
-      uint8_t scaling_list_pred_mode_flag = BsGet(bs, 1);
-      if (!scaling_list_pred_mode_flag) {
-        uint32_t scaling_list_pred_matrix_id_delta = BsUe(bs);
-      } else {
-        int coefNum = 1 << (4 + (sizeId << 1));
-        if (64 < coefNum)
-          coefNum = 64;
-        if (sizeId > 1) {
-          int32_t scaling_list_dc_coef_minus8 = BsSe(bs);
-        }
-        int i;
-        for (i = 0; i < coefNum; i++) {
-          int32_t scaling_list_delta_coef = BsSe(bs);
-        }
-      }
-    }
+static void h265_slice_plan_compile(struct h265_decode_t *dec) {
+  struct H265SlicePlan *plan = &dec->slice_plan;
+  struct H265SliceSegmentHeader *d = &plan->defaults;
+  const struct H265SeqParameterSet *sps = &dec->seq_param_set;
+  const struct H265PicParameterSet *pps = &dec->pic_param_set;
+  uint32_t present = 0;
+
+  if (pps->dependent_slice_segments_enabled_flag)
+    present |= H265_SLICE_HAS_DEPENDENT_SLICE_SEGMENT_FLAG;
+  if (pps->output_flag_present_flag)
+    present |= H265_SLICE_HAS_PIC_OUTPUT_FLAG;
+  if (sps->separate_colour_plane_flag == 1)
+    present |= H265_SLICE_HAS_COLOUR_PLANE_ID;
+  if (sps->num_short_term_ref_pic_sets > 1)
+    present |= H265_SLICE_HAS_SHORT_TERM_REF_PIC_SET_IDX;
+  if (sps->long_term_ref_pics_present_flag) {
+    present |= H265_SLICE_HAS_LONG_TERM_REF_PICS;
+    if (sps->num_long_term_ref_pics_sps > 0)
+      present |= H265_SLICE_HAS_NUM_LONG_TERM_SPS;
   }
-  return 0;
-};
+  if (sps->sps_temporal_mvp_enabled_flag)
+    present |= H265_SLICE_HAS_TEMPORAL_MVP;
+  if (sps->sample_adaptive_offset_enabled_flag) {
+    present |= H265_SLICE_HAS_SAO_LUMA;
+    if (sps->ChromaArrayType != 0)
+      present |= H265_SLICE_HAS_SAO_CHROMA;
+  }
+  if (pps->lists_modification_present_flag)
+    present |= H265_SLICE_HAS_LISTS_MODIFICATION;
+  if (pps->cabac_init_present_flag)
+    present |= H265_SLICE_HAS_CABAC_INIT_FLAG;
+  if (pps->weighted_pred_flag)
+    present |= H265_SLICE_HAS_PRED_WEIGHT_P;
+  if (pps->weighted_bipred_flag)
+    present |= H265_SLICE_HAS_PRED_WEIGHT_B;
+  if (pps->pps_slice_chroma_qp_offsets_present_flag)
+    present |= H265_SLICE_HAS_CHROMA_QP_OFFSETS;
+  if (pps->chroma_qp_offset_list_enabled_flag)
+    present |= H265_SLICE_HAS_CU_CHROMA_QP_OFFSET;
+  if (pps->deblocking_filter_override_enabled_flag)
+    present |= H265_SLICE_HAS_DEBLOCKING_OVERRIDE;
+  if (pps->pps_loop_filter_across_slices_enabled_flag)
+    present |= H265_SLICE_HAS_LOOP_FILTER_ACROSS;
+  if (pps->tiles_enabled_flag || pps->entropy_coding_sync_enabled_flag)
+    present |= H265_SLICE_HAS_ENTRY_POINTS;
+  if (pps->slice_segment_header_extension_present_flag)
+    present |= H265_SLICE_HAS_EXTENSION;
+  plan->present = present;
 
-int h265_ref_pic_set(uint32_t stRpsIdx, struct h265_decode_t *dec,
-                     struct BitStream *bs, struct OutputContextDict *out) {
-  uint8_t inter_ref_pic_set_prediction_flag = 0;
-  uint32_t i, j;
+  plan->slice_segment_address_bits = CeilLog2(sps->PicSizeInCtbsY);
+  plan->num_extra_slice_header_bits = pps->num_extra_slice_header_bits;
+  plan->slice_pic_order_cnt_lsb_bits =
+      sps->log2_max_pic_order_cnt_lsb_minus4 + 4;
+  plan->short_term_ref_pic_set_idx_bits =
+      sps->num_short_term_ref_pic_sets > 1
+          ? CeilLog2(sps->num_short_term_ref_pic_sets)
+          : 0;
+  plan->lt_idx_sps_bits = sps->num_long_term_ref_pics_sps > 1
+                              ? CeilLog2(sps->num_long_term_ref_pics_sps)
+                              : 0;
+  plan->num_short_term_ref_pic_sets = sps->num_short_term_ref_pic_sets;
+  plan->num_long_term_ref_pics_sps = sps->num_long_term_ref_pics_sps;
+  plan->max_long_term_pics =
+      sps->sps_max_dec_pic_buffering_minus1[sps->sps_max_sub_layers_minus1 %
+                                            H265_MAX_SUB_LAYERS];
+  if (plan->max_long_term_pics > H265_MAX_DPB_SIZE - 1)
+    plan->max_long_term_pics = H265_MAX_DPB_SIZE - 1;
+  if (pps->tiles_enabled_flag && pps->entropy_coding_sync_enabled_flag)
+    plan->max_entry_point_offsets =
+        (pps->num_tile_columns_minus1 + 1) * sps->PicHeightInCtbsY - 1;
+  else if (pps->tiles_enabled_flag)
+    plan->max_entry_point_offsets =
+        (pps->num_tile_columns_minus1 + 1) * (pps->num_tile_rows_minus1 + 1) -
+        1;
+  else
+    plan->max_entry_point_offsets = sps->PicHeightInCtbsY - 1;
 
-  if (stRpsIdx != 0)
-    inter_ref_pic_set_prediction_flag = BsGet(bs, 1);
-  if (inter_ref_pic_set_prediction_flag) {
-    if (stRpsIdx == dec->seq_param_set.num_short_term_ref_pic_sets) {
-      uint32_t delta_idx_minus1 = BsUe(bs);
-    }
-    uint8_t delta_rps_sign = BsGet(bs, 1);
-    uint32_t abs_delta_rps_minus1 = BsUe(bs);
-    fprintf(stderr, "Unimplemented ref_pic_set decoding.\n");
-    exit(-2);
-    /*
-    for (j = 0; j <= NumDeltaPocs[RefRpsIdx]; j++) {
-      uint8_t used_by_curr_pic_flag = BsGet(bs, 1);
-      if (!used_by_curr_pic_flag) {
-        uint8_t use_delta_flag = BsGet(bs, 1);
-      }
-    }
-    */
-  } else {
-    uint32_t num_negative_pics = BsUe(bs);
-    uint32_t num_positive_pics = BsUe(bs);
-    for (i = 0; i < num_negative_pics; i++) {
-      uint32_t delta_poc_s0_minus1 = BsUe(bs);
-      uint8_t used_by_curr_pic_s0_flag = BsGet(bs, 1);
-    }
-    for (i = 0; i < num_positive_pics; i++) {
-      uint32_t delta_poc_s1_minus1 = BsUe(bs);
-      uint8_t used_by_curr_pic_s1_flag = BsGet(bs, 1);
-    }
-  }
+  memset(d, 0, sizeof(*d));
+  d->pic_output_flag = 1;
+  d->num_ref_idx_l0_active_minus1 = pps->num_ref_idx_l0_default_active_minus1;
+  d->num_ref_idx_l1_active_minus1 = pps->num_ref_idx_l1_default_active_minus1;
+  d->collocated_from_l0_flag = 1;
+  d->slice_deblocking_filter_disabled_flag =
+      pps->pps_deblocking_filter_disabled_flag;
+  d->slice_beta_offset_div2 = pps->pps_beta_offset_div2;
+  d->slice_tc_offset_div2 = pps->pps_tc_offset_div2;
+  d->slice_loop_filter_across_slices_enabled_flag =
+      pps->pps_loop_filter_across_slices_enabled_flag;
+  plan->valid = 1;
+}
 
-  return 0;
+// (7-55) without pps_curr_pic_ref_enabled_flag; the long-term pictures are
+// added by the caller.
+static uint32_t h265_num_pic_total_curr(
+    const struct H265ShortTermRefPicSet *rps) {
+  uint32_t i, n = 0;
+  for (i = 0; i < rps->NumNegativePics && i < H265_MAX_DPB_SIZE; i++)
+    n += rps->UsedByCurrPicS0[i];
+  for (i = 0; i < rps->NumPositivePics && i < H265_MAX_DPB_SIZE; i++)
+    n += rps->UsedByCurrPicS1[i];
+  return n;
 }
 
-int h265_sub_layer_hrd_parameters(uint8_t subLayerId, uint32_t CpbCnt,
-                                  struct h265_decode_t *dec,
-                                  struct BitStream *bs,
-                                  struct OutputContextDict *out) {
-  uint32_t i;
-  //  CpbCnt is set equal to cpb_cnt_minus1[ subLayerId ]
-  for (i = 0; i <= CpbCnt; i++) {
-    uint32_t bit_rate_value_minus1 = BsUe(bs);
-    uint32_t cpb_size_value_minus1 = BsUe(bs);
-    if (dec->seq_param_set.vui_param.hrd_parameters
-            .sub_pic_hrd_params_present_flag) {
-      uint32_t cpb_size_du_value_minus1 = BsUe(bs);
-      uint32_t bit_rate_du_value_minus1 = BsUe(bs);
+// Size of the first |rbsp_size| bytes of |rbsp| with the emulation
+// prevention bytes the NAL unit had, as removed by remove_03.
+static uint32_t h265_escaped_size(const uint8_t *rbsp, uint32_t rbsp_size) {
+  uint32_t i, zeros = 0, escaped = rbsp_size;
+  for (i = 0; i < rbsp_size; i++) {
+    if (zeros >= 2 && rbsp[i] <= 3) {
+      escaped++;
+      zeros = 0;
     }
-    uint8_t cbr_flag = BsGet(bs, 1);
+    zeros = rbsp[i] == 0 ? zeros + 1 : 0;
   }
-  return 0;
+  return escaped;
 }
 
-int h265_hrd_parameters(uint8_t commonInfPresentFlag,
-                        uint8_t maxNumSubLayersMinus1,
-                        struct H265HrdParameters *hrd,
-                        struct h265_decode_t *dec, struct BitStream *bs,
-                        struct OutputContextDict *out) {
-  // E.2.2 HRD parameters syntax
-  int i;
-  if (commonInfPresentFlag) {
-    out->put_uint(out, "nal_hrd_parameters_present_flag",
-                  hrd->nal_hrd_parameters_present_flag = BsGet(bs, 1));
-    out->put_uint(out, "vcl_hrd_parameters_present_flag",
-                  hrd->vcl_hrd_parameters_present_flag = BsGet(bs, 1));
-    if (hrd->nal_hrd_parameters_present_flag ||
-        hrd->vcl_hrd_parameters_present_flag) {
-      out->put_uint(out, "sub_pic_hrd_params_present_flag",
-                    hrd->sub_pic_hrd_params_present_flag = BsGet(bs, 1));
-      if (hrd->sub_pic_hrd_params_present_flag) {
-        out->put_uint(out, "tick_divisor_minus2",
-                      hrd->tick_divisor_minus2 = BsGet(bs, 8));
-        out->put_uint(out, "du_cpb_removal_delay_increment_length_minus1",
-                      hrd->du_cpb_removal_delay_increment_length_minus1 =
-                          BsGet(bs, 5));
-        out->put_uint(out, "sub_pic_cpb_params_in_pic_timing_sei_flag",
-                      hrd->sub_pic_cpb_params_in_pic_timing_sei_flag =
-                          BsGet(bs, 1));
-        out->put_uint(out, "dpb_output_delay_du_length_minus1",
-                      hrd->dpb_output_delay_du_length_minus1 = BsGet(bs, 5));
-      }
-      out->put_uint(out, "bit_rate_scale", hrd->bit_rate_scale = BsGet(bs, 4));
-      out->put_uint(out, "cpb_size_scale", hrd->cpb_size_scale = BsGet(bs, 4));
-      if (hrd->sub_pic_hrd_params_present_flag) {
-        out->put_uint(out, "cpb_size_du_scale",
-                      hrd->cpb_size_du_scale = BsGet(bs, 4));
-      }
-      out->put_uint(out, "initial_cpb_removal_delay_length_minus1",
-                    hrd->initial_cpb_removal_delay_length_minus1 =
-                        BsGet(bs, 5));
-      out->put_uint(out, "au_cpb_removal_delay_length_minus1",
-                    hrd->au_cpb_removal_delay_length_minus1 = BsGet(bs, 5));
-      out->put_uint(out, "dpb_output_delay_length_minus1",
-                    hrd->dpb_output_delay_length_minus1 = BsGet(bs, 5));
-    }
-  }
-  for (i = 0; i <= maxNumSubLayersMinus1; i++) {
-    out->put_uint(out, "fixed_pic_rate_general_flag",
-                  hrd->fixed_pic_rate_general_flag = BsGet(bs, 1));
-    if (!hrd->fixed_pic_rate_general_flag) {
-      out->put_uint(out, "fixed_pic_rate_within_cvs_flag",
-                    hrd->fixed_pic_rate_within_cvs_flag = BsGet(bs, 1));
-    }
-    if (hrd->fixed_pic_rate_within_cvs_flag) {
-      out->put_uint(out, "elemental_duration_in_tc_minus1",
-                    hrd->elemental_duration_in_tc_minus1 = BsUe(bs));
-    } else {
-      out->put_uint(out, "low_delay_hrd_flag",
-                    hrd->low_delay_hrd_flag = BsGet(bs, 1));
-    }
-    if (!hrd->low_delay_hrd_flag) {
-      out->put_uint(out, "cpb_cnt_minus1", hrd->cpb_cnt_minus1 = BsUe(bs));
-    }
-    if (hrd->nal_hrd_parameters_present_flag) {
-      h265_sub_layer_hrd_parameters(i, hrd->cpb_cnt_minus1, dec, bs, out);
-    }
-    if (hrd->vcl_hrd_parameters_present_flag) {
-      h265_sub_layer_hrd_parameters(i, hrd->cpb_cnt_minus1, dec, bs, out);
+static void h265_ref_pic_lists_modification(
+    struct H265SliceSegmentHeader *ssh, struct BitStream *bs,
+    struct OutputContextDict *out) {
+  // 7.3.6.2 Reference picture list modification syntax
+  struct H265RefPicListsModification *m = &ssh->lists_modification;
+  struct OutputContextList list[1];
+  uint32_t bits = CeilLog2(ssh->NumPicTotalCurr), i;
+  out->put_uint(out, "ref_pic_list_modification_flag_l0",
+                m->ref_pic_list_modification_flag_l0 = BsGet(bs, 1));
+  if (m->ref_pic_list_modification_flag_l0) {
+    out->put_list(out, "list_entry_l0", list);
+    for (i = 0; i <= ssh->num_ref_idx_l0_active_minus1; i++) {
+      uint32_t entry = BsGet(bs, bits);
+      if (i < H265_MAX_REF_IDX)
+        m->list_entry_l0[i] = (uint8_t)entry;
+      list->put_uint(list, entry);
     }
+    list->end(list);
   }
-  return 0;
-}
-
-int h265_vui_parameters(struct h265_decode_t *dec, struct BitStream *bs,
-                        struct OutputContextDict *out) {
-  struct H265VuiParameters *vui = &dec->seq_param_set.vui_param;
-  out->put_uint(out, "aspect_ratio_info_present_flag",
-                vui->aspect_ratio_info_present_flag = BsGet(bs, 1));
-  if (vui->aspect_ratio_info_present_flag) {
-    out->put_uint(out, "aspect_ratio_idc",
-                  vui->aspect_ratio_idc = BsGet(bs, 8));
-    if (vui->aspect_ratio_idc == EXTENDED_SAR) {
-      out->put_uint(out, "sar_width", vui->sar_width = BsGet(bs, 16));
-      out->put_uint(out, "sar_height", vui->sar_height = BsGet(bs, 16));
-    }
-  }
-  out->put_uint(out, "overscan_info_present_flag",
-                vui->overscan_info_present_flag = BsGet(bs, 1));
-  if (vui->overscan_info_present_flag) {
-    out->put_uint(out, "overscan_appropriate_flag",
-                  vui->overscan_appropriate_flag = BsGet(bs, 1));
-  }
-  out->put_uint(out, "video_signal_type_present_flag",
-                vui->video_signal_type_present_flag = BsGet(bs, 1));
-  if (vui->video_signal_type_present_flag) {
-    out->put_uint(out, "video_format", vui->video_format = BsGet(bs, 3));
-    out->put_uint(out, "video_full_range_flag",
-                  vui->video_full_range_flag = BsGet(bs, 1));
-    out->put_uint(out, "colour_description_present_flag",
-                  vui->colour_description_present_flag = BsGet(bs, 1));
-    if (vui->colour_description_present_flag) {
-      out->put_uint(out, "colour_primaries",
-                    vui->colour_primaries = BsGet(bs, 8));
-      out->put_uint(out, "transfer_characteristics",
-                    vui->transfer_characteristics = BsGet(bs, 8));
-      out->put_uint(out, "matrix_coeffs", vui->matrix_coeffs = BsGet(bs, 8));
-    }
-  }
-  out->put_uint(out, "chroma_loc_info_present_flag",
-                vui->chroma_loc_info_present_flag = BsGet(bs, 1));
-  if (vui->chroma_loc_info_present_flag) {
-    out->put_uint(out, "chroma_sample_loc_type_top_field",
-                  vui->chroma_sample_loc_type_top_field = BsUe(bs));
-    out->put_uint(out, "chroma_sample_loc_type_bottom_field",
-                  vui->chroma_sample_loc_type_bottom_field = BsUe(bs));
-  }
-  out->put_uint(out, "neutral_chroma_indication_flag",
-                vui->neutral_chroma_indication_flag = BsGet(bs, 1));
-  out->put_uint(out, "field_seq_flag", vui->field_seq_flag = BsGet(bs, 1));
-  out->put_uint(out, "frame_field_info_present_flag",
-                vui->frame_field_info_present_flag = BsGet(bs, 1));
-  out->put_uint(out, "default_display_window_flag",
-                vui->default_display_window_flag = BsGet(bs, 1));
-  if (vui->default_display_window_flag) {
-    out->put_uint(out, "def_disp_win_left_offset",
-                  vui->def_disp_win_left_offset = BsUe(bs));
-    out->put_uint(out, "def_disp_win_right_offset",
-                  vui->def_disp_win_right_offset = BsUe(bs));
-    out->put_uint(out, "def_disp_win_top_offset",
-                  vui->def_disp_win_top_offset = BsUe(bs));
-    out->put_uint(out, "def_disp_win_bottom_offset",
-                  vui->def_disp_win_bottom_offset = BsUe(bs));
-  }
-  out->put_uint(out, "vui_timing_info_present_flag",
-                vui->vui_timing_info_present_flag = BsGet(bs, 1));
-  if (vui->vui_timing_info_present_flag) {
-    out->put_uint(out, "vui_num_units_in_tick",
-                  vui->vui_num_units_in_tick = BsGet(bs, 32));
-    out->put_uint(out, "vui_time_scale", vui->vui_time_scale = BsGet(bs, 32));
-    out->put_uint(out, "vui_poc_proportional_to_timing_flag",
-                  vui->vui_poc_proportional_to_timing_flag = BsGet(bs, 1));
-    if (vui->vui_poc_proportional_to_timing_flag) {
-      out->put_uint(out, "vui_num_ticks_poc_diff_one_minus1",
-                    vui->vui_num_ticks_poc_diff_one_minus1 = BsUe(bs));
+  if (ssh->slice_type != H265_SLICE_TYPE_B)
+    return;
+  out->put_uint(out, "ref_pic_list_modification_flag_l1",
+                m->ref_pic_list_modification_flag_l1 = BsGet(bs, 1));
+  if (m->ref_pic_list_modification_flag_l1) {
+    out->put_list(out, "list_entry_l1", list);
+    for (i = 0; i <= ssh->num_ref_idx_l1_active_minus1; i++) {
+      uint32_t entry = BsGet(bs, bits);
+      if (i < H265_MAX_REF_IDX)
+        m->list_entry_l1[i] = (uint8_t)entry;
+      list->put_uint(list, entry);
     }
-
-    out->put_uint(out, "vui_hrd_parameters_present_flag",
-                  vui->vui_hrd_parameters_present_flag = BsGet(bs, 1));
-    if (vui->vui_hrd_parameters_present_flag)
-      h265_hrd_parameters(1, dec->seq_param_set.sps_max_sub_layers_minus1,
-                          &dec->seq_param_set.vui_param.hrd_parameters, dec, bs,
-                          out);
-  }
-  out->put_uint(out, "bitstream_restriction_flag",
-                vui->bitstream_restriction_flag = BsGet(bs, 1));
-  if (vui->bitstream_restriction_flag) {
-    out->put_uint(out, "tiles_fixed_structure_flag",
-                  vui->tiles_fixed_structure_flag = BsGet(bs, 1));
-    out->put_uint(out, "motion_vectors_over_pic_boundaries_flag",
-                  vui->motion_vectors_over_pic_boundaries_flag = BsGet(bs, 1));
-    out->put_uint(out, "restricted_ref_pic_lists_flag",
-                  vui->restricted_ref_pic_lists_flag = BsGet(bs, 1));
-    out->put_uint(out, "min_spatial_segmentation_idc",
-                  vui->min_spatial_segmentation_idc = BsUe(bs));
-    out->put_uint(out, "max_bytes_per_pic_denom",
-                  vui->max_bytes_per_pic_denom = BsUe(bs));
-    out->put_uint(out, "max_bits_per_min_cu_denom",
-                  vui->max_bits_per_min_cu_denom = BsUe(bs));
-    out->put_uint(out, "log2_max_mv_length_horizontal",
-                  vui->log2_max_mv_length_horizontal = BsUe(bs));
-    out->put_uint(out, "log2_max_mv_length_vertical",
-                  vui->log2_max_mv_length_vertical = BsUe(bs));
+    list->end(list);
   }
-  return 0;
 }
 
-int h265_seq_parameter_set(struct h265_decode_t *dec, struct BitStream *bs,
-                           struct OutputContextDict *out) {
-  uint32_t i;
-  struct H265SeqParameterSet *sps = &dec->seq_param_set;
-  struct OutputContextDict subdict[1];
-  out->put_uint(out, "sps_video_parameter_set_id",
-                sps->sps_video_parameter_set_id = BsGet(bs, 4));
-  out->put_uint(out, "sps_max_sub_layers_minus1",
-                sps->sps_max_sub_layers_minus1 = BsGet(bs, 3));
-  out->put_uint(out, "sps_temporal_id_nesting_flag",
-                sps->sps_temporal_id_nesting_flag = BsGet(bs, 1));
-
-  out->put_dict(out, "profile_tier_level", subdict);
-  h265_profile_tier_level(1, sps->sps_max_sub_layers_minus1, dec, bs, subdict);
-  subdict->end(subdict);
-
-  out->put_uint(out, "sps_seq_parameter_set_id",
-                sps->sps_seq_parameter_set_id = BsUe(bs));
-  out->put_uint(out, "chroma_format_idc", sps->chroma_format_idc = BsUe(bs));
-  if (sps->chroma_format_idc == 3) {
-    out->put_uint(out, "separate_colour_plane_flag",
-                  sps->separate_colour_plane_flag = BsGet(bs, 1));
-  }
-  out->put_uint(out, "ChromaArrayType",
-                sps->ChromaArrayType = (sps->separate_colour_plane_flag == 0)
-                                           ? sps->chroma_format_idc
-                                           : 0);
-  out->put_uint(out, "pic_width_in_luma_samples",
-                sps->pic_width_in_luma_samples = BsUe(bs));
-  out->put_uint(out, "pic_height_in_luma_samples",
-                sps->pic_height_in_luma_samples = BsUe(bs));
-  out->put_uint(out, "conformance_window_flag",
-                sps->conformance_window_flag = BsGet(bs, 1));
-  if (sps->conformance_window_flag) {
-    out->put_uint(out, "conf_win_left_offset",
-                  sps->conf_win_left_offset = BsUe(bs));
-    out->put_uint(out, "conf_win_right_offset",
-                  sps->conf_win_right_offset = BsUe(bs));
-    out->put_uint(out, "conf_win_top_offset",
-                  sps->conf_win_top_offset = BsUe(bs));
-    out->put_uint(out, "conf_win_bottom_offset",
-                  sps->conf_win_bottom_offset = BsUe(bs));
-  }
-  out->put_uint(out, "bit_depth_luma_minus8",
-                sps->bit_depth_luma_minus8 = BsUe(bs));
-  out->put_uint(out, "bit_depth_chroma_minus8",
-                sps->bit_depth_chroma_minus8 = BsUe(bs));
-  out->put_uint(out, "log2_max_pic_order_cnt_lsb_minus4",
-                sps->log2_max_pic_order_cnt_lsb_minus4 = BsUe(bs));
-  out->put_uint(out, "sps_sub_layer_ordering_info_present_flag",
-                sps->sps_sub_layer_ordering_info_present_flag = BsGet(bs, 1));
-  for (i = (sps->sps_sub_layer_ordering_info_present_flag
-                ? 0
-                : dec->seq_param_set.sps_max_sub_layers_minus1);
-       i <= dec->seq_param_set.sps_max_sub_layers_minus1; i++) {
-    uint32_t sps_max_dec_pic_buffering_minus1 = BsUe(bs);
-    uint32_t sps_max_num_reorder_pics = BsUe(bs);
-    uint32_t sps_max_latency_increase_plus1 = BsUe(bs);
-  }
-  out->put_uint(out, "log2_min_luma_coding_block_size_minus3",
-                sps->log2_min_luma_coding_block_size_minus3 = BsUe(bs));
-  out->put_uint(out, "log2_diff_max_min_luma_coding_block_size",
-                sps->log2_diff_max_min_luma_coding_block_size = BsUe(bs));
-  out->put_uint(out, "log2_min_luma_transform_block_size_minus2",
-                sps->log2_min_luma_transform_block_size_minus2 = BsUe(bs));
-  out->put_uint(out, "log2_diff_max_min_luma_transform_block_size",
-                sps->log2_diff_max_min_luma_transform_block_size = BsUe(bs));
-  out->put_uint(out, "max_transform_hierarchy_depth_inter",
-                sps->max_transform_hierarchy_depth_inter = BsUe(bs));
-  out->put_uint(out, "max_transform_hierarchy_depth_intra",
-                sps->max_transform_hierarchy_depth_intra = BsUe(bs));
-  out->put_uint(out, "scaling_list_enabled_flag",
-                sps->scaling_list_enabled_flag = BsGet(bs, 1));
-  if (sps->scaling_list_enabled_flag) {
-    out->put_uint(out, "sps_scaling_list_data_present_flag",
-                  sps->sps_scaling_list_data_present_flag = BsGet(bs, 1));
-    if (sps->sps_scaling_list_data_present_flag) {
-      h265_scaling_list_data(dec, bs, out);
-    }
-  }
-  out->put_uint(out, "amp_enabled_flag", sps->amp_enabled_flag = BsGet(bs, 1));
-  out->put_uint(out, "sample_adaptive_offset_enabled_flag",
-                sps->sample_adaptive_offset_enabled_flag = BsGet(bs, 1));
-  out->put_uint(out, "pcm_enabled_flag", sps->pcm_enabled_flag = BsGet(bs, 1));
-  if (sps->pcm_enabled_flag) {
-    out->put_uint(out, "pcm_sample_bit_depth_luma_minus1",
-                  sps->pcm_sample_bit_depth_luma_minus1 = BsGet(bs, 4));
-
-    // ===========================
+static int h265_pred_weight_table(struct h265_decode_t *dec,
+                                  struct BitStream *bs,
+                                  struct OutputContextDict *out) {
+  // 7.3.6.3 Weighted prediction parameters syntax. Without a range
+  // extension high_precision_offsets_enabled_flag is 0, so offsets are in
+  // units of 8-bit samples.
+  static const char *kLists[2] = {"l0", "l1"};
+  static const char *kLumaFlags[2] = {"luma_weight_l0_flag",
+                                      "luma_weight_l1_flag"};
+  static const char *kChromaFlags[2] = {"chroma_weight_l0_flag",
+                                        "chroma_weight_l1_flag"};
+  static const char *kDeltaLuma[2] = {"delta_luma_weight_l0",
+                                      "delta_luma_weight_l1"};
+  static const char *kLumaOffset[2] = {"luma_offset_l0", "luma_offset_l1"};
+  static const char *kDeltaChroma[2] = {"delta_chroma_weight_l0",
+                                        "delta_chroma_weight_l1"};
+  static const char *kDeltaChromaOffset[2] = {"delta_chroma_offset_l0",
+                                              "delta_chroma_offset_l1"};
+  const int32_t half_range = 1 << 7;  // WpOffsetHalfRangeC
+  struct H265SliceSegmentHeader *ssh = &dec->slice_segment.header;
+  struct H265PredWeightTable *pwt = &ssh->pred_weight_table;
+  uint8_t chroma = dec->seq_param_set.ChromaArrayType != 0;
+  uint32_t lists = ssh->slice_type == H265_SLICE_TYPE_B ? 2 : 1;
+  uint32_t l, i, j, count[2];
+  int32_t delta_chroma_log2_weight_denom = 0;
 
-    out->put_uint(out, "pcm_sample_bit_depth_chroma_minus1",
-                  sps->pcm_sample_bit_depth_chroma_minus1 = BsGet(bs, 4));
-    out->put_uint(out, "log2_min_pcm_luma_coding_block_size_minus3",
-                  sps->log2_min_pcm_luma_coding_block_size_minus3 = BsUe(bs));
-    out->put_uint(out, "log2_diff_max_min_pcm_luma_coding_block_size",
-                  sps->log2_diff_max_min_pcm_luma_coding_block_size = BsUe(bs));
-    out->put_uint(out, "pcm_loop_filter_disabled_flag",
-                  sps->pcm_loop_filter_disabled_flag = BsGet(bs, 1));
-  }
-  sps->num_short_term_ref_pic_sets = BsUe(bs);
-  out->put_uint(out, "num_short_term_ref_pic_sets",
-                sps->num_short_term_ref_pic_sets);
-  for (i = 0; i < sps->num_short_term_ref_pic_sets; i++) {
-    // TODO: phrase st_ref_pic_set
-    // st_ref_pic_set(i);
-  }
-  out->put_uint(out, "long_term_ref_pics_present_flag",
-                sps->long_term_ref_pics_present_flag = BsGet(bs, 1));
-  if (sps->long_term_ref_pics_present_flag) {
-    out->put_uint(out, "num_long_term_ref_pics_sps",
-                  sps->num_long_term_ref_pics_sps = BsUe(bs));
-    for (i = 0; i < sps->num_long_term_ref_pics_sps; i++) {
-      uint32_t lt_ref_pic_poc_lsb_sps =
-          BsGet(bs, sps->log2_max_pic_order_cnt_lsb_minus4 + 4);
-      uint8_t used_by_curr_pic_lt_sps_flag = BsGet(bs, 1);
-    }
-  }
-  out->put_uint(out, "sps_temporal_mvp_enabled_flag",
-                sps->sps_temporal_mvp_enabled_flag = BsGet(bs, 1));
-  out->put_uint(out, "strong_intra_smoothing_enabled_flag",
-                sps->strong_intra_smoothing_enabled_flag = BsGet(bs, 1));
-  out->put_uint(out, "vui_parameters_present_flag",
-                sps->vui_parameters_present_flag = BsGet(bs, 1));
-  if (sps->vui_parameters_present_flag) {
-    out->put_dict(out, "vui_parameters", subdict);
-    h265_vui_parameters(dec, bs, subdict);
-    subdict->end(subdict);
+  count[0] = ssh->num_ref_idx_l0_active_minus1 + 1;
+  count[1] = ssh->num_ref_idx_l1_active_minus1 + 1;
+  if (count[0] > H265_MAX_REF_IDX || count[1] > H265_MAX_REF_IDX) {
+    fprintf(stderr, "num_ref_idx_active_minus1 out of range\n");
+    return H265_ERR_INVALID;
   }
-  out->put_uint(out, "sps_extension_present_flag",
-                sps->sps_extension_present_flag = BsGet(bs, 1));
-  if (sps->sps_extension_present_flag) {
-    uint8_t sps_range_extension_flag = BsGet(bs, 1);
-    uint8_t sps_multilayer_extension_flag = BsGet(bs, 1);
-    uint8_t sps_extension_6bits = BsGet(bs, 6);
-  }
-  /*
-  if (sps_range_extension_flag)
-    sps_range_extension()
-    if (sps_multilayer_extension_flag)
-      sps_multilayer_extension() // specified in Annex F
-      if (sps_extension_6bits)
-        while (more_rbsp_data())
-          uint8_t sps_extension_data_flag = BsGet(bs, 1);
-  rbsp_trailing_bits()
-  */
-
-  // =======================
-  // P20, Table 6-1
-  if (sps->separate_colour_plane_flag == 0) {
-    switch (sps->chroma_format_idc) {
-    case 0:
-      sps->SubWidthC = 1;
-      sps->SubHeightC = 1;
-      break;
-    case 1:
-      sps->SubWidthC = 2;
-      sps->SubHeightC = 2;
-      break;
-    case 2:
-      sps->SubWidthC = 2;
-      sps->SubHeightC = 1;
-      break;
-    case 3:
-      sps->SubWidthC = 1;
-      sps->SubHeightC = 1;
-      break;
-    }
-  } else if (sps->separate_colour_plane_flag == 1 &&
-             sps->chroma_format_idc == 3) {
-    sps->SubWidthC = 1;
-    sps->SubHeightC = 1;
+  out->put_uint(out, "luma_log2_weight_denom",
+                pwt->luma_log2_weight_denom = BsUe(bs));
+  if (chroma) {
+    out->put_int(out, "delta_chroma_log2_weight_denom",
+                 delta_chroma_log2_weight_denom = BsSe(bs));
   }
-  out->put_uint(out, "SubWidthC", sps->SubWidthC);
-  out->put_uint(out, "SubHeightC", sps->SubHeightC);
-
-  // P74, (7-10) ~ (7-22)
-  sps->MinCbLog2SizeY = sps->log2_min_luma_coding_block_size_minus3 + 3;
-  sps->CtbLog2SizeY =
-      sps->MinCbLog2SizeY + sps->log2_diff_max_min_luma_coding_block_size;
-  sps->MinCbSizeY = 1 << sps->MinCbLog2SizeY;
-  sps->CtbSizeY = 1 << sps->CtbLog2SizeY;
-  sps->PicWidthInMinCbsY = sps->pic_width_in_luma_samples / sps->MinCbSizeY;
-  sps->PicWidthInCtbsY =
-      (uint32_t)ceil(1.0 * sps->pic_width_in_luma_samples / sps->CtbSizeY);
-  sps->PicHeightInMinCbsY = sps->pic_height_in_luma_samples / sps->MinCbSizeY;
-  sps->PicHeightInCtbsY =
-      (uint32_t)ceil(1.0 * sps->pic_height_in_luma_samples / sps->CtbSizeY);
-  sps->PicSizeInMinCbsY = sps->PicWidthInMinCbsY * sps->PicHeightInMinCbsY;
-  sps->PicSizeInCtbsY = sps->PicWidthInCtbsY * sps->PicHeightInCtbsY;
-  sps->PicSizeInSamplesY =
-      sps->pic_width_in_luma_samples * sps->pic_height_in_luma_samples;
-  sps->PicWidthInSamplesC = sps->pic_width_in_luma_samples / sps->SubWidthC;
-  sps->PicHeightInSamplesC = sps->pic_height_in_luma_samples / sps->SubHeightC;
-  out->put_uint(out, "MinCbLog2SizeY", sps->MinCbLog2SizeY);
-  out->put_uint(out, "CtbLog2SizeY", sps->CtbLog2SizeY);
-  out->put_uint(out, "MinCbSizeY", sps->MinCbSizeY);
-  out->put_uint(out, "CtbSizeY", sps->CtbSizeY);
-  out->put_uint(out, "PicWidthInMinCbsY", sps->PicWidthInMinCbsY);
-  out->put_uint(out, "PicWidthInCtbsY", sps->PicWidthInCtbsY);
-  out->put_uint(out, "PicHeightInMinCbsY", sps->PicHeightInMinCbsY);
-  out->put_uint(out, "PicHeightInCtbsY", sps->PicHeightInCtbsY);
-  out->put_uint(out, "PicSizeInMinCbsY", sps->PicSizeInMinCbsY);
-  out->put_uint(out, "PicSizeInCtbsY", sps->PicSizeInCtbsY);
-  out->put_uint(out, "PicSizeInSamplesY", sps->PicSizeInSamplesY);
-  out->put_uint(out, "PicWidthInSamplesC", sps->PicWidthInSamplesC);
-  out->put_uint(out, "PicHeightInSamplesC", sps->PicHeightInSamplesC);
-  return 0;
-}
-
-int h265_video_parameter_set(struct h265_decode_t *dec, struct BitStream *bs,
-                             struct OutputContextDict *out) {
-  uint32_t i, j;
-  struct H265VideoParameterSet *vps = &dec->video_param_set;
-  out->put_uint(out, "vps_video_parameter_set_id",
-                vps->vps_video_parameter_set_id = BsGet(bs, 4));
-  out->put_uint(out, "vps_base_layer_internal_flag",
-                vps->vps_base_layer_internal_flag = BsGet(bs, 1));
-  out->put_uint(out, "vps_base_layer_available_flag",
-                vps->vps_base_layer_available_flag = BsGet(bs, 1));
-  out->put_uint(out, "vps_max_layers_minus1",
-                vps->vps_max_layers_minus1 = BsGet(bs, 6));
-  out->put_uint(out, "vps_max_sub_layers_minus1",
-                vps->vps_max_sub_layers_minus1 = BsGet(bs, 3));
-  out->put_uint(out, "vps_temporal_id_nesting_flag",
-                vps->vps_temporal_id_nesting_flag = BsGet(bs, 1));
-  out->put_hex(out, "vps_reserved_0xffff_16bits",
-               vps->vps_reserved_0xffff_16bits = BsGet(bs, 16));
-  h265_profile_tier_level(1, vps->vps_max_sub_layers_minus1, dec, bs, out);
-  out->put_uint(out, "vps_sub_layer_ordering_info_present_flag",
-                vps->vps_sub_layer_ordering_info_present_flag = BsGet(bs, 1));
-
-  for (i = (vps->vps_sub_layer_ordering_info_present_flag
-                ? 0
-                : vps->vps_max_sub_layers_minus1);
-       i <= vps->vps_max_sub_layers_minus1; i++) {
-    uint32_t vps_max_dec_pic_buffering_minus1 = BsUe(bs);
-    uint32_t vps_max_num_reorder_pics = BsUe(bs);
-    uint32_t vps_max_latency_increase_plus1 = BsUe(bs);
-  }
-  out->put_uint(out, "vps_max_layer_id", vps->vps_max_layer_id = BsGet(bs, 6));
-  out->put_uint(out, "vps_num_layer_sets_minus1",
-                vps->vps_num_layer_sets_minus1 = BsUe(bs));
-  for (i = 1; i <= vps->vps_num_layer_sets_minus1; i++) {
-    for (j = 0; j <= vps->vps_max_layer_id; j++) {
-      uint8_t layer_id_included_flag = BsGet(bs, 1);
-    }
-  }
-  out->put_uint(out, "vps_timing_info_present_flag",
-                vps->vps_timing_info_present_flag = BsGet(bs, 1));
-  if (vps->vps_timing_info_present_flag) {
-    out->put_uint(out, "vps_num_units_in_tick",
-                  vps->vps_num_units_in_tick = BsGet(bs, 32));
-    out->put_uint(out, "vps_time_scale", vps->vps_time_scale = BsGet(bs, 32));
-    out->put_uint(out, "vps_poc_proportional_to_timing_flag",
-                  vps->vps_poc_proportional_to_timing_flag = BsGet(bs, 1));
-    if (vps->vps_poc_proportional_to_timing_flag) {
-      out->put_uint(out, "vps_num_ticks_poc_diff_one_minus1",
-                    vps->vps_num_ticks_poc_diff_one_minus1 = BsUe(bs));
-    }
-    out->put_uint(out, "vps_num_hrd_parameters",
-                  vps->vps_num_hrd_parameters = BsUe(bs));
-
-    struct OutputContextList list[1];
-    out->put_list(out, "hrd_parameters", list);
-    for (i = 0; i < vps->vps_num_hrd_parameters; i++) {
-      uint8_t hrd_layer_set_idx = BsUe(bs);
-      uint8_t cprms_present_flag = 0;
-      if (i > 0) {
-        cprms_present_flag = BsGet(bs, 1);
-      }
-      struct H265HrdParameters hrd;
-      struct OutputContextDict subdict[1];
-      list->put_dict(list, subdict);
-      h265_hrd_parameters(cprms_present_flag, vps->vps_max_sub_layers_minus1,
-                          &hrd, dec, bs, subdict);
-      subdict->end(subdict);
-    }
-    list->end(list);
+  if (pwt->luma_log2_weight_denom > 7 ||
+      pwt->luma_log2_weight_denom + delta_chroma_log2_weight_denom < 0 ||
+      pwt->luma_log2_weight_denom + delta_chroma_log2_weight_denom > 7) {
+    fprintf(stderr, "pred_weight_table weight denominator out of range\n");
+    return H265_ERR_INVALID;
   }
-  out->put_uint(out, "vps_extension_flag",
-                vps->vps_extension_flag = BsGet(bs, 1));
-  return 0;
-}
+  pwt->ChromaLog2WeightDenom =
+      (uint8_t)(pwt->luma_log2_weight_denom + delta_chroma_log2_weight_denom);
 
-int h265_pps_range_extension(struct h265_decode_t *dec, struct BitStream *bs,
-                             struct OutputContextDict *out) {
-  uint32_t i;
-  struct H265PicParameterSet *pps = &dec->pic_param_set;
-  if (pps->transform_skip_enabled_flag) {
-    out->put_uint(out, "log2_max_transform_skip_block_size_minus2",
-                  pps->log2_max_transform_skip_block_size_minus2 = BsUe(bs));
-  }
-  out->put_uint(out, "cross_component_prediction_enabled_flag",
-                pps->cross_component_prediction_enabled_flag = BsGet(bs, 1));
-  out->put_uint(out, "chroma_qp_offset_list_enabled_flag",
-                pps->chroma_qp_offset_list_enabled_flag = BsGet(bs, 1));
-  if (pps->chroma_qp_offset_list_enabled_flag) {
-    out->put_uint(out, "diff_cu_chroma_qp_offset_depth",
-                  pps->diff_cu_chroma_qp_offset_depth = BsUe(bs));
-    out->put_uint(out, "chroma_qp_offset_list_len_minus1",
-                  pps->chroma_qp_offset_list_len_minus1 = BsUe(bs));
-    for (i = 0; i <= pps->chroma_qp_offset_list_len_minus1; i++) {
-      int32_t cb_qp_offset_list = BsSe(bs);
-      int32_t cr_qp_offset_list = BsSe(bs);
-    }
-  }
-  out->put_uint(out, "log2_sao_offset_scale_luma",
-                pps->log2_sao_offset_scale_luma = BsUe(bs));
-  out->put_uint(out, "log2_sao_offset_scale_chroma",
-                pps->log2_sao_offset_scale_chroma = BsUe(bs));
-  return 0;
-}
+  for (l = 0; l < lists; l++) {
+    struct OutputContextList list[1], values[1];
+    struct OutputContextDict entry[1];
+    // every reference picture of a single layer stream differs from the
+    // current picture, so the flags are always present
+    pwt->luma_weight_flag[l] = 0;
+    pwt->chroma_weight_flag[l] = 0;
+    for (i = 0; i < count[l]; i++)
+      pwt->luma_weight_flag[l] |= (uint16_t)(BsGet(bs, 1) << i);
+    for (i = 0; chroma && i < count[l]; i++)
+      pwt->chroma_weight_flag[l] |= (uint16_t)(BsGet(bs, 1) << i);
 
-int h265_pic_parameter_set(struct h265_decode_t *dec, struct BitStream *bs,
-                           struct OutputContextDict *out) {
-  uint32_t i;
-  struct H265PicParameterSet *pps = &dec->pic_param_set;
-  out->put_uint(out, "pps_pic_parameter_set_id",
-                pps->pps_pic_parameter_set_id = BsUe(bs));
-  out->put_uint(out, "pps_seq_parameter_set_id",
-                pps->pps_seq_parameter_set_id = BsUe(bs));
-  out->put_uint(out, "dependent_slice_segments_enabled_flag",
-                pps->dependent_slice_segments_enabled_flag = BsGet(bs, 1));
-  out->put_uint(out, "output_flag_present_flag",
-                pps->output_flag_present_flag = BsGet(bs, 1));
-  out->put_uint(out, "num_extra_slice_header_bits",
-                pps->num_extra_slice_header_bits = BsGet(bs, 3));
-  out->put_uint(out, "sign_data_hiding_enabled_flag",
-                pps->sign_data_hiding_enabled_flag = BsGet(bs, 1));
-  out->put_uint(out, "cabac_init_present_flag",
-                pps->cabac_init_present_flag = BsGet(bs, 1));
-  out->put_uint(out, "num_ref_idx_l0_default_active_minus1",
-                pps->num_ref_idx_l0_default_active_minus1 = BsUe(bs));
-  out->put_uint(out, "num_ref_idx_l1_default_active_minus1",
-                pps->num_ref_idx_l1_default_active_minus1 = BsUe(bs));
-  out->put_int(out, "init_qp_minus26", pps->init_qp_minus26 = BsSe(bs));
-  out->put_uint(out, "constrained_intra_pred_flag",
-                pps->constrained_intra_pred_flag = BsGet(bs, 1));
-  out->put_uint(out, "transform_skip_enabled_flag",
-                pps->transform_skip_enabled_flag = BsGet(bs, 1));
-  out->put_uint(out, "cu_qp_delta_enabled_flag",
-                pps->cu_qp_delta_enabled_flag = BsGet(bs, 1));
-  if (pps->cu_qp_delta_enabled_flag) {
-    out->put_uint(out, "diff_cu_qp_delta_depth",
-                  pps->diff_cu_qp_delta_depth = BsUe(bs));
-  }
-  out->put_int(out, "pps_cb_qp_offset", pps->pps_cb_qp_offset = BsSe(bs));
-  out->put_int(out, "pps_cr_qp_offset", pps->pps_cr_qp_offset = BsSe(bs));
-  out->put_uint(out, "pps_slice_chroma_qp_offsets_present_flag",
-                pps->pps_slice_chroma_qp_offsets_present_flag = BsGet(bs, 1));
-  out->put_uint(out, "weighted_pred_flag",
-                pps->weighted_pred_flag = BsGet(bs, 1));
-  out->put_uint(out, "weighted_bipred_flag",
-                pps->weighted_bipred_flag = BsGet(bs, 1));
-  out->put_uint(out, "transquant_bypass_enabled_flag",
-                pps->transquant_bypass_enabled_flag = BsGet(bs, 1));
-  out->put_uint(out, "tiles_enabled_flag",
-                pps->tiles_enabled_flag = BsGet(bs, 1));
-  out->put_uint(out, "entropy_coding_sync_enabled_flag",
-                pps->entropy_coding_sync_enabled_flag = BsGet(bs, 1));
-  if (pps->tiles_enabled_flag) {
-    out->put_uint(out, "num_tile_columns_minus1",
-                  pps->num_tile_columns_minus1 = BsUe(bs));
-    out->put_uint(out, "num_tile_rows_minus1",
-                  pps->num_tile_rows_minus1 = BsUe(bs));
-    out->put_uint(out, "uniform_spacing_flag",
-                  pps->uniform_spacing_flag = BsGet(bs, 1));
-    if (!pps->uniform_spacing_flag) {
-      for (i = 0; i < pps->num_tile_columns_minus1; i++) {
-        uint32_t column_width_minus1 = BsUe(bs);
+    out->put_list(out, kLists[l], list);
+    for (i = 0; i < count[l]; i++) {
+      list->put_dict(list, entry);
+      pwt->LumaWeight[l][i] = (int16_t)(1 << pwt->luma_log2_weight_denom);
+      pwt->luma_offset[l][i] = 0;
+      entry->put_uint(entry, kLumaFlags[l],
+                      (pwt->luma_weight_flag[l] >> i) & 1);
+      if (chroma) {
+        entry->put_uint(entry, kChromaFlags[l],
+                        (pwt->chroma_weight_flag[l] >> i) & 1);
+      }
+      if ((pwt->luma_weight_flag[l] >> i) & 1) {
+        int32_t delta = BsSe(bs), offset;
+        entry->put_int(entry, kDeltaLuma[l], delta);
+        entry->put_int(entry, kLumaOffset[l], offset = BsSe(bs));
+        pwt->LumaWeight[l][i] += (int16_t)delta;
+        pwt->luma_offset[l][i] = (int16_t)offset;
       }
-      for (i = 0; i < pps->num_tile_rows_minus1; i++) {
-        uint32_t row_height_minus1 = BsUe(bs);
+      for (j = 0; j < 2; j++) {
+        pwt->ChromaWeight[l][i][j] =
+            (int16_t)(1 << pwt->ChromaLog2WeightDenom);
+        pwt->ChromaOffset[l][i][j] = 0;
       }
+      if (chroma && ((pwt->chroma_weight_flag[l] >> i) & 1)) {
+        int32_t delta_weight[2], delta_offset[2];
+        for (j = 0; j < 2; j++) {
+          delta_weight[j] = BsSe(bs);
+          delta_offset[j] = BsSe(bs);
+        }
+        entry->put_list(entry, kDeltaChroma[l], values);
+        for (j = 0; j < 2; j++)
+          values->put_int(values, delta_weight[j]);
+        values->end(values);
+        entry->put_list(entry, kDeltaChromaOffset[l], values);
+        for (j = 0; j < 2; j++)
+          values->put_int(values, delta_offset[j]);
+        values->end(values);
+        for (j = 0; j < 2; j++) {
+          // (7-56), (7-60)
+          int32_t w = (1 << pwt->ChromaLog2WeightDenom) + delta_weight[j];
+          int32_t o = half_range -
+                      ((half_range * w) >> pwt->ChromaLog2WeightDenom) +
+                      delta_offset[j];
+          pwt->ChromaWeight[l][i][j] = (int16_t)w;
+          pwt->ChromaOffset[l][i][j] =
+              (int16_t)(o < -half_range
+                            ? -half_range
+                            : o > half_range - 1 ? half_range - 1 : o);
+        }
+      }
+      entry->end(entry);
     }
-    out->put_uint(out, "loop_filter_across_tiles_enabled_flag",
-                  pps->loop_filter_across_tiles_enabled_flag = BsGet(bs, 1));
-  }
-  out->put_uint(out, "pps_loop_filter_across_slices_enabled_flag",
-                pps->pps_loop_filter_across_slices_enabled_flag = BsGet(bs, 1));
-  out->put_uint(out, "deblocking_filter_control_present_flag",
-                pps->deblocking_filter_control_present_flag = BsGet(bs, 1));
-  if (pps->deblocking_filter_control_present_flag) {
-    out->put_uint(out, "deblocking_filter_override_enabled_flag",
-                  pps->deblocking_filter_override_enabled_flag = BsGet(bs, 1));
-    out->put_uint(out, "pps_deblocking_filter_disabled_flag",
-                  pps->pps_deblocking_filter_disabled_flag = BsGet(bs, 1));
-    if (!pps->pps_deblocking_filter_disabled_flag) {
-      out->put_int(out, "pps_beta_offset_div2",
-                   pps->pps_beta_offset_div2 = BsSe(bs));
-      out->put_int(out, "pps_tc_offset_div2",
-                   pps->pps_tc_offset_div2 = BsSe(bs));
-    }
-  }
-  out->put_uint(out, "pps_scaling_list_data_present_flag",
-                pps->pps_scaling_list_data_present_flag = BsGet(bs, 1));
-  if (pps->pps_scaling_list_data_present_flag) {
-    h265_scaling_list_data(dec, bs, out);
-  }
-  out->put_uint(out, "lists_modification_present_flag",
-                pps->lists_modification_present_flag = BsGet(bs, 1));
-  out->put_uint(out, "log2_parallel_merge_level_minus2",
-                pps->log2_parallel_merge_level_minus2 = BsUe(bs));
-  out->put_uint(out, "slice_segment_header_extension_present_flag",
-                pps->slice_segment_header_extension_present_flag =
-                    BsGet(bs, 1));
-  out->put_uint(out, "pps_extension_present_flag",
-                pps->pps_extension_present_flag = BsGet(bs, 1));
-  if (pps->pps_extension_present_flag) {
-    out->put_uint(out, "pps_range_extension_flag",
-                  pps->pps_range_extension_flag = BsGet(bs, 1));
-    out->put_uint(out, "pps_multilayer_extension_flag",
-                  pps->pps_multilayer_extension_flag = BsGet(bs, 1));
-    out->put_uint(out, "pps_extension_6bits",
-                  pps->pps_extension_6bits = BsGet(bs, 6));
-  }
-  if (pps->pps_range_extension_flag)
-    h265_pps_range_extension(dec, bs, out);
-  /*
-  if( pps_multilayer_extension_flag )
-  pps_multilayer_extension();  // specified in Annex F
-  if( pps_extension_6bits )
-  while( more_rbsp_data( ) )
-  out->put_uint(out, "pps_extension_data_flag", pps->pps_extension_data_flag
-  =BsGet(bs, 1));
-  */
+    list->end(list);
+  }
   return 0;
 }
 
@@ -944,11 +423,18 @@ int h265_slice_segment_header(struct h265_decode_t *dec, struct BitStream *bs,
                               struct OutputContextDict *out) {
   uint32_t i;
   struct H265SliceSegmentHeader *ssh = &dec->slice_segment.header;
-  struct H265SeqParameterSet *sps = &dec->seq_param_set;
-  struct H265PicParameterSet *pps = &dec->pic_param_set;
+  const struct H265SlicePlan *plan = &dec->slice_plan;
+  uint32_t has;
 
   uint8_t nal_unit_type = dec->nal_unit_header.nal_unit_type;
 
+  if (!plan->valid)
+    h265_slice_plan_compile(dec);
+  has = plan->present;
+
+  ssh->dependent_slice_segment_flag = 0;
+  ssh->slice_segment_address = 0;
+  ssh->slice_data_bit_offset = 0;
   out->put_uint(out, "first_slice_segment_in_pic_flag",
                 ssh->first_slice_segment_in_pic_flag = BsGet(bs, 1));
   if (nal_unit_type >= H265_NAL_TYPE_BLA_W_LP &&
@@ -959,24 +445,29 @@ int h265_slice_segment_header(struct h265_decode_t *dec, struct BitStream *bs,
   out->put_uint(out, "slice_pic_parameter_set_id",
                 ssh->slice_pic_parameter_set_id = BsUe(bs));
   if (!ssh->first_slice_segment_in_pic_flag) {
-    if (dec->pic_param_set.dependent_slice_segments_enabled_flag) {
+    if (has & H265_SLICE_HAS_DEPENDENT_SLICE_SEGMENT_FLAG) {
       out->put_uint(out, "dependent_slice_segment_flag",
                     ssh->dependent_slice_segment_flag = BsGet(bs, 1));
     }
     out->put_uint(out, "slice_segment_address",
                   ssh->slice_segment_address =
-                      BsGet(bs, CeilLog2(sps->PicSizeInCtbsY)));
+                      BsGet(bs, plan->slice_segment_address_bits));
   }
   if (!ssh->dependent_slice_segment_flag) {
-    for (i = 0; i < pps->num_extra_slice_header_bits; i++) {
-      uint8_t slice_reserved_flag = BsGet(bs, 1);
+    memcpy(&ssh->slice_type, &plan->defaults.slice_type,
+           offsetof(struct H265SliceSegmentHeader, st_ref_pic_set) -
+               offsetof(struct H265SliceSegmentHeader, slice_type));
+    ssh->NumPicTotalCurr = 0;
+    if (plan->num_extra_slice_header_bits) {
+      // slice_reserved_flag[]
+      BsGet(bs, plan->num_extra_slice_header_bits);
     }
     out->put_uint(out, "slice_type", ssh->slice_type = BsUe(bs));
-    if (pps->output_flag_present_flag) {
+    if (has & H265_SLICE_HAS_PIC_OUTPUT_FLAG) {
       out->put_uint(out, "pic_output_flag",
                     ssh->pic_output_flag = BsGet(bs, 1));
     }
-    if (sps->separate_colour_plane_flag == 1) {
+    if (has & H265_SLICE_HAS_COLOUR_PLANE_ID) {
       out->put_uint(out, "colour_plane_id",
                     ssh->colour_plane_id = BsGet(bs, 2));
     }
@@ -984,35 +475,62 @@ int h265_slice_segment_header(struct h265_decode_t *dec, struct BitStream *bs,
         nal_unit_type != H265_NAL_TYPE_IDR_N_LP) {
       out->put_uint(out, "slice_pic_order_cnt_lsb",
                     ssh->slice_pic_order_cnt_lsb =
-                        BsGet(bs, sps->log2_max_pic_order_cnt_lsb_minus4 + 4));
+                        BsGet(bs, plan->slice_pic_order_cnt_lsb_bits));
       out->put_uint(out, "short_term_ref_pic_set_sps_flag",
                     ssh->short_term_ref_pic_set_sps_flag = BsGet(bs, 1));
       if (!ssh->short_term_ref_pic_set_sps_flag) {
-        fprintf(stderr, "Unimplement st_ref_pic_set\n");
-        return -2;
-        // st_ref_pic_set(sps->num_short_term_ref_pic_sets);
-      } else if (sps->num_short_term_ref_pic_sets > 1) {
+        struct OutputContextDict subdict[1];
+        int err;
+        out->put_dict(out, "st_ref_pic_set", subdict);
+        METRICS_FUNC(METRICS_FN_REF_PIC_SET,
+                     err = h265_ref_pic_set(plan->num_short_term_ref_pic_sets,
+                                            &ssh->st_ref_pic_set, dec, bs,
+                                            subdict));
+        subdict->end(subdict);
+        if (err)
+          return err;
+      } else if (has & H265_SLICE_HAS_SHORT_TERM_REF_PIC_SET_IDX) {
         out->put_uint(out, "short_term_ref_pic_set_idx",
-                      ssh->short_term_ref_pic_set_idx = BsGet(
-                          bs, CeilLog2(sps->num_short_term_ref_pic_sets)));
+                      ssh->short_term_ref_pic_set_idx =
+                          BsGet(bs, plan->short_term_ref_pic_set_idx_bits));
+      }
+      if (!ssh->short_term_ref_pic_set_sps_flag) {
+        ssh->NumPicTotalCurr = h265_num_pic_total_curr(&ssh->st_ref_pic_set);
+      } else if (ssh->short_term_ref_pic_set_idx <
+                 H265_MAX_SHORT_TERM_REF_PIC_SETS) {
+        uint32_t idx = ssh->short_term_ref_pic_set_idx;
+        ssh->NumPicTotalCurr =
+            h265_num_pic_total_curr(&dec->seq_param_set.st_ref_pic_set[idx]);
       }
-      if (sps->long_term_ref_pics_present_flag) {
-        if (sps->num_long_term_ref_pics_sps > 0) {
+      if (has & H265_SLICE_HAS_LONG_TERM_REF_PICS) {
+        if (has & H265_SLICE_HAS_NUM_LONG_TERM_SPS) {
           out->put_uint(out, "num_long_term_sps",
                         ssh->num_long_term_sps = BsUe(bs));
         }
         out->put_uint(out, "num_long_term_pics",
                       ssh->num_long_term_pics = BsUe(bs));
+        if (ssh->num_long_term_sps > plan->num_long_term_ref_pics_sps ||
+            ssh->num_long_term_pics > plan->max_long_term_pics ||
+            ssh->num_long_term_sps + ssh->num_long_term_pics >
+                plan->max_long_term_pics) {
+          fprintf(stderr, "slice_segment_header num_long_term_sps %u + "
+                  "num_long_term_pics %u out of range\n",
+                  ssh->num_long_term_sps, ssh->num_long_term_pics);
+          return H265_ERR_INVALID;
+        }
         for (i = 0; i < ssh->num_long_term_sps + ssh->num_long_term_pics; i++) {
+          if (bs->overread)
+            return H265_ERR_INVALID;
           if (i < ssh->num_long_term_sps) {
-            if (sps->num_long_term_ref_pics_sps > 1) {
-              uint8_t lt_idx_sps =
-                  BsGet(bs, CeilLog2(sps->num_long_term_ref_pics_sps));
-            }
+            uint32_t lt_idx_sps = BsGet(bs, plan->lt_idx_sps_bits);
+            if (lt_idx_sps < H265_MAX_LONG_TERM_REF_PICS_SPS)
+              ssh->NumPicTotalCurr +=
+                  dec->seq_param_set.used_by_curr_pic_lt_sps_flag[lt_idx_sps];
           } else {
-            uint8_t poc_lsb_lt =
-                BsGet(bs, sps->log2_max_pic_order_cnt_lsb_minus4 + 4);
+            uint32_t poc_lsb_lt =
+                BsGet(bs, plan->slice_pic_order_cnt_lsb_bits);
             uint8_t used_by_curr_pic_lt_flag = BsGet(bs, 1);
+            ssh->NumPicTotalCurr += used_by_curr_pic_lt_flag;
           }
           uint8_t delta_poc_msb_present_flag = BsGet(bs, 1);
           if (delta_poc_msb_present_flag) {
@@ -1020,17 +538,17 @@ int h265_slice_segment_header(struct h265_decode_t *dec, struct BitStream *bs,
           }
         }
       }
-      if (sps->sps_temporal_mvp_enabled_flag) {
+      if (has & H265_SLICE_HAS_TEMPORAL_MVP) {
         out->put_uint(out, "slice_temporal_mvp_enabled_flag",
                       ssh->slice_temporal_mvp_enabled_flag = BsGet(bs, 1));
       }
 
       // ===================
     }
-    if (sps->sample_adaptive_offset_enabled_flag) {
+    if (has & H265_SLICE_HAS_SAO_LUMA) {
       out->put_uint(out, "slice_sao_luma_flag",
                     ssh->slice_sao_luma_flag = BsGet(bs, 1));
-      if (sps->ChromaArrayType != 0) {
+      if (has & H265_SLICE_HAS_SAO_CHROMA) {
         out->put_uint(out, "slice_sao_chroma_flag",
                       ssh->slice_sao_chroma_flag = BsGet(bs, 1));
       }
@@ -1047,18 +565,18 @@ int h265_slice_segment_header(struct h265_decode_t *dec, struct BitStream *bs,
                         ssh->num_ref_idx_l1_active_minus1 = BsUe(bs));
         }
       }
-      fprintf(stderr, "Unimplemented ref_pic_lists_modification()\n");
-      return -2;
-      /*
-      if (pps->lists_modification_present_flag && NumPicTotalCurr > 1) {
-        ref_pic_lists_modification();
+      if ((has & H265_SLICE_HAS_LISTS_MODIFICATION) &&
+          ssh->NumPicTotalCurr > 1) {
+        struct OutputContextDict subdict[1];
+        out->put_dict(out, "ref_pic_lists_modification", subdict);
+        h265_ref_pic_lists_modification(ssh, bs, subdict);
+        subdict->end(subdict);
       }
-      */
       if (ssh->slice_type == H265_SLICE_TYPE_B) {
         out->put_uint(out, "mvd_l1_zero_flag",
                       ssh->mvd_l1_zero_flag = BsGet(bs, 1));
       }
-      if (pps->cabac_init_present_flag) {
+      if (has & H265_SLICE_HAS_CABAC_INIT_FLAG) {
         out->put_uint(out, "cabac_init_flag",
                       ssh->cabac_init_flag = BsGet(bs, 1));
       }
@@ -1075,27 +593,33 @@ int h265_slice_segment_header(struct h265_decode_t *dec, struct BitStream *bs,
                         ssh->collocated_ref_idx = BsUe(bs));
         }
       }
-      if ((pps->weighted_pred_flag && ssh->slice_type == H265_SLICE_TYPE_P) ||
-          (pps->weighted_bipred_flag && ssh->slice_type == H265_SLICE_TYPE_B)) {
-        fprintf(stderr, "Unimplemented pred_weight_table()\n");
-        return -2;
-        // pred_weight_table();
+      if (((has & H265_SLICE_HAS_PRED_WEIGHT_P) &&
+           ssh->slice_type == H265_SLICE_TYPE_P) ||
+          ((has & H265_SLICE_HAS_PRED_WEIGHT_B) &&
+           ssh->slice_type == H265_SLICE_TYPE_B)) {
+        struct OutputContextDict subdict[1];
+        int err;
+        out->put_dict(out, "pred_weight_table", subdict);
+        err = h265_pred_weight_table(dec, bs, subdict);
+        subdict->end(subdict);
+        if (err)
+          return err;
       }
       out->put_uint(out, "five_minus_max_num_merge_cand",
                     ssh->five_minus_max_num_merge_cand = BsUe(bs));
     }
     out->put_int(out, "slice_qp_delta", ssh->slice_qp_delta = BsSe(bs));
-    if (pps->pps_slice_chroma_qp_offsets_present_flag) {
+    if (has & H265_SLICE_HAS_CHROMA_QP_OFFSETS) {
       out->put_int(out, "slice_cb_qp_offset",
                    ssh->slice_cb_qp_offset = BsSe(bs));
       out->put_int(out, "slice_cr_qp_offset",
                    ssh->slice_cr_qp_offset = BsSe(bs));
     }
-    if (pps->chroma_qp_offset_list_enabled_flag) {
+    if (has & H265_SLICE_HAS_CU_CHROMA_QP_OFFSET) {
       out->put_uint(out, "cu_chroma_qp_offset_enabled_flag",
                     ssh->cu_chroma_qp_offset_enabled_flag = BsGet(bs, 1));
     }
-    if (pps->deblocking_filter_override_enabled_flag) {
+    if (has & H265_SLICE_HAS_DEBLOCKING_OVERRIDE) {
       out->put_uint(out, "deblocking_filter_override_flag",
                     ssh->deblocking_filter_override_flag = BsGet(bs, 1));
     }
@@ -1112,7 +636,7 @@ int h265_slice_segment_header(struct h265_decode_t *dec, struct BitStream *bs,
 
     // =======================
 
-    if (pps->pps_loop_filter_across_slices_enabled_flag &&
+    if ((has & H265_SLICE_HAS_LOOP_FILTER_ACROSS) &&
         (ssh->slice_sao_luma_flag || ssh->slice_sao_chroma_flag ||
          !ssh->slice_deblocking_filter_disabled_flag)) {
       out->put_uint(out, "slice_loop_filter_across_slices_enabled_flag",
@@ -1120,48 +644,381 @@ int h265_slice_segment_header(struct h265_decode_t *dec, struct BitStream *bs,
                         BsGet(bs, 1));
     }
   }
-  if (pps->tiles_enabled_flag || pps->entropy_coding_sync_enabled_flag) {
+  if (has & H265_SLICE_HAS_ENTRY_POINTS) {
     out->put_uint(out, "num_entry_point_offsets",
                   ssh->num_entry_point_offsets = BsUe(bs));
+    if (ssh->num_entry_point_offsets > plan->max_entry_point_offsets) {
+      fprintf(stderr, "slice_segment_header num_entry_point_offsets %u > "
+              "%u\n", ssh->num_entry_point_offsets,
+              plan->max_entry_point_offsets);
+      return H265_ERR_INVALID;
+    }
     if (ssh->num_entry_point_offsets > 0) {
       out->put_uint(out, "offset_len_minus1",
                     ssh->offset_len_minus1 = BsUe(bs));
+      if (ssh->offset_len_minus1 > 31) {
+        fprintf(stderr, "slice_segment_header offset_len_minus1 %u > 31\n",
+                ssh->offset_len_minus1);
+        return H265_ERR_INVALID;
+      }
       for (i = 0; i < ssh->num_entry_point_offsets; i++) {
-        uint8_t entry_point_offset_minus1 =
+        uint32_t entry_point_offset_minus1 =
             BsGet(bs, ssh->offset_len_minus1 + 1);
+        if (bs->overread)
+          return H265_ERR_INVALID;
+        if (i < H265_MAX_ENTRY_POINTS)
+          ssh->entry_point_offset_minus1[i] = entry_point_offset_minus1;
       }
     }
   }
-  if (pps->slice_segment_header_extension_present_flag) {
+  if (has & H265_SLICE_HAS_EXTENSION) {
     out->put_uint(out, "slice_segment_header_extension_length",
                   ssh->slice_segment_header_extension_length = BsUe(bs));
+    if (ssh->slice_segment_header_extension_length > 256) {
+      fprintf(stderr, "slice_segment_header_extension_length %u > 256\n",
+              ssh->slice_segment_header_extension_length);
+      return H265_ERR_INVALID;
+    }
     for (i = 0; i < ssh->slice_segment_header_extension_length; i++) {
       uint8_t slice_segment_header_extension_data_byte = BsGet(bs, 8);
+      if (bs->overread)
+        return H265_ERR_INVALID;
     }
   }
-  // byte_alignment();
+  // byte_alignment()
+  if (BsGet(bs, 1) != 1) {
+    fprintf(stderr, "slice_segment_header alignment_bit_equal_to_one != 1\n");
+    return H265_ERR_INVALID;
+  }
+  BsGet(bs, (8 - bs->pos % 8) % 8);
+  ssh->slice_data_bit_offset = bs->pos;
+  ssh->slice_data_byte_offset =
+      h265_escaped_size(bs->buffer_end - bs->size / 8, bs->pos / 8);
+  out->put_uint(out, "slice_data_bit_offset", ssh->slice_data_bit_offset);
+  out->put_uint(out, "slice_data_byte_offset", ssh->slice_data_byte_offset);
   return 0;
 }
 
-int h265_parse_nal(struct h265_decode_t *dec, struct BitStream *bs,
-                   struct OutputContextDict *out) {
-  int err = 0;
+int h265_buffering_period(struct h265_decode_t *dec, struct BitStream *bs,
+                          struct OutputContextDict *out) {
+  // D.2.2 Buffering period SEI message syntax
+  struct H265BufferingPeriod *bp = &dec->sei.buffering_period;
+  const struct H265HrdParameters *hrd =
+      &dec->seq_param_set.vui_param.hrd_parameters;
+  // CPBs of the highest sub-layer, as for the HRD simulator
+  uint32_t i, CpbCnt =
+      hrd->cpb_cnt_minus1[dec->seq_param_set.sps_max_sub_layers_minus1];
+  uint32_t delay_len = hrd->initial_cpb_removal_delay_length_minus1 + 1;
+  out->put_uint(out, "bp_seq_parameter_set_id",
+                bp->bp_seq_parameter_set_id = BsUe(bs));
+  bp->irap_cpb_params_present_flag = 0;
+  if (!hrd->sub_pic_hrd_params_present_flag) {
+    out->put_uint(out, "irap_cpb_params_present_flag",
+                  bp->irap_cpb_params_present_flag = BsGet(bs, 1));
+  }
+  if (bp->irap_cpb_params_present_flag) {
+    out->put_uint(out, "cpb_delay_offset",
+                  bp->cpb_delay_offset =
+                      BsGet(bs, hrd->au_cpb_removal_delay_length_minus1 + 1));
+    out->put_uint(out, "dpb_delay_offset",
+                  bp->dpb_delay_offset =
+                      BsGet(bs, hrd->dpb_output_delay_length_minus1 + 1));
+  }
+  out->put_uint(out, "concatenation_flag",
+                bp->concatenation_flag = BsGet(bs, 1));
+  out->put_uint(out, "au_cpb_removal_delay_delta_minus1",
+                bp->au_cpb_removal_delay_delta_minus1 =
+                    BsGet(bs, hrd->au_cpb_removal_delay_length_minus1 + 1));
+  if (hrd->nal_hrd_parameters_present_flag) {
+    for (i = 0; i <= CpbCnt; i++) {
+      bp->nal_initial_cpb_removal_delay[i] = BsGet(bs, delay_len);
+      bp->nal_initial_cpb_removal_offset[i] = BsGet(bs, delay_len);
+      if (hrd->sub_pic_hrd_params_present_flag ||
+          bp->irap_cpb_params_present_flag) {
+        bp->nal_initial_alt_cpb_removal_delay[i] = BsGet(bs, delay_len);
+        bp->nal_initial_alt_cpb_removal_offset[i] = BsGet(bs, delay_len);
+      }
+    }
+    out->put_uint(out, "nal_initial_cpb_removal_delay",
+                  bp->nal_initial_cpb_removal_delay[0]);
+    out->put_uint(out, "nal_initial_cpb_removal_offset",
+                  bp->nal_initial_cpb_removal_offset[0]);
+    if (hrd->sub_pic_hrd_params_present_flag ||
+        bp->irap_cpb_params_present_flag) {
+      out->put_uint(out, "nal_initial_alt_cpb_removal_delay",
+                    bp->nal_initial_alt_cpb_removal_delay[0]);
+      out->put_uint(out, "nal_initial_alt_cpb_removal_offset",
+                    bp->nal_initial_alt_cpb_removal_offset[0]);
+    }
+  }
+  if (hrd->vcl_hrd_parameters_present_flag) {
+    for (i = 0; i <= CpbCnt; i++) {
+      bp->vcl_initial_cpb_removal_delay[i] = BsGet(bs, delay_len);
+      bp->vcl_initial_cpb_removal_offset[i] = BsGet(bs, delay_len);
+      if (hrd->sub_pic_hrd_params_present_flag ||
+          bp->irap_cpb_params_present_flag) {
+        bp->vcl_initial_alt_cpb_removal_delay[i] = BsGet(bs, delay_len);
+        bp->vcl_initial_alt_cpb_removal_offset[i] = BsGet(bs, delay_len);
+      }
+    }
+    out->put_uint(out, "vcl_initial_cpb_removal_delay",
+                  bp->vcl_initial_cpb_removal_delay[0]);
+    out->put_uint(out, "vcl_initial_cpb_removal_offset",
+                  bp->vcl_initial_cpb_removal_offset[0]);
+    if (hrd->sub_pic_hrd_params_present_flag ||
+        bp->irap_cpb_params_present_flag) {
+      out->put_uint(out, "vcl_initial_alt_cpb_removal_delay",
+                    bp->vcl_initial_alt_cpb_removal_delay[0]);
+      out->put_uint(out, "vcl_initial_alt_cpb_removal_offset",
+                    bp->vcl_initial_alt_cpb_removal_offset[0]);
+    }
+  }
+  return 0;
+}
+
+int h265_pic_timing(struct h265_decode_t *dec, struct BitStream *bs,
+                    struct OutputContextDict *out) {
+  // D.2.3 Picture timing SEI message syntax
+  struct H265PicTiming *pt = &dec->sei.pic_timing;
+  const struct H265VuiParameters *vui = &dec->seq_param_set.vui_param;
+  const struct H265HrdParameters *hrd = &vui->hrd_parameters;
+  uint32_t i;
+  if (vui->frame_field_info_present_flag) {
+    out->put_uint(out, "pic_struct", pt->pic_struct = BsGet(bs, 4));
+    out->put_uint(out, "source_scan_type", pt->source_scan_type = BsGet(bs, 2));
+    out->put_uint(out, "duplicate_flag", pt->duplicate_flag = BsGet(bs, 1));
+  }
+  // CpbDpbDelaysPresentFlag
+  if (vui->vui_hrd_parameters_present_flag &&
+      (hrd->nal_hrd_parameters_present_flag ||
+       hrd->vcl_hrd_parameters_present_flag)) {
+    out->put_uint(out, "au_cpb_removal_delay_minus1",
+                  pt->au_cpb_removal_delay_minus1 =
+                      BsGet(bs, hrd->au_cpb_removal_delay_length_minus1 + 1));
+    out->put_uint(out, "pic_dpb_output_delay",
+                  pt->pic_dpb_output_delay =
+                      BsGet(bs, hrd->dpb_output_delay_length_minus1 + 1));
+    if (hrd->sub_pic_hrd_params_present_flag) {
+      out->put_uint(out, "pic_dpb_output_du_delay",
+                    pt->pic_dpb_output_du_delay =
+                        BsGet(bs, hrd->dpb_output_delay_du_length_minus1 + 1));
+    }
+    if (hrd->sub_pic_hrd_params_present_flag &&
+        hrd->sub_pic_cpb_params_in_pic_timing_sei_flag) {
+      uint32_t du_len = hrd->du_cpb_removal_delay_increment_length_minus1 + 1;
+      out->put_uint(out, "num_decoding_units_minus1",
+                    pt->num_decoding_units_minus1 = BsUe(bs));
+      out->put_uint(out, "du_common_cpb_removal_delay_flag",
+                    pt->du_common_cpb_removal_delay_flag = BsGet(bs, 1));
+      if (pt->du_common_cpb_removal_delay_flag) {
+        out->put_uint(out, "du_common_cpb_removal_delay_increment_minus1",
+                      pt->du_common_cpb_removal_delay_increment_minus1 =
+                          BsGet(bs, du_len));
+      }
+      for (i = 0; i <= pt->num_decoding_units_minus1 && !BsEof(bs); i++) {
+        BsUe(bs);  // num_nalus_in_du_minus1[i]
+        if (!pt->du_common_cpb_removal_delay_flag &&
+            i < pt->num_decoding_units_minus1)
+          BsGet(bs, du_len);  // du_cpb_removal_delay_increment_minus1[i]
+      }
+    }
+  }
+  return 0;
+}
+
+int h265_sei_rbsp(struct h265_decode_t *dec, struct BitStream *bs,
+                  struct OutputContextDict *out) {
+  // 7.3.2.4 Supplemental enhancement information RBSP syntax
+  struct OutputContextList list[1];
+  struct OutputContextDict subdict[1];
+  uint8_t prefix =
+      dec->nal_unit_header.nal_unit_type == H265_NAL_TYPE_PREFIX_SEI_NUT;
+  dec->sei.buffering_period_present = 0;
+  dec->sei.pic_timing_present = 0;
+  out->put_list(out, "sei_message", list);
+  while (BsMoreRbspData(bs)) {
+    // 7.3.5 Supplemental enhancement information message syntax
+    uint32_t payloadType = 0, payloadSize = 0, byte, payload_end;
+    do {
+      payloadType += byte = BsGet(bs, 8);
+    } while (byte == 0xFF && !BsEof(bs));
+    do {
+      payloadSize += byte = BsGet(bs, 8);
+    } while (byte == 0xFF && !BsEof(bs));
+    if (payloadSize > BsRemain(bs) / 8) {
+      fprintf(stderr, "sei_message: truncated payload\n");
+      list->end(list);
+      return H265_ERR_TRUNCATED;
+    }
+    payload_end = bs->pos + payloadSize * 8;
+
+    list->put_dict(list, subdict);
+    subdict->put_uint(subdict, "payloadType", payloadType);
+    subdict->put_uint(subdict, "payloadSize", payloadSize);
+    if (prefix && payloadType == H265_SEI_BUFFERING_PERIOD) {
+      METRICS_FUNC(METRICS_FN_BUFFERING_PERIOD,
+                   h265_buffering_period(dec, bs, subdict));
+      dec->sei.buffering_period_present = 1;
+    } else if (prefix && payloadType == H265_SEI_PIC_TIMING) {
+      METRICS_FUNC(METRICS_FN_PIC_TIMING, h265_pic_timing(dec, bs, subdict));
+      dec->sei.pic_timing_present = 1;
+    }
+    subdict->end(subdict);
+    BsSeek(bs, payload_end);
+  }
+  list->end(list);
+  return 0;
+}
+
+static int h265_is_vcl(enum H265NalType nal_unit_type) {
+  return nal_unit_type < H265_NAL_TYPE_VPS_NUT;
+}
+
+int h265_starts_access_unit(const struct h265_decode_t *dec,
+                            enum H265NalType nal_unit_type,
+                            uint8_t first_slice_segment_in_pic_flag) {
+  // 7.4.2.4.4 Order of NAL units and coded pictures and their association to
+  // access units. The first of any AUD, parameter set, prefix SEI or
+  // reserved prefix NAL unit, or the first VCL NAL unit of a picture, that
+  // follows a VCL NAL unit starts a new access unit.
+  enum H265NalType type = nal_unit_type;
+  if (!dec->au_has_vcl)
+    return 0;
+  if (h265_is_vcl(type))
+    return first_slice_segment_in_pic_flag;
+  return type == H265_NAL_TYPE_AUD_NUT || type == H265_NAL_TYPE_VPS_NUT ||
+         type == H265_NAL_TYPE_SPS_NUT || type == H265_NAL_TYPE_PPS_NUT ||
+         type == H265_NAL_TYPE_PREFIX_SEI_NUT || (type >= 41 && type <= 44) ||
+         (type >= 48 && type <= 55);
+}
+
+void h265_parse_mask_init(struct H265ParseMask *mask) {
+  mask->max_temporal_id = 6;
+  mask->layer_ids = ~(uint64_t)0;
+  mask->nal_unit_types = ~(uint64_t)0;
+}
+
+int h265_parse_mask_selects(const struct H265ParseMask *mask,
+                            const uint8_t *nal, uint32_t size) {
+  uint32_t type, layer, tid_plus1;
+  if (size < 2)
+    return 1;
+  type = nal[0] >> 1 & 63;
+  layer = (nal[0] & 1) << 5 | nal[1] >> 3;
+  tid_plus1 = nal[1] & 7;
+  if (type >= H265_NAL_TYPE_VPS_NUT && type <= H265_NAL_TYPE_PPS_NUT)
+    return 1;
+  return tid_plus1 <= (uint32_t)mask->max_temporal_id + 1 &&
+         (mask->layer_ids >> layer & 1) && (mask->nal_unit_types >> type & 1);
+}
+
+int32_t h265_pic_order_cnt(struct H265PocState *state,
+                           const struct h265_decode_t *dec) {
+  uint32_t type = dec->nal_unit_header.nal_unit_type;
+  uint32_t tid = dec->nal_unit_header.nuh_temporal_id_plus1 - 1u;
+  int32_t max_lsb =
+      1 << (dec->seq_param_set.log2_max_pic_order_cnt_lsb_minus4 + 4);
+  int32_t lsb = (int32_t)dec->slice_segment.header.slice_pic_order_cnt_lsb;
+  int32_t prev_lsb = state->prev_tid0_poc & (max_lsb - 1);
+  int32_t prev_msb = state->prev_tid0_poc - prev_lsb;
+  int32_t msb, poc;
+  uint8_t irap =
+      type >= H265_NAL_TYPE_BLA_W_LP && type <= H265_NAL_TYPE_CRA_NUT;
+  if (type == H265_NAL_TYPE_IDR_W_RADL || type == H265_NAL_TYPE_IDR_N_LP)
+    lsb = 0;
+  if (irap && (type != H265_NAL_TYPE_CRA_NUT || !state->seen_picture))
+    msb = 0;  // NoRaslOutputFlag
+  else if (lsb < prev_lsb && prev_lsb - lsb >= max_lsb / 2)
+    msb = prev_msb + max_lsb;
+  else if (lsb > prev_lsb && lsb - prev_lsb > max_lsb / 2)
+    msb = prev_msb - max_lsb;
+  else
+    msb = prev_msb;
+  poc = msb + lsb;
+  // TemporalId 0 and not RASL, RADL or a sub-layer non-reference picture
+  if (tid == 0 && !(type <= H265_NAL_TYPE_RASL_R && !(type & 1)) &&
+      type != H265_NAL_TYPE_RADL_R && type != H265_NAL_TYPE_RASL_R)
+    state->prev_tid0_poc = poc;
+  state->seen_picture = 1;
+  return poc;
+}
+
+double h265_clock_tick(const struct h265_decode_t *dec) {
+  const struct H265SeqParameterSet *sps = &dec->seq_param_set;
+  const struct H265VideoParameterSet *vps = &dec->video_param_set;
+  if (sps->vui_parameters_present_flag &&
+      sps->vui_param.vui_timing_info_present_flag &&
+      sps->vui_param.vui_time_scale)
+    return (double)sps->vui_param.vui_num_units_in_tick /
+           sps->vui_param.vui_time_scale;
+  if (vps->vps_timing_info_present_flag && vps->vps_time_scale)
+    return (double)vps->vps_num_units_in_tick / vps->vps_time_scale;
+  return 0;
+}
+
+static void h265_detect_access_unit(struct h265_decode_t *dec,
+                                    struct BitStream *bs) {
+  enum H265NalType type = dec->nal_unit_header.nal_unit_type;
+  uint8_t vcl = h265_is_vcl(type);
+  dec->new_access_unit =
+      (uint8_t)h265_starts_access_unit(dec, type, vcl && BsPeek(bs, 1));
+  if (vcl)
+    dec->au_has_vcl = 1;
+  else if (dec->new_access_unit)
+    dec->au_has_vcl = 0;
+}
+
+int h265_parse_nal_header(struct h265_decode_t *dec, struct BitStream *bs,
+                          struct OutputContextDict *out) {
+  int err;
   struct OutputContextDict subdict[1];
-  if (BsGet(bs, 24) == 0)
-    BsGet(bs, 8);
   out->put_dict(out, "nal_unit_header", subdict);
   err = h265_nal_unit_header(dec, bs, subdict);
   subdict->end(subdict);
+  // the slice_data() offsets of the previous slice segment stay 0 unless
+  // this one's header is parsed through
+  if (h265_is_vcl(dec->nal_unit_header.nal_unit_type)) {
+    dec->slice_segment.header.slice_data_bit_offset = 0;
+    dec->slice_segment.header.slice_data_byte_offset = 0;
+  }
+  if (err == 0)
+    h265_detect_access_unit(dec, bs);
+  return err;
+}
+
+int h265_parse_nal(struct h265_decode_t *dec, struct BitStream *bs,
+                   struct OutputContextDict *out) {
+  int err = h265_parse_nal_header(dec, bs, out);
   if (err == 0) {
     switch (dec->nal_unit_header.nal_unit_type) {
+    // parameter sets have an output free variant for disabled output
     case H265_NAL_TYPE_VPS_NUT:
-      h265_video_parameter_set(dec, bs, out);
+      if (OutputContextEnabled(out))
+        METRICS_FUNC(METRICS_FN_VIDEO_PARAMETER_SET,
+                     err = h265_video_parameter_set(dec, bs, out));
+      else
+        METRICS_FUNC(METRICS_FN_VIDEO_PARAMETER_SET,
+                     err = h265_video_parameter_set_decode(dec, bs));
       break;
     case H265_NAL_TYPE_SPS_NUT:
-      h265_seq_parameter_set(dec, bs, out);
+      if (OutputContextEnabled(out))
+        METRICS_FUNC(METRICS_FN_SEQ_PARAMETER_SET,
+                     err = h265_seq_parameter_set(dec, bs, out));
+      else
+        METRICS_FUNC(METRICS_FN_SEQ_PARAMETER_SET,
+                     err = h265_seq_parameter_set_decode(dec, bs));
       break;
     case H265_NAL_TYPE_PPS_NUT:
-      h265_pic_parameter_set(dec, bs, out);
+      if (OutputContextEnabled(out))
+        METRICS_FUNC(METRICS_FN_PIC_PARAMETER_SET,
+                     err = h265_pic_parameter_set(dec, bs, out));
+      else
+        METRICS_FUNC(METRICS_FN_PIC_PARAMETER_SET,
+                     err = h265_pic_parameter_set_decode(dec, bs));
+      break;
+    case H265_NAL_TYPE_PREFIX_SEI_NUT:
+    case H265_NAL_TYPE_SUFFIX_SEI_NUT:
+      METRICS_FUNC(METRICS_FN_SEI_RBSP, err = h265_sei_rbsp(dec, bs, out));
       break;
     case H265_NAL_TYPE_TRAIL_N:
     case H265_NAL_TYPE_TRAIL_R:
@@ -1179,77 +1036,1224 @@ int h265_parse_nal(struct h265_decode_t *dec, struct BitStream *bs,
     case H265_NAL_TYPE_IDR_W_RADL:
     case H265_NAL_TYPE_IDR_N_LP:
     case H265_NAL_TYPE_CRA_NUT:
-      h265_slice_segment_header(dec, bs, out);
+      if (!dec->sps_valid || !dec->pps_valid) {
+        err = H265_ERR_NO_PARAMETER_SET;
+        break;
+      }
+      METRICS_FUNC(METRICS_FN_SLICE_SEGMENT_HEADER,
+                   err = h265_slice_segment_header(dec, bs, out));
       break;
     }
+    // the bits past the end read as zeros, which parse without complaint
+    if (err == 0 && bs->overread)
+      err = H265_ERR_TRUNCATED;
+    if (dec->nal_unit_header.nal_unit_type == H265_NAL_TYPE_SPS_NUT)
+      dec->sps_valid = err == 0;
+    else if (dec->nal_unit_header.nal_unit_type == H265_NAL_TYPE_PPS_NUT)
+      dec->pps_valid = err == 0;
   }
   return err;
 }
 
-#define MAX_BUFFER (1024 * 512)
-uint8_t buffer[MAX_BUFFER];
+static struct HrdSimulator hrd_sim;
+static struct StreamStats stream_stats;
+static struct Segmenter segmenter;
+static struct PsRewriter ps_rewriter;
+static struct HvccWriter hvcc_writer;
+static struct SliceData slice_data;
+static struct Checkpoint checkpoint;
+static struct ShmRing shm_ring;
+static struct TsDemux ts_demux;
+static struct FollowSource follow;
+static struct H265Events events;
+static struct ParseCache parse_cache;
+static struct NalFilter nal_filter;
+static struct AuTimestamps au_timestamps;
+
+// Subscribers of the parse next to the JSON output
+static void HrdOnNal(void *opaque, const struct h265_decode_t *dec,
+                     const struct NalUnit *nal, int err) {
+  HrdSimPushNal((struct HrdSimulator *)opaque, dec, nal->size,
+                nal->prefix_bytes);
+}
+
+static void StatsOnNal(void *opaque, const struct h265_decode_t *dec,
+                       const struct NalUnit *nal, int err) {
+  StreamStatsPushNal((struct StreamStats *)opaque, dec, nal->size,
+                     nal->prefix_bytes, err);
+}
+
+static void TimestampsOnNal(void *opaque, const struct h265_decode_t *dec,
+                            const struct NalUnit *nal, int err) {
+  AuTimestampsPushNal((struct AuTimestamps *)opaque, dec, nal, err);
+}
+
+// Positions |in| at the last IRAP access unit presented at or before
+// |seconds|, by the index at |index_fn| built first if it's missing or
+// stale, with the parameter sets before it parsed into |dec|. |entry| gets
+// the timestamp state there and |end_offset| where a run of |duration|
+// seconds, 0 for the rest of the input, can stop.
+static int seek_input(struct NalInput *in, FILE *fi, const char *index_fn,
+                      double seconds, double duration,
+                      struct h265_decode_t *dec,
+                      struct SeekIndexEntry *entry, uint64_t *end_offset,
+                      uint8_t timing) {
+  struct SeekIndex idx;
+  struct OutputConfig config = {0, 0};
+  int64_t pts = (int64_t)floor(seconds * 90000 + 0.5);
+  int64_t end_pts = duration > 0 ? pts + (int64_t)floor(duration * 90000 + 0.5)
+                                 : INT64_MAX;
+  clock_t start;
+  int i, ret = SeekIndexOpen(&idx, index_fn, fi);
+  if (ret < 0) {
+    fprintf(stderr, "--seek needs an input file\n");
+    return -1;
+  }
+  if (ret == 0) {
+    fprintf(stderr, "indexing the input into %s\n", index_fn);
+    start = clock();
+    if (SeekIndexBuild(&idx, in) != 0)
+      return -1;
+    if (timing)
+      fprintf(stderr, "index: %llu IRAP access units in %.3f s\n",
+              (unsigned long long)idx.header.count,
+              (double)(clock() - start) / CLOCKS_PER_SEC);
+  }
+  start = clock();
+  ret = SeekIndexFind(&idx, pts, end_pts, entry, end_offset);
+  SeekIndexClose(&idx);
+  if (ret != 0) {
+    fprintf(stderr, "no IRAP picture with timing in %s\n", index_fn);
+    return -1;
+  }
+  for (i = 0; i < 3; i++) {
+    struct NalUnit nal;
+    struct BitStream bs;
+    struct OutputContextDict none[1];
+    if (entry->set_offsets[i] == SEEK_INDEX_NONE)
+      continue;
+    if (NalInputSeek(in, entry->set_offsets[i]) != 0 ||
+        in->next(in, &nal) <= 0)
+      return -1;
+    OutputContextInitDict(none, NULL, -1, &config);
+    BsInit(&bs, nal.data, remove_03(nal.data, nal.size));
+    h265_parse_nal(dec, &bs, none);
+    none->end(none);
+  }
+  if (NalInputSeek(in, entry->offset) != 0)
+    return -1;
+  if (timing)
+    fprintf(stderr, "seek: 0x%llX, pts %lld, %u index reads in %.3f ms\n",
+            (unsigned long long)entry->offset, (long long)entry->pts,
+            idx.reads, (double)(clock() - start) * 1000 / CLOCKS_PER_SEC);
+  return 0;
+}
+
+// Parses a comma separated list of values below 64 and ranges like 16-21
+// into a bit set; with |nal_types|, also NAL unit type names (IDR_W_RADL),
+// irap and vcl. Returns -1 if the list is invalid.
+static int parse_id_set(const char *list, int nal_types, uint64_t *set) {
+  static const struct {
+    const char *name;
+    uint32_t first, last;
+  } kNames[] = {
+#define NAL_TYPE_NAME(name, value) {#name, value, value},
+      H265_NAL_TYPES(NAL_TYPE_NAME)
+#undef NAL_TYPE_NAME
+      {"irap", H265_NAL_TYPE_BLA_W_LP, H265_NAL_TYPE_RSV_IRAP_VCL23},
+      {"vcl", 0, 31},
+  };
+  const char *p = list;
+  *set = 0;
+  while (*p) {
+    size_t n = strcspn(p, ",");
+    unsigned first, last;
+    char item[32];
+    size_t j;
+    int end;
+    if (n == 0 || n >= sizeof(item))
+      return -1;
+    memcpy(item, p, n);
+    item[n] = 0;
+    if (sscanf(item, "%u%n", &first, &end) == 1 && !item[end]) {
+      last = first;
+    } else if (sscanf(item, "%u-%u%n", &first, &last, &end) != 2 ||
+               item[end]) {
+      for (j = 0; j < sizeof(kNames) / sizeof(kNames[0]); j++) {
+        if (nal_types && strcmp(item, kNames[j].name) == 0)
+          break;
+      }
+      if (j == sizeof(kNames) / sizeof(kNames[0]))
+        return -1;
+      first = kNames[j].first;
+      last = kNames[j].last;
+    }
+    if (first > last || last > 63)
+      return -1;
+    for (; first <= last; first++)
+      *set |= (uint64_t)1 << first;
+    p += n;
+    if (*p)
+      p++;
+  }
+  return *set ? 0 : -1;
+}
+
+static int has_suffix(const char *s, const char *suffix) {
+  size_t n = strlen(s), m = strlen(suffix);
+  return n >= m && strcmp(s + n - m, suffix) == 0;
+}
+
+// Hashes the options that change the output, for the parse cache: all but
+// the input, where the output goes, timing and the cache's own.
+static uint64_t options_hash(int argc, char *argv[], const char *input) {
+  static const char *const kIgnored[] = {"--output", "--cache", "--cache-size",
+                                         "--metrics", "--metrics-interval"};
+  uint64_t h = 0xcbf29ce484222325ULL;
+  int i;
+  size_t j;
+  for (i = 1; i < argc; i++) {
+    int skip = argv[i] == input || strcmp(argv[i], "--timing") == 0;
+    for (j = 0; j < sizeof(kIgnored) / sizeof(kIgnored[0]) && !skip; j++) {
+      if (strcmp(argv[i], kIgnored[j]) == 0) {
+        skip = 1;
+        i++;
+      }
+    }
+    if (!skip)
+      h = ParseCacheHash(h, argv[i], strlen(argv[i]) + 1);
+  }
+  return h;
+}
+
+// --stats over several inputs: a summary of each, parsed with a fresh
+// decoder, then the merged total with "files" in place of "file".
+static int stats_inputs(const char **inputs, int count,
+                        uint8_t length_prefixed, uint8_t length_size,
+                        uint8_t transport_stream,
+                        const struct H265ParseMask *mask, FILE *fp) {
+  struct OutputConfig config = {1, 1};
+  struct OutputContextList list[1];
+  struct OutputContextDict dict[1];
+  struct StreamStats total;
+  struct h265_decode_t dec;
+  int i, ret = 0;
+  StreamStatsInit(&total);
+  OutputContextInitList(list, fp, 0, &config);
+  for (i = 0; i < count && ret == 0; i++) {
+    struct NalInput input;
+    struct NalUnit nal;
+    FILE *fi = fopen(inputs[i], "rb");
+    if (!fi) {
+      fprintf(stderr, "couldn't open %s\n", inputs[i]);
+      ret = -1;
+      break;
+    }
+    memset(&dec, 0, sizeof(dec));
+    StreamStatsInit(&stream_stats);
+    if (length_prefixed) {
+      ret = NalInputOpenLengthPrefixed(&input, fi, length_size);
+    } else if (transport_stream || has_suffix(inputs[i], ".ts") ||
+               has_suffix(inputs[i], ".m2ts") ||
+               has_suffix(inputs[i], ".mts")) {
+      TsDemuxInit(&ts_demux, fi);
+      ret = NalInputOpenAnnexBSource(&input, TsDemuxRead, TsDemuxStamp,
+                                     &ts_demux);
+    } else {
+      ret = NalInputOpenAnnexB(&input, fi);
+    }
+    while (ret == 0) {
+      struct BitStream bs;
+      struct OutputContextDict none[1];
+      uint32_t nal_len;
+      int err = input.next(&input, &nal);
+      if (err <= 0) {
+        ret = err < 0 ? -1 : 0;
+        break;
+      }
+      if (!h265_parse_mask_selects(mask, nal.data, nal.size))
+        continue;
+      nal_len = remove_03(nal.data, nal.size);
+      OutputContextInitDict(none, NULL, -1, &config);
+      BsInit(&bs, nal.data, nal_len);
+      err = h265_parse_nal(&dec, &bs, none);
+      none->end(none);
+      StreamStatsPushNal(&stream_stats, &dec, nal.size, nal.prefix_bytes,
+                         err);
+    }
+    NalInputClose(&input);
+    fclose(fi);
+    StreamStatsFinish(&stream_stats);
+    StreamStatsMerge(&total, &stream_stats);
+    list->put_dict(list, dict);
+    dict->put_str(dict, "file", inputs[i]);
+    StreamStatsWrite(&stream_stats, dict);
+    dict->end(dict);
+  }
+  if (ret == 0) {
+    list->put_dict(list, dict);
+    dict->put_uint(dict, "files", count);
+    StreamStatsWrite(&total, dict);
+    dict->end(dict);
+  }
+  list->end(list);
+  fputc('\n', fp);
+  return ret;
+}
+
+static void usage(const char *prog) {
+  fprintf(stderr,
+          "usage: %s [options] input.hevc\n"
+          "       %s --stats [options] input.hevc...\n"
+          "  --hrd            run the Annex C CPB/DPB simulator\n"
+          "  --hrd-trace      also print CPB fullness at each removal\n"
+          "  --length-size N  input is N-byte length prefixed NAL units\n"
+          "  --hvcc FILE      hvcC record of a length prefixed input\n"
+          "  --ts             input is an MPEG-2 transport stream\n"
+          "                   (default for .ts, .m2ts and .mts files)\n"
+          "  --follow         keep reading as the input grows ('-': stdin)\n"
+          "  --latency MS     with --follow, after MS ms without new data\n"
+          "                   write the NAL unit read so far as a record\n"
+          "                   with \"partial\": 1; it is written again,\n"
+          "                   whole, once the next start code arrives\n"
+          "  --idle MS        with --follow, stop after MS ms without data\n"
+          "  --shm NAME       read Annex B from the shared memory ring NAME\n"
+          "                   of a capture process, in place, instead of a\n"
+          "                   file\n"
+          "  --shm-produce NAME  write the input into a new ring NAME for a\n"
+          "                   --shm reader, then print throughput and\n"
+          "                   latency as one JSON line\n"
+          "  --shm-size N     ring size in bytes (64M)\n"
+          "  --shm-chunk N    bytes per write (64K)\n"
+          "  --shm-loops N    write the input N times (1)\n"
+          "  --shm-rate MBPS  write at most MBPS MB/s (0: unlimited)\n"
+          "  --timing         print input throughput and NAL units that\n"
+          "                   failed to parse to stderr\n"
+          "  --output FILE    write to FILE instead of stdout\n"
+          "  --checkpoint FILE  snapshot the run to FILE now and then and\n"
+          "                   resume from it when it exists; needs --output\n"
+          "                   and a file input, removed once the run ends\n"
+          "  --checkpoint-interval S  seconds between snapshots (60, 0: each\n"
+          "                   access unit)\n"
+          "  --cache DIR      keep the output of each input file and set of\n"
+          "                   options in DIR and replay it while the file\n"
+          "                   is unchanged\n"
+          "  --cache-size N   remove the least recently used cache files\n"
+          "                   beyond N bytes (1G)\n"
+          "  --stats          write one summary of the stream instead of\n"
+          "                   the NAL units: counts, slice QP and type\n"
+          "                   distributions, NAL, access unit, IRAP\n"
+          "                   interval and GOP length histograms; for\n"
+          "                   several inputs, one per input and their\n"
+          "                   merged total\n"
+          "  --slice-data     also walk the slice data of each slice\n"
+          "                   segment: CU, PU and TU counts and the bits\n"
+          "                   of each CTU, per slice and with --stats\n"
+          "  --slice-data-ctus  also write [CtbAddrInRs, bits, cus,\n"
+          "                   skip_cus, intra_cus, tus] of each CTU\n"
+          "  --threads N      walk tiles and WPP rows on N threads (1)\n"
+          "  --segment PREFIX split the input at IRAP pictures into\n"
+          "                   PREFIX-NNNNN.hevc chunks with a PREFIX.json\n"
+          "                   manifest instead of writing NAL units\n"
+          "  --segment-duration S  cut at the first IRAP after S seconds\n"
+          "  --segment-bytes N     cut at the first IRAP after N bytes\n"
+          "  --segment-keep-rasl   keep the RASL pictures of the IRAP\n"
+          "                   picture a chunk starts with\n"
+          "  --timestamps     write the DTS and PTS of each access unit, in\n"
+          "                   90 kHz units, instead of the NAL units; see\n"
+          "                   au-timestamps.h\n"
+          "  --seek S         start at the last IRAP picture presented at or\n"
+          "                   before S seconds; needs --index\n"
+          "  --seek-duration S  stop at the first IRAP picture presented S\n"
+          "                   seconds after that\n"
+          "  --index FILE     IRAP index of the input for --seek, built when\n"
+          "                   missing or older than the input\n"
+          "  --rewrite FILE   copy the input to FILE with the VUI of each SPS\n"
+          "                   edited by --set instead of writing NAL units\n"
+          "  --set NAME=VALUE VUI field to set, repeatable, e.g.\n"
+          "                   colour_primaries=9 or sar_width=4; see\n"
+          "                   ps-rewriter.h\n"
+          "  --rewrite-verify read FILE back and compare it with the input\n"
+          "  --to-hvcc FILE   write the input to FILE as 4 byte length\n"
+          "                   prefixed samples and the hvcC record to\n"
+          "                   FILE.hvcC, and the sample table instead of NAL\n"
+          "                   units; see hvcc-writer.h\n"
+          "  --max-tid N      parse only NAL units with TemporalId up to N\n"
+          "  --layers L       parse only NAL units of these nuh_layer_ids,\n"
+          "                   e.g. 0 or 0-1\n"
+          "  --nal-types L    parse only NAL units of these types: numbers,\n"
+          "                   ranges, names like IDR_W_RADL, irap and vcl;\n"
+          "                   VPS, SPS and PPS are parsed whatever the\n"
+          "                   three masks say\n"
+          "  --filter EXPR    write only the NAL units EXPR selects, e.g.\n"
+          "                   'is_slice && (nal_unit_type == IDR_W_RADL ||\n"
+          "                   slice_qp_delta > 6)'; see nal-filter.h\n"
+          "  --delta N        write NAL units as the changes against the\n"
+          "                   previous one of their type, in full every\n"
+          "                   N-th (0: only the first)\n"
+          "  --undelta FILE   restore the full output of a --delta output\n"
+          "  --generate FILE  write a synthetic stream instead of parsing\n"
+          "  --gen-NAME VALUE generator setting, NAME is one of\n"
+          "                   %s\n"
+          "  --bench DIR      run each parse mode over generated corpora\n"
+          "                   kept in DIR, one JSON line per result\n"
+          "  --bench-sizes L  corpus sizes (default 1M,64M)\n"
+          "  --bench-modes L  subset of %s\n"
+          "  --bench-repeat N runs per result, the fastest counts (3)\n"
+          "  --bench-filter EXPR  filter of the filter mode, repeatable\n"
+          "  --perf           micro-benchmark the parse stages on the input,\n"
+          "                   one JSON line per case, with hardware counters\n"
+          "                   where available\n"
+          "  --perf-samples N samples per case, the best counts (5)\n"
+          "  --perf-compare BASE NEW  compare two --perf outputs, exit\n"
+          "                   status 1 on a regression\n"
+          "  --perf-threshold PCT  slowdown counted as a regression (5)\n"
+#ifdef H265_METRICS
+          "  --metrics TARGET write Prometheus metrics to a file, or to\n"
+          "                   unix:PATH, at exit (default: stderr)\n"
+          "  --metrics-interval S  also write a snapshot every S seconds\n"
+#endif
+          ,
+          prog, prog, kGeneratorOptions, kBenchModes);
+}
 
 int main(int argc, char *argv[]) {
-  uint32_t buffer_on, buffer_size;
-  uint64_t bytes = 0;
+  int i, ret;
+  uint8_t run_hrd = 0, hrd_trace = 0, timing = 0;
+  uint8_t length_prefixed = 0, length_size = 0, transport_stream = 0;
+  uint8_t follow_mode = 0, delta_mode = 0, stats_mode = 0;
+  uint8_t slice_data_mode = 0, timestamps_mode = 0;
+  const char *output_fn = NULL, *checkpoint_fn = NULL;
+  const char *cache_dir = NULL;
+  const char *filter_expr = NULL;
+  const char *index_fn = NULL;
+  double seek_seconds = -1, seek_duration = 0;
+  struct SeekIndexEntry seek_entry;
+  uint64_t seek_end = SEEK_INDEX_NONE;
+  int filter_skips = 0;
+  uint64_t cache_size = (uint64_t)1 << 30;
+  int cache_hit = 0;
+  double checkpoint_interval = 60;
+  struct CheckpointPosition resume;
+  int resumed = 0;
+  const char *shm_name = NULL;
+  struct ShmProducerConfig shm_cfg;
+  struct SliceDataConfig sd_cfg;
+  uint32_t delta_interval = 0;
+  const char *undelta_fn = NULL;
+  struct SegmenterConfig seg_cfg;
+  struct PsRewriterConfig rw_cfg;
+  struct PsRewriterCheck rw_check;
+  uint8_t rw_verify = 0;
+  struct H265ParseMask parse_mask;
+  uint8_t masked_run = 0;
+  uint64_t masked = 0;
+  uint32_t latency_ms = 0, idle_ms = 0;
+#ifdef H265_METRICS
+  const char *metrics_target = NULL;
+  uint32_t metrics_interval = 0;
+#endif
+  const char *hvcc_fn = NULL;
+  const char *to_hvcc_fn = NULL;
+  const char *generate_fn = NULL;
+  struct GeneratorConfig gen_cfg;
+  struct BenchConfig bench;
+  struct PerfBenchConfig perf;
+  uint8_t run_perf = 0;
+  const char *perf_base = NULL, *perf_current = NULL;
+  double perf_threshold = 5;
+  uint64_t nal_count = 0, nal_bytes = 0;
+  // NAL units that failed to parse, by -H265Error
+  uint64_t errors[H265_ERROR_TYPES];
+  clock_t start;
 
   const char *fn1 = "E:\\Data\\MediaSample\\sample_k.hvc";
-  FILE *fi = fopen(fn1, "rb");
+  // file arguments; only --stats takes more than one
+  const char **inputs = (const char **)calloc(argc, sizeof(*inputs));
+  int num_inputs = 0;
+  GeneratorDefaults(&gen_cfg);
+  memset(errors, 0, sizeof(errors));
+  memset(&bench, 0, sizeof(bench));
+  memset(&seg_cfg, 0, sizeof(seg_cfg));
+  memset(&rw_cfg, 0, sizeof(rw_cfg));
+  h265_parse_mask_init(&parse_mask);
+  memset(&sd_cfg, 0, sizeof(sd_cfg));
+  memset(&shm_cfg, 0, sizeof(shm_cfg));
+  shm_cfg.capacity = 64 << 20;
+  shm_cfg.chunk = 64 << 10;
+  shm_cfg.loops = 1;
+  sd_cfg.threads = 1;
+  bench.sizes = "1M,64M";
+  bench.repeat = 3;
+  memset(&perf, 0, sizeof(perf));
+  perf.samples = 5;
+  perf.min_seconds = 0.05;
+  for (i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--hrd") == 0) {
+      run_hrd = 1;
+    } else if (strcmp(argv[i], "--hrd-trace") == 0) {
+      run_hrd = hrd_trace = 1;
+    } else if (strcmp(argv[i], "--length-size") == 0 && i + 1 < argc) {
+      length_prefixed = 1;
+      length_size = (uint8_t)atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--hvcc") == 0 && i + 1 < argc) {
+      length_prefixed = 1;
+      hvcc_fn = argv[++i];
+    } else if (strcmp(argv[i], "--ts") == 0) {
+      transport_stream = 1;
+    } else if (strcmp(argv[i], "--follow") == 0) {
+      follow_mode = 1;
+    } else if (strcmp(argv[i], "--latency") == 0 && i + 1 < argc) {
+      latency_ms = (uint32_t)atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--idle") == 0 && i + 1 < argc) {
+      idle_ms = (uint32_t)atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--cache") == 0 && i + 1 < argc) {
+      cache_dir = argv[++i];
+    } else if (strcmp(argv[i], "--cache-size") == 0 && i + 1 < argc) {
+      cache_size = GeneratorParseSize(argv[++i]);
+    } else if (strcmp(argv[i], "--shm") == 0 && i + 1 < argc) {
+      shm_name = argv[++i];
+    } else if (strcmp(argv[i], "--shm-produce") == 0 && i + 1 < argc) {
+      shm_cfg.name = argv[++i];
+    } else if (strcmp(argv[i], "--shm-size") == 0 && i + 1 < argc) {
+      shm_cfg.capacity = strtoull(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--shm-chunk") == 0 && i + 1 < argc) {
+      shm_cfg.chunk = (uint32_t)atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--shm-loops") == 0 && i + 1 < argc) {
+      shm_cfg.loops = (uint32_t)atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--shm-rate") == 0 && i + 1 < argc) {
+      shm_cfg.rate = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--timing") == 0) {
+      timing = 1;
+    } else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) {
+      output_fn = argv[++i];
+    } else if (strcmp(argv[i], "--checkpoint") == 0 && i + 1 < argc) {
+      checkpoint_fn = argv[++i];
+    } else if (strcmp(argv[i], "--checkpoint-interval") == 0 &&
+               i + 1 < argc) {
+      checkpoint_interval = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--segment") == 0 && i + 1 < argc) {
+      seg_cfg.prefix = argv[++i];
+    } else if (strcmp(argv[i], "--segment-duration") == 0 && i + 1 < argc) {
+      seg_cfg.target_seconds = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--segment-bytes") == 0 && i + 1 < argc) {
+      seg_cfg.target_bytes = strtoull(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--segment-keep-rasl") == 0) {
+      seg_cfg.keep_rasl = 1;
+    } else if (strcmp(argv[i], "--rewrite") == 0 && i + 1 < argc) {
+      rw_cfg.output = argv[++i];
+    } else if (strcmp(argv[i], "--set") == 0 && i + 1 < argc) {
+      if (PsRewriterAddEdit(&rw_cfg, argv[++i]) != 0)
+        return -1;
+    } else if (strcmp(argv[i], "--rewrite-verify") == 0) {
+      rw_verify = 1;
+    } else if (strcmp(argv[i], "--to-hvcc") == 0 && i + 1 < argc) {
+      to_hvcc_fn = argv[++i];
+    } else if (strcmp(argv[i], "--max-tid") == 0 && i + 1 < argc) {
+      masked_run = 1;
+      parse_mask.max_temporal_id = (uint8_t)atoi(argv[++i]);
+    } else if ((strcmp(argv[i], "--layers") == 0 ||
+                strcmp(argv[i], "--nal-types") == 0) &&
+               i + 1 < argc) {
+      int types = argv[i][2] == 'n';
+      masked_run = 1;
+      if (parse_id_set(argv[i + 1], types,
+                       types ? &parse_mask.nal_unit_types
+                             : &parse_mask.layer_ids) != 0) {
+        fprintf(stderr, "invalid %s list %s\n", argv[i], argv[i + 1]);
+        return -1;
+      }
+      i++;
+    } else if (strcmp(argv[i], "--stats") == 0) {
+      stats_mode = 1;
+    } else if (strcmp(argv[i], "--slice-data") == 0) {
+      slice_data_mode = 1;
+    } else if (strcmp(argv[i], "--slice-data-ctus") == 0) {
+      slice_data_mode = 1;
+      sd_cfg.ctus = 1;
+    } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+      sd_cfg.threads = (uint32_t)atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--timestamps") == 0) {
+      timestamps_mode = 1;
+    } else if (strcmp(argv[i], "--seek") == 0 && i + 1 < argc) {
+      seek_seconds = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--seek-duration") == 0 && i + 1 < argc) {
+      seek_duration = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--index") == 0 && i + 1 < argc) {
+      index_fn = argv[++i];
+    } else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+      filter_expr = argv[++i];
+    } else if (strcmp(argv[i], "--delta") == 0 && i + 1 < argc) {
+      delta_mode = 1;
+      delta_interval = (uint32_t)atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--undelta") == 0 && i + 1 < argc) {
+      undelta_fn = argv[++i];
+    } else if (strcmp(argv[i], "--generate") == 0 && i + 1 < argc) {
+      generate_fn = argv[++i];
+    } else if (strncmp(argv[i], "--gen-", 6) == 0 && i + 1 < argc) {
+      if (GeneratorSetOption(&gen_cfg, argv[i] + 6, argv[i + 1]) != 0) {
+        fprintf(stderr, "invalid %s %s\n", argv[i], argv[i + 1]);
+        return -1;
+      }
+      i++;
+    } else if (strcmp(argv[i], "--bench") == 0 && i + 1 < argc) {
+      bench.corpus_dir = argv[++i];
+    } else if (strcmp(argv[i], "--bench-sizes") == 0 && i + 1 < argc) {
+      bench.sizes = argv[++i];
+    } else if (strcmp(argv[i], "--bench-modes") == 0 && i + 1 < argc) {
+      bench.modes = argv[++i];
+    } else if (strcmp(argv[i], "--bench-filter") == 0 && i + 1 < argc) {
+      if (bench.filter_count == BENCH_MAX_FILTERS) {
+        fprintf(stderr, "at most %d --bench-filter\n", BENCH_MAX_FILTERS);
+        return -1;
+      }
+      bench.filters[bench.filter_count++] = argv[++i];
+    } else if (strcmp(argv[i], "--bench-repeat") == 0 && i + 1 < argc) {
+      bench.repeat = (uint32_t)atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--perf") == 0) {
+      run_perf = 1;
+    } else if (strcmp(argv[i], "--perf-samples") == 0 && i + 1 < argc) {
+      perf.samples = (uint32_t)atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--perf-compare") == 0 && i + 2 < argc) {
+      perf_base = argv[++i];
+      perf_current = argv[++i];
+    } else if (strcmp(argv[i], "--perf-threshold") == 0 && i + 1 < argc) {
+      perf_threshold = atof(argv[++i]);
+#ifdef H265_METRICS
+    } else if (strcmp(argv[i], "--metrics") == 0 && i + 1 < argc) {
+      metrics_target = argv[++i];
+    } else if (strcmp(argv[i], "--metrics-interval") == 0 && i + 1 < argc) {
+      metrics_interval = (uint32_t)atoi(argv[++i]);
+#endif
+    } else if (argv[i][0] == '-' && argv[i][1] != 0) {
+      usage(argv[0]);
+      return -1;
+    } else {
+      inputs[num_inputs++] = argv[i];
+    }
+  }
+  if (num_inputs > 0)
+    fn1 = inputs[0];
+  if (num_inputs > 1) {
+    FILE *fo;
+    if (!stats_mode || generate_fn || undelta_fn || bench.corpus_dir ||
+        perf_base || run_perf || shm_cfg.name || shm_name || follow_mode ||
+        hvcc_fn || slice_data_mode || run_hrd || timestamps_mode ||
+        delta_mode || filter_expr || seek_seconds >= 0 || seg_cfg.prefix ||
+        rw_cfg.output || to_hvcc_fn || checkpoint_fn || cache_dir) {
+      fprintf(stderr, "several inputs go only with --stats, --length-size, "
+              "--ts, --output and the parse masks\n");
+      free(inputs);
+      return -1;
+    }
+    fo = output_fn ? fopen(output_fn, "w") : stdout;
+    if (!fo) {
+      fprintf(stderr, "couldn't create %s\n", output_fn);
+      free(inputs);
+      return -1;
+    }
+    ret = stats_inputs(inputs, num_inputs, length_prefixed, length_size,
+                       transport_stream, &parse_mask, fo);
+    if (fo != stdout && fclose(fo) != 0) {
+      fprintf(stderr, "couldn't write %s\n", output_fn);
+      ret = -1;
+    }
+    free(inputs);
+    return ret;
+  }
+  free(inputs);
+  if (generate_fn) {
+    struct GeneratorStats stats;
+    FILE *fo =
+        strcmp(generate_fn, "-") == 0 ? stdout : fopen(generate_fn, "wb");
+    if (!fo) {
+      fprintf(stderr, "couldn't create %s\n", generate_fn);
+      return -1;
+    }
+    ret = GeneratorWrite(&gen_cfg, fo, &stats);
+    if (fo != stdout && fclose(fo) != 0)
+      ret = -1;
+    fprintf(stderr, "%llu bytes, %llu NAL units, %llu pictures\n",
+            (unsigned long long)stats.bytes,
+            (unsigned long long)stats.nal_units,
+            (unsigned long long)stats.pictures);
+    if (stats.flipped)
+      fprintf(stderr, "%llu bits flipped\n",
+              (unsigned long long)stats.flipped);
+    return ret < 0 ? -1 : 0;
+  }
+  if (undelta_fn) {
+    FILE *fd =
+        strcmp(undelta_fn, "-") == 0 ? stdin : fopen(undelta_fn, "rb");
+    if (!fd) {
+      fprintf(stderr, "couldn't open %s\n", undelta_fn);
+      return -1;
+    }
+    ret = DeltaRestore(fd, stdout);
+    if (fd != stdin)
+      fclose(fd);
+    return ret;
+  }
+  if (bench.corpus_dir) {
+    bench.gen = gen_cfg;
+    if (bench.repeat < 1)
+      bench.repeat = 1;
+    return BenchRun(&bench, stdout) < 0 ? -1 : 0;
+  }
+  if (perf_base)
+    return PerfBenchCompare(perf_base, perf_current, perf_threshold, stdout);
+  if (run_perf) {
+    perf.corpus = fn1;
+    if (perf.samples < 1)
+      perf.samples = 1;
+    return PerfBenchRun(&perf, stdout) < 0 ? -1 : 0;
+  }
+  if (shm_cfg.name) {
+    struct ShmProducerStats shm_stats;
+    struct OutputConfig cfg = {0, 0};
+    struct OutputContextDict dict[1];
+    shm_cfg.input = fn1;
+    if (shm_cfg.chunk < 1)
+      shm_cfg.chunk = 1;
+    ret = ShmRingProduce(&shm_cfg, &shm_stats);
+    OutputContextInitDict(dict, stdout, 0, &cfg);
+    dict->put_str(dict, "ring", shm_cfg.name);
+    dict->put_uint(dict, "bytes", shm_stats.bytes);
+    dict->put_uint(dict, "writes", shm_stats.writes);
+    dict->put_uint(dict, "full_waits", shm_stats.full_waits);
+    dict->put_uint(dict, "microseconds",
+                   (uint64_t)(shm_stats.seconds * 1e6));
+    dict->put_uint(dict, "mb_per_second",
+                   shm_stats.seconds > 0
+                       ? (uint64_t)(shm_stats.bytes / shm_stats.seconds / 1e6)
+                       : 0);
+    StatsHistogramWrite(dict, "latency_us", &shm_stats.latency_us);
+    dict->end(dict);
+    fputc('\n', stdout);
+    return ret < 0 ? -1 : 0;
+  }
+  FILE *fi = shm_name ? NULL
+             : strcmp(fn1, "-") == 0 ? stdin : fopen(fn1, "rb");
   FILE *fp = stdout;
-  struct h265_decode_t dec, prevdec;
+  if (!fi && !shm_name) {
+    fprintf(stderr, "couldn't open %s\n", fn1);
+    return -1;
+  }
+  struct NalInput input;
+  if (!length_prefixed && !shm_name &&
+      (has_suffix(fn1, ".ts") || has_suffix(fn1, ".m2ts") ||
+       has_suffix(fn1, ".mts")))
+    transport_stream = 1;
+  if (shm_name) {
+    // the ring holds an Annex B byte stream the parser reads in place
+    if (transport_stream || length_prefixed || follow_mode) {
+      fprintf(stderr, "--shm input is an Annex B byte stream\n");
+      return -1;
+    }
+    if (ShmRingAttach(&shm_ring, shm_name) != 0)
+      return -1;
+    ret = ShmRingOpenInput(&shm_ring, &input);
+  } else if (transport_stream) {
+    TsDemuxInit(&ts_demux, fi);
+    ret = NalInputOpenAnnexBSource(&input, TsDemuxRead, TsDemuxStamp,
+                                   &ts_demux);
+  } else if (length_prefixed)
+    ret = NalInputOpenLengthPrefixed(&input, fi, length_size);
+  else
+    ret = NalInputOpenAnnexB(&input, fi);
+  if (ret == 0 && hvcc_fn) {
+    FILE *fh = fopen(hvcc_fn, "rb");
+    if (!fh) {
+      fprintf(stderr, "couldn't open %s\n", hvcc_fn);
+      ret = -1;
+    } else {
+      ret = NalInputLoadHvcc(&input, fh);
+      fclose(fh);
+    }
+  }
+  if (ret == 0 && follow_mode) {
+    ret = FollowSourceOpen(&follow, fileno(fi), fi == stdin ? NULL : fn1,
+                           latency_ms, idle_ms);
+    if (transport_stream) {
+      fprintf(stderr, "--follow is not supported for transport streams\n");
+      ret = -1;
+    }
+    NalInputSetSource(&input, FollowSourceRead, FollowSourceStamp, &follow);
+  }
+  if (ret == 0 && masked_run &&
+      (seg_cfg.prefix || rw_cfg.output || to_hvcc_fn)) {
+    // they copy the input, masked NAL units included
+    fprintf(stderr, "--max-tid, --layers and --nal-types don't go with "
+            "--segment, --rewrite or --to-hvcc\n");
+    ret = -1;
+  }
+  if (ret == 0 && seg_cfg.prefix) {
+    // chunks are copied from the input file by offset
+    if (!fi || fi == stdin || transport_stream || length_prefixed ||
+        follow_mode) {
+      fprintf(stderr, "--segment needs an Annex B input file\n");
+      ret = -1;
+    } else {
+      ret = SegmenterOpen(&segmenter, &seg_cfg, fn1);
+    }
+  }
+  if (ret == 0 && rw_cfg.output) {
+    // unedited NAL units are copied from the input file by offset
+    if (!fi || fi == stdin || transport_stream || length_prefixed ||
+        follow_mode || seg_cfg.prefix || checkpoint_fn || cache_dir ||
+        filter_expr || seek_seconds >= 0) {
+      fprintf(stderr, "--rewrite needs an Annex B input file and doesn't go "
+              "with --follow, --segment, --checkpoint, --cache, --filter "
+              "or --seek\n");
+      ret = -1;
+    } else if (strcmp(rw_cfg.output, fn1) == 0) {
+      fprintf(stderr, "--rewrite can't write over its input\n");
+      ret = -1;
+    } else {
+      ret = PsRewriterOpen(&ps_rewriter, &rw_cfg, fn1);
+    }
+  }
+  if (ret == 0 && to_hvcc_fn) {
+    // payloads are written from the input file by offset
+    if (!fi || fi == stdin || transport_stream || length_prefixed ||
+        follow_mode || seg_cfg.prefix || rw_cfg.output || checkpoint_fn ||
+        cache_dir || filter_expr || stats_mode || timestamps_mode ||
+        seek_seconds >= 0) {
+      fprintf(stderr, "--to-hvcc needs an Annex B input file and doesn't go "
+              "with --follow, --segment, --rewrite, --checkpoint, --cache, "
+              "--filter, --stats, --timestamps or --seek\n");
+      ret = -1;
+    } else if (strcmp(to_hvcc_fn, fn1) == 0) {
+      fprintf(stderr, "--to-hvcc can't write over its input\n");
+      ret = -1;
+    } else {
+      ret = HvccWriterOpen(&hvcc_writer, to_hvcc_fn, fn1);
+    }
+  }
+  if (ret == 0 && checkpoint_fn) {
+    // state kept elsewhere than in the regions can't be resumed
+    if (!output_fn || !fi || fi == stdin || transport_stream || follow_mode ||
+        delta_mode || run_hrd || seg_cfg.prefix) {
+      fprintf(stderr, "--checkpoint needs --output and a file input, and "
+              "doesn't go with --ts, --follow, --delta, --hrd or "
+              "--segment\n");
+      ret = -1;
+    }
+  }
+  if (ret == 0 && filter_expr) {
+    if (stats_mode || seg_cfg.prefix || timestamps_mode) {
+      fprintf(stderr, "--filter selects NAL unit records and doesn't go "
+              "with --stats, --segment or --timestamps\n");
+      ret = -1;
+    } else if (NalFilterCompile(&nal_filter, filter_expr) != 0) {
+      ret = -1;
+    }
+  }
+  if (ret == 0 && seek_seconds >= 0) {
+    // the input is read from an offset of the index
+    if (!index_fn || !fi || fi == stdin || transport_stream ||
+        length_prefixed || follow_mode || checkpoint_fn || seg_cfg.prefix) {
+      fprintf(stderr, "--seek needs --index and an Annex B input file, and "
+              "doesn't go with --follow, --checkpoint or --segment\n");
+      ret = -1;
+    }
+  }
+  if (ret == 0 && cache_dir) {
+    // a run that reads more than the file, or writes more than the output,
+    // can't be replayed
+    if (!fi || fi == stdin || follow_mode || seg_cfg.prefix ||
+        checkpoint_fn) {
+      fprintf(stderr, "--cache needs a file input and doesn't go with "
+              "--follow, --segment or --checkpoint\n");
+      ret = -1;
+    } else if (ParseCacheOpen(&parse_cache, cache_dir, cache_size, fi,
+                              options_hash(argc, argv, fn1)) != 0) {
+      fprintf(stderr, "couldn't identify %s for the cache\n", fn1);
+      ret = -1;
+    }
+  }
+  if (ret != 0) {
+    NalInputClose(&input);
+    if (fi)
+      fclose(fi);
+    return -1;
+  }
+  struct h265_decode_t dec;
   memset(&dec, 0, sizeof(dec));
-  memset(&prevdec, 0, sizeof(prevdec));
-
-  buffer_on = buffer_size = 0;
+  if (stats_mode)
+    StreamStatsInit(&stream_stats);
+  if (slice_data_mode && SliceDataInit(&slice_data, &sd_cfg) != 0) {
+    fprintf(stderr, "out of memory\n");
+    return -1;
+  }
+  if (checkpoint_fn) {
+    CheckpointInit(&checkpoint, checkpoint_fn, checkpoint_interval);
+    CheckpointAddRegion(&checkpoint, "decoder", &dec, sizeof(dec));
+    CheckpointAddRegion(&checkpoint, "nals", &nal_count, sizeof(nal_count));
+    CheckpointAddRegion(&checkpoint, "bytes", &nal_bytes, sizeof(nal_bytes));
+    CheckpointAddRegion(&checkpoint, "errors", errors, sizeof(errors));
+    if (stats_mode)
+      CheckpointAddRegion(&checkpoint, "stats", &stream_stats,
+                          sizeof(stream_stats));
+    if (slice_data_mode)
+      CheckpointAddRegion(&checkpoint, "slicedat", &slice_data.total,
+                          sizeof(slice_data.total));
+    resumed = CheckpointLoad(&checkpoint, &resume);
+    if (resumed > 0 && NalInputSeek(&input, resume.input_offset) != 0)
+      resumed = -1;
+    if (resumed < 0) {
+      NalInputClose(&input);
+      if (fi)
+        fclose(fi);
+      return -1;
+    }
+    if (resumed)
+      fprintf(stderr, "resuming at 0x%llX from %s\n",
+              (unsigned long long)resume.input_offset, checkpoint_fn);
+  }
+  if (seek_seconds >= 0 &&
+      seek_input(&input, fi, index_fn, seek_seconds, seek_duration, &dec,
+                 &seek_entry, &seek_end, timing) != 0) {
+    NalInputClose(&input);
+    fclose(fi);
+    return -1;
+  }
+  if (output_fn) {
+    fp = CheckpointOpenOutput(output_fn, resumed ? &resume : NULL);
+    if (!fp) {
+      fprintf(stderr, "couldn't create %s\n", output_fn);
+      NalInputClose(&input);
+      if (fi)
+        fclose(fi);
+      return -1;
+    }
+  }
 
-  struct OutputContextList out_list[1];
+  struct OutputContextList json_list[1], *out_list = json_list;
   struct OutputConfig out_cfg;
+  struct DeltaOutput delta;
   out_cfg.print_hex = 1;
   out_cfg.explain_enum = 1;
-  OutputContextInitList(out_list, fp, 1, &out_cfg);
-  while (!feof(fi)) {
-    bytes += buffer_on;
-    if (buffer_on != 0) {
-      buffer_on = buffer_size - buffer_on;
-      memmove(buffer, &buffer[buffer_size - buffer_on], buffer_on);
-    }
-    buffer_size = fread(buffer + buffer_on, 1, sizeof(buffer) - buffer_on, fi);
-    buffer_size += buffer_on;
-    buffer_on = 0;
-
-    int done = 0;
-
+  // the summary of --stats is one line
+  if (resumed)
+    OutputContextContinueList(json_list, fp, stats_mode ? 0 : 1, &out_cfg,
+                              resume.output_empty);
+  else
+    OutputContextInitList(json_list, fp, stats_mode ? 0 : 1, &out_cfg);
+  if (cache_dir) {
+    cache_hit = ParseCacheLookup(&parse_cache);
+    if (!cache_hit)
+      out_list = ParseCacheRecord(&parse_cache, json_list);
+  }
+  if (delta_mode) {
+    DeltaOutputInit(&delta, out_list, delta_interval);
+    out_list = delta.list;
+  }
+  H265EventsInit(&events);
+  if (run_hrd) {
+    struct H265Subscriber sub;
+    memset(&sub, 0, sizeof(sub));
+    HrdSimInit(&hrd_sim, out_list, hrd_trace);
+    sub.opaque = &hrd_sim;
+    sub.on_nal = HrdOnNal;
+    H265EventsSubscribe(&events, &sub);
+  }
+  if (stats_mode) {
+    struct H265Subscriber sub;
+    memset(&sub, 0, sizeof(sub));
+    sub.opaque = &stream_stats;
+    sub.on_nal = StatsOnNal;
+    H265EventsSubscribe(&events, &sub);
+  }
+  if (timestamps_mode) {
+    struct H265Subscriber sub;
+    memset(&sub, 0, sizeof(sub));
+    AuTimestampsInit(&au_timestamps, out_list);
+    if (seek_seconds >= 0)
+      AuTimestampsRestore(&au_timestamps, &seek_entry.timestamps);
+    sub.opaque = &au_timestamps;
+    sub.on_nal = TimestampsOnNal;
+    H265EventsSubscribe(&events, &sub);
+  }
+  // with nothing else looking at the parse, NAL units the filter decides
+  // against by their header needn't be parsed further
+  filter_skips = events.count == 0;
+  // and the rewriter only needs the VPS and SPS, which are always parsed
+  if (rw_cfg.output && events.count == 0)
+    parse_mask.nal_unit_types = 0;
+  if (to_hvcc_fn)
+    hvcc_writer.out = out_list;
+  METRICS_INIT();
+#ifdef H265_METRICS
+  if (metrics_target && MetricsOpenExport(metrics_target, metrics_interval)) {
+    fprintf(stderr, "invalid metrics target %s\n", metrics_target);
+    return -1;
+  }
+#endif
+  start = clock();
+  if (cache_hit) {
+    // the recorded output is that of the whole run, the input isn't read
+    if (ParseCacheReplay(&parse_cache, json_list) != 0)
+      ret = -1;
+    nal_count = parse_cache.header->nal_count;
+    nal_bytes = parse_cache.header->key.size;
+  }
+  struct NalUnit nal;
+  while (!cache_hit) {
     struct BitStream bs;
-    do {
-      uint32_t ret;
-      struct OutputContextDict out_dict[1];
-      ret = h265_find_next_start_code(buffer + buffer_on,
-                                      buffer_size - buffer_on);
-      if (ret == 0) {
-        done = 1;
-        if (buffer_on == 0) {
-          fprintf(stderr, "couldn't find start code in buffer\n");
-          exit(-1);
-        }
-        break;
-      }
-      if (ret > 3) {
-        uint32_t nal_len;
-        nal_len = remove_03(buffer + buffer_on, ret);
-        out_list->put_dict(out_list, out_dict);
-        out_dict->put_uint(out_dict, "nal_length", nal_len);
-        out_dict->put_uint(out_dict, "start_code_bytes",
-                           buffer[buffer_on + 2] == 1 ? 3 : 4);
-        out_dict->put_hex(out_dict, "offset", bytes + buffer_on);
-        BsInit(&bs, buffer + buffer_on, nal_len);
-        h265_parse_nal(&dec, &bs, out_dict);
-        out_dict->end(out_dict);
+    struct OutputContextDict out_dict[1];
+    uint32_t nal_len;
+    int err, filtered;
+    METRICS_BEGIN(stage_start);
+    ret = input.next(&input, &nal);
+    if (ret <= 0)
+      break;
+    if (nal.offset >= seek_end) {
+      ret = 0;
+      break;
+    }
+    if (nal.partial) {
+      // the NAL unit at the end of a followed input that went idle; it
+      // comes again whole, so it is neither parsed nor counted here
+      if (!filter_expr && !stats_mode && !seg_cfg.prefix &&
+          !timestamps_mode && !rw_cfg.output && !to_hvcc_fn && !delta_mode) {
+        struct OutputContextDict partial_dict[1];
+        out_list->put_dict(out_list, partial_dict);
+        partial_dict->put_uint(partial_dict, "nal_length", nal.size);
+        partial_dict->put_uint(partial_dict, "start_code_bytes",
+                               nal.prefix_bytes);
+        partial_dict->put_hex(partial_dict, "offset", nal.offset);
+        partial_dict->put_uint(partial_dict, "partial", 1);
+        partial_dict->end(partial_dict);
+        fflush(fp);
       }
-      buffer_on += ret;
-    } while (!done);
+      continue;
+    }
+    METRICS_LAP(METRICS_STAGE_SCAN, stage_start, nal.prefix_bytes + nal.size);
+    // snapshots are taken between access units, where no picture is half
+    // parsed; the NAL unit header isn't escaped
+    if (checkpoint_fn && !nal.from_config && nal.size > 2 &&
+        h265_starts_access_unit(&dec,
+                                (enum H265NalType)(nal.data[0] >> 1 & 63),
+                                nal.data[2] >> 7) &&
+        CheckpointDue(&checkpoint) &&
+        CheckpointSave(&checkpoint, fp, nal.offset, json_list->first) != 0) {
+      ret = -1;
+      break;
+    }
+    nal_count++;
+    nal_bytes += nal.prefix_bytes + nal.size;
+    if (!h265_parse_mask_selects(&parse_mask, nal.data, nal.size)) {
+      masked++;
+      continue;
+    }
+    nal_len = remove_03(nal.data, nal.size);
+    METRICS_LAP(METRICS_STAGE_UNESCAPE, stage_start, nal.size);
+    METRICS_NAL_BEGIN(stage_start);
+    filtered = filter_expr && !NalFilterSelect(&nal_filter, &dec, nal.data,
+                                               nal_len, filter_skips, &err);
+    if (filtered || stats_mode || seg_cfg.prefix || timestamps_mode ||
+        rw_cfg.output || to_hvcc_fn)
+      OutputContextInitDict(out_dict, fp, -1, &out_cfg);
+    else
+      out_list->put_dict(out_list, out_dict);
+    out_dict->put_uint(out_dict, "nal_length", nal_len);
+    if (input.format == NAL_INPUT_ANNEXB)
+      out_dict->put_uint(out_dict, "start_code_bytes", nal.prefix_bytes);
+    else
+      out_dict->put_uint(out_dict, "length_size", nal.prefix_bytes);
+    if (nal.from_config)
+      out_dict->put_str(out_dict, "source", "hvcC");
+    out_dict->put_hex(out_dict, "offset", nal.offset);
+    if (nal.pts >= 0) {
+      out_dict->put_uint(out_dict, "pts", nal.pts);
+      out_dict->put_uint(out_dict, "dts", nal.dts);
+    }
+    if (!filtered) {
+      BsInit(&bs, nal.data, nal_len);
+      err = h265_parse_nal(&dec, &bs, out_dict);
+      if (slice_data_mode && err == 0)
+        SliceDataWalk(&slice_data, &dec, nal.data, nal_len, out_dict);
+    }
+    METRICS_NAL_END(dec.nal_unit_header.nal_unit_type, nal_len);
+    // a NAL unit that fails is skipped, parsing goes on with the next one
+    if (err < 0 && err > -H265_ERROR_TYPES) {
+      errors[-err]++;
+      out_dict->put_str(out_dict, "error", h265_error_name(err));
+    }
+    out_dict->end(out_dict);
+    H265EventsDispatch(&events, &dec, &nal, err);
+    if (cache_dir)
+      ParseCacheAddNal(&parse_cache, &nal, dec.nal_unit_header.nal_unit_type);
+    if (seg_cfg.prefix && SegmenterPushNal(&segmenter, &dec, &nal) != 0) {
+      ret = -1;
+      break;
+    }
+    if (rw_cfg.output &&
+        PsRewriterPushNal(&ps_rewriter, &dec, &nal, nal_len, err) != 0) {
+      ret = -1;
+      break;
+    }
+    if (to_hvcc_fn &&
+        HvccWriterPushNal(&hvcc_writer, &dec, &nal, nal_len, err) != 0) {
+      ret = -1;
+      break;
+    }
+    if (follow_mode)
+      fflush(fp);
+#ifdef H265_METRICS
+    MetricsTick();
+#endif
+  }
+  if (run_hrd && !cache_hit)
+    HrdSimFinish(&hrd_sim);
+  if (seg_cfg.prefix && SegmenterClose(&segmenter) != 0)
+    ret = -1;
+  if (rw_cfg.output) {
+    struct OutputContextDict rw_dict[1];
+    if (PsRewriterClose(&ps_rewriter) != 0)
+      ret = -1;
+    if (ret >= 0 && rw_verify &&
+        (PsRewriterVerify(&rw_cfg, fn1, &rw_check) != 0 ||
+         rw_check.mismatches))
+      ret = -1;
+    out_list->put_dict(out_list, rw_dict);
+    rw_dict->put_str(rw_dict, "file", rw_cfg.output);
+    rw_dict->put_uint(rw_dict, "sps_rewritten", ps_rewriter.sps_rewritten);
+    rw_dict->put_uint(rw_dict, "vps_rewritten", ps_rewriter.vps_rewritten);
+    rw_dict->put_uint(rw_dict, "unchanged", ps_rewriter.unchanged);
+    rw_dict->put_uint(rw_dict, "bytes_copied", ps_rewriter.bytes_copied);
+    rw_dict->put_uint(rw_dict, "bytes_written", ps_rewriter.bytes_written);
+    if (rw_verify) {
+      rw_dict->put_uint(rw_dict, "verified_nal_units", rw_check.nal_units);
+      rw_dict->put_uint(rw_dict, "verified_parameter_sets",
+                        rw_check.parameter_sets);
+      rw_dict->put_uint(rw_dict, "mismatches", rw_check.mismatches);
+    }
+    rw_dict->end(rw_dict);
+  }
+  if (to_hvcc_fn) {
+    struct OutputContextDict hvcc_dict[1];
+    if (HvccWriterClose(&hvcc_writer) != 0)
+      ret = -1;
+    out_list->put_dict(out_list, hvcc_dict);
+    hvcc_dict->put_str(hvcc_dict, "file", to_hvcc_fn);
+    hvcc_dict->put_uint(hvcc_dict, "samples", hvcc_writer.samples);
+    hvcc_dict->put_uint(hvcc_dict, "sync_samples", hvcc_writer.sync_samples);
+    hvcc_dict->put_uint(hvcc_dict, "nal_units", hvcc_writer.nal_units);
+    hvcc_dict->put_uint(hvcc_dict, "bytes", hvcc_writer.output_size);
+    hvcc_dict->put_uint(hvcc_dict, "writes", hvcc_writer.writes);
+    hvcc_dict->put_uint(hvcc_dict, "hvcc_bytes", hvcc_writer.record_size);
+    hvcc_dict->end(hvcc_dict);
+  }
+  if (stats_mode && !cache_hit) {
+    struct OutputContextDict stats_dict[1];
+    StreamStatsFinish(&stream_stats);
+    out_list->put_dict(out_list, stats_dict);
+    stats_dict->put_str(stats_dict, "file", fn1);
+    StreamStatsWrite(&stream_stats, stats_dict);
+    if (slice_data_mode) {
+      struct OutputContextDict sd_dict[1];
+      stats_dict->put_dict(stats_dict, "slice_data", sd_dict);
+      SliceDataStatsWrite(&slice_data.total, sd_dict, 1);
+      sd_dict->end(sd_dict);
+    }
+    stats_dict->end(stats_dict);
   }
   out_list->end(out_list);
+  if (stats_mode)
+    fputc('\n', fp);
+  if (fp != stdout && fclose(fp) != 0) {
+    fprintf(stderr, "couldn't write %s\n", output_fn);
+    ret = -1;
+  }
+  // a finished run starts over
+  if (checkpoint_fn && ret >= 0)
+    CheckpointRemove(&checkpoint);
+  if (cache_dir && !cache_hit && ret >= 0)
+    ParseCacheCommit(&parse_cache,
+                     (double)(clock() - start) / CLOCKS_PER_SEC);
+  if (delta_mode) {
+    if (timing)
+      fprintf(stderr, "delta: %llu full records, %llu delta records\n",
+              (unsigned long long)delta.full_records,
+              (unsigned long long)delta.delta_records);
+    DeltaOutputClose(&delta);
+  }
+  if (timing) {
+    double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+    uint64_t failed = 0;
+    fprintf(stderr, "%llu NAL units, %llu bytes in %.3f s, %.1f MB/s\n",
+            (unsigned long long)nal_count, (unsigned long long)nal_bytes,
+            seconds, seconds > 0 ? nal_bytes / seconds / 1e6 : 0.0);
+    if (masked_run)
+      fprintf(stderr, "%llu NAL units masked\n", (unsigned long long)masked);
+    for (i = 1; i < H265_ERROR_TYPES; i++)
+      failed += errors[i];
+    if (failed || input.resyncs) {
+      fprintf(stderr, "errors:");
+      for (i = 1; i < H265_ERROR_TYPES; i++)
+        fprintf(stderr, " %s %llu", h265_error_name(-i),
+                (unsigned long long)errors[i]);
+      fprintf(stderr, ", %llu resyncs skipping %llu bytes\n",
+              (unsigned long long)input.resyncs,
+              (unsigned long long)input.resync_bytes);
+    }
+    if (slice_data_mode) {
+      fprintf(stderr, "slice_data: %llu slice segments, %llu errors, "
+              "%llu CTUs, %llu bits\n",
+              (unsigned long long)slice_data.total.slices,
+              (unsigned long long)slice_data.total.errors,
+              (unsigned long long)slice_data.total.ctus,
+              (unsigned long long)slice_data.total.bits);
+    }
+    if (cache_dir && cache_hit) {
+      fprintf(stderr, "cache: hit %s, %llu bytes replayed, %.3f s when "
+              "parsed\n", parse_cache.path,
+              (unsigned long long)parse_cache.map_size,
+              parse_cache.header->parse_us / 1e6);
+    } else if (cache_dir) {
+      fprintf(stderr, "cache: miss, wrote %s, %llu bytes of output, %llu "
+              "files evicted\n", parse_cache.path,
+              (unsigned long long)parse_cache.tape_size,
+              (unsigned long long)parse_cache.evicted);
+    }
+    if (checkpoint_fn) {
+      fprintf(stderr, "checkpoint: %llu snapshots, %llu bytes\n",
+              (unsigned long long)checkpoint.taken,
+              (unsigned long long)checkpoint.bytes);
+    }
+    if (transport_stream) {
+      fprintf(stderr,
+              "ts: %llu bytes, %llu packets of %u bytes, %llu PES packets, "
+              "%llu continuity errors, %llu resyncs, %.1f MB/s\n",
+              (unsigned long long)ts_demux.input_bytes,
+              (unsigned long long)ts_demux.packets, ts_demux.packet_size,
+              (unsigned long long)ts_demux.pes_packets,
+              (unsigned long long)ts_demux.cc_errors,
+              (unsigned long long)ts_demux.resyncs,
+              seconds > 0 ? ts_demux.input_bytes / seconds / 1e6 : 0.0);
+    }
+  }
+  if (transport_stream && ts_demux.dropped_timestamps)
+    fprintf(stderr, "ts: %llu PES timestamps dropped\n",
+            (unsigned long long)ts_demux.dropped_timestamps);
 
-  fclose(fi);
-  return 0;
+#ifdef H265_METRICS
+  MetricsFinish();
+#endif
+  if (slice_data_mode)
+    SliceDataClose(&slice_data);
+  if (follow_mode) {
+    FollowSourcePrintStats(&follow, stderr);
+    FollowSourceClose(&follow);
+  }
+  NalInputClose(&input);
+  if (cache_dir)
+    ParseCacheClose(&parse_cache);
+  if (shm_name)
+    ShmRingClose(&shm_ring);
+  if (fi)
+    fclose(fi);
+  return ret < 0 ? -1 : 0;
 }
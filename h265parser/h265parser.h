@@ -2,6 +2,37 @@
 #define H265_PARSER_H_
 
 #include <stdint.h>
+#include "h265const.h"
+
+struct BitStream;
+struct OutputContextDict;
+
+#define H265_MAX_SUB_LAYERS 8
+#define H265_MAX_CPB_CNT 32
+#define H265_MAX_SHORT_TERM_REF_PIC_SETS 64
+#define H265_MAX_DPB_SIZE 16
+#define H265_MAX_LONG_TERM_REF_PICS_SPS 32
+#define H265_MAX_REF_IDX 16
+// Table A.6 maxima of the highest level
+#define H265_MAX_TILE_COLUMNS 20
+#define H265_MAX_TILE_ROWS 22
+#define H265_MAX_ENTRY_POINTS 1024
+
+// What the h265_* parsing functions return, 0 or one of these. A NAL unit
+// that fails is skipped and parsing continues with the next one; parameter
+// sets that fail don't count as received.
+enum H265Error {
+  H265_OK = 0,
+  H265_ERR_TRUNCATED = -1,  // the syntax runs past the end of the NAL unit
+  H265_ERR_INVALID = -2,    // a value out of the range the syntax allows
+  // forbidden_zero_bit set or nuh_temporal_id_plus1 0, so likely not a NAL
+  // unit but damaged data past a start code
+  H265_ERR_NAL_HEADER = -3,
+  // a slice segment before its SPS and PPS were received, or after one of
+  // them failed to parse
+  H265_ERR_NO_PARAMETER_SET = -4,
+};
+#define H265_ERROR_TYPES 5
 
 struct NalUnitHeader {
   enum H265NalType nal_unit_type;
@@ -9,6 +40,31 @@ struct NalUnitHeader {
   uint8_t nuh_temporal_id_plus1;
 };
 
+// 7.3.3 Profile, tier and level, general or of a sub-layer
+struct H265ProfileTierLevelSubLayer {
+  uint8_t profile_present_flag;
+  uint8_t level_present_flag;
+  uint8_t profile_space;
+  uint8_t tier_flag;
+  uint8_t profile_idc;
+  uint8_t profile_compatibility_flag[32];
+  uint8_t progressive_source_flag;
+  uint8_t interlaced_source_flag;
+  uint8_t non_packed_constraint_flag;
+  uint8_t frame_only_constraint_flag;
+  uint8_t max_12bit_constraint_flag;
+  uint8_t max_10bit_constraint_flag;
+  uint8_t max_8bit_constraint_flag;
+  uint8_t max_422chroma_constraint_flag;
+  uint8_t max_420chroma_constraint_flag;
+  uint8_t max_monochrome_constraint_flag;
+  uint8_t intra_constraint_flag;
+  uint8_t one_picture_only_constraint_flag;
+  uint8_t lower_bit_rate_constraint_flag;
+  uint8_t inbld_flag;
+  uint8_t level_idc;
+};
+
 struct H265VideoParameterSet {
   uint8_t vps_video_parameter_set_id;
   uint8_t vps_base_layer_internal_flag;
@@ -17,16 +73,19 @@ struct H265VideoParameterSet {
   uint8_t vps_max_sub_layers_minus1;
   uint8_t vps_temporal_id_nesting_flag;
   uint16_t vps_reserved_0xffff_16bits;
+  struct H265ProfileTierLevelSubLayer general_profile_tier_level;
   uint8_t vps_sub_layer_ordering_info_present_flag;
   uint8_t vps_max_layer_id;
   uint16_t vps_num_layer_sets_minus1;
   uint8_t vps_timing_info_present_flag;
   uint32_t vps_num_units_in_tick;
-  uint8_t vps_time_scale;
+  uint32_t vps_time_scale;
   uint8_t vps_poc_proportional_to_timing_flag;
   uint32_t vps_num_ticks_poc_diff_one_minus1;
   uint32_t vps_num_hrd_parameters;
   uint8_t vps_extension_flag;
+  // RBSP bit position of vps_num_units_in_tick, for rewriting
+  uint32_t vps_timing_info_pos;
 };
 
 struct H265PicParameterSet {
@@ -55,6 +114,8 @@ struct H265PicParameterSet {
   uint32_t num_tile_columns_minus1;
   uint32_t num_tile_rows_minus1;
   uint8_t uniform_spacing_flag;
+  uint32_t column_width_minus1[H265_MAX_TILE_COLUMNS];
+  uint32_t row_height_minus1[H265_MAX_TILE_ROWS];
   uint8_t loop_filter_across_tiles_enabled_flag;
   uint8_t pps_loop_filter_across_slices_enabled_flag;
   uint8_t deblocking_filter_control_present_flag;
@@ -82,6 +143,15 @@ struct H265PicParameterSet {
   uint32_t log2_sao_offset_scale_chroma;
 };
 
+// E.2.3 Sub-layer HRD parameters, one instance per sub-layer
+struct H265SubLayerHrdParameters {
+  uint32_t bit_rate_value_minus1[H265_MAX_CPB_CNT];
+  uint32_t cpb_size_value_minus1[H265_MAX_CPB_CNT];
+  uint32_t cpb_size_du_value_minus1[H265_MAX_CPB_CNT];
+  uint32_t bit_rate_du_value_minus1[H265_MAX_CPB_CNT];
+  uint8_t cbr_flag[H265_MAX_CPB_CNT];
+};
+
 struct H265HrdParameters {
   uint8_t nal_hrd_parameters_present_flag;
   uint8_t vcl_hrd_parameters_present_flag;
@@ -96,11 +166,13 @@ struct H265HrdParameters {
   uint8_t initial_cpb_removal_delay_length_minus1;
   uint8_t au_cpb_removal_delay_length_minus1;
   uint8_t dpb_output_delay_length_minus1;
-  uint8_t fixed_pic_rate_general_flag;
-  uint8_t fixed_pic_rate_within_cvs_flag;
-  uint32_t elemental_duration_in_tc_minus1;
-  uint8_t low_delay_hrd_flag;
-  uint32_t cpb_cnt_minus1;
+  uint8_t fixed_pic_rate_general_flag[H265_MAX_SUB_LAYERS];
+  uint8_t fixed_pic_rate_within_cvs_flag[H265_MAX_SUB_LAYERS];
+  uint32_t elemental_duration_in_tc_minus1[H265_MAX_SUB_LAYERS];
+  uint8_t low_delay_hrd_flag[H265_MAX_SUB_LAYERS];
+  uint32_t cpb_cnt_minus1[H265_MAX_SUB_LAYERS];
+  struct H265SubLayerHrdParameters nal_sub_layer[H265_MAX_SUB_LAYERS];
+  struct H265SubLayerHrdParameters vcl_sub_layer[H265_MAX_SUB_LAYERS];
 };
 
 struct H265VuiParameters {
@@ -144,26 +216,45 @@ struct H265VuiParameters {
   uint32_t log2_max_mv_length_horizontal;
   uint32_t log2_max_mv_length_vertical;
   struct H265HrdParameters hrd_parameters;
+  // RBSP bit range of hrd_parameters(), for rewriting
+  uint32_t hrd_parameters_pos;
+  uint32_t hrd_parameters_end;
+};
+
+// 7.3.7 Short-term reference picture set, with the (7-61) ~ (7-62) variables
+struct H265ShortTermRefPicSet {
+  uint8_t inter_ref_pic_set_prediction_flag;
+  uint8_t NumNegativePics;
+  uint8_t NumPositivePics;
+  uint8_t NumDeltaPocs;
+  int32_t DeltaPocS0[H265_MAX_DPB_SIZE];
+  int32_t DeltaPocS1[H265_MAX_DPB_SIZE];
+  uint8_t UsedByCurrPicS0[H265_MAX_DPB_SIZE];
+  uint8_t UsedByCurrPicS1[H265_MAX_DPB_SIZE];
 };
 
 struct H265SeqParameterSet {
   uint32_t sps_video_parameter_set_id;
   uint8_t sps_max_sub_layers_minus1;
   uint32_t sps_temporal_id_nesting_flag;
+  struct H265ProfileTierLevelSubLayer general_profile_tier_level;
   uint8_t sps_seq_parameter_set_id;
   uint8_t chroma_format_idc;
   uint32_t separate_colour_plane_flag;
-  uint8_t pic_width_in_luma_samples;
-  uint8_t pic_height_in_luma_samples;
+  uint32_t pic_width_in_luma_samples;
+  uint32_t pic_height_in_luma_samples;
   uint32_t conformance_window_flag;
-  uint8_t conf_win_left_offset;
-  uint8_t conf_win_right_offset;
-  uint8_t conf_win_top_offset;
-  uint8_t conf_win_bottom_offset;
+  uint32_t conf_win_left_offset;
+  uint32_t conf_win_right_offset;
+  uint32_t conf_win_top_offset;
+  uint32_t conf_win_bottom_offset;
   uint8_t bit_depth_luma_minus8;
   uint8_t bit_depth_chroma_minus8;
   uint8_t log2_max_pic_order_cnt_lsb_minus4;
   uint32_t sps_sub_layer_ordering_info_present_flag;
+  uint32_t sps_max_dec_pic_buffering_minus1[H265_MAX_SUB_LAYERS];
+  uint32_t sps_max_num_reorder_pics[H265_MAX_SUB_LAYERS];
+  uint32_t sps_max_latency_increase_plus1[H265_MAX_SUB_LAYERS];
   uint8_t log2_min_luma_coding_block_size_minus3;
   uint8_t log2_diff_max_min_luma_coding_block_size;
   uint8_t log2_min_luma_transform_block_size_minus2;
@@ -181,13 +272,24 @@ struct H265SeqParameterSet {
   uint8_t log2_diff_max_min_pcm_luma_coding_block_size;
   uint32_t pcm_loop_filter_disabled_flag;
   uint32_t num_short_term_ref_pic_sets;
+  struct H265ShortTermRefPicSet
+      st_ref_pic_set[H265_MAX_SHORT_TERM_REF_PIC_SETS];
   uint32_t long_term_ref_pics_present_flag;
   uint8_t num_long_term_ref_pics_sps;
+  uint32_t lt_ref_pic_poc_lsb_sps[H265_MAX_LONG_TERM_REF_PICS_SPS];
+  uint8_t used_by_curr_pic_lt_sps_flag[H265_MAX_LONG_TERM_REF_PICS_SPS];
   uint32_t sps_temporal_mvp_enabled_flag;
   uint32_t strong_intra_smoothing_enabled_flag;
   uint32_t vui_parameters_present_flag;
   uint32_t sps_extension_present_flag;
+  uint8_t sps_range_extension_flag;
+  uint8_t sps_multilayer_extension_flag;
+  uint8_t sps_extension_6bits;
   struct H265VuiParameters vui_param;
+  // RBSP bit range of vui_parameters_present_flag and vui_parameters(), for
+  // rewriting
+  uint32_t vui_parameters_pos;
+  uint32_t vui_parameters_end;
 
   // variables
   // P73
@@ -213,28 +315,26 @@ struct H265SeqParameterSet {
   uint32_t PicHeightInSamplesC;
 };
 
-struct H265ProfileTierLevelSubLayer {
-  uint8_t profile_present_flag;
-  uint8_t level_present_flag;
-  uint8_t profile_space;
-  uint8_t tier_flag;
-  uint8_t profile_idc;
-  uint8_t profile_compatibility_flag[32];
-  uint8_t progressive_source_flag;
-  uint8_t interlaced_source_flag;
-  uint8_t non_packed_constraint_flag;
-  uint8_t frame_only_constraint_flag;
-  uint8_t max_12bit_constraint_flag;
-  uint8_t max_10bit_constraint_flag;
-  uint8_t max_8bit_constraint_flag;
-  uint8_t max_422chroma_constraint_flag;
-  uint8_t max_420chroma_constraint_flag;
-  uint8_t max_monochrome_constraint_flag;
-  uint8_t intra_constraint_flag;
-  uint8_t one_picture_only_constraint_flag;
-  uint8_t lower_bit_rate_constraint_flag;
-  uint8_t inbld_flag;
-  uint8_t level_idc;
+// 7.3.6.2 Reference picture list modification
+struct H265RefPicListsModification {
+  uint8_t ref_pic_list_modification_flag_l0;
+  uint8_t ref_pic_list_modification_flag_l1;
+  uint8_t list_entry_l0[H265_MAX_REF_IDX];
+  uint8_t list_entry_l1[H265_MAX_REF_IDX];
+};
+
+// 7.3.6.3 Weighted prediction parameters, as the (7-56) ~ (7-60) weights
+// and offsets of each list and reference index; entries without weights
+// hold the default ones. The flags are bit masks over the reference index.
+struct H265PredWeightTable {
+  uint8_t luma_log2_weight_denom;
+  uint8_t ChromaLog2WeightDenom;
+  uint16_t luma_weight_flag[2];
+  uint16_t chroma_weight_flag[2];
+  int16_t LumaWeight[2][H265_MAX_REF_IDX];
+  int16_t luma_offset[2][H265_MAX_REF_IDX];
+  int16_t ChromaWeight[2][H265_MAX_REF_IDX][2];
+  int16_t ChromaOffset[2][H265_MAX_REF_IDX][2];
 };
 
 struct H265SliceSegmentHeader {
@@ -242,11 +342,11 @@ struct H265SliceSegmentHeader {
   uint8_t no_output_of_prior_pics_flag;
   uint32_t slice_pic_parameter_set_id;
   uint8_t dependent_slice_segment_flag;
-  uint8_t slice_segment_address;
+  uint32_t slice_segment_address;
   uint32_t slice_type;
   uint8_t pic_output_flag;
   uint8_t colour_plane_id;
-  uint8_t slice_pic_order_cnt_lsb;
+  uint32_t slice_pic_order_cnt_lsb;
   uint8_t short_term_ref_pic_set_sps_flag;
   uint8_t short_term_ref_pic_set_idx;
   uint32_t num_long_term_sps;
@@ -274,10 +374,193 @@ struct H265SliceSegmentHeader {
   uint32_t num_entry_point_offsets;
   uint32_t offset_len_minus1;
   uint32_t slice_segment_header_extension_length;
+  // last, H265SlicePlan.defaults covers slice_type up to here
+  struct H265ShortTermRefPicSet st_ref_pic_set;
+  uint32_t NumPicTotalCurr;  // (7-55)
+  struct H265RefPicListsModification lists_modification;
+  struct H265PredWeightTable pred_weight_table;
+  // where slice_data() starts, past byte_alignment(): in bits of the RBSP
+  // and in bytes of the NAL unit as stored, with its emulation prevention
+  // bytes; both from the start of the NAL unit header
+  uint32_t slice_data_bit_offset;  // 0 until the header parsed completely
+  uint32_t slice_data_byte_offset;
+  // the first H265_MAX_ENTRY_POINTS of num_entry_point_offsets
+  uint32_t entry_point_offset_minus1[H265_MAX_ENTRY_POINTS];
 };
 
 struct H265SliceSegmentLayer {
   struct H265SliceSegmentHeader header;
 };
 
+// D.2.2 Buffering period SEI message
+struct H265BufferingPeriod {
+  uint32_t bp_seq_parameter_set_id;
+  uint8_t irap_cpb_params_present_flag;
+  uint32_t cpb_delay_offset;
+  uint32_t dpb_delay_offset;
+  uint8_t concatenation_flag;
+  uint32_t au_cpb_removal_delay_delta_minus1;
+  uint32_t nal_initial_cpb_removal_delay[H265_MAX_CPB_CNT];
+  uint32_t nal_initial_cpb_removal_offset[H265_MAX_CPB_CNT];
+  uint32_t vcl_initial_cpb_removal_delay[H265_MAX_CPB_CNT];
+  uint32_t vcl_initial_cpb_removal_offset[H265_MAX_CPB_CNT];
+  // with sub-picture HRD parameters or irap_cpb_params_present_flag
+  uint32_t nal_initial_alt_cpb_removal_delay[H265_MAX_CPB_CNT];
+  uint32_t nal_initial_alt_cpb_removal_offset[H265_MAX_CPB_CNT];
+  uint32_t vcl_initial_alt_cpb_removal_delay[H265_MAX_CPB_CNT];
+  uint32_t vcl_initial_alt_cpb_removal_offset[H265_MAX_CPB_CNT];
+};
+
+// D.2.3 Picture timing SEI message
+struct H265PicTiming {
+  uint8_t pic_struct;
+  uint8_t source_scan_type;
+  uint8_t duplicate_flag;
+  uint32_t au_cpb_removal_delay_minus1;
+  uint32_t pic_dpb_output_delay;
+  uint32_t pic_dpb_output_du_delay;
+  // decoding units; the per-unit num_nalus_in_du_minus1 and
+  // du_cpb_removal_delay_increment_minus1 are read past, not kept
+  uint32_t num_decoding_units_minus1;
+  uint8_t du_common_cpb_removal_delay_flag;
+  uint32_t du_common_cpb_removal_delay_increment_minus1;
+};
+
+// Timing-related SEI messages seen in the most recent SEI NAL unit
+struct H265SeiMessages {
+  uint8_t buffering_period_present;
+  uint8_t pic_timing_present;
+  struct H265BufferingPeriod buffering_period;
+  struct H265PicTiming pic_timing;
+};
+
+// Slice segment header decode plan, compiled from the active SPS and PPS on
+// the first slice after either changes: which SPS/PPS-conditional elements
+// of 7.3.6.1 are present, their bit widths, and the values 7.4.7.1 infers
+// for elements that are not present. Slices then test one mask instead of
+// the parameter sets.
+enum H265SlicePlanFlag {
+  H265_SLICE_HAS_DEPENDENT_SLICE_SEGMENT_FLAG = 1 << 0,
+  H265_SLICE_HAS_PIC_OUTPUT_FLAG = 1 << 1,
+  H265_SLICE_HAS_COLOUR_PLANE_ID = 1 << 2,
+  H265_SLICE_HAS_SHORT_TERM_REF_PIC_SET_IDX = 1 << 3,
+  H265_SLICE_HAS_LONG_TERM_REF_PICS = 1 << 4,
+  H265_SLICE_HAS_NUM_LONG_TERM_SPS = 1 << 5,
+  H265_SLICE_HAS_TEMPORAL_MVP = 1 << 6,
+  H265_SLICE_HAS_SAO_LUMA = 1 << 7,
+  H265_SLICE_HAS_SAO_CHROMA = 1 << 8,
+  H265_SLICE_HAS_LISTS_MODIFICATION = 1 << 9,
+  H265_SLICE_HAS_CABAC_INIT_FLAG = 1 << 10,
+  H265_SLICE_HAS_PRED_WEIGHT_P = 1 << 11,
+  H265_SLICE_HAS_PRED_WEIGHT_B = 1 << 12,
+  H265_SLICE_HAS_CHROMA_QP_OFFSETS = 1 << 13,
+  H265_SLICE_HAS_CU_CHROMA_QP_OFFSET = 1 << 14,
+  H265_SLICE_HAS_DEBLOCKING_OVERRIDE = 1 << 15,
+  H265_SLICE_HAS_LOOP_FILTER_ACROSS = 1 << 16,
+  H265_SLICE_HAS_ENTRY_POINTS = 1 << 17,
+  H265_SLICE_HAS_EXTENSION = 1 << 18,
+};
+
+struct H265SlicePlan {
+  uint8_t valid;     // cleared when an SPS or PPS is parsed
+  uint32_t present;  // H265_SLICE_HAS_* flags
+  uint8_t slice_segment_address_bits;
+  uint8_t num_extra_slice_header_bits;
+  uint8_t slice_pic_order_cnt_lsb_bits;
+  uint8_t short_term_ref_pic_set_idx_bits;
+  uint8_t lt_idx_sps_bits;
+  uint32_t num_short_term_ref_pic_sets;
+  // 7.4.7.1 upper limits of the slice segment header loops
+  uint32_t num_long_term_ref_pics_sps;
+  uint32_t max_long_term_pics;  // num_long_term_sps + num_long_term_pics
+  uint32_t max_entry_point_offsets;
+  // inferred values, copied from slice_type onwards for each independent
+  // slice segment
+  struct H265SliceSegmentHeader defaults;
+};
+
+// 8.3.1 picture order count state carried from picture to picture
+struct H265PocState {
+  int32_t prev_tid0_poc;
+  uint8_t seen_picture;
+};
+
+struct h265_decode_t {
+  struct NalUnitHeader nal_unit_header;
+  struct H265VideoParameterSet video_param_set;
+  struct H265SeqParameterSet seq_param_set;
+  struct H265PicParameterSet pic_param_set;
+  struct H265SliceSegmentLayer slice_segment;
+  struct H265SeiMessages sei;
+  struct H265SlicePlan slice_plan;
+
+  // 7.4.2.4.4 access unit tracking, updated by h265_parse_nal
+  uint8_t new_access_unit;
+  uint8_t au_has_vcl;
+  // the SPS and PPS parsed without error, as slice segments need them
+  uint8_t sps_valid;
+  uint8_t pps_valid;
+};
+
+// "truncated", "invalid", ... for an H265Error, "ok" for 0.
+const char *h265_error_name(int err);
+// Returns the offset of the start code following the one at pBuf[0], or 0
+// if there is none in the first bufLen bytes.
+uint32_t h265_find_next_start_code(uint8_t *pBuf, uint32_t bufLen);
+// Removes emulation_prevention_three_bytes in place, returns the new length.
+uint32_t remove_03(uint8_t *r_ptr, uint32_t len);
+// 1 if a NAL unit of this type, and for a VCL NAL unit this flag, starts a
+// new access unit after the NAL units |dec| parsed; it need not be parsed.
+int h265_starts_access_unit(const struct h265_decode_t *dec,
+                            enum H265NalType nal_unit_type,
+                            uint8_t first_slice_segment_in_pic_flag);
+// Which NAL units to parse, decided from the two bytes of nal_unit_header
+// before the NAL unit is unescaped: VPS, SPS and PPS always, so that the
+// parameter set state stays right, and other NAL units only with a
+// TemporalId up to max_temporal_id, a nuh_layer_id in layer_ids and a
+// nal_unit_type in nal_unit_types. The TemporalId and layer limits drop what
+// the sub-bitstream extraction process of clause 10 drops.
+struct H265ParseMask {
+  uint8_t max_temporal_id;
+  uint64_t layer_ids;       // bit per nuh_layer_id
+  uint64_t nal_unit_types;  // bit per nal_unit_type
+};
+
+// A mask that selects every NAL unit.
+void h265_parse_mask_init(struct H265ParseMask *mask);
+// 1 if |mask| selects the NAL unit at |nal|, escaped, of |size| bytes. One
+// too short for its header is selected, for h265_parse_nal to report.
+int h265_parse_mask_selects(const struct H265ParseMask *mask,
+                            const uint8_t *nal, uint32_t size);
+// 8.3.1 PicOrderCntVal of the picture whose first slice segment |dec| just
+// parsed.
+int32_t h265_pic_order_cnt(struct H265PocState *state,
+                           const struct h265_decode_t *dec);
+// Seconds per clock tick of the VUI timing of the SPS, else of the VPS; 0
+// without either.
+double h265_clock_tick(const struct h265_decode_t *dec);
+// Parses one NAL unit, starting at its nal_unit_header (no start code).
+int h265_parse_nal(struct h265_decode_t *dec, struct BitStream *bs,
+                   struct OutputContextDict *out);
+// Parses only the nal_unit_header of a NAL unit and tracks access units,
+// for NAL units whose RBSP is of no interest; parameter sets must still go
+// through h265_parse_nal.
+int h265_parse_nal_header(struct h265_decode_t *dec, struct BitStream *bs,
+                          struct OutputContextDict *out);
+
+// Syntax structures called by h265_parse_nal; the RBSP ones expect
+// dec->nal_unit_header to be set and |bs| to be past it.
+int h265_nal_unit_header(struct h265_decode_t *dec, struct BitStream *bs,
+                         struct OutputContextDict *out);
+int h265_video_parameter_set(struct h265_decode_t *dec, struct BitStream *bs,
+                             struct OutputContextDict *out);
+int h265_seq_parameter_set(struct h265_decode_t *dec, struct BitStream *bs,
+                           struct OutputContextDict *out);
+int h265_pic_parameter_set(struct h265_decode_t *dec, struct BitStream *bs,
+                           struct OutputContextDict *out);
+int h265_sei_rbsp(struct h265_decode_t *dec, struct BitStream *bs,
+                  struct OutputContextDict *out);
+int h265_slice_segment_header(struct h265_decode_t *dec, struct BitStream *bs,
+                              struct OutputContextDict *out);
+
 #endif
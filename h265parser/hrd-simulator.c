@@ -0,0 +1,346 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "hrd-simulator.h"
+
+static const char* kHrdSimTypeNames[HRD_SIM_TYPES] = {"nal", "vcl"};
+
+static int64_t ToTicks90k(double t) {
+  return (int64_t)floor(t * 90000 + 0.5);
+}
+
+static void EmitEvent(struct HrdSimulator* sim,
+                      const char* event,
+                      int type,
+                      uint32_t sched_sel_idx,
+                      uint64_t au,
+                      double time,
+                      double value) {
+  struct OutputContextDict dict[1];
+  sim->out->put_dict(sim->out, dict);
+  dict->put_str(dict, "hrd_event", event);
+  if (type >= 0) {
+    dict->put_str(dict, "hrd", kHrdSimTypeNames[type]);
+    dict->put_uint(dict, "sched_sel_idx", sched_sel_idx);
+  }
+  dict->put_uint(dict, "access_unit", au);
+  dict->put_int(dict, "time_90k", ToTicks90k(time));
+  dict->put_int(dict, "value", (int64_t)value);
+  dict->end(dict);
+}
+
+static void LoadParams(struct HrdSimulator* sim,
+                       const struct h265_decode_t* dec) {
+  const struct H265SeqParameterSet* sps = &dec->seq_param_set;
+  const struct H265VuiParameters* vui = &sps->vui_param;
+  const struct H265VideoParameterSet* vps = &dec->video_param_set;
+  const struct H265HrdParameters* hrd = &vui->hrd_parameters;
+  uint32_t htid = sps->sps_max_sub_layers_minus1;
+  int type;
+  uint32_t i;
+
+  if (htid >= H265_MAX_SUB_LAYERS)
+    htid = H265_MAX_SUB_LAYERS - 1;
+  sim->clock_tick = 0;
+  if (vui->vui_timing_info_present_flag && vui->vui_time_scale) {
+    sim->clock_tick = (double)vui->vui_num_units_in_tick / vui->vui_time_scale;
+  } else if (vps->vps_timing_info_present_flag && vps->vps_time_scale) {
+    sim->clock_tick = (double)vps->vps_num_units_in_tick / vps->vps_time_scale;
+  }
+  sim->low_delay = hrd->low_delay_hrd_flag[htid];
+  sim->fixed_pic_rate = hrd->fixed_pic_rate_within_cvs_flag[htid];
+  sim->elemental_duration = hrd->elemental_duration_in_tc_minus1[htid] + 1;
+  sim->max_dec_pic_buffering = sps->sps_max_dec_pic_buffering_minus1[htid] + 1;
+
+  for (type = 0; type < HRD_SIM_TYPES; type++) {
+    struct HrdSimCpb* c = &sim->cpb[type];
+    const struct H265SubLayerHrdParameters* sub =
+        type == HRD_SIM_NAL ? &hrd->nal_sub_layer[htid]
+                            : &hrd->vcl_sub_layer[htid];
+    uint8_t present = type == HRD_SIM_NAL
+                          ? hrd->nal_hrd_parameters_present_flag
+                          : hrd->vcl_hrd_parameters_present_flag;
+    if (!vui->vui_hrd_parameters_present_flag || !present) {
+      c->count = 0;
+      continue;
+    }
+    c->count = hrd->cpb_cnt_minus1[htid] + 1;
+    // (E-62) ~ (E-63)
+    for (i = 0; i < c->count; i++) {
+      c->bit_rate[i] = ldexp((double)sub->bit_rate_value_minus1[i] + 1,
+                             6 + hrd->bit_rate_scale);
+      c->cpb_size[i] = ldexp((double)sub->cpb_size_value_minus1[i] + 1,
+                             4 + hrd->cpb_size_scale);
+      c->cbr[i] = sub->cbr_flag[i];
+    }
+  }
+  sim->params_loaded = 1;
+}
+
+static void FinalizeAccessUnit(struct HrdSimulator* sim,
+                               struct HrdSimCpb* c,
+                               int type,
+                               uint32_t i) {
+  // CPB fullness just before the removal of the access unit at head[i]: the
+  // access units still in the CPB, plus whatever part of the following ones
+  // has arrived by then.
+  uint64_t h = c->head[i], k;
+  uint32_t slot = h % HRD_SIM_MAX_PENDING;
+  double tr = c->removal[slot][i];
+  double fullness = 0, after;
+  for (k = h; k < c->tail; k++) {
+    uint32_t s = k % HRD_SIM_MAX_PENDING;
+    double tai = c->initial_arrival[s][i];
+    double taf = c->final_arrival[s][i];
+    if (tai >= tr)
+      break;
+    if (taf <= tr)
+      fullness += c->bits[s];
+    else
+      fullness += c->bits[s] * (tr - tai) / (taf - tai);
+  }
+  if (fullness > c->cpb_size[i]) {
+    c->overflows[i]++;
+    EmitEvent(sim, "cpb_overflow", type, i, h, tr, fullness);
+  }
+  after = fullness - c->bits[slot];
+  if (fullness > c->max_fullness[i])
+    c->max_fullness[i] = fullness;
+  if (after < c->min_fullness[i])
+    c->min_fullness[i] = after;
+  if (sim->trace) {
+    struct OutputContextDict dict[1];
+    sim->out->put_dict(sim->out, dict);
+    dict->put_str(dict, "hrd", kHrdSimTypeNames[type]);
+    dict->put_uint(dict, "sched_sel_idx", i);
+    dict->put_uint(dict, "access_unit", h);
+    dict->put_int(dict, "removal_time_90k", ToTicks90k(tr));
+    dict->put_uint(dict, "fullness", (uint64_t)fullness);
+    dict->end(dict);
+  }
+  c->head[i]++;
+}
+
+static void RunCpb(struct HrdSimulator* sim, int type) {
+  // C.2.2 ~ C.2.3 timing of CPB arrival and removal
+  struct HrdSimCpb* c = &sim->cpb[type];
+  const struct HrdSimAccessUnit* au = &sim->au;
+  const struct H265BufferingPeriod* bp = &au->buffering_period;
+  double tc = sim->clock_tick, delay;
+  uint64_t bits = type == HRD_SIM_NAL ? au->nal_bits : au->vcl_bits;
+  uint32_t slot = c->tail % HRD_SIM_MAX_PENDING;
+  uint32_t i;
+
+  if (au->has_buffering_period) {
+    const uint32_t* d = type == HRD_SIM_NAL ? bp->nal_initial_cpb_removal_delay
+                                            : bp->vcl_initial_cpb_removal_delay;
+    const uint32_t* o = type == HRD_SIM_NAL
+                            ? bp->nal_initial_cpb_removal_offset
+                            : bp->vcl_initial_cpb_removal_offset;
+    for (i = 0; i < c->count; i++) {
+      c->init_delay[i] = d[i] / 90000.0;
+      c->init_offset[i] = o[i] / 90000.0;
+    }
+  }
+  for (i = 0; i < c->count; i++) {
+    if (c->tail - c->head[i] >= HRD_SIM_MAX_PENDING)
+      FinalizeAccessUnit(sim, c, type, i);
+  }
+
+  if (au->has_pic_timing)
+    delay = tc * (au->pic_timing.au_cpb_removal_delay_minus1 + 1.0);
+  else
+    delay = tc * (sim->fixed_pic_rate ? sim->elemental_duration : 1);
+  c->bits[slot] = bits;
+  for (i = 0; i < c->count; i++) {
+    double tr, tai, taf;
+    if (c->tail == 0) {
+      tr = c->init_delay[i];
+    } else if (au->has_buffering_period && bp->concatenation_flag) {
+      tr = c->prev_removal[i] +
+           tc * (bp->au_cpb_removal_delay_delta_minus1 + 1.0);
+    } else if (au->has_pic_timing) {
+      tr = c->removal_base[i] + delay;
+    } else {
+      tr = c->prev_removal[i] + delay;
+    }
+    if (c->tail == 0 || au->has_buffering_period)
+      c->removal_base[i] = tr;
+
+    if (c->tail == 0) {
+      tai = 0;
+    } else if (c->cbr[i]) {
+      tai = c->prev_final_arrival[i];
+    } else {
+      double earliest = tr - c->init_delay[i];
+      if (!au->has_buffering_period)
+        earliest -= c->init_offset[i];
+      tai = c->prev_final_arrival[i] > earliest ? c->prev_final_arrival[i]
+                                                : earliest;
+    }
+    taf = tai + bits / c->bit_rate[i];
+
+    c->initial_arrival[slot][i] = tai;
+    c->final_arrival[slot][i] = taf;
+    c->removal[slot][i] = tr;
+    c->prev_removal[i] = tr;
+    c->prev_final_arrival[i] = taf;
+  }
+  for (i = 0; i < c->count; i++) {
+    if (!sim->low_delay && c->final_arrival[slot][i] > c->removal[slot][i]) {
+      c->underflows[i]++;
+      EmitEvent(sim, "cpb_underflow", type, i, c->tail, c->removal[slot][i],
+                (c->final_arrival[slot][i] - c->removal[slot][i]) * 90000);
+    }
+  }
+  c->tail++;
+  for (i = 0; i < c->count; i++) {
+    while (c->head[i] < c->tail &&
+           c->removal[c->head[i] % HRD_SIM_MAX_PENDING][i] <=
+               c->initial_arrival[slot][i]) {
+      FinalizeAccessUnit(sim, c, type, i);
+    }
+  }
+}
+
+static void RunDpb(struct HrdSimulator* sim, double tr) {
+  // C.3 output order DPB operation, counting pictures waiting for output
+  uint32_t i, n = 0;
+  double to;
+  for (i = 0; i < sim->dpb_fullness; i++) {
+    if (sim->dpb_output[i] > tr)
+      sim->dpb_output[n++] = sim->dpb_output[i];
+  }
+  sim->dpb_fullness = n;
+  to = tr + sim->clock_tick * sim->au.pic_timing.pic_dpb_output_delay;
+  if (to > tr && sim->dpb_fullness <= H265_MAX_DPB_SIZE)
+    sim->dpb_output[sim->dpb_fullness++] = to;
+  if (sim->dpb_fullness > sim->dpb_max_fullness)
+    sim->dpb_max_fullness = sim->dpb_fullness;
+  if (sim->dpb_fullness > sim->max_dec_pic_buffering) {
+    sim->dpb_overflows++;
+    EmitEvent(sim, "dpb_overflow", -1, 0, sim->au_count, tr,
+              sim->dpb_fullness);
+  }
+}
+
+static void EndAccessUnit(struct HrdSimulator* sim) {
+  int type;
+  if (!sim->au.has_vcl)
+    return;
+  if (sim->clock_tick <= 0) {
+    if (!sim->warned)
+      fprintf(stderr, "HRD: no timing information, simulation disabled\n");
+    sim->warned = 1;
+    return;
+  }
+  for (type = 0; type < HRD_SIM_TYPES; type++) {
+    if (sim->cpb[type].count)
+      RunCpb(sim, type);
+  }
+  if (sim->au.has_pic_timing) {
+    const struct HrdSimCpb* c =
+        sim->cpb[HRD_SIM_NAL].count ? &sim->cpb[HRD_SIM_NAL]
+                                    : &sim->cpb[HRD_SIM_VCL];
+    if (c->count)
+      RunDpb(sim, c->prev_removal[0]);
+  }
+  sim->au_count++;
+}
+
+void HrdSimInit(struct HrdSimulator* sim,
+                struct OutputContextList* out,
+                uint8_t trace) {
+  int type;
+  uint32_t i;
+  memset(sim, 0, sizeof(*sim));
+  sim->out = out;
+  sim->trace = trace;
+  for (type = 0; type < HRD_SIM_TYPES; type++) {
+    for (i = 0; i < H265_MAX_CPB_CNT; i++) {
+      sim->cpb[type].min_fullness[i] = HUGE_VAL;
+    }
+  }
+}
+
+void HrdSimPushNal(struct HrdSimulator* sim,
+                   const struct h265_decode_t* dec,
+                   uint32_t nal_bytes,
+                   uint32_t prefix_bytes) {
+  enum H265NalType type = dec->nal_unit_header.nal_unit_type;
+  struct HrdSimAccessUnit* au = &sim->au;
+  if (dec->new_access_unit && sim->au_open) {
+    EndAccessUnit(sim);
+    memset(au, 0, sizeof(*au));
+  }
+  sim->au_open = 1;
+  // Type II bitstream conformance counts every byte of the byte stream, the
+  // Type I (VCL) HRD only VCL and filler data NAL units.
+  au->nal_bits += (nal_bytes + prefix_bytes) * 8ULL;
+  if (type < H265_NAL_TYPE_VPS_NUT || type == H265_NAL_TYPE_FD_NUT)
+    au->vcl_bits += nal_bytes * 8ULL;
+  if (type < H265_NAL_TYPE_VPS_NUT && !au->has_vcl) {
+    au->has_vcl = 1;
+    if (!sim->params_loaded || au->has_buffering_period)
+      LoadParams(sim, dec);
+  }
+  if (type == H265_NAL_TYPE_PREFIX_SEI_NUT) {
+    if (dec->sei.buffering_period_present) {
+      au->has_buffering_period = 1;
+      au->buffering_period = dec->sei.buffering_period;
+    }
+    if (dec->sei.pic_timing_present) {
+      au->has_pic_timing = 1;
+      au->pic_timing = dec->sei.pic_timing;
+    }
+  }
+}
+
+void HrdSimFinish(struct HrdSimulator* sim) {
+  struct OutputContextDict dict[1], summary[1], sched[1];
+  struct OutputContextList list[1];
+  int type;
+  uint32_t i;
+
+  if (sim->au_open)
+    EndAccessUnit(sim);
+  sim->au_open = 0;
+  for (type = 0; type < HRD_SIM_TYPES; type++) {
+    struct HrdSimCpb* c = &sim->cpb[type];
+    for (i = 0; i < c->count; i++) {
+      while (c->head[i] < c->tail)
+        FinalizeAccessUnit(sim, c, type, i);
+    }
+  }
+
+  sim->out->put_dict(sim->out, dict);
+  dict->put_dict(dict, "hrd_summary", summary);
+  summary->put_uint(summary, "access_units", sim->au_count);
+  summary->put_int(summary, "duration_90k",
+                   ToTicks90k(sim->cpb[HRD_SIM_NAL].count
+                                  ? sim->cpb[HRD_SIM_NAL].prev_removal[0]
+                                  : sim->cpb[HRD_SIM_VCL].prev_removal[0]));
+  summary->put_uint(summary, "dpb_max_fullness", sim->dpb_max_fullness);
+  summary->put_uint(summary, "dpb_overflows", sim->dpb_overflows);
+  for (type = 0; type < HRD_SIM_TYPES; type++) {
+    struct HrdSimCpb* c = &sim->cpb[type];
+    summary->put_list(summary, kHrdSimTypeNames[type], list);
+    for (i = 0; i < c->count; i++) {
+      list->put_dict(list, sched);
+      sched->put_uint(sched, "sched_sel_idx", i);
+      sched->put_uint(sched, "bit_rate", (uint64_t)c->bit_rate[i]);
+      sched->put_uint(sched, "cpb_size", (uint64_t)c->cpb_size[i]);
+      sched->put_uint(sched, "cbr_flag", c->cbr[i]);
+      if (c->tail) {
+        sched->put_int(sched, "min_fullness", (int64_t)c->min_fullness[i]);
+        sched->put_int(sched, "max_fullness", (int64_t)c->max_fullness[i]);
+      }
+      sched->put_uint(sched, "underflows", c->underflows[i]);
+      sched->put_uint(sched, "overflows", c->overflows[i]);
+      sched->end(sched);
+    }
+    list->end(list);
+  }
+  summary->end(summary);
+  dict->end(dict);
+}
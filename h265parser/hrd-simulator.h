@@ -0,0 +1,95 @@
+#ifndef HRD_SIMULATOR_H_
+#define HRD_SIMULATOR_H_
+
+#include <stdint.h>
+#include "h265parser.h"
+#include "output-context.h"
+
+// Annex C hypothetical reference decoder. Access units are fed NAL by NAL;
+// each access unit is run through the CPB of every SchedSelIdx of the NAL and
+// VCL HRD at once, and the DPB output process is checked against
+// sps_max_dec_pic_buffering_minus1.
+//
+// An access unit can only be checked for overflow once every access unit that
+// starts arriving before its removal time is known, so access units are kept
+// in a small ring until then.
+
+#define HRD_SIM_MAX_PENDING 128
+
+enum HrdSimType { HRD_SIM_NAL = 0, HRD_SIM_VCL = 1, HRD_SIM_TYPES = 2 };
+
+// One CPB per SchedSelIdx, laid out as parallel arrays so the per access unit
+// update runs across all of them in one loop.
+struct HrdSimCpb {
+  uint32_t count;  // cpb_cnt_minus1 + 1, 0 if this HRD is not present
+  double bit_rate[H265_MAX_CPB_CNT];
+  double cpb_size[H265_MAX_CPB_CNT];
+  uint8_t cbr[H265_MAX_CPB_CNT];
+  double init_delay[H265_MAX_CPB_CNT];
+  double init_offset[H265_MAX_CPB_CNT];
+  double removal_base[H265_MAX_CPB_CNT];
+  double prev_removal[H265_MAX_CPB_CNT];
+  double prev_final_arrival[H265_MAX_CPB_CNT];
+  double min_fullness[H265_MAX_CPB_CNT];
+  double max_fullness[H265_MAX_CPB_CNT];
+  uint64_t underflows[H265_MAX_CPB_CNT];
+  uint64_t overflows[H265_MAX_CPB_CNT];
+
+  // ring of access units that are in, or still arriving to, the CPB
+  uint64_t tail;
+  uint64_t head[H265_MAX_CPB_CNT];
+  double initial_arrival[HRD_SIM_MAX_PENDING][H265_MAX_CPB_CNT];
+  double final_arrival[HRD_SIM_MAX_PENDING][H265_MAX_CPB_CNT];
+  double removal[HRD_SIM_MAX_PENDING][H265_MAX_CPB_CNT];
+  uint64_t bits[HRD_SIM_MAX_PENDING];
+};
+
+// Timing information of the access unit being collected
+struct HrdSimAccessUnit {
+  uint64_t nal_bits;
+  uint64_t vcl_bits;
+  uint8_t has_vcl;
+  uint8_t has_buffering_period;
+  uint8_t has_pic_timing;
+  struct H265BufferingPeriod buffering_period;
+  struct H265PicTiming pic_timing;
+};
+
+struct HrdSimulator {
+  struct OutputContextList* out;
+  uint8_t trace;
+  uint8_t warned;
+
+  // parameters of the active SPS, refreshed at each buffering period
+  double clock_tick;
+  uint8_t params_loaded;
+  uint8_t low_delay;
+  uint8_t fixed_pic_rate;
+  uint32_t elemental_duration;
+  uint32_t max_dec_pic_buffering;
+
+  uint64_t au_count;
+  uint8_t au_open;
+  struct HrdSimAccessUnit au;
+  struct HrdSimCpb cpb[HRD_SIM_TYPES];
+
+  // DPB: output times of pictures waiting for output
+  double dpb_output[H265_MAX_DPB_SIZE + 1];
+  uint32_t dpb_fullness;
+  uint32_t dpb_max_fullness;
+  uint64_t dpb_overflows;
+  double last_removal;
+};
+
+void HrdSimInit(struct HrdSimulator* sim,
+                struct OutputContextList* out,
+                uint8_t trace);
+// nal_bytes is the size of the NAL unit, prefix_bytes the size of the start
+// code and any zero bytes preceding it in the byte stream.
+void HrdSimPushNal(struct HrdSimulator* sim,
+                   const struct h265_decode_t* dec,
+                   uint32_t nal_bytes,
+                   uint32_t prefix_bytes);
+void HrdSimFinish(struct HrdSimulator* sim);
+
+#endif
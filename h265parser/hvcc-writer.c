@@ -0,0 +1,360 @@
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <io.h>
+#define open _open
+#define close _close
+#define read _read
+#define lseek _lseeki64
+#define fstat _fstat64
+#define stat _stat64
+#else
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#define O_BINARY 0
+#endif
+#include "hvcc-writer.h"
+#include "bitwriter.h"
+#include "file-copy.h"
+#include "h265const.h"
+
+int HvccWriterOpen(struct HvccWriter* w,
+                   const char* output,
+                   const char* input_path) {
+  struct stat st;
+  memset(w, 0, sizeof(*w));
+  w->output = output;
+  AuTimestampsInit(&w->timestamps, NULL);
+  w->in_fd = open(input_path, O_RDONLY | O_BINARY);
+  if (w->in_fd < 0 || fstat(w->in_fd, &st) != 0) {
+    fprintf(stderr, "couldn't open %s\n", input_path);
+    if (w->in_fd >= 0)
+      close(w->in_fd);
+    return -1;
+  }
+  w->out_fd = open(output, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0644);
+  if (w->out_fd < 0) {
+    fprintf(stderr, "couldn't create %s\n", output);
+    close(w->in_fd);
+    return -1;
+  }
+#ifndef _WIN32
+  if (st.st_size > 0 && (uint64_t)st.st_size == (size_t)st.st_size) {
+    void* map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED,
+                     w->in_fd, 0);
+    if (map != MAP_FAILED) {
+      w->map = (const uint8_t*)map;
+      w->map_size = (uint64_t)st.st_size;
+      // read once from start to end
+      madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+    }
+  }
+#endif
+  return 0;
+}
+
+static int WriteSpans(struct HvccWriter* w) {
+  uint32_t i = 0;
+#ifndef _WIN32
+  struct iovec iov[HVCC_WRITER_SPANS * 2];
+  uint32_t count = 0, first = 0;
+  if (w->map) {
+    for (i = 0; i < w->span_count; i++) {
+      iov[count].iov_base = w->lengths[i];
+      iov[count++].iov_len = 4;
+      iov[count].iov_base = (void*)(w->map + w->spans[i].offset);
+      iov[count++].iov_len = w->spans[i].size;
+    }
+    // a partial write leaves the rest for the next call
+    while (first < count) {
+      ssize_t n = writev(w->out_fd, iov + first,
+                         (int)(count - first < 1024 ? count - first : 1024));
+      w->writes++;
+      if (n <= 0)
+        return -1;
+      while (first < count && (size_t)n >= iov[first].iov_len)
+        n -= (ssize_t)iov[first++].iov_len;
+      if (first < count) {
+        iov[first].iov_base = (uint8_t*)iov[first].iov_base + n;
+        iov[first].iov_len -= (size_t)n;
+      }
+    }
+    w->span_count = 0;
+    return 0;
+  }
+#endif
+  for (i = 0; i < w->span_count; i++) {
+    w->writes++;
+    if (FileWriteAll(w->out_fd, w->lengths[i], 4) != 0 ||
+        FileCopyRange(w->in_fd, w->out_fd, w->spans[i].offset,
+                      w->spans[i].size) != 0)
+      return -1;
+  }
+  w->span_count = 0;
+  return 0;
+}
+
+static void EndSample(struct HvccWriter* w) {
+  struct HvccWriterSample* s = &w->sample;
+  struct OutputContextDict dict[1];
+  if (!s->nal_units)
+    return;
+  w->samples++;
+  w->sync_samples += s->sync;
+  if (w->out) {
+    w->out->put_dict(w->out, dict);
+    dict->put_uint(dict, "sample", w->samples - 1);
+    dict->put_hex(dict, "offset", s->offset);
+    dict->put_uint(dict, "size", s->size);
+    dict->put_uint(dict, "nal_units", s->nal_units);
+    dict->put_uint(dict, "sync", s->sync);
+    if (s->stamped && s->times.timed) {
+      dict->put_int(dict, "dts", s->times.dts);
+      dict->put_int(dict, "pts", s->times.pts);
+    }
+    dict->end(dict);
+  }
+  memset(s, 0, sizeof(*s));
+  s->offset = w->output_size;
+}
+
+static void KeepParameters(struct HvccWriter* w,
+                           const struct h265_decode_t* dec,
+                           uint32_t type) {
+  const struct H265SeqParameterSet* sps = &dec->seq_param_set;
+  const struct H265PicParameterSet* pps = &dec->pic_param_set;
+  if (type == H265_NAL_TYPE_SPS_NUT && !w->has_sps) {
+    double tick = h265_clock_tick(dec);
+    w->has_sps = 1;
+    w->ptl = sps->general_profile_tier_level;
+    w->chroma_format_idc = sps->chroma_format_idc;
+    w->bit_depth_luma_minus8 = sps->bit_depth_luma_minus8;
+    w->bit_depth_chroma_minus8 = sps->bit_depth_chroma_minus8;
+    if (sps->vui_parameters_present_flag &&
+        sps->vui_param.bitstream_restriction_flag)
+      w->min_spatial_segmentation_idc =
+          sps->vui_param.min_spatial_segmentation_idc;
+    w->num_temporal_layers = sps->sps_max_sub_layers_minus1 + 1;
+    w->temporal_id_nested = (uint8_t)sps->sps_temporal_id_nesting_flag;
+    if (tick > 0 && 256 / tick < 65536)
+      w->avg_frame_rate = (uint16_t)floor(256 / tick + 0.5);
+  } else if (type == H265_NAL_TYPE_PPS_NUT && !w->has_pps) {
+    w->has_pps = 1;
+    // 0: unknown or mixed, 1: slices, 2: tiles, 3: wavefronts
+    if (pps->entropy_coding_sync_enabled_flag && pps->tiles_enabled_flag)
+      w->parallelism_type = 0;
+    else if (pps->entropy_coding_sync_enabled_flag)
+      w->parallelism_type = 3;
+    else if (pps->tiles_enabled_flag)
+      w->parallelism_type = 2;
+    else
+      w->parallelism_type = 1;
+  }
+}
+
+int HvccWriterPushNal(struct HvccWriter* w,
+                      const struct h265_decode_t* dec,
+                      const struct NalUnit* nal,
+                      uint32_t rbsp_size,
+                      int err) {
+  uint32_t type = dec->nal_unit_header.nal_unit_type;
+  uint32_t size = nal->size, id, slot = HVCC_WRITER_SETS;
+  uint8_t* length;
+  if (w->failed)
+    return -1;
+  // trailing_zero_8bits belong to the byte stream
+  while (size && rbsp_size && nal->data[rbsp_size - 1] == 0) {
+    size--;
+    rbsp_size--;
+  }
+  if (size == 0)
+    return 0;
+  if (dec->new_access_unit)
+    EndSample(w);
+  if (AuTimestampsPushNal(&w->timestamps, dec, nal, err) > 0) {
+    w->sample.stamped = 1;
+    w->sample.times = w->timestamps.last;
+    w->sample.sync = type >= H265_NAL_TYPE_BLA_W_LP &&
+                     type <= H265_NAL_TYPE_CRA_NUT;
+  }
+  if (err == 0 && type == H265_NAL_TYPE_VPS_NUT) {
+    id = dec->video_param_set.vps_video_parameter_set_id;
+    slot = id;
+  } else if (err == 0 && type == H265_NAL_TYPE_SPS_NUT) {
+    id = dec->seq_param_set.sps_seq_parameter_set_id;
+    slot = HVCC_WRITER_SPS_BASE + id;
+  } else if (err == 0 && type == H265_NAL_TYPE_PPS_NUT) {
+    id = dec->pic_param_set.pps_pic_parameter_set_id;
+    slot = id < 64 ? HVCC_WRITER_PPS_BASE + id : HVCC_WRITER_SETS;
+  }
+  if (slot < HVCC_WRITER_SETS && w->sets[slot].size == 0 && size < 65536) {
+    w->sets[slot].offset = nal->offset + nal->prefix_bytes;
+    w->sets[slot].size = size;
+    KeepParameters(w, dec, type);
+  }
+  if (w->span_count == HVCC_WRITER_SPANS && WriteSpans(w) != 0) {
+    fprintf(stderr, "couldn't write %s\n", w->output);
+    w->failed = 1;
+    return -1;
+  }
+  w->spans[w->span_count].offset = nal->offset + nal->prefix_bytes;
+  w->spans[w->span_count].size = size;
+  length = w->lengths[w->span_count++];
+  length[0] = (uint8_t)(size >> 24);
+  length[1] = (uint8_t)(size >> 16);
+  length[2] = (uint8_t)(size >> 8);
+  length[3] = (uint8_t)size;
+  if (w->sample.nal_units++ == 0)
+    w->sample.offset = w->output_size;
+  w->sample.size += 4 + size;
+  w->output_size += 4 + size;
+  w->nal_units++;
+  return 0;
+}
+
+static int ReadInput(struct HvccWriter* w,
+                     uint8_t* dst,
+                     const struct HvccWriterSpan* span) {
+  uint32_t done = 0;
+  if (w->map) {
+    memcpy(dst, w->map + span->offset, span->size);
+    return 0;
+  }
+  if (lseek(w->in_fd, span->offset, SEEK_SET) < 0)
+    return -1;
+  while (done < span->size) {
+    int n = read(w->in_fd, dst + done, span->size - done);
+    if (n <= 0)
+      return -1;
+    done += (uint32_t)n;
+  }
+  return 0;
+}
+
+// the VPS, SPS and PPS arrays in |sets|
+static const uint32_t kArrays[4] = {0, HVCC_WRITER_SPS_BASE,
+                                    HVCC_WRITER_PPS_BASE, HVCC_WRITER_SETS};
+
+// HEVCDecoderConfigurationRecord of ISO/IEC 14496-15 8.3.3.1
+static int WriteRecord(struct HvccWriter* w) {
+  const struct H265ProfileTierLevelSubLayer* ptl = &w->ptl;
+  struct BitWriter bw;
+  uint8_t* record;
+  uint32_t capacity = 23, size, i, j, arrays = 0, counts[3] = {0, 0, 0};
+  char* path;
+  FILE* fp;
+  int ok;
+  for (i = 0; i < HVCC_WRITER_SETS; i++)
+    capacity += 5 + w->sets[i].size;
+  record = (uint8_t*)malloc(capacity);
+  path = (char*)malloc(strlen(w->output) + 6);
+  if (!record || !path) {
+    free(record);
+    free(path);
+    return -1;
+  }
+  BsWriterInit(&bw, record, capacity);
+  BsPut(&bw, 1, 8);  // configurationVersion
+  BsPut(&bw, ptl->profile_space, 2);
+  BsPut(&bw, ptl->tier_flag, 1);
+  BsPut(&bw, ptl->profile_idc, 5);
+  for (j = 0; j < 32; j++)
+    BsPut(&bw, ptl->profile_compatibility_flag[j], 1);
+  // general_constraint_indicator_flags, the 48 bits after the flags above
+  BsPut(&bw, ptl->progressive_source_flag, 1);
+  BsPut(&bw, ptl->interlaced_source_flag, 1);
+  BsPut(&bw, ptl->non_packed_constraint_flag, 1);
+  BsPut(&bw, ptl->frame_only_constraint_flag, 1);
+  BsPut(&bw, ptl->max_12bit_constraint_flag, 1);
+  BsPut(&bw, ptl->max_10bit_constraint_flag, 1);
+  BsPut(&bw, ptl->max_8bit_constraint_flag, 1);
+  BsPut(&bw, ptl->max_422chroma_constraint_flag, 1);
+  BsPut(&bw, ptl->max_420chroma_constraint_flag, 1);
+  BsPut(&bw, ptl->max_monochrome_constraint_flag, 1);
+  BsPut(&bw, ptl->intra_constraint_flag, 1);
+  BsPut(&bw, ptl->one_picture_only_constraint_flag, 1);
+  BsPut(&bw, ptl->lower_bit_rate_constraint_flag, 1);
+  BsPut(&bw, 0, 2);
+  BsPut(&bw, 0, 32);
+  BsPut(&bw, ptl->inbld_flag, 1);
+  BsPut(&bw, ptl->level_idc, 8);
+  BsPut(&bw, 0xf, 4);
+  BsPut(&bw, w->min_spatial_segmentation_idc, 12);
+  BsPut(&bw, 0x3f, 6);
+  BsPut(&bw, w->min_spatial_segmentation_idc ? w->parallelism_type : 0, 2);
+  BsPut(&bw, 0x3f, 6);
+  BsPut(&bw, w->chroma_format_idc, 2);
+  BsPut(&bw, 0x1f, 5);
+  BsPut(&bw, w->bit_depth_luma_minus8, 3);
+  BsPut(&bw, 0x1f, 5);
+  BsPut(&bw, w->bit_depth_chroma_minus8, 3);
+  BsPut(&bw, w->avg_frame_rate, 16);
+  BsPut(&bw, 0, 2);  // constantFrameRate, unknown
+  BsPut(&bw, w->num_temporal_layers, 3);
+  BsPut(&bw, w->temporal_id_nested, 1);
+  BsPut(&bw, 3, 2);  // lengthSizeMinusOne
+  for (i = 0; i < 3; i++) {
+    for (j = kArrays[i]; j < kArrays[i + 1]; j++)
+      counts[i] += w->sets[j].size != 0;
+    arrays += counts[i] != 0;
+  }
+  BsPut(&bw, arrays, 8);
+  size = BsBytes(&bw);
+  ok = 1;
+  for (i = 0; i < 3; i++) {
+    if (!counts[i])
+      continue;
+    // array_completeness 0: parameter sets are in the samples as well
+    record[size++] = (uint8_t)(H265_NAL_TYPE_VPS_NUT + i);
+    record[size++] = (uint8_t)(counts[i] >> 8);
+    record[size++] = (uint8_t)counts[i];
+    for (j = kArrays[i]; j < kArrays[i + 1]; j++) {
+      if (!w->sets[j].size)
+        continue;
+      record[size++] = (uint8_t)(w->sets[j].size >> 8);
+      record[size++] = (uint8_t)w->sets[j].size;
+      if (ReadInput(w, record + size, &w->sets[j]) != 0)
+        ok = 0;
+      size += w->sets[j].size;
+    }
+  }
+  w->record_size = size;
+  fp = fopen(strcat(strcpy(path, w->output), ".hvcC"), "wb");
+  ok = ok && fp && fwrite(record, 1, size, fp) == size;
+  if (fp && fclose(fp) != 0)
+    ok = 0;
+  if (!ok)
+    fprintf(stderr, "couldn't write %s\n", path);
+  free(record);
+  free(path);
+  return ok ? 0 : -1;
+}
+
+int HvccWriterClose(struct HvccWriter* w) {
+  int ret = w->failed ? -1 : 0;
+  EndSample(w);
+  if (ret == 0 && WriteSpans(w) != 0) {
+    fprintf(stderr, "couldn't write %s\n", w->output);
+    ret = -1;
+  }
+  if (ret == 0 && !w->has_sps) {
+    fprintf(stderr, "no SPS for the hvcC record of %s\n", w->output);
+    ret = -1;
+  }
+  if (ret == 0 && WriteRecord(w) != 0)
+    ret = -1;
+  if (close(w->out_fd) != 0)
+    ret = -1;
+#ifndef _WIN32
+  if (w->map)
+    munmap((void*)w->map, (size_t)w->map_size);
+#endif
+  w->map = NULL;
+  close(w->in_fd);
+  return ret;
+}
@@ -0,0 +1,100 @@
+#ifndef HVCC_WRITER_H_
+#define HVCC_WRITER_H_
+
+#include <stdint.h>
+#include "au-timestamps.h"
+#include "h265parser.h"
+#include "nal-input.h"
+#include "output-context.h"
+
+// Converts an Annex B file to the length-prefixed samples of MP4 while it is
+// parsed: each NAL unit is written with a 4 byte big-endian length in place
+// of its start code, one sample per access unit, and an
+// HEVCDecoderConfigurationRecord (ISO/IEC 14496-15 8.3.3) goes to OUTPUT.hvcC
+// at the end, from the VPS, SPS and PPS first seen of each id and the
+// general profile_tier_level() of the first SPS. Parameter sets stay in the
+// samples too, as 'hev1' allows, so the arrays are marked incomplete.
+//
+// Payloads aren't copied: the input is mapped and the length fields and the
+// NAL units as stored in the input are written together by writev() once
+// HVCC_WRITER_SPANS of them are gathered. Without mmap and writev each span
+// is copied from the input file by offset (file-copy.h).
+//
+// Each sample is written to w->out as it ends, with its offset and size in
+// the output, the NAL units it holds, whether it is a sync sample (an IRAP
+// picture) and its AuTimestamps times, for the sample tables.
+
+#define HVCC_WRITER_SPANS 512
+// parameter sets by id, VPS, then SPS, then PPS
+#define HVCC_WRITER_SPS_BASE 16
+#define HVCC_WRITER_PPS_BASE 32
+#define HVCC_WRITER_SETS 96
+
+// A NAL unit of the input without its start code or trailing zero bytes
+struct HvccWriterSpan {
+  uint64_t offset;
+  uint32_t size;
+};
+
+struct HvccWriterSample {
+  uint64_t offset;  // in the output
+  uint64_t size;
+  uint32_t nal_units;
+  uint8_t sync;
+  uint8_t stamped;  // a first slice segment was seen
+  struct AuTimestamp times;
+};
+
+struct HvccWriter {
+  const char* output;
+  int in_fd;
+  int out_fd;
+  const uint8_t* map;  // the input, NULL where it can't be mapped
+  uint64_t map_size;
+  int failed;
+
+  // gathered and not written yet
+  struct HvccWriterSpan spans[HVCC_WRITER_SPANS];
+  uint8_t lengths[HVCC_WRITER_SPANS][4];
+  uint32_t span_count;
+
+  struct HvccWriterSpan sets[HVCC_WRITER_SETS];  // size 0: not seen
+  uint8_t has_sps;
+  uint8_t has_pps;
+  // from the first SPS and PPS
+  struct H265ProfileTierLevelSubLayer ptl;
+  uint8_t chroma_format_idc;
+  uint8_t bit_depth_luma_minus8;
+  uint8_t bit_depth_chroma_minus8;
+  uint32_t min_spatial_segmentation_idc;
+  uint8_t num_temporal_layers;
+  uint8_t temporal_id_nested;
+  uint16_t avg_frame_rate;  // frames per 256 s, 0: unknown
+  uint8_t parallelism_type;
+
+  struct OutputContextList* out;  // for the samples, NULL: not written
+  struct AuTimestamps timestamps;
+  struct HvccWriterSample sample;
+  uint64_t output_size;
+
+  uint64_t samples;
+  uint64_t sync_samples;
+  uint64_t nal_units;
+  uint64_t writes;  // writev() calls, or spans copied
+  uint32_t record_size;
+};
+
+int HvccWriterOpen(struct HvccWriter* w,
+                   const char* output,
+                   const char* input_path);
+// Called after h265_parse_nal with each NAL unit, |rbsp_size| bytes of
+// RBSP in nal->data, and what h265_parse_nal returned.
+int HvccWriterPushNal(struct HvccWriter* w,
+                      const struct h265_decode_t* dec,
+                      const struct NalUnit* nal,
+                      uint32_t rbsp_size,
+                      int err);
+// Writes the last sample and the hvcC record.
+int HvccWriterClose(struct HvccWriter* w);
+
+#endif
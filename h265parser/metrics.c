@@ -0,0 +1,284 @@
+#ifdef H265_METRICS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+#include "h265const.h"
+#include "metrics.h"
+
+static const char* kStageNames[METRICS_STAGES] = {"scan", "unescape", "parse",
+                                                  "output"};
+
+static const char* kFunctionNames[METRICS_FUNCTIONS] = {
+    "h265_video_parameter_set",
+    "h265_seq_parameter_set",
+    "h265_pic_parameter_set",
+    "h265_sei_rbsp",
+    "h265_slice_segment_header",
+    "h265_profile_tier_level",
+    "h265_vui_parameters",
+    "h265_hrd_parameters",
+    "h265_scaling_list_data",
+    "h265_ref_pic_set",
+    "h265_pps_range_extension",
+    "h265_buffering_period",
+    "h265_pic_timing",
+};
+
+static struct {
+  uint64_t stage_cycles[METRICS_STAGES];
+  uint64_t stage_bytes[METRICS_STAGES];
+  uint64_t stage_events[METRICS_STAGES];
+  uint64_t function_calls[METRICS_FUNCTIONS];
+  uint64_t function_cycles[METRICS_FUNCTIONS];
+  uint64_t nal_count[METRICS_NAL_TYPES];
+  uint64_t nal_bytes[METRICS_NAL_TYPES];
+  uint64_t nal_cycles[METRICS_NAL_TYPES];
+  uint64_t nal_histogram[METRICS_NAL_TYPES][METRICS_HISTOGRAM_BUCKETS];
+
+  uint64_t nal_start;
+  uint64_t nal_output_mark;
+
+  char target[1024];
+  uint32_t interval;
+  time_t next_snapshot;
+  uint32_t ticks;
+  uint64_t start_cycles;
+  double start_time;
+} metrics;
+
+uint32_t metrics_output_calls;
+
+static double WallSeconds(void) {
+  struct timespec ts;
+#ifdef _WIN32
+  timespec_get(&ts, TIME_UTC);
+#else
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+#if !defined(_MSC_VER) && !defined(__x86_64__) && !defined(__i386__)
+uint64_t MetricsNow(void) {
+  // nanoseconds stand in for cycles without a time stamp counter
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+#endif
+
+void MetricsAddStage(enum MetricsStage stage, uint64_t cycles, uint64_t bytes) {
+  metrics.stage_cycles[stage] += cycles;
+  metrics.stage_bytes[stage] += bytes;
+  metrics.stage_events[stage]++;
+}
+
+void MetricsAddOutputSample(uint64_t cycles) {
+  metrics.stage_cycles[METRICS_STAGE_OUTPUT] += cycles * METRICS_OUTPUT_SAMPLE;
+  metrics.stage_events[METRICS_STAGE_OUTPUT] += METRICS_OUTPUT_SAMPLE;
+}
+
+void MetricsAddFunction(enum MetricsFunction fn, uint64_t cycles) {
+  metrics.function_calls[fn]++;
+  metrics.function_cycles[fn] += cycles;
+}
+
+void MetricsNalBegin(uint64_t start) {
+  metrics.nal_output_mark = metrics.stage_cycles[METRICS_STAGE_OUTPUT];
+  metrics.nal_start = start;
+}
+
+void MetricsNalEnd(uint8_t nal_unit_type, uint64_t bytes) {
+  uint64_t cycles = MetricsNow() - metrics.nal_start;
+  uint64_t output =
+      metrics.stage_cycles[METRICS_STAGE_OUTPUT] - metrics.nal_output_mark;
+  uint32_t bucket = 0;
+  uint64_t c;
+  nal_unit_type &= METRICS_NAL_TYPES - 1;
+  MetricsAddStage(METRICS_STAGE_PARSE, cycles > output ? cycles - output : 0,
+                  bytes);
+  metrics.nal_count[nal_unit_type]++;
+  metrics.nal_bytes[nal_unit_type] += bytes;
+  metrics.nal_cycles[nal_unit_type] += cycles;
+  for (c = cycles; c > 1 && bucket < METRICS_HISTOGRAM_BUCKETS - 1; c >>= 1)
+    bucket++;
+  metrics.nal_histogram[nal_unit_type][bucket]++;
+}
+
+static void Write(FILE* fp) {
+  uint32_t i, j;
+  double seconds = WallSeconds() - metrics.start_time;
+
+  fprintf(fp,
+          "# HELP h265_stage_cycles_total Cycles spent in each stage.\n"
+          "# TYPE h265_stage_cycles_total counter\n");
+  for (i = 0; i < METRICS_STAGES; i++) {
+    fprintf(fp, "h265_stage_cycles_total{stage=\"%s\"} %llu\n", kStageNames[i],
+            (unsigned long long)metrics.stage_cycles[i]);
+  }
+  fprintf(fp,
+          "# HELP h265_stage_bytes_total Bytes handled by each stage.\n"
+          "# TYPE h265_stage_bytes_total counter\n");
+  for (i = 0; i < METRICS_STAGES; i++) {
+    fprintf(fp, "h265_stage_bytes_total{stage=\"%s\"} %llu\n", kStageNames[i],
+            (unsigned long long)metrics.stage_bytes[i]);
+  }
+  fprintf(fp,
+          "# HELP h265_stage_events_total Timed sections of each stage.\n"
+          "# TYPE h265_stage_events_total counter\n");
+  for (i = 0; i < METRICS_STAGES; i++) {
+    fprintf(fp, "h265_stage_events_total{stage=\"%s\"} %llu\n",
+            kStageNames[i], (unsigned long long)metrics.stage_events[i]);
+  }
+
+  fprintf(fp,
+          "# HELP h265_function_calls_total Calls of each parse function.\n"
+          "# TYPE h265_function_calls_total counter\n");
+  for (i = 0; i < METRICS_FUNCTIONS; i++) {
+    fprintf(fp, "h265_function_calls_total{function=\"%s\"} %llu\n",
+            kFunctionNames[i], (unsigned long long)metrics.function_calls[i]);
+  }
+  fprintf(fp,
+          "# HELP h265_function_cycles_total Inclusive cycles of each parse "
+          "function.\n"
+          "# TYPE h265_function_cycles_total counter\n");
+  for (i = 0; i < METRICS_FUNCTIONS; i++) {
+    fprintf(fp, "h265_function_cycles_total{function=\"%s\"} %llu\n",
+            kFunctionNames[i], (unsigned long long)metrics.function_cycles[i]);
+  }
+
+  fprintf(fp,
+          "# HELP h265_nal_units_total NAL units by nal_unit_type.\n"
+          "# TYPE h265_nal_units_total counter\n");
+  for (i = 0; i < METRICS_NAL_TYPES; i++) {
+    if (metrics.nal_count[i]) {
+      fprintf(fp, "h265_nal_units_total{type=\"%u\",name=\"%s\"} %llu\n", i,
+              GetH265NalType((enum H265NalType)i),
+              (unsigned long long)metrics.nal_count[i]);
+    }
+  }
+  fprintf(fp,
+          "# HELP h265_nal_bytes_total Unescaped NAL unit bytes by "
+          "nal_unit_type.\n"
+          "# TYPE h265_nal_bytes_total counter\n");
+  for (i = 0; i < METRICS_NAL_TYPES; i++) {
+    if (metrics.nal_count[i]) {
+      fprintf(fp, "h265_nal_bytes_total{type=\"%u\",name=\"%s\"} %llu\n", i,
+              GetH265NalType((enum H265NalType)i),
+              (unsigned long long)metrics.nal_bytes[i]);
+    }
+  }
+  fprintf(fp,
+          "# HELP h265_nal_parse_cycles Cycles to parse and output one NAL "
+          "unit.\n"
+          "# TYPE h265_nal_parse_cycles histogram\n");
+  for (i = 0; i < METRICS_NAL_TYPES; i++) {
+    uint64_t cumulative = 0;
+    if (!metrics.nal_count[i])
+      continue;
+    for (j = 0; j < METRICS_HISTOGRAM_BUCKETS - 1; j++) {
+      cumulative += metrics.nal_histogram[i][j];
+      fprintf(fp, "h265_nal_parse_cycles_bucket{type=\"%u\",le=\"%llu\"} ",
+              i, 2ULL << j);
+      fprintf(fp, "%llu\n", (unsigned long long)cumulative);
+    }
+    fprintf(fp, "h265_nal_parse_cycles_bucket{type=\"%u\",le=\"+Inf\"} ", i);
+    fprintf(fp, "%llu\n", (unsigned long long)metrics.nal_count[i]);
+    fprintf(fp, "h265_nal_parse_cycles_sum{type=\"%u\"} %llu\n", i,
+            (unsigned long long)metrics.nal_cycles[i]);
+    fprintf(fp, "h265_nal_parse_cycles_count{type=\"%u\"} %llu\n", i,
+            (unsigned long long)metrics.nal_count[i]);
+  }
+
+  fprintf(fp,
+          "# HELP h265_cycles_per_second Cycle counter rate over the run.\n"
+          "# TYPE h265_cycles_per_second gauge\n"
+          "h265_cycles_per_second %.0f\n",
+          seconds > 0 ? (MetricsNow() - metrics.start_cycles) / seconds : 0.0);
+}
+
+static int Export(void) {
+  FILE* fp;
+#ifndef _WIN32
+  if (strncmp(metrics.target, "unix:", 5) == 0) {
+    struct sockaddr_un addr;
+    size_t len = strlen(metrics.target + 5);
+    int fd;
+    if (len >= sizeof(addr.sun_path))
+      return -1;
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+      return -1;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, metrics.target + 5, len);
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+        !(fp = fdopen(fd, "w"))) {
+      close(fd);
+      return -1;
+    }
+    Write(fp);
+    fclose(fp);
+    return 0;
+  } else
+#endif
+  {
+    // readers never see a partially written file
+    char tmp[1040];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", metrics.target);
+    fp = fopen(tmp, "w");
+    if (!fp)
+      return -1;
+    Write(fp);
+    fclose(fp);
+#ifdef _WIN32
+    remove(metrics.target);
+#endif
+    return rename(tmp, metrics.target);
+  }
+}
+
+void MetricsInit(void) {
+  memset(&metrics, 0, sizeof(metrics));
+  metrics.start_cycles = MetricsNow();
+  metrics.start_time = WallSeconds();
+}
+
+int MetricsOpenExport(const char* target, uint32_t interval) {
+  if (strlen(target) >= sizeof(metrics.target))
+    return -1;
+  strcpy(metrics.target, target);
+  metrics.interval = interval;
+  metrics.next_snapshot = time(NULL) + interval;
+  return 0;
+}
+
+void MetricsTick(void) {
+  // time() is only looked at every 256 NAL units
+  if (!metrics.interval || !metrics.target[0] || (++metrics.ticks & 255))
+    return;
+  if (time(NULL) >= metrics.next_snapshot) {
+    if (Export() != 0)
+      fprintf(stderr, "couldn't write metrics to %s\n", metrics.target);
+    metrics.next_snapshot = time(NULL) + metrics.interval;
+  }
+}
+
+void MetricsFinish(void) {
+  if (!metrics.target[0]) {
+    // summary to stderr when no export target was given
+    Write(stderr);
+    return;
+  }
+  if (Export() != 0)
+    fprintf(stderr, "couldn't write metrics to %s\n", metrics.target);
+}
+
+#endif
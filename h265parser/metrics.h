@@ -0,0 +1,116 @@
+#ifndef METRICS_H_
+#define METRICS_H_
+
+#include <stdint.h>
+
+// Hot path instrumentation, compiled in with -DH265_METRICS. Without it the
+// METRICS_* macros expand to nothing, or to the bare statement for
+// METRICS_FUNC, and no metrics code is called.
+//
+// Cycles come from the time stamp counter where there is one. Function
+// cycles are inclusive of nested parse functions and of output.
+
+enum MetricsStage {
+  METRICS_STAGE_SCAN = 0,      // finding NAL units in the input
+  METRICS_STAGE_UNESCAPE = 1,  // remove_03
+  METRICS_STAGE_PARSE = 2,     // syntax parsing and bit reading
+  METRICS_STAGE_OUTPUT = 3,    // output context formatting and writing
+  METRICS_STAGES = 4
+};
+
+enum MetricsFunction {
+  METRICS_FN_VIDEO_PARAMETER_SET = 0,
+  METRICS_FN_SEQ_PARAMETER_SET,
+  METRICS_FN_PIC_PARAMETER_SET,
+  METRICS_FN_SEI_RBSP,
+  METRICS_FN_SLICE_SEGMENT_HEADER,
+  METRICS_FN_PROFILE_TIER_LEVEL,
+  METRICS_FN_VUI_PARAMETERS,
+  METRICS_FN_HRD_PARAMETERS,
+  METRICS_FN_SCALING_LIST_DATA,
+  METRICS_FN_REF_PIC_SET,
+  METRICS_FN_PPS_RANGE_EXTENSION,
+  METRICS_FN_BUFFERING_PERIOD,
+  METRICS_FN_PIC_TIMING,
+  METRICS_FUNCTIONS
+};
+
+#define METRICS_HISTOGRAM_BUCKETS 32  // log2 cycles
+#define METRICS_NAL_TYPES 64
+
+#ifdef H265_METRICS
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define MetricsNow() __rdtsc()
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define MetricsNow() __rdtsc()
+#else
+uint64_t MetricsNow(void);
+#endif
+
+void MetricsInit(void);
+void MetricsAddStage(enum MetricsStage stage, uint64_t cycles, uint64_t bytes);
+void MetricsAddOutputSample(uint64_t cycles);
+void MetricsAddFunction(enum MetricsFunction fn, uint64_t cycles);
+// Brackets the parse of one NAL unit started at |start|; output cycles in
+// between are taken out of the parse stage.
+void MetricsNalBegin(uint64_t start);
+void MetricsNalEnd(uint8_t nal_unit_type, uint64_t bytes);
+// |target| is a file, written through a temporary and renamed, or
+// "unix:PATH" for a UNIX stream socket. A snapshot is written every
+// |interval| seconds (0: only at exit).
+int MetricsOpenExport(const char* target, uint32_t interval);
+void MetricsTick(void);
+void MetricsFinish(void);
+
+#define METRICS_INIT() MetricsInit()
+#define METRICS_BEGIN(var) uint64_t var = MetricsNow()
+#define METRICS_END(stage, var, bytes) \
+  MetricsAddStage(stage, MetricsNow() - (var), bytes)
+// Ends a stage started at |var| and starts the next one at the same time.
+#define METRICS_LAP(stage, var, bytes)               \
+  do {                                               \
+    uint64_t metrics_now_ = MetricsNow();            \
+    MetricsAddStage(stage, metrics_now_ - (var), bytes); \
+    (var) = metrics_now_;                            \
+  } while (0)
+#define METRICS_FUNC(fn, stmt)                             \
+  do {                                                     \
+    uint64_t metrics_start_ = MetricsNow();                \
+    stmt;                                                  \
+    MetricsAddFunction(fn, MetricsNow() - metrics_start_); \
+  } while (0)
+// Output calls are too frequent to time each one: every
+// METRICS_OUTPUT_SAMPLE-th call is timed and counts for the ones in between.
+#define METRICS_OUTPUT_SAMPLE 32
+extern uint32_t metrics_output_calls;
+#define METRICS_OUTPUT(stmt)                                          \
+  do {                                                                \
+    if (++metrics_output_calls % METRICS_OUTPUT_SAMPLE == 0) {        \
+      uint64_t metrics_start_ = MetricsNow();                         \
+      stmt;                                                           \
+      MetricsAddOutputSample(MetricsNow() - metrics_start_);          \
+    } else {                                                          \
+      stmt;                                                           \
+    }                                                                 \
+  } while (0)
+#define METRICS_NAL_BEGIN(var) MetricsNalBegin(var)
+#define METRICS_NAL_END(nal_unit_type, bytes) \
+  MetricsNalEnd(nal_unit_type, bytes)
+
+#else
+
+#define METRICS_INIT()
+#define METRICS_BEGIN(var)
+#define METRICS_END(stage, var, bytes)
+#define METRICS_LAP(stage, var, bytes)
+#define METRICS_FUNC(fn, stmt) stmt
+#define METRICS_OUTPUT(stmt) stmt
+#define METRICS_NAL_BEGIN(var)
+#define METRICS_NAL_END(nal_unit_type, bytes)
+
+#endif
+
+#endif
@@ -0,0 +1,573 @@
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "nal-filter.h"
+#include "bitstream.h"
+#include "output-context.h"
+
+enum NalFilterOp {
+  FILTER_LOAD = 0,
+  FILTER_CONST = 1,
+  FILTER_EQ = 2,
+  FILTER_NE = 3,
+  FILTER_LT = 4,
+  FILTER_LE = 5,
+  FILTER_GT = 6,
+  FILTER_GE = 7,
+  FILTER_NOT = 8,
+  FILTER_AND_JUMP = 9,  // to arg if the top is false, keeping it
+  FILTER_OR_JUMP = 10,  // to arg if the top is true, keeping it
+  FILTER_AND = 11,
+  FILTER_OR = 12
+};
+
+// What a load reads from. The slice segment header is absent from NAL
+// units that aren't slice segments.
+enum NalFilterSource {
+  FILTER_NUH = 0,
+  FILTER_CLASS = 1,
+  FILTER_LENGTH = 2,
+  FILTER_SLICE = 3,
+  FILTER_SPS = 4,
+  FILTER_PPS = 5,
+  FILTER_SOURCES = 6
+};
+
+// Values on the evaluation stack
+enum NalFilterState {
+  FILTER_KNOWN = 0,
+  FILTER_UNKNOWN = 1,
+  FILTER_ABSENT = 2
+};
+
+struct NalFilterUnit {
+  uint32_t nal_length;
+  uint8_t is_vcl;
+  uint8_t is_slice;
+  uint8_t is_irap;
+};
+
+struct NalFilterField {
+  const char* name;
+  uint8_t source;
+  uint8_t width;
+  uint32_t offset;
+};
+
+#define FILTER_FIELD(source, type, member, sign)                       \
+  {#member, source, (uint8_t)(sign | sizeof(((type*)0)->member)),      \
+   (uint32_t)offsetof(type, member)},
+#define NUH(m) FILTER_FIELD(FILTER_NUH, struct NalUnitHeader, m, 0)
+#define UNIT(source, m) FILTER_FIELD(source, struct NalFilterUnit, m, 0)
+#define SH(m) FILTER_FIELD(FILTER_SLICE, struct H265SliceSegmentHeader, m, 0)
+#define SH_SIGNED(m) \
+  FILTER_FIELD(FILTER_SLICE, struct H265SliceSegmentHeader, m, 0x80)
+#define SPS(m) FILTER_FIELD(FILTER_SPS, struct H265SeqParameterSet, m, 0)
+#define PPS(m) FILTER_FIELD(FILTER_PPS, struct H265PicParameterSet, m, 0)
+#define PPS_SIGNED(m) \
+  FILTER_FIELD(FILTER_PPS, struct H265PicParameterSet, m, 0x80)
+
+static const struct NalFilterField kFields[] = {
+    NUH(nal_unit_type)
+    NUH(nuh_layer_id)
+    NUH(nuh_temporal_id_plus1)
+    UNIT(FILTER_CLASS, is_vcl)
+    UNIT(FILTER_CLASS, is_slice)
+    UNIT(FILTER_CLASS, is_irap)
+    UNIT(FILTER_LENGTH, nal_length)
+    SH(first_slice_segment_in_pic_flag)
+    SH(no_output_of_prior_pics_flag)
+    SH(slice_pic_parameter_set_id)
+    SH(dependent_slice_segment_flag)
+    SH(slice_segment_address)
+    SH(slice_type)
+    SH(pic_output_flag)
+    SH(colour_plane_id)
+    SH(slice_pic_order_cnt_lsb)
+    SH(short_term_ref_pic_set_sps_flag)
+    SH(short_term_ref_pic_set_idx)
+    SH(num_long_term_sps)
+    SH(num_long_term_pics)
+    SH(slice_temporal_mvp_enabled_flag)
+    SH(slice_sao_luma_flag)
+    SH(slice_sao_chroma_flag)
+    SH(num_ref_idx_active_override_flag)
+    SH(num_ref_idx_l0_active_minus1)
+    SH(num_ref_idx_l1_active_minus1)
+    SH(mvd_l1_zero_flag)
+    SH(cabac_init_flag)
+    SH(collocated_from_l0_flag)
+    SH(collocated_ref_idx)
+    SH(five_minus_max_num_merge_cand)
+    SH_SIGNED(slice_qp_delta)
+    SH_SIGNED(slice_cb_qp_offset)
+    SH_SIGNED(slice_cr_qp_offset)
+    SH(cu_chroma_qp_offset_enabled_flag)
+    SH(deblocking_filter_override_flag)
+    SH(slice_deblocking_filter_disabled_flag)
+    SH_SIGNED(slice_beta_offset_div2)
+    SH_SIGNED(slice_tc_offset_div2)
+    SH(slice_loop_filter_across_slices_enabled_flag)
+    SH(num_entry_point_offsets)
+    SH(offset_len_minus1)
+    SH(slice_segment_header_extension_length)
+    SH(NumPicTotalCurr)
+    SH(slice_data_bit_offset)
+    SH(slice_data_byte_offset)
+    SPS(sps_video_parameter_set_id)
+    SPS(sps_max_sub_layers_minus1)
+    SPS(sps_temporal_id_nesting_flag)
+    SPS(sps_seq_parameter_set_id)
+    SPS(chroma_format_idc)
+    SPS(separate_colour_plane_flag)
+    SPS(pic_width_in_luma_samples)
+    SPS(pic_height_in_luma_samples)
+    SPS(conformance_window_flag)
+    SPS(bit_depth_luma_minus8)
+    SPS(bit_depth_chroma_minus8)
+    SPS(log2_max_pic_order_cnt_lsb_minus4)
+    SPS(log2_min_luma_coding_block_size_minus3)
+    SPS(log2_diff_max_min_luma_coding_block_size)
+    SPS(log2_min_luma_transform_block_size_minus2)
+    SPS(log2_diff_max_min_luma_transform_block_size)
+    SPS(max_transform_hierarchy_depth_inter)
+    SPS(max_transform_hierarchy_depth_intra)
+    SPS(scaling_list_enabled_flag)
+    SPS(amp_enabled_flag)
+    SPS(sample_adaptive_offset_enabled_flag)
+    SPS(pcm_enabled_flag)
+    SPS(num_short_term_ref_pic_sets)
+    SPS(long_term_ref_pics_present_flag)
+    SPS(sps_temporal_mvp_enabled_flag)
+    SPS(strong_intra_smoothing_enabled_flag)
+    SPS(vui_parameters_present_flag)
+    SPS(sps_extension_present_flag)
+    SPS(ChromaArrayType)
+    SPS(CtbLog2SizeY)
+    SPS(CtbSizeY)
+    SPS(PicWidthInCtbsY)
+    SPS(PicHeightInCtbsY)
+    SPS(PicSizeInCtbsY)
+    PPS(pps_pic_parameter_set_id)
+    PPS(pps_seq_parameter_set_id)
+    PPS(dependent_slice_segments_enabled_flag)
+    PPS(output_flag_present_flag)
+    PPS(num_extra_slice_header_bits)
+    PPS(sign_data_hiding_enabled_flag)
+    PPS(cabac_init_present_flag)
+    PPS(num_ref_idx_l0_default_active_minus1)
+    PPS(num_ref_idx_l1_default_active_minus1)
+    PPS_SIGNED(init_qp_minus26)
+    PPS(constrained_intra_pred_flag)
+    PPS(transform_skip_enabled_flag)
+    PPS(cu_qp_delta_enabled_flag)
+    PPS(diff_cu_qp_delta_depth)
+    PPS_SIGNED(pps_cb_qp_offset)
+    PPS_SIGNED(pps_cr_qp_offset)
+    PPS(weighted_pred_flag)
+    PPS(weighted_bipred_flag)
+    PPS(transquant_bypass_enabled_flag)
+    PPS(tiles_enabled_flag)
+    PPS(entropy_coding_sync_enabled_flag)
+    PPS(num_tile_columns_minus1)
+    PPS(num_tile_rows_minus1)
+    PPS(deblocking_filter_control_present_flag)
+    PPS(pps_deblocking_filter_disabled_flag)
+    PPS(lists_modification_present_flag)
+    PPS(log2_parallel_merge_level_minus2)};
+
+struct NalFilterConstant {
+  const char* name;
+  int64_t value;
+};
+
+static const struct NalFilterConstant kConstants[] = {
+#define FILTER_NAL_TYPE(name, value) {#name, value},
+    H265_NAL_TYPES(FILTER_NAL_TYPE)
+#undef FILTER_NAL_TYPE
+    {"B", H265_SLICE_TYPE_B},
+    {"P", H265_SLICE_TYPE_P},
+    {"I", H265_SLICE_TYPE_I}};
+
+struct NalFilterParser {
+  const char* expr;
+  const char* p;
+  struct NalFilter* filter;
+  uint32_t depth;    // of the stack at this point of the code
+  uint32_t nesting;  // of parentheses and !
+  int failed;
+};
+
+static void Fail(struct NalFilterParser* ps, const char* what) {
+  if (!ps->failed)
+    fprintf(stderr, "filter: %s at column %d of \"%s\"\n", what,
+            (int)(ps->p - ps->expr) + 1, ps->expr);
+  ps->failed = 1;
+}
+
+static void SkipSpace(struct NalFilterParser* ps) {
+  while (*ps->p == ' ' || *ps->p == '\t' || *ps->p == '\n' || *ps->p == '\r')
+    ps->p++;
+}
+
+// Consumes |token| if it comes next.
+static int Accept(struct NalFilterParser* ps, const char* token) {
+  size_t n = strlen(token);
+  SkipSpace(ps);
+  if (strncmp(ps->p, token, n) != 0)
+    return 0;
+  ps->p += n;
+  return 1;
+}
+
+// Appends an instruction moving the stack depth by |push|; returns its
+// index, -1 once failed.
+static int Emit(struct NalFilterParser* ps, uint8_t op, int push) {
+  struct NalFilter* f = ps->filter;
+  if (ps->failed)
+    return -1;
+  if (f->size == NAL_FILTER_MAX_CODE) {
+    Fail(ps, "expression too long");
+    return -1;
+  }
+  ps->depth += push;
+  if (ps->depth > NAL_FILTER_MAX_STACK) {
+    Fail(ps, "expression nested too deeply");
+    return -1;
+  }
+  memset(&f->code[f->size], 0, sizeof(f->code[f->size]));
+  f->code[f->size].op = op;
+  return (int)f->size++;
+}
+
+static void Or(struct NalFilterParser* ps);
+
+static void Operand(struct NalFilterParser* ps) {
+  const char* start;
+  size_t n, i;
+  int at;
+  SkipSpace(ps);
+  start = ps->p;
+  if (Accept(ps, "(")) {
+    if (++ps->nesting > NAL_FILTER_MAX_STACK)
+      Fail(ps, "expression nested too deeply");
+    else
+      Or(ps);
+    if (!Accept(ps, ")"))
+      Fail(ps, "expected )");
+    ps->nesting--;
+    return;
+  }
+  if ((*ps->p >= '0' && *ps->p <= '9') || *ps->p == '-') {
+    char* end;
+    int64_t value = strtoll(start, &end, 0);
+    if (end == start || (*start == '-' && end == start + 1)) {
+      Fail(ps, "expected a number");
+      return;
+    }
+    ps->p = end;
+    at = Emit(ps, FILTER_CONST, 1);
+    if (at >= 0)
+      ps->filter->code[at].value = value;
+    return;
+  }
+  while ((*ps->p >= 'a' && *ps->p <= 'z') || (*ps->p >= 'A' && *ps->p <= 'Z') ||
+         (*ps->p >= '0' && *ps->p <= '9') || *ps->p == '_')
+    ps->p++;
+  n = (size_t)(ps->p - start);
+  if (n == 0) {
+    Fail(ps, "expected a field, name or number");
+    return;
+  }
+  for (i = 0; i < sizeof(kFields) / sizeof(kFields[0]); i++) {
+    if (strlen(kFields[i].name) == n && strncmp(start, kFields[i].name, n) == 0)
+      break;
+  }
+  if (i < sizeof(kFields) / sizeof(kFields[0])) {
+    at = Emit(ps, FILTER_LOAD, 1);
+    if (at >= 0) {
+      ps->filter->code[at].source = kFields[i].source;
+      ps->filter->code[at].width = kFields[i].width;
+      ps->filter->code[at].arg = kFields[i].offset;
+    }
+    return;
+  }
+  // NAL unit types also as the output names them
+  if (n > 14 && strncmp(start, "H265_NAL_TYPE_", 14) == 0) {
+    start += 14;
+    n -= 14;
+  }
+  for (i = 0; i < sizeof(kConstants) / sizeof(kConstants[0]); i++) {
+    if (strlen(kConstants[i].name) == n &&
+        strncmp(start, kConstants[i].name, n) == 0)
+      break;
+  }
+  if (i == sizeof(kConstants) / sizeof(kConstants[0])) {
+    ps->p = start;
+    Fail(ps, "unknown name");
+    return;
+  }
+  at = Emit(ps, FILTER_CONST, 1);
+  if (at >= 0)
+    ps->filter->code[at].value = kConstants[i].value;
+}
+
+static void Not(struct NalFilterParser* ps) {
+  SkipSpace(ps);
+  // not !=, which can't start an operand anyway
+  if (ps->p[0] == '!' && ps->p[1] != '=') {
+    ps->p++;
+    if (++ps->nesting > NAL_FILTER_MAX_STACK)
+      Fail(ps, "expression nested too deeply");
+    else
+      Not(ps);
+    Emit(ps, FILTER_NOT, 0);
+    ps->nesting--;
+    return;
+  }
+  Operand(ps);
+}
+
+static void Compare(struct NalFilterParser* ps) {
+  // two character operators first
+  static const struct {
+    const char* token;
+    uint8_t op;
+  } kOps[] = {{"==", FILTER_EQ}, {"!=", FILTER_NE}, {"<=", FILTER_LE},
+              {">=", FILTER_GE}, {"<", FILTER_LT},  {">", FILTER_GT}};
+  size_t i;
+  Not(ps);
+  for (i = 0; i < sizeof(kOps) / sizeof(kOps[0]); i++) {
+    if (Accept(ps, kOps[i].token)) {
+      Not(ps);
+      Emit(ps, kOps[i].op, -1);
+      return;
+    }
+  }
+}
+
+// && and || of the operands |next| parses, short-circuited by |jump|
+static void Chain(struct NalFilterParser* ps,
+                  const char* token,
+                  uint8_t jump,
+                  uint8_t op,
+                  void (*next)(struct NalFilterParser*)) {
+  next(ps);
+  while (!ps->failed && Accept(ps, token)) {
+    int at = Emit(ps, jump, 0);
+    next(ps);
+    Emit(ps, op, -1);
+    if (at >= 0)
+      ps->filter->code[at].arg = ps->filter->size;
+  }
+}
+
+static void And(struct NalFilterParser* ps) {
+  Chain(ps, "&&", FILTER_AND_JUMP, FILTER_AND, Compare);
+}
+
+static void Or(struct NalFilterParser* ps) {
+  Chain(ps, "||", FILTER_OR_JUMP, FILTER_OR, And);
+}
+
+int NalFilterCompile(struct NalFilter* filter, const char* expr) {
+  struct NalFilterParser ps;
+  memset(&ps, 0, sizeof(ps));
+  ps.expr = ps.p = expr;
+  ps.filter = filter;
+  filter->size = 0;
+  Or(&ps);
+  SkipSpace(&ps);
+  if (*ps.p)
+    Fail(&ps, "unexpected text");
+  return ps.failed ? -1 : 0;
+}
+
+static int64_t Load(const uint8_t* p, uint8_t width) {
+  switch (width) {
+  case 1:
+    return *p;
+  case 2:
+    return *(const uint16_t*)p;
+  case 4:
+    return *(const uint32_t*)p;
+  case 0x80 | 4:
+    return *(const int32_t*)p;
+  }
+  return 0;
+}
+
+enum NalFilterResult NalFilterEval(const struct NalFilter* filter,
+                                   const struct h265_decode_t* dec,
+                                   const struct NalUnitHeader* nuh,
+                                   uint32_t nal_length,
+                                   int parsed) {
+  const uint8_t* base[FILTER_SOURCES];
+  struct NalFilterUnit unit;
+  enum H265NalType type = nuh->nal_unit_type;
+  uint32_t unknown = 0, pc;
+  int64_t value[NAL_FILTER_MAX_STACK];
+  uint8_t state[NAL_FILTER_MAX_STACK];
+  int sp = -1;
+  unit.nal_length = nal_length;
+  unit.is_vcl = type < H265_NAL_TYPE_VPS_NUT;
+  unit.is_slice = type <= H265_NAL_TYPE_RASL_R ||
+                  (type >= H265_NAL_TYPE_BLA_W_LP &&
+                   type <= H265_NAL_TYPE_CRA_NUT);
+  unit.is_irap = type >= H265_NAL_TYPE_BLA_W_LP &&
+                 type <= H265_NAL_TYPE_RSV_IRAP_VCL23;
+  base[FILTER_NUH] = (const uint8_t*)nuh;
+  base[FILTER_CLASS] = base[FILTER_LENGTH] = (const uint8_t*)&unit;
+  base[FILTER_SLICE] =
+      unit.is_slice ? (const uint8_t*)&dec->slice_segment.header : NULL;
+  base[FILTER_SPS] = (const uint8_t*)&dec->seq_param_set;
+  base[FILTER_PPS] = (const uint8_t*)&dec->pic_param_set;
+  if (!parsed) {
+    unknown = 1 << FILTER_LENGTH | 1 << FILTER_SLICE;
+    if (type == H265_NAL_TYPE_SPS_NUT)
+      unknown |= 1 << FILTER_SPS;
+    else if (type == H265_NAL_TYPE_PPS_NUT)
+      unknown |= 1 << FILTER_PPS;
+  }
+
+  for (pc = 0; pc < filter->size; pc++) {
+    const struct NalFilterInsn* in = &filter->code[pc];
+    int64_t a, b;
+    uint8_t sa, sb, decides;
+    switch (in->op) {
+    case FILTER_LOAD:
+      sp++;
+      value[sp] = 0;
+      if (unknown & 1 << in->source) {
+        state[sp] = FILTER_UNKNOWN;
+      } else if (!base[in->source]) {
+        state[sp] = FILTER_ABSENT;
+      } else {
+        state[sp] = FILTER_KNOWN;
+        value[sp] = Load(base[in->source] + in->arg, in->width);
+      }
+      break;
+    case FILTER_CONST:
+      sp++;
+      state[sp] = FILTER_KNOWN;
+      value[sp] = in->value;
+      break;
+    case FILTER_NOT:
+      if (state[sp] == FILTER_ABSENT)
+        state[sp] = FILTER_KNOWN;
+      value[sp] = !value[sp];
+      break;
+    case FILTER_AND_JUMP:
+      if (state[sp] == FILTER_ABSENT ||
+          (state[sp] == FILTER_KNOWN && !value[sp]))
+        pc = in->arg - 1;
+      break;
+    case FILTER_OR_JUMP:
+      if (state[sp] == FILTER_KNOWN && value[sp])
+        pc = in->arg - 1;
+      break;
+    case FILTER_AND:
+    case FILTER_OR:
+      sp--;
+      sa = state[sp];
+      sb = state[sp + 1];
+      a = sa == FILTER_KNOWN && value[sp];
+      b = sb == FILTER_KNOWN && value[sp + 1];
+      // a known false operand of && decides, a known true one of ||
+      decides = in->op == FILTER_OR;
+      if ((sa != FILTER_UNKNOWN && a == decides) ||
+          (sb != FILTER_UNKNOWN && b == decides)) {
+        state[sp] = FILTER_KNOWN;
+        value[sp] = decides;
+      } else if (sa == FILTER_UNKNOWN || sb == FILTER_UNKNOWN) {
+        state[sp] = FILTER_UNKNOWN;
+      } else {
+        state[sp] = FILTER_KNOWN;
+        value[sp] = !decides;
+      }
+      break;
+    default:
+      sp--;
+      sa = state[sp];
+      sb = state[sp + 1];
+      a = value[sp];
+      b = value[sp + 1];
+      if (sa == FILTER_ABSENT || sb == FILTER_ABSENT) {
+        state[sp] = FILTER_KNOWN;
+        value[sp] = 0;
+        break;
+      }
+      if (sa == FILTER_UNKNOWN || sb == FILTER_UNKNOWN) {
+        state[sp] = FILTER_UNKNOWN;
+        break;
+      }
+      switch (in->op) {
+      case FILTER_EQ:
+        value[sp] = a == b;
+        break;
+      case FILTER_NE:
+        value[sp] = a != b;
+        break;
+      case FILTER_LT:
+        value[sp] = a < b;
+        break;
+      case FILTER_LE:
+        value[sp] = a <= b;
+        break;
+      case FILTER_GT:
+        value[sp] = a > b;
+        break;
+      default:
+        value[sp] = a >= b;
+        break;
+      }
+      break;
+    }
+  }
+  if (state[0] == FILTER_UNKNOWN)
+    return NAL_FILTER_UNKNOWN;
+  return state[0] == FILTER_KNOWN && value[0] ? NAL_FILTER_YES : NAL_FILTER_NO;
+}
+
+int NalFilterSelect(const struct NalFilter* filter,
+                    struct h265_decode_t* dec,
+                    uint8_t* data,
+                    uint32_t size,
+                    int skip_rbsp,
+                    int* err) {
+  struct NalUnitHeader nuh;
+  struct BitStream bs;
+  struct OutputContextDict none[1];
+  struct OutputConfig config;
+  uint8_t new_access_unit = dec->new_access_unit;
+  uint8_t au_has_vcl = dec->au_has_vcl;
+  enum NalFilterResult match;
+  // too short for a NAL unit header: h265_parse_nal reports it
+  if (size < 2)
+    return 1;
+  nuh.nal_unit_type = (enum H265NalType)(data[0] >> 1 & 63);
+  nuh.nuh_layer_id = (uint8_t)((data[0] & 1) << 5 | data[1] >> 3);
+  nuh.nuh_temporal_id_plus1 = data[1] & 7;
+  match = NalFilterEval(filter, dec, &nuh, size, 0);
+  if (match == NAL_FILTER_YES)
+    return 1;
+  memset(&config, 0, sizeof(config));
+  OutputContextInitDict(none, NULL, -1, &config);
+  BsInit(&bs, data, size);
+  if (match == NAL_FILTER_NO && skip_rbsp &&
+      (nuh.nal_unit_type < H265_NAL_TYPE_VPS_NUT ||
+       nuh.nal_unit_type > H265_NAL_TYPE_PPS_NUT))
+    *err = h265_parse_nal_header(dec, &bs, none);
+  else
+    *err = h265_parse_nal(dec, &bs, none);
+  none->end(none);
+  if (match == NAL_FILTER_NO ||
+      NalFilterEval(filter, dec, &dec->nal_unit_header, size, 1) !=
+          NAL_FILTER_YES)
+    return 0;
+  // parsed again into the record, which tracks access units again
+  dec->new_access_unit = new_access_unit;
+  dec->au_has_vcl = au_has_vcl;
+  return 1;
+}
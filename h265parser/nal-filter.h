@@ -0,0 +1,77 @@
+#ifndef NAL_FILTER_H_
+#define NAL_FILTER_H_
+
+#include <stdint.h>
+#include "h265parser.h"
+
+// Filter expressions over the parsed fields of a NAL unit, compiled once to
+// a small stack bytecode and evaluated per NAL unit, e.g.
+//
+//   is_slice && nuh_layer_id == 0 &&
+//       (nal_unit_type == IDR_W_RADL || slice_qp_delta > 6)
+//
+// Operands are numbers, the names of NAL unit types (IDR_W_RADL, also as
+// H265_NAL_TYPE_IDR_W_RADL), slice types B, P and I, and field names:
+//
+//   the NalUnitHeader fields
+//   is_vcl, is_slice, is_irap and nal_length, the size without emulation
+//   prevention bytes
+//   the scalar fields of the slice segment header; they compare false, and
+//   are false, in NAL units that aren't slice segments
+//   the scalar fields of the SPS and PPS parsed last
+//
+// with the operators == != < <= > >= ! && || and parentheses; a field on its
+// own is true when it isn't 0.
+//
+// Evaluation is three-valued so that the NAL unit header can decide before
+// the parse: the slice segment header, nal_length and the parameter set a
+// NAL unit carries are unknown until it is parsed, && and || skip their
+// right operand once the left one decides.
+
+#define NAL_FILTER_MAX_CODE 256
+#define NAL_FILTER_MAX_STACK 32
+
+enum NalFilterResult {
+  NAL_FILTER_NO = 0,
+  NAL_FILTER_YES = 1,
+  NAL_FILTER_UNKNOWN = 2
+};
+
+struct NalFilterInsn {
+  uint8_t op;
+  uint8_t source;  // loads: the struct read
+  uint8_t width;   // loads: bytes, with 0x80 for signed
+  uint32_t arg;    // loads: offset in the struct; jumps: target
+  int64_t value;   // constants
+};
+
+struct NalFilter {
+  struct NalFilterInsn code[NAL_FILTER_MAX_CODE];
+  uint32_t size;
+};
+
+// Returns -1 after printing where |expr| is invalid.
+int NalFilterCompile(struct NalFilter* filter, const char* expr);
+// Evaluates |filter| on the NAL unit with header |nuh| and |nal_length|.
+// Before the parse of the NAL unit |parsed| is 0, and the result may be
+// NAL_FILTER_UNKNOWN; after it, |nuh| is &dec->nal_unit_header.
+enum NalFilterResult NalFilterEval(const struct NalFilter* filter,
+                                   const struct h265_decode_t* dec,
+                                   const struct NalUnitHeader* nuh,
+                                   uint32_t nal_length,
+                                   int parsed);
+// Decides whether the record of the NAL unit |data|, without emulation
+// prevention bytes, is written. Returns 1 with |dec| unchanged, to be
+// parsed into the record, or 0 once it was parsed without output, with
+// what h265_parse_nal returned in |err|. NAL units the header decides
+// against are parsed only as far as their NAL unit header when
+// |skip_rbsp| is set and they aren't parameter sets, which only leaves
+// the slice segment header and SEI messages in |dec| behind.
+int NalFilterSelect(const struct NalFilter* filter,
+                    struct h265_decode_t* dec,
+                    uint8_t* data,
+                    uint32_t size,
+                    int skip_rbsp,
+                    int* err);
+
+#endif
@@ -0,0 +1,486 @@
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE  // memfd_create
+#endif
+#include <stdlib.h>
+#include <string.h>
+#include "nal-input.h"
+#include "h265parser.h"
+#ifdef _WIN32
+#define fseeko _fseeki64
+#elif defined(__linux__)
+#include <sys/mman.h>
+#include <unistd.h>
+#define NAL_INPUT_MIRROR
+#endif
+
+static uint8_t* MapMirror(uint32_t capacity) {
+  // a memfd mapped twice into one reserved range; |capacity| is a multiple of
+  // the page size
+#ifdef NAL_INPUT_MIRROR
+  uint8_t* base;
+  int fd = memfd_create("nal-input", MFD_CLOEXEC);
+  if (fd < 0)
+    return NULL;
+  if (ftruncate(fd, capacity) != 0 ||
+      (base = (uint8_t*)mmap(NULL, 2 * (size_t)capacity, PROT_NONE,
+                             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) ==
+          MAP_FAILED) {
+    close(fd);
+    return NULL;
+  }
+  if (mmap(base, capacity, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+           fd, 0) == MAP_FAILED ||
+      mmap(base + capacity, capacity, PROT_READ | PROT_WRITE,
+           MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+    munmap(base, 2 * (size_t)capacity);
+    close(fd);
+    return NULL;
+  }
+  close(fd);
+  return base;
+#else
+  return NULL;
+#endif
+}
+
+static void FreeBuffer(uint8_t* buffer, uint32_t capacity, uint8_t mirrored) {
+#ifdef NAL_INPUT_MIRROR
+  if (mirrored) {
+    munmap(buffer, 2 * (size_t)capacity);
+    return;
+  }
+#endif
+  free(buffer);
+}
+
+static uint8_t* NewBuffer(uint32_t capacity, uint8_t* mirrored) {
+  // a ring if |*mirrored| and one can be mapped; clears |*mirrored| if not
+  uint8_t* buffer = *mirrored ? MapMirror(capacity) : NULL;
+  *mirrored = buffer != NULL;
+  if (!buffer)
+    buffer = (uint8_t*)malloc(capacity);
+  return buffer;
+}
+
+static int GrowBuffer(struct NalInput* in) {
+  // Doubles the buffer for a NAL unit that doesn't fit; with a ring, the
+  // only time the unconsumed bytes are copied.
+  uint32_t avail = in->end - in->begin;
+  uint8_t mirrored = in->mirrored;
+  uint8_t* buffer;
+  if (in->capacity >= NAL_INPUT_MAX_BUFFER_SIZE)
+    return -1;
+  buffer = NewBuffer(in->capacity * 2, &mirrored);
+  if (!buffer)
+    return -1;
+  memcpy(buffer, in->buffer + in->begin, avail);
+  FreeBuffer(in->buffer, in->capacity, in->mirrored);
+  in->buffer = buffer;
+  in->capacity *= 2;
+  in->mirrored = mirrored;
+  in->buffer_offset += in->begin;
+  in->begin = 0;
+  in->end = avail;
+  return 0;
+}
+
+static int FillBuffer(struct NalInput* in) {
+  // Refills the buffer after its unconsumed bytes. Returns the number of
+  // bytes read.
+  size_t n;
+  if (in->eof)
+    return 0;
+  if (in->mirrored) {
+    // the same bytes a capacity lower
+    if (in->begin >= in->capacity) {
+      in->begin -= in->capacity;
+      in->end -= in->capacity;
+      in->buffer_offset += in->capacity;
+    }
+  } else if (in->begin != 0) {
+    memmove(in->buffer, in->buffer + in->begin, in->end - in->begin);
+    in->buffer_offset += in->begin;
+    in->end -= in->begin;
+    in->begin = 0;
+  }
+  n = in->read(in->opaque, in->buffer + in->end,
+               in->capacity - (in->end - in->begin));
+  in->flush = n == NAL_INPUT_READ_IDLE;
+  if (in->flush)
+    return 0;
+  in->end += (uint32_t)n;
+  if (n == 0)
+    in->eof = 1;
+  return (int)n;
+}
+
+static size_t FileRead(void* opaque, uint8_t* dst, size_t size) {
+  return fread(dst, 1, size, (FILE*)opaque);
+}
+
+static uint32_t StartCodeBytes(const uint8_t* p, uint32_t avail) {
+  if (avail >= 3 && p[0] == 0 && p[1] == 0 && p[2] == 1)
+    return 3;
+  if (avail >= 4 && p[0] == 0 && p[1] == 0 && p[2] == 0 && p[3] == 1)
+    return 4;
+  return 0;
+}
+
+static int NextConfigNal(struct NalInput* in, struct NalUnit* nal) {
+  const uint8_t* p = in->config;
+  uint32_t len;
+  while (in->config_nalus_left == 0) {
+    if (in->config_arrays_left == 0)
+      return 0;
+    if (in->config_pos + 3 > in->config_size)
+      return -1;
+    // array_completeness, reserved, NAL_unit_type; numNalus
+    in->config_nalus_left =
+        (p[in->config_pos + 1] << 8) | p[in->config_pos + 2];
+    in->config_pos += 3;
+    in->config_arrays_left--;
+  }
+  if (in->config_pos + 2 > in->config_size)
+    return -1;
+  len = (p[in->config_pos] << 8) | p[in->config_pos + 1];
+  if (in->config_pos + 2 + len > in->config_size)
+    return -1;
+  nal->data = in->config + in->config_pos + 2;
+  nal->size = len;
+  nal->prefix_bytes = 2;
+  nal->offset = in->config_pos;
+  nal->from_config = 1;
+  nal->partial = 0;
+  nal->pts = nal->dts = -1;
+  in->config_pos += 2 + len;
+  in->config_nalus_left--;
+  return 1;
+}
+
+static int AnnexBNext(struct NalInput* in, struct NalUnit* nal) {
+  // B.2 Byte stream NAL unit decoding process: the NAL unit runs from the end
+  // of its start code to the next start code, or to the end of the stream.
+  for (;;) {
+    uint32_t avail = in->end - in->begin;
+    uint8_t* p = in->buffer + in->begin;
+    uint32_t sc, next, from;
+    if (avail < 4 && !in->eof) {
+      FillBuffer(in);
+      continue;
+    }
+    sc = StartCodeBytes(p, avail);
+    if (sc == 0) {
+      // leading zero_byte or garbage before the first start code
+      if (avail == 0)
+        return 0;
+      in->begin++;
+      continue;
+    }
+    // A NAL unit longer than the buffer is searched again after each
+    // refill; resume where the last search stopped. It read up to 4 bytes
+    // short of its end, so no start code begins in the 7 bytes before that.
+    from = in->scanned > sc + 7 ? in->scanned - 7 : 0;
+    next = 0;
+    if (avail >= 4) {
+      next = h265_find_next_start_code(p + from, avail - from);
+      if (next)
+        next += from;
+    }
+    if (next == 0 && !in->eof) {
+      if (in->flush && avail > sc) {
+        // The source went idle inside what may be one NAL unit. Its bytes
+        // so far go out marked partial and stay buffered; the search
+        // resumes where it stopped once more bytes arrive.
+        in->flush = 0;
+        in->scanned = avail;
+        nal->data = p + sc;
+        nal->size = avail - sc;
+        nal->prefix_bytes = sc;
+        nal->offset = in->buffer_offset + (p - in->buffer);
+        nal->from_config = 0;
+        nal->partial = 1;
+        nal->pts = nal->dts = -1;
+        if (in->stamp)
+          in->stamp(in->opaque, nal);
+        return 1;
+      }
+      in->flush = 0;
+      in->scanned = avail;
+      if (avail == in->capacity && GrowBuffer(in) != 0) {
+        fprintf(stderr, "NAL unit at 0x%llX exceeds the %u byte buffer\n",
+                (unsigned long long)(in->buffer_offset + in->begin),
+                in->capacity);
+        return -1;
+      }
+      FillBuffer(in);
+      continue;
+    }
+    if (next == 0)
+      next = avail;
+    in->flush = 0;
+    in->scanned = 0;
+    in->begin += next;
+    if (next <= sc)
+      continue;
+    nal->data = p + sc;
+    nal->size = next - sc;
+    nal->prefix_bytes = sc;
+    nal->offset = in->buffer_offset + (p - in->buffer);
+    nal->from_config = 0;
+    nal->partial = 0;
+    nal->pts = nal->dts = -1;
+    if (in->stamp)
+      in->stamp(in->opaque, nal);
+    return 1;
+  }
+}
+
+// forbidden_zero_bit 0, nal_unit_type not reserved, nuh_layer_id not 63,
+// nuh_temporal_id_plus1 not 0
+static int PlausibleHeader(const uint8_t* p) {
+  uint32_t type = (p[0] >> 1) & 0x3F;
+  return !(p[0] & 0x80) && !(type >= 10 && type <= 15) &&
+         !(type >= 22 && type <= 31) && !(type >= 41 && type <= 47) &&
+         ((p[0] & 1) << 5 | p[1] >> 3) != 63 && (p[1] & 7) != 0;
+}
+
+// 1 if the length field |len| at |p| leads to a plausible NAL unit header
+// followed by another length field and header, or by the end of the input;
+// 0 if not; -1 if that needs more bytes than |avail|. One damaged length
+// field would otherwise swallow or cut short the NAL units after it.
+//
+// Random bytes pass for a length field and header now and then, so while
+// resynchronizing the chain has to hold for NAL_INPUT_RESYNC_LINKS NAL units
+// and fit the buffer as it is: a NAL unit that needed a larger one is lost.
+static int PlausibleLength(const struct NalInput* in,
+                           const uint8_t* p,
+                           uint32_t len,
+                           uint32_t avail) {
+  uint32_t i, k, ls = in->length_size;
+  uint32_t links = in->resyncing ? NAL_INPUT_RESYNC_LINKS : 2;
+  uint64_t pos = 0;
+  uint64_t limit = in->resyncing ? in->capacity : NAL_INPUT_MAX_BUFFER_SIZE;
+  for (k = 0;; k++) {
+    if (len < 2 || pos + 2 * ls + len + 2 > limit)
+      return 0;
+    if (avail < pos + ls + 2)
+      return in->eof ? 0 : -1;
+    if (!PlausibleHeader(p + pos + ls))
+      return 0;
+    pos += ls + len;
+    if (k + 1 == links)
+      return 1;
+    if (avail < pos + ls + 2) {
+      // the last NAL unit, or the last one so far of a followed input
+      if (avail == pos && (in->eof || in->flush))
+        return 1;
+      return in->eof ? 0 : -1;
+    }
+    len = 0;
+    for (i = 0; i < ls; i++)
+      len = (len << 8) | p[pos + i];
+  }
+}
+
+static int LengthPrefixedNext(struct NalInput* in, struct NalUnit* nal) {
+  // The length field gives the position of the next NAL unit, so no byte of
+  // the payload has to be looked at. A length field that doesn't lead to
+  // the next one is damaged; the input is then searched byte by byte for
+  // two NAL units in a row that are.
+  uint32_t i, len;
+  uint8_t* p;
+  int ret = NextConfigNal(in, nal);
+  if (ret != 0)
+    return ret;
+  if (in->length_size == 0)
+    in->length_size = 4;
+  for (;;) {
+    uint32_t avail = in->end - in->begin;
+    p = in->buffer + in->begin;
+    if (avail < in->length_size) {
+      if (in->eof) {
+        in->resync_bytes += in->resyncing ? avail : 0;
+        return avail == 0 || in->resyncing ? 0 : -1;
+      }
+      FillBuffer(in);
+      continue;
+    }
+    len = 0;
+    for (i = 0; i < in->length_size; i++)
+      len = (len << 8) | p[i];
+    if (len == 0) {
+      in->begin += in->length_size;
+      continue;
+    }
+    ret = PlausibleLength(in, p, len, avail);
+    if (ret < 0) {
+      if (avail == in->capacity && GrowBuffer(in) != 0) {
+        fprintf(stderr, "NAL unit at 0x%llX exceeds the %u byte buffer\n",
+                (unsigned long long)(in->buffer_offset + in->begin),
+                in->capacity);
+        return -1;
+      }
+      FillBuffer(in);
+      continue;
+    }
+    if (ret == 0) {
+      if (!in->resyncing) {
+        if (in->eof && avail < (uint64_t)in->length_size + len)
+          fprintf(stderr, "NAL unit at 0x%llX runs past the end of the input\n",
+                  (unsigned long long)(in->buffer_offset + in->begin));
+        in->resyncs++;
+      }
+      in->resyncing = 1;
+      in->begin++;
+      in->resync_bytes++;
+      continue;
+    }
+    in->resyncing = 0;
+    in->begin += in->length_size + len;
+    nal->data = p + in->length_size;
+    nal->size = len;
+    nal->prefix_bytes = in->length_size;
+    nal->offset = in->buffer_offset + (p - in->buffer);
+    nal->from_config = 0;
+    nal->partial = 0;
+    nal->pts = nal->dts = -1;
+    if (in->stamp)
+      in->stamp(in->opaque, nal);
+    return 1;
+  }
+}
+
+static int OpenCommon(struct NalInput* in,
+                      FILE* fp,
+                      enum NalInputFormat format) {
+  memset(in, 0, sizeof(*in));
+  in->format = format;
+  in->fp = fp;
+  in->read = FileRead;
+  in->opaque = fp;
+  in->capacity = NAL_INPUT_BUFFER_SIZE;
+  in->mirrored = 1;
+  in->buffer = NewBuffer(in->capacity, &in->mirrored);
+  if (!in->buffer)
+    return -1;
+  return 0;
+}
+
+int NalInputOpenAnnexB(struct NalInput* in, FILE* fp) {
+  int err = OpenCommon(in, fp, NAL_INPUT_ANNEXB);
+  in->next = AnnexBNext;
+  return err;
+}
+
+int NalInputOpenAnnexBSource(struct NalInput* in,
+                             size_t (*read)(void* opaque,
+                                            uint8_t* dst,
+                                            size_t size),
+                             void (*stamp)(void* opaque, struct NalUnit* nal),
+                             void* opaque) {
+  int err = NalInputOpenAnnexB(in, NULL);
+  NalInputSetSource(in, read, stamp, opaque);
+  return err;
+}
+
+void NalInputSetSource(struct NalInput* in,
+                       size_t (*read)(void* opaque, uint8_t* dst, size_t size),
+                       void (*stamp)(void* opaque, struct NalUnit* nal),
+                       void* opaque) {
+  in->read = read;
+  in->stamp = stamp;
+  in->opaque = opaque;
+}
+
+int NalInputOpenLengthPrefixed(struct NalInput* in,
+                               FILE* fp,
+                               uint8_t length_size) {
+  int err = OpenCommon(in, fp, NAL_INPUT_LENGTH_PREFIXED);
+  in->next = LengthPrefixedNext;
+  in->length_size = length_size;
+  if (length_size != 0 && length_size != 1 && length_size != 2 &&
+      length_size != 4) {
+    fprintf(stderr, "length size must be 1, 2 or 4\n");
+    return -1;
+  }
+  return err;
+}
+
+int NalInputLoadHvcc(struct NalInput* in, FILE* fp) {
+  uint8_t* p;
+  uint32_t size = 0, capacity = 4096;
+  size_t n;
+  in->config = (uint8_t*)malloc(capacity);
+  while (in->config &&
+         (n = fread(in->config + size, 1, capacity - size, fp)) > 0) {
+    size += (uint32_t)n;
+    if (size == capacity) {
+      uint8_t* grown = (uint8_t*)realloc(in->config, capacity * 2);
+      if (!grown)
+        free(in->config);
+      in->config = grown;
+      capacity *= 2;
+    }
+  }
+  if (!in->config)
+    return -1;
+  p = in->config;
+  // skip the box header of a whole 'hvcC' box
+  if (size >= 8 && memcmp(p + 4, "hvcC", 4) == 0) {
+    p += 8;
+    size -= 8;
+    memmove(in->config, p, size);
+    p = in->config;
+  }
+  if (size < 23 || p[0] != 1) {
+    fprintf(stderr, "not an HEVCDecoderConfigurationRecord\n");
+    return -1;
+  }
+  // byte 21: constantFrameRate(2) numTemporalLayers(3) temporalIdNested(1)
+  // lengthSizeMinusOne(2); byte 22: numOfArrays
+  if (in->length_size == 0)
+    in->length_size = (p[21] & 3) + 1;
+  if (in->length_size == 3) {
+    fprintf(stderr, "hvcC: invalid lengthSizeMinusOne\n");
+    return -1;
+  }
+  in->config_size = size;
+  in->config_arrays_left = p[22];
+  in->config_pos = 23;
+  in->config_nalus_left = 0;
+  return 0;
+}
+
+int NalInputSeek(struct NalInput* in, uint64_t offset) {
+  if (!in->fp || in->read != FileRead ||
+      fseeko(in->fp, (int64_t)offset, SEEK_SET) != 0) {
+    fprintf(stderr, "couldn't seek the input to 0x%llX\n",
+            (unsigned long long)offset);
+    return -1;
+  }
+  in->begin = in->end = in->scanned = 0;
+  in->buffer_offset = offset;
+  in->eof = in->flush = in->resyncing = 0;
+  // the hvcC parameter sets came before any sample
+  in->config_arrays_left = in->config_nalus_left = 0;
+  return 0;
+}
+
+int NalInputUseFlatBuffer(struct NalInput* in) {
+  if (!in->mirrored)
+    return 0;
+  if (in->end != 0)
+    return -1;
+  FreeBuffer(in->buffer, in->capacity, in->mirrored);
+  in->mirrored = 0;
+  in->buffer = NewBuffer(in->capacity, &in->mirrored);
+  return in->buffer ? 0 : -1;
+}
+
+void NalInputClose(struct NalInput* in) {
+  if (in->buffer)
+    FreeBuffer(in->buffer, in->capacity, in->mirrored);
+  free(in->config);
+  in->buffer = NULL;
+  in->config = NULL;
+}
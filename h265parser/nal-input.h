@@ -0,0 +1,113 @@
+#ifndef NAL_INPUT_H_
+#define NAL_INPUT_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+// Initial size of the read buffer; it doubles for a NAL unit that doesn't
+// fit, up to NAL_INPUT_MAX_BUFFER_SIZE. Intra pictures of 4K video take
+// megabytes.
+#define NAL_INPUT_BUFFER_SIZE (1024 * 1024 * 8)
+#define NAL_INPUT_MAX_BUFFER_SIZE (1024 * 1024 * 1024)
+// NAL units in a row a resynchronizing length prefixed reader checks
+#define NAL_INPUT_RESYNC_LINKS 4
+// Returned by a read callback when no data arrived within its latency bound.
+// A length prefixed reader then emits a NAL unit whose length field is met
+// without waiting for the next one. An Annex B reader can't tell whether the
+// buffered tail is a whole NAL unit before the next start code arrives; it
+// emits it marked |partial| and returns it again, whole, once it ends.
+#define NAL_INPUT_READ_IDLE ((size_t)-1)
+
+enum NalInputFormat {
+  NAL_INPUT_ANNEXB = 0,
+  NAL_INPUT_LENGTH_PREFIXED = 1
+};
+
+struct NalUnit {
+  uint8_t* data;          // first byte of the NAL unit header, still escaped
+  uint32_t size;          // size of the NAL unit as stored in the input
+  uint32_t prefix_bytes;  // start code or length field preceding the NAL unit
+  uint64_t offset;        // input offset of the start code / length field
+  uint8_t from_config;    // parameter set taken from the hvcC record
+  uint8_t partial;        // the bytes so far of a NAL unit that goes on
+  int64_t pts;            // 90 kHz PES timestamps, -1 if not carried
+  int64_t dts;
+};
+
+struct NalInput {
+  // public:
+  // Returns 1 and fills |nal| for each NAL unit, 0 at the end of the input
+  // and a negative value on error. |nal->data| is writable and stays valid
+  // until the next call.
+  int (*next)(struct NalInput* in, struct NalUnit* nal);
+  // private:
+  enum NalInputFormat format;
+  FILE* fp;
+  // byte source, fread() on |fp| unless opened with NalInputOpenAnnexBSource
+  size_t (*read)(void* opaque, uint8_t* dst, size_t size);
+  void (*stamp)(void* opaque, struct NalUnit* nal);
+  void* opaque;
+  // Where it can, the buffer is a ring mapped twice back to back, so that
+  // buffer[i] and buffer[i + capacity] are the same byte: the unconsumed
+  // bytes buffer[begin, end) are contiguous wherever they start, and
+  // refilling moves none of them. Otherwise it is malloc'ed and they are
+  // moved to the front first.
+  uint8_t* buffer;
+  uint32_t capacity;
+  uint32_t begin;  // below capacity after each refill
+  uint32_t end;    // at most begin + capacity
+  uint8_t mirrored;
+  uint32_t scanned;  // bytes from begin searched for the next start code
+  uint64_t buffer_offset;  // input offset of buffer[0]
+  uint8_t eof;
+  uint8_t flush;  // source went idle, see NAL_INPUT_READ_IDLE
+  uint8_t length_size;
+  // A length field that doesn't lead to a plausible NAL unit header and
+  // another such length field, or the end of the input, was damaged; the
+  // reader then moves on byte by byte to one that does.
+  uint8_t resyncing;
+  uint64_t resyncs;
+  uint64_t resync_bytes;  // skipped
+
+  // hvcC parameter set arrays, delivered before the first sample
+  uint8_t* config;
+  uint32_t config_size;
+  uint32_t config_pos;
+  uint32_t config_arrays_left;
+  uint32_t config_nalus_left;
+};
+
+// Byte stream format (Annex B), NAL units delimited by start codes.
+int NalInputOpenAnnexB(struct NalInput* in, FILE* fp);
+// Byte stream produced by |read|, e.g. a demuxer; |read| returns 0 at the end
+// of the stream. |stamp|, if set, fills in the timestamps of each NAL unit.
+int NalInputOpenAnnexBSource(struct NalInput* in,
+                             size_t (*read)(void* opaque,
+                                            uint8_t* dst,
+                                            size_t size),
+                             void (*stamp)(void* opaque, struct NalUnit* nal),
+                             void* opaque);
+// NAL units preceded by a 1, 2 or 4 byte big-endian length, as in MP4 and
+// Matroska samples.
+// Replaces the byte source of an opened input.
+void NalInputSetSource(struct NalInput* in,
+                       size_t (*read)(void* opaque, uint8_t* dst, size_t size),
+                       void (*stamp)(void* opaque, struct NalUnit* nal),
+                       void* opaque);
+int NalInputOpenLengthPrefixed(struct NalInput* in,
+                               FILE* fp,
+                               uint8_t length_size);
+// Reads an HEVCDecoderConfigurationRecord (ISO/IEC 14496-15 8.3.3.1), with or
+// without its box header. Takes lengthSizeMinusOne from the record unless a
+// length size was given, and queues its parameter sets ahead of the samples.
+int NalInputLoadHvcc(struct NalInput* in, FILE* fp);
+// Continues a file input at |offset|, the start code or length field of a NAL
+// unit, as if everything before it was read; hvcC parameter sets are not
+// delivered again.
+int NalInputSeek(struct NalInput* in, uint64_t offset);
+// Switches an input that read nothing yet to the malloc'ed buffer, for
+// comparing the two.
+int NalInputUseFlatBuffer(struct NalInput* in);
+void NalInputClose(struct NalInput* in);
+
+#endif
@@ -1,4 +1,5 @@
 #include "output-context.h"
+#include "metrics.h"
 
 static void PrintIndent(FILE* fp, int n) {
   static const char* indents[] = {"", "  ", "    ", "      ", "        "};
@@ -217,6 +218,53 @@ static void ListEnd(struct OutputContextList* ctx) {
   ctx->indent = -1;
 }
 
+#ifdef H265_METRICS
+// Entry points timed as the output stage; nested calls go to the untimed
+// functions so nothing is counted twice.
+#define TIMED(name, params, args) \
+  static void Timed##name params { METRICS_OUTPUT(name args); }
+TIMED(DictPrintInt,
+      (struct OutputContextDict* ctx, const char* key, int64_t val),
+      (ctx, key, val))
+TIMED(DictPrintUint,
+      (struct OutputContextDict* ctx, const char* key, uint64_t val),
+      (ctx, key, val))
+TIMED(DictPrintHex,
+      (struct OutputContextDict* ctx, const char* key, uint64_t val),
+      (ctx, key, val))
+TIMED(DictPrintEnum,
+      (struct OutputContextDict* ctx, const char* key, const char* str,
+       int val),
+      (ctx, key, str, val))
+TIMED(DictPrintStr,
+      (struct OutputContextDict* ctx, const char* key, const char* val),
+      (ctx, key, val))
+TIMED(DictPrintDict,
+      (struct OutputContextDict* ctx, const char* key,
+       struct OutputContextDict* dict),
+      (ctx, key, dict))
+TIMED(DictPrintList,
+      (struct OutputContextDict* ctx, const char* key,
+       struct OutputContextList* list),
+      (ctx, key, list))
+TIMED(DictEnd, (struct OutputContextDict* ctx), (ctx))
+TIMED(ListPrintInt, (struct OutputContextList* ctx, int64_t val), (ctx, val))
+TIMED(ListPrintUint, (struct OutputContextList* ctx, uint64_t val), (ctx, val))
+TIMED(ListPrintStr,
+      (struct OutputContextList* ctx, const char* val),
+      (ctx, val))
+TIMED(ListPrintDict,
+      (struct OutputContextList* ctx, struct OutputContextDict* dict),
+      (ctx, dict))
+TIMED(ListPrintList,
+      (struct OutputContextList* ctx, struct OutputContextList* list),
+      (ctx, list))
+TIMED(ListEnd, (struct OutputContextList* ctx), (ctx))
+#define OUTPUT_FN(name) Timed##name
+#else
+#define OUTPUT_FN(name) name
+#endif
+
 void OutputContextInitDict(struct OutputContextDict* ctx,
                            FILE* fp,
                            int indent,
@@ -225,34 +273,58 @@ void OutputContextInitDict(struct OutputContextDict* ctx,
   ctx->first = 1;
   ctx->indent = indent;
   ctx->config = config;
-  ctx->put_int = DictPrintInt;
-  ctx->put_uint = DictPrintUint;
-  ctx->put_hex = DictPrintHex;
-  ctx->put_enum = DictPrintEnum;
-  ctx->put_dict = DictPrintDict;
-  ctx->put_list = DictPrintList;
-  ctx->end = DictEnd;
+  ctx->sink = NULL;
+  ctx->put_int = OUTPUT_FN(DictPrintInt);
+  ctx->put_uint = OUTPUT_FN(DictPrintUint);
+  ctx->put_hex = OUTPUT_FN(DictPrintHex);
+  ctx->put_enum = OUTPUT_FN(DictPrintEnum);
+  ctx->put_str = OUTPUT_FN(DictPrintStr);
+  ctx->put_dict = OUTPUT_FN(DictPrintDict);
+  ctx->put_list = OUTPUT_FN(DictPrintList);
+  ctx->end = OUTPUT_FN(DictEnd);
   if (ctx->indent >= 0) {
     fputc('{', ctx->fp);
   }
 }
 
-void OutputContextInitList(struct OutputContextList* ctx,
-                           FILE* fp,
-                           int indent,
-                           struct OutputConfig* config) {
+static void ListInit(struct OutputContextList* ctx,
+                     FILE* fp,
+                     int indent,
+                     struct OutputConfig* config) {
   ctx->fp = fp;
   ctx->first = 1;
   ctx->indent = indent;
   ctx->config = config;
-  ctx->put_int = ListPrintInt;
-  ctx->put_uint = ListPrintUint;
+  ctx->sink = NULL;
+  ctx->put_int = OUTPUT_FN(ListPrintInt);
+  ctx->put_uint = OUTPUT_FN(ListPrintUint);
   // ctx->put_hex = ListPrintHex;
   // ctx->put_enum = ListPrintEnum;
-  ctx->put_dict = ListPrintDict;
-  ctx->put_list = ListPrintList;
-  ctx->end = ListEnd;
+  ctx->put_str = OUTPUT_FN(ListPrintStr);
+  ctx->put_dict = OUTPUT_FN(ListPrintDict);
+  ctx->put_list = OUTPUT_FN(ListPrintList);
+  ctx->end = OUTPUT_FN(ListEnd);
+}
+
+void OutputContextInitList(struct OutputContextList* ctx,
+                           FILE* fp,
+                           int indent,
+                           struct OutputConfig* config) {
+  ListInit(ctx, fp, indent, config);
   if (ctx->indent >= 0) {
     fputc('[', ctx->fp);
   }
 }
+
+void OutputContextContinueList(struct OutputContextList* ctx,
+                               FILE* fp,
+                               int indent,
+                               struct OutputConfig* config,
+                               int empty) {
+  ListInit(ctx, fp, indent, config);
+  ctx->first = empty != 0;
+}
+
+int OutputContextEnabled(const struct OutputContextDict* ctx) {
+  return ctx->indent >= 0;
+}
@@ -38,6 +38,7 @@ struct OutputContextDict {
   uint8_t first;
   FILE* fp;
   struct OutputConfig* config;
+  void* sink;  // state of other backends, NULL for this one
 };
 
 struct OutputContextList {
@@ -53,6 +54,7 @@ struct OutputContextList {
   int first : 1;
   FILE* fp;
   struct OutputConfig* config;
+  void* sink;
 };
 
 void OutputContextInitDict(struct OutputContextDict* ctx,
@@ -63,5 +65,15 @@ void OutputContextInitList(struct OutputContextList* ctx,
                            FILE* fp,
                            int indent,
                            struct OutputConfig* config);
+// Continues a top level list another run wrote the opening bracket and
+// elements of to |fp|; |empty| if there were none.
+void OutputContextContinueList(struct OutputContextList* ctx,
+                               FILE* fp,
+                               int indent,
+                               struct OutputConfig* config,
+                               int empty);
+// 0 for a dict initialized with a negative indent, which discards everything
+// put into it.
+int OutputContextEnabled(const struct OutputContextDict* ctx);
 
 #endif
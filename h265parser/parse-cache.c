@@ -0,0 +1,721 @@
+#include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <utime.h>
+#endif
+#include "parse-cache.h"
+
+static const char kMagic[8] = {'H', '2', '6', '5', 'C', 'A', 'C', 'H'};
+#define PARSE_CACHE_VERSION 1
+// bytes hashed at each end of the input
+#define PARSE_CACHE_SAMPLE (64 * 1024)
+
+enum TapeType {
+  TAPE_UINT = 0,
+  TAPE_INT = 1,
+  TAPE_HEX = 2,
+  TAPE_ENUM = 3,
+  TAPE_STR = 4,
+  TAPE_DICT = 5,
+  TAPE_LIST = 6,
+  TAPE_END = 7
+};
+
+uint64_t ParseCacheHash(uint64_t h, const void* data, size_t size) {
+  const uint8_t* p = (const uint8_t*)data;
+  size_t i;
+  for (i = 0; i < size; i++)
+    h = (h ^ p[i]) * 0x100000001b3ULL;
+  return h;
+}
+
+// Recording
+
+static void Append(struct ParseCache* c, const void* data, size_t size) {
+  if (c->failed)
+    return;
+  if (c->tape_size + size > c->tape_capacity) {
+    uint64_t capacity = c->tape_capacity ? c->tape_capacity : 1 << 16;
+    uint8_t* tape;
+    while (capacity < c->tape_size + size)
+      capacity *= 2;
+    tape = (uint8_t*)realloc(c->tape, (size_t)capacity);
+    if (!tape) {
+      c->failed = 1;
+      return;
+    }
+    c->tape = tape;
+    c->tape_capacity = capacity;
+  }
+  memcpy(c->tape + c->tape_size, data, size);
+  c->tape_size += size;
+}
+
+static void Varint(struct ParseCache* c, uint64_t val) {
+  uint8_t buf[10];
+  size_t n = 0;
+  while (val >= 0x80) {
+    buf[n++] = (uint8_t)(val | 0x80);
+    val >>= 7;
+  }
+  buf[n++] = (uint8_t)val;
+  Append(c, buf, n);
+}
+
+static void String(struct ParseCache* c, const char* s) {
+  size_t n = strlen(s);
+  Varint(c, n);
+  Append(c, s, n + 1);
+}
+
+static uint32_t Key(struct ParseCache* c, const char* key) {
+  // interned by content; index + 1 of the key table
+  uint32_t i = (uint32_t)ParseCacheHash(0xcbf29ce484222325ULL, key,
+                                        strlen(key)) &
+               (PARSE_CACHE_KEY_SLOTS - 1);
+  size_t n;
+  for (;; i = (i + 1) & (PARSE_CACHE_KEY_SLOTS - 1)) {
+    uint32_t k = c->key_slots[i];
+    if (k == 0)
+      break;
+    if (strcmp(c->keys + c->key_offsets[k - 1], key) == 0)
+      return k;
+  }
+  n = strlen(key) + 1;
+  if (c->key_count == PARSE_CACHE_KEY_SLOTS / 2) {
+    c->failed = 1;
+    return 0;
+  }
+  if (c->keys_size + n > c->keys_capacity) {
+    uint64_t capacity = c->keys_capacity ? c->keys_capacity * 2 : 4096;
+    char* keys = (char*)realloc(c->keys, (size_t)(capacity + n));
+    if (!keys) {
+      c->failed = 1;
+      return 0;
+    }
+    c->keys = keys;
+    c->keys_capacity = capacity + n;
+  }
+  if (!c->key_offsets) {
+    c->key_offsets = (uint32_t*)malloc(PARSE_CACHE_KEY_SLOTS / 2 *
+                                       sizeof(uint32_t));
+    if (!c->key_offsets) {
+      c->failed = 1;
+      return 0;
+    }
+  }
+  memcpy(c->keys + c->keys_size, key, n);
+  c->key_offsets[c->key_count] = (uint32_t)c->keys_size;
+  c->keys_size += n;
+  c->key_slots[i] = ++c->key_count;
+  return c->key_count;
+}
+
+static void Tag(struct ParseCache* c, const char* key, enum TapeType type) {
+  Varint(c, (uint64_t)(key ? Key(c, key) : 0) << 3 | type);
+}
+
+static void InitDict(struct OutputContextDict* ctx,
+                     struct ParseCache* c,
+                     int level);
+static void InitList(struct OutputContextList* ctx,
+                     struct ParseCache* c,
+                     int level);
+
+// |ctx->indent| is the nesting level; what is put into it is passed on to
+// c->dicts or c->lists at that level, c->out at level 0.
+
+static struct ParseCache* Cache(void* sink, int level) {
+  struct ParseCache* c = (struct ParseCache*)sink;
+  if (level + 1 >= PARSE_CACHE_MAX_DEPTH)
+    c->failed = 1;
+  return c;
+}
+
+static void DictInt(struct OutputContextDict* ctx,
+                    const char* key,
+                    int64_t val) {
+  struct ParseCache* c = (struct ParseCache*)ctx->sink;
+  struct OutputContextDict* inner = &c->dicts[ctx->indent];
+  inner->put_int(inner, key, val);
+  Tag(c, key, TAPE_INT);
+  Varint(c, ((uint64_t)val << 1) ^ (uint64_t)(val >> 63));
+}
+
+static void DictUint(struct OutputContextDict* ctx,
+                     const char* key,
+                     uint64_t val) {
+  struct ParseCache* c = (struct ParseCache*)ctx->sink;
+  struct OutputContextDict* inner = &c->dicts[ctx->indent];
+  inner->put_uint(inner, key, val);
+  Tag(c, key, TAPE_UINT);
+  Varint(c, val);
+}
+
+static void DictHex(struct OutputContextDict* ctx,
+                    const char* key,
+                    uint64_t val) {
+  struct ParseCache* c = (struct ParseCache*)ctx->sink;
+  struct OutputContextDict* inner = &c->dicts[ctx->indent];
+  inner->put_hex(inner, key, val);
+  Tag(c, key, TAPE_HEX);
+  Varint(c, val);
+}
+
+static void DictEnum(struct OutputContextDict* ctx,
+                     const char* key,
+                     const char* str,
+                     int val) {
+  struct ParseCache* c = (struct ParseCache*)ctx->sink;
+  struct OutputContextDict* inner = &c->dicts[ctx->indent];
+  inner->put_enum(inner, key, str, val);
+  Tag(c, key, TAPE_ENUM);
+  Varint(c, ((uint64_t)(int64_t)val << 1) ^ (uint64_t)((int64_t)val >> 63));
+  String(c, str);
+}
+
+static void DictStr(struct OutputContextDict* ctx,
+                    const char* key,
+                    const char* val) {
+  struct ParseCache* c = (struct ParseCache*)ctx->sink;
+  struct OutputContextDict* inner = &c->dicts[ctx->indent];
+  inner->put_str(inner, key, val);
+  Tag(c, key, TAPE_STR);
+  String(c, val);
+}
+
+static void DictDict(struct OutputContextDict* ctx,
+                     const char* key,
+                     struct OutputContextDict* dict) {
+  struct ParseCache* c = Cache(ctx->sink, ctx->indent);
+  int level = c->failed ? ctx->indent : ctx->indent + 1;
+  struct OutputContextDict* inner = &c->dicts[ctx->indent];
+  inner->put_dict(inner, key, &c->dicts[level]);
+  InitDict(dict, c, level);
+  Tag(c, key, TAPE_DICT);
+}
+
+static void DictList(struct OutputContextDict* ctx,
+                     const char* key,
+                     struct OutputContextList* list) {
+  struct ParseCache* c = Cache(ctx->sink, ctx->indent);
+  int level = c->failed ? ctx->indent : ctx->indent + 1;
+  struct OutputContextDict* inner = &c->dicts[ctx->indent];
+  inner->put_list(inner, key, &c->lists[level]);
+  InitList(list, c, level);
+  Tag(c, key, TAPE_LIST);
+}
+
+static void DictEnd(struct OutputContextDict* ctx) {
+  struct ParseCache* c = (struct ParseCache*)ctx->sink;
+  struct OutputContextDict* inner = &c->dicts[ctx->indent];
+  inner->end(inner);
+  Tag(c, NULL, TAPE_END);
+}
+
+static struct OutputContextList* Inner(struct ParseCache* c, int level) {
+  return level == 0 ? c->out : &c->lists[level];
+}
+
+static void ListInt(struct OutputContextList* ctx, int64_t val) {
+  struct ParseCache* c = (struct ParseCache*)ctx->sink;
+  struct OutputContextList* inner = Inner(c, ctx->indent);
+  inner->put_int(inner, val);
+  Tag(c, NULL, TAPE_INT);
+  Varint(c, ((uint64_t)val << 1) ^ (uint64_t)(val >> 63));
+}
+
+static void ListUint(struct OutputContextList* ctx, uint64_t val) {
+  struct ParseCache* c = (struct ParseCache*)ctx->sink;
+  struct OutputContextList* inner = Inner(c, ctx->indent);
+  inner->put_uint(inner, val);
+  Tag(c, NULL, TAPE_UINT);
+  Varint(c, val);
+}
+
+static void ListStr(struct OutputContextList* ctx, const char* val) {
+  struct ParseCache* c = (struct ParseCache*)ctx->sink;
+  struct OutputContextList* inner = Inner(c, ctx->indent);
+  inner->put_str(inner, val);
+  Tag(c, NULL, TAPE_STR);
+  String(c, val);
+}
+
+static void ListDict(struct OutputContextList* ctx,
+                     struct OutputContextDict* dict) {
+  struct ParseCache* c = Cache(ctx->sink, ctx->indent);
+  int level = c->failed ? ctx->indent : ctx->indent + 1;
+  struct OutputContextList* inner = Inner(c, ctx->indent);
+  inner->put_dict(inner, &c->dicts[level]);
+  InitDict(dict, c, level);
+  Tag(c, NULL, TAPE_DICT);
+}
+
+static void ListList(struct OutputContextList* ctx,
+                     struct OutputContextList* list) {
+  struct ParseCache* c = Cache(ctx->sink, ctx->indent);
+  int level = c->failed ? ctx->indent : ctx->indent + 1;
+  struct OutputContextList* inner = Inner(c, ctx->indent);
+  inner->put_list(inner, &c->lists[level]);
+  InitList(list, c, level);
+  Tag(c, NULL, TAPE_LIST);
+}
+
+static void ListEnd(struct OutputContextList* ctx) {
+  struct ParseCache* c = (struct ParseCache*)ctx->sink;
+  struct OutputContextList* inner = Inner(c, ctx->indent);
+  inner->end(inner);
+  // the top level list isn't recorded
+  if (ctx->indent > 0)
+    Tag(c, NULL, TAPE_END);
+}
+
+static void InitDict(struct OutputContextDict* ctx,
+                     struct ParseCache* c,
+                     int level) {
+  memset(ctx, 0, sizeof(*ctx));
+  ctx->indent = level;
+  ctx->sink = c;
+  ctx->config = c->out->config;
+  ctx->put_int = DictInt;
+  ctx->put_uint = DictUint;
+  ctx->put_hex = DictHex;
+  ctx->put_enum = DictEnum;
+  ctx->put_str = DictStr;
+  ctx->put_dict = DictDict;
+  ctx->put_list = DictList;
+  ctx->end = DictEnd;
+}
+
+static void InitList(struct OutputContextList* ctx,
+                     struct ParseCache* c,
+                     int level) {
+  memset(ctx, 0, sizeof(*ctx));
+  ctx->indent = level;
+  ctx->sink = c;
+  ctx->config = c->out->config;
+  ctx->put_int = ListInt;
+  ctx->put_uint = ListUint;
+  ctx->put_str = ListStr;
+  ctx->put_dict = ListDict;
+  ctx->put_list = ListList;
+  ctx->end = ListEnd;
+}
+
+struct OutputContextList* ParseCacheRecord(struct ParseCache* cache,
+                                           struct OutputContextList* out) {
+  cache->out = out;
+  InitList(cache->list, cache, 0);
+  return cache->list;
+}
+
+void ParseCacheAddNal(struct ParseCache* cache,
+                      const struct NalUnit* nal,
+                      uint8_t nal_unit_type) {
+  struct ParseCacheNal* n;
+  if (cache->failed)
+    return;
+  if (cache->nal_count == cache->nal_capacity) {
+    uint64_t capacity = cache->nal_capacity ? cache->nal_capacity * 2 : 4096;
+    struct ParseCacheNal* nals = (struct ParseCacheNal*)realloc(
+        cache->nals, (size_t)capacity * sizeof(*nals));
+    if (!nals) {
+      cache->failed = 1;
+      return;
+    }
+    cache->nals = nals;
+    cache->nal_capacity = capacity;
+  }
+  n = &cache->nals[cache->nal_count++];
+  memset(n, 0, sizeof(*n));
+  n->offset = nal->offset;
+  n->size = nal->size;
+  n->prefix_bytes = (uint8_t)nal->prefix_bytes;
+  n->nal_unit_type = nal_unit_type;
+}
+
+// Replay
+
+static int ReadVarint(const uint8_t** p, const uint8_t* end, uint64_t* val) {
+  uint32_t shift = 0;
+  *val = 0;
+  while (*p < end && shift < 64) {
+    uint8_t b = *(*p)++;
+    *val |= (uint64_t)(b & 0x7f) << shift;
+    if (!(b & 0x80))
+      return 0;
+    shift += 7;
+  }
+  return -1;
+}
+
+static int ReadString(const uint8_t** p, const uint8_t* end, const char** s) {
+  uint64_t n;
+  if (ReadVarint(p, end, &n) != 0 || n >= (uint64_t)(end - *p) ||
+      (*p)[n] != 0)
+    return -1;
+  *s = (const char*)*p;
+  *p += n + 1;
+  return 0;
+}
+
+static int64_t Unzigzag(uint64_t v) {
+  return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+// Walks the tape, writing it to |out| unless that is NULL.
+static int Walk(const uint8_t* p,
+                const uint8_t* end,
+                const char** keys,
+                uint32_t key_count,
+                struct OutputContextList* out) {
+  struct OutputContextDict dicts[PARSE_CACHE_MAX_DEPTH];
+  struct OutputContextList lists[PARSE_CACHE_MAX_DEPTH];
+  uint8_t in_dict[PARSE_CACHE_MAX_DEPTH];
+  uint32_t depth = 0;
+  in_dict[0] = 0;
+  while (p < end) {
+    struct OutputContextDict* d = &dicts[depth];
+    struct OutputContextList* l = depth ? &lists[depth] : out;
+    uint64_t tag, v;
+    const char *key, *s;
+    uint32_t type;
+    if (ReadVarint(&p, end, &tag) != 0 || (tag >> 3) > key_count)
+      return -1;
+    type = (uint32_t)(tag & 7);
+    key = keys[tag >> 3];
+    // dict members have keys, list items and ends don't
+    if ((key != NULL) != (in_dict[depth] && type != TAPE_END))
+      return -1;
+    switch (type) {
+    case TAPE_UINT:
+    case TAPE_INT:
+    case TAPE_HEX:
+      if (ReadVarint(&p, end, &v) != 0 || (type == TAPE_HEX && !key))
+        return -1;
+      if (!out)
+        break;
+      if (type == TAPE_UINT && key)
+        d->put_uint(d, key, v);
+      else if (type == TAPE_UINT)
+        l->put_uint(l, v);
+      else if (type == TAPE_INT && key)
+        d->put_int(d, key, Unzigzag(v));
+      else if (type == TAPE_INT)
+        l->put_int(l, Unzigzag(v));
+      else
+        d->put_hex(d, key, v);
+      break;
+    case TAPE_ENUM:
+      if (!key || ReadVarint(&p, end, &v) != 0 ||
+          ReadString(&p, end, &s) != 0)
+        return -1;
+      if (out)
+        d->put_enum(d, key, s, (int)Unzigzag(v));
+      break;
+    case TAPE_STR:
+      if (ReadString(&p, end, &s) != 0)
+        return -1;
+      if (out && key)
+        d->put_str(d, key, s);
+      else if (out)
+        l->put_str(l, s);
+      break;
+    case TAPE_DICT:
+    case TAPE_LIST:
+      if (depth + 1 >= PARSE_CACHE_MAX_DEPTH)
+        return -1;
+      depth++;
+      in_dict[depth] = type == TAPE_DICT;
+      if (!out)
+        break;
+      if (type == TAPE_DICT && key)
+        d->put_dict(d, key, &dicts[depth]);
+      else if (type == TAPE_DICT)
+        l->put_dict(l, &dicts[depth]);
+      else if (key)
+        d->put_list(d, key, &lists[depth]);
+      else
+        l->put_list(l, &lists[depth]);
+      break;
+    case TAPE_END:
+      if (depth == 0)
+        return -1;
+      if (out && in_dict[depth])
+        d->end(d);
+      else if (out)
+        l->end(l);
+      depth--;
+      break;
+    }
+  }
+  return depth == 0 ? 0 : -1;
+}
+
+int ParseCacheReplay(struct ParseCache* cache, struct OutputContextList* out) {
+  const struct ParseCacheHeader* h = cache->header;
+  const uint8_t* keys_blob =
+      cache->map + sizeof(*h) + h->nal_count * sizeof(struct ParseCacheNal);
+  const uint8_t* tape = keys_blob + h->keys_size;
+  const char** keys;
+  uint64_t i, k = 1;
+  int ret;
+  keys = (const char**)malloc((h->key_count + 1) * sizeof(*keys));
+  if (!keys)
+    return -1;
+  keys[0] = NULL;
+  for (i = 0; i < h->keys_size && k <= h->key_count; i++) {
+    if (i == 0 || keys_blob[i - 1] == 0)
+      keys[k++] = (const char*)keys_blob + i;
+  }
+  // all of it is checked before anything is written
+  ret = k == h->key_count + 1 &&
+                (h->keys_size == 0 || keys_blob[h->keys_size - 1] == 0)
+            ? Walk(tape, tape + h->tape_size, keys, h->key_count, NULL)
+            : -1;
+  if (ret == 0)
+    ret = Walk(tape, tape + h->tape_size, keys, h->key_count, out);
+  else
+    fprintf(stderr, "%s is damaged\n", cache->path);
+  free(keys);
+  return ret;
+}
+
+void ParseCacheClose(struct ParseCache* cache) {
+#ifndef _WIN32
+  if (cache->map)
+    munmap(cache->map, (size_t)cache->map_size);
+#endif
+  cache->map = NULL;
+  free(cache->tape);
+  free(cache->keys);
+  free(cache->key_offsets);
+  free(cache->nals);
+  cache->tape = NULL;
+  cache->keys = NULL;
+  cache->key_offsets = NULL;
+  cache->nals = NULL;
+}
+
+#ifdef _WIN32
+
+int ParseCacheOpen(struct ParseCache* cache,
+                   const char* dir,
+                   uint64_t size_limit,
+                   FILE* fp,
+                   uint64_t options) {
+  memset(cache, 0, sizeof(*cache));
+  fprintf(stderr, "the parse cache is not supported on Windows\n");
+  return -1;
+}
+
+int ParseCacheLookup(struct ParseCache* cache) {
+  return 0;
+}
+
+int ParseCacheCommit(struct ParseCache* cache, double seconds) {
+  return -1;
+}
+
+#else
+
+int ParseCacheOpen(struct ParseCache* cache,
+                   const char* dir,
+                   uint64_t size_limit,
+                   FILE* fp,
+                   uint64_t options) {
+  struct stat st;
+  uint8_t* sample;
+  uint64_t h = 0xcbf29ce484222325ULL, id;
+  ssize_t n;
+  int fd = fileno(fp);
+  memset(cache, 0, sizeof(*cache));
+  cache->dir = dir;
+  cache->size_limit = size_limit;
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+    return -1;
+  cache->key.device = (uint64_t)st.st_dev;
+  cache->key.inode = (uint64_t)st.st_ino;
+  cache->key.size = (uint64_t)st.st_size;
+  cache->key.mtime_ns =
+      (uint64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+  // an edit that keeps the size and the time shows at either end
+  sample = (uint8_t*)malloc(PARSE_CACHE_SAMPLE);
+  if (!sample)
+    return -1;
+  n = pread(fd, sample, PARSE_CACHE_SAMPLE, 0);
+  if (n > 0)
+    h = ParseCacheHash(h, sample, (size_t)n);
+  if (cache->key.size > PARSE_CACHE_SAMPLE) {
+    n = pread(fd, sample, PARSE_CACHE_SAMPLE,
+              (off_t)(cache->key.size - PARSE_CACHE_SAMPLE));
+    if (n > 0)
+      h = ParseCacheHash(h, sample, (size_t)n);
+  }
+  free(sample);
+  cache->key.content = h;
+  cache->key.options =
+      ParseCacheHash(options, __DATE__ " " __TIME__,
+                     sizeof(__DATE__ " " __TIME__));
+  id = ParseCacheHash(0xcbf29ce484222325ULL, &cache->key.device,
+                      sizeof(cache->key.device));
+  id = ParseCacheHash(id, &cache->key.inode, sizeof(cache->key.inode));
+  id = ParseCacheHash(id, &cache->key.options, sizeof(cache->key.options));
+  snprintf(cache->path, sizeof(cache->path), "%s/%016llx.h265c", dir,
+           (unsigned long long)id);
+  return 0;
+}
+
+int ParseCacheLookup(struct ParseCache* cache) {
+  const struct ParseCacheHeader* h;
+  struct stat st;
+  void* map;
+  int fd = open(cache->path, O_RDONLY);
+  if (fd < 0)
+    return 0;
+  if (fstat(fd, &st) != 0 ||
+      (uint64_t)st.st_size < sizeof(struct ParseCacheHeader)) {
+    close(fd);
+    return 0;
+  }
+  map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return 0;
+  h = (const struct ParseCacheHeader*)map;
+  // a changed input, other options or another build: written again
+  if (memcmp(h->magic, kMagic, sizeof(kMagic)) != 0 ||
+      h->version != PARSE_CACHE_VERSION ||
+      memcmp(&h->key, &cache->key, sizeof(cache->key)) != 0 ||
+      h->nal_count > (uint64_t)st.st_size / sizeof(struct ParseCacheNal) ||
+      h->keys_size > (uint64_t)st.st_size ||
+      h->tape_size > (uint64_t)st.st_size ||
+      sizeof(*h) + h->nal_count * sizeof(struct ParseCacheNal) +
+              h->keys_size + h->tape_size !=
+          (uint64_t)st.st_size) {
+    munmap(map, (size_t)st.st_size);
+    return 0;
+  }
+  cache->map = (uint8_t*)map;
+  cache->map_size = (uint64_t)st.st_size;
+  cache->header = h;
+  // least recently used goes first
+  utime(cache->path, NULL);
+  return 1;
+}
+
+struct CacheFile {
+  char name[256];
+  uint64_t size;
+  int64_t mtime;
+};
+
+static int CompareAge(const void* a, const void* b) {
+  const struct CacheFile* x = (const struct CacheFile*)a;
+  const struct CacheFile* y = (const struct CacheFile*)b;
+  return x->mtime < y->mtime ? -1 : x->mtime > y->mtime;
+}
+
+static void Evict(struct ParseCache* cache) {
+  // removes the least recently used cache files while the directory holds
+  // more than the limit, never the one just written
+  struct CacheFile* files = NULL;
+  uint32_t count = 0, capacity = 0, i;
+  uint64_t total = 0;
+  const char* own = strrchr(cache->path, '/') + 1;
+  struct dirent* e;
+  DIR* d = opendir(cache->dir);
+  if (!d)
+    return;
+  while ((e = readdir(d)) != NULL) {
+    char path[1024];
+    struct stat st;
+    size_t n = strlen(e->d_name);
+    if (n < 6 || n >= sizeof(files->name) ||
+        strcmp(e->d_name + n - 6, ".h265c") != 0)
+      continue;
+    snprintf(path, sizeof(path), "%s/%s", cache->dir, e->d_name);
+    if (stat(path, &st) != 0)
+      continue;
+    if (count == capacity) {
+      struct CacheFile* f;
+      capacity = capacity ? capacity * 2 : 64;
+      f = (struct CacheFile*)realloc(files, capacity * sizeof(*f));
+      if (!f)
+        break;
+      files = f;
+    }
+    strcpy(files[count].name, e->d_name);
+    files[count].size = (uint64_t)st.st_size;
+    files[count].mtime =
+        (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+    total += files[count].size;
+    count++;
+  }
+  closedir(d);
+  qsort(files, count, sizeof(*files), CompareAge);
+  for (i = 0; i < count && total > cache->size_limit; i++) {
+    char path[1024];
+    if (strcmp(files[i].name, own) == 0)
+      continue;
+    snprintf(path, sizeof(path), "%s/%s", cache->dir, files[i].name);
+    if (remove(path) == 0) {
+      total -= files[i].size;
+      cache->evicted++;
+    }
+  }
+  free(files);
+}
+
+int ParseCacheCommit(struct ParseCache* cache, double seconds) {
+  struct ParseCacheHeader header;
+  char tmp[1040];
+  int ok;
+  FILE* fp;
+  if (cache->failed)
+    return -1;
+  if (mkdir(cache->dir, 0777) != 0 && errno != EEXIST) {
+    fprintf(stderr, "couldn't create %s\n", cache->dir);
+    return -1;
+  }
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = PARSE_CACHE_VERSION;
+  header.key_count = cache->key_count;
+  header.key = cache->key;
+  header.nal_count = cache->nal_count;
+  header.keys_size = cache->keys_size;
+  header.tape_size = cache->tape_size;
+  header.parse_us = (uint64_t)(seconds * 1e6);
+  snprintf(tmp, sizeof(tmp), "%s.tmp", cache->path);
+  fp = fopen(tmp, "wb");
+  if (!fp) {
+    fprintf(stderr, "couldn't create %s\n", tmp);
+    return -1;
+  }
+  ok = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+       fwrite(cache->nals, sizeof(*cache->nals), (size_t)cache->nal_count,
+              fp) == cache->nal_count &&
+       fwrite(cache->keys, 1, (size_t)cache->keys_size, fp) ==
+           cache->keys_size &&
+       fwrite(cache->tape, 1, (size_t)cache->tape_size, fp) ==
+           cache->tape_size;
+  if (fclose(fp) != 0)
+    ok = 0;
+  if (!ok || rename(tmp, cache->path) != 0) {
+    fprintf(stderr, "couldn't write %s\n", cache->path);
+    remove(tmp);
+    return -1;
+  }
+  Evict(cache);
+  return 0;
+}
+
+#endif
@@ -0,0 +1,121 @@
+#ifndef PARSE_CACHE_H_
+#define PARSE_CACHE_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include "nal-input.h"
+#include "output-context.h"
+
+// On-disk cache of the output of a run, so that repeating a query on an
+// unchanged file replays it from a mapped cache file instead of reading and
+// parsing the video. One file DIR/XXXXXXXXXXXXXXXX.h265c per input and set of
+// options:
+//
+//   struct ParseCacheHeader
+//   nal_count struct ParseCacheNal   where each NAL unit is in the input
+//   keys_size bytes                  the output keys, NUL terminated
+//   tape_size bytes                  the output
+//
+// The output is recorded as LEB128 varints: a tag, key << 3 | type, where
+// key 0 is a list item and key n the n-th string of the key table, followed
+// for UINT and HEX by the value, for INT by the zigzag coded value, for STR
+// by its length and NUL terminated bytes and for ENUM by the zigzag coded
+// value and the name as for STR. DICT and LIST run up to their END tag; the
+// top level list is not recorded.
+//
+// A cache file is used only if the device, inode, size and modification
+// time of the input, a hash of its first and last 64 KiB, the options and
+// the build all match; otherwise it is written again. Files are written to
+// FILE.tmp and renamed. Hits touch the file, and once the directory exceeds
+// its size limit the least recently used files are removed.
+
+#define PARSE_CACHE_MAX_DEPTH 32
+#define PARSE_CACHE_KEY_SLOTS 4096
+
+struct ParseCacheKey {
+  uint64_t device;
+  uint64_t inode;
+  uint64_t size;
+  uint64_t mtime_ns;
+  uint64_t content;  // FNV-1a of the first and last 64 KiB
+  uint64_t options;  // of the options and the build
+};
+
+struct ParseCacheHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t key_count;
+  struct ParseCacheKey key;
+  uint64_t nal_count;
+  uint64_t keys_size;
+  uint64_t tape_size;
+  uint64_t parse_us;  // how long the run that wrote it took
+};
+
+struct ParseCacheNal {
+  uint64_t offset;  // of the start code or length field
+  uint32_t size;
+  uint8_t prefix_bytes;
+  uint8_t nal_unit_type;
+  uint8_t pad[2];
+};
+
+struct ParseCache {
+  const char* dir;
+  uint64_t size_limit;
+  struct ParseCacheKey key;
+  char path[1024];
+
+  // a hit: the mapped file
+  uint8_t* map;
+  uint64_t map_size;
+  const struct ParseCacheHeader* header;
+
+  // a miss: the output recorded on its way to |out|
+  struct OutputContextList list[1];
+  struct OutputContextList* out;
+  struct OutputContextDict dicts[PARSE_CACHE_MAX_DEPTH];
+  struct OutputContextList lists[PARSE_CACHE_MAX_DEPTH];
+  uint8_t* tape;
+  uint64_t tape_size;
+  uint64_t tape_capacity;
+  char* keys;
+  uint64_t keys_size;
+  uint64_t keys_capacity;
+  uint32_t* key_offsets;
+  uint32_t key_count;
+  uint32_t key_slots[PARSE_CACHE_KEY_SLOTS];  // key index, 0 if free
+  struct ParseCacheNal* nals;
+  uint64_t nal_count;
+  uint64_t nal_capacity;
+  uint8_t failed;  // out of memory or too deep: nothing is written
+  uint64_t evicted;
+};
+
+// Identifies the open input |fp| for the cache in |dir|; |options| hashes
+// the options that change the output. Returns -1 if |fp| isn't a file.
+int ParseCacheOpen(struct ParseCache* cache,
+                   const char* dir,
+                   uint64_t size_limit,
+                   FILE* fp,
+                   uint64_t options);
+// Maps the cache file of the input; returns 1 on a hit, 0 on a miss.
+int ParseCacheLookup(struct ParseCache* cache);
+// A hit: writes the recorded output into |out|. Returns -1 if the file is
+// malformed, before writing anything.
+int ParseCacheReplay(struct ParseCache* cache, struct OutputContextList* out);
+// A miss: returns the list to write to instead of |out|, which records the
+// output and passes it on.
+struct OutputContextList* ParseCacheRecord(struct ParseCache* cache,
+                                           struct OutputContextList* out);
+void ParseCacheAddNal(struct ParseCache* cache,
+                      const struct NalUnit* nal,
+                      uint8_t nal_unit_type);
+// Writes the cache file of a finished run that took |seconds|, then evicts.
+int ParseCacheCommit(struct ParseCache* cache, double seconds);
+void ParseCacheClose(struct ParseCache* cache);
+
+// FNV-1a, for hashing the options
+uint64_t ParseCacheHash(uint64_t h, const void* data, size_t size);
+
+#endif
@@ -0,0 +1,724 @@
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#define NULL_DEVICE "NUL"
+#else
+#define NULL_DEVICE "/dev/null"
+#endif
+#include "bitstream.h"
+#include "bitwriter.h"
+#include "h265parser.h"
+#include "h265-syntax.h"
+#include "nal-input.h"
+#include "output-context.h"
+#include "perf-bench.h"
+#include "perf-counters.h"
+
+#define UE_CODES (1024 * 1024)
+#define MAX_PASSES 1000000
+
+struct PerfNal {
+  uint32_t offset;     // into PerfBench.escaped and PerfBench.rbsp
+  uint32_t size;       // as stored in the input
+  uint32_t rbsp_size;  // after remove_03
+  struct NalUnitHeader header;
+};
+
+struct PerfBench {
+  const char* path;
+  uint8_t* raw;  // the whole input
+  uint32_t raw_size;
+  uint8_t* escaped;  // the NAL units back to back, without start codes
+  uint8_t* rbsp;     // the same after remove_03 of each
+  uint8_t* scratch;
+  uint32_t escaped_size;
+  struct PerfNal* nals;
+  uint32_t nal_count;
+  uint8_t* ue;  // UE_CODES exp-Golomb codes
+  uint32_t ue_size;
+  struct h265_decode_t* dec;
+  struct OutputConfig out_cfg;
+  FILE* sink;         // the null device
+  uint64_t errors;    // parse errors, reset before each sample
+  uint32_t checksum;  // of values read, so the reads are not optimized out
+};
+
+struct PerfCase {
+  const char* name;
+  // One pass over the corpus; returns the items processed and adds the
+  // bytes they took up in the input to |bytes|.
+  uint64_t (*run)(struct PerfBench* pb, uint64_t* bytes);
+  // Called before each pass and not measured, or NULL.
+  void (*prepare)(struct PerfBench* pb);
+};
+
+typedef int (*SyntaxFunction)(struct h265_decode_t* dec,
+                              struct BitStream* bs,
+                              struct OutputContextDict* out);
+typedef int (*DecodeFunction)(struct h265_decode_t* dec, struct BitStream* bs);
+typedef int (*BinaryFunction)(struct h265_decode_t* dec,
+                              struct BitStream* bs,
+                              struct H265SyntaxBin* out);
+
+static uint64_t RunFindStartCode(struct PerfBench* pb, uint64_t* bytes) {
+  uint8_t* p = pb->raw;
+  uint32_t left = pb->raw_size;
+  uint64_t items = 0;
+  while (left > 4) {
+    uint32_t offset = h265_find_next_start_code(p, left);
+    if (!offset)
+      break;
+    p += offset;
+    left -= offset;
+    items++;
+  }
+  *bytes += pb->raw_size;
+  return items;
+}
+
+static void PrepareRemove03(struct PerfBench* pb) {
+  memcpy(pb->scratch, pb->escaped, pb->escaped_size);
+}
+
+static uint64_t RunRemove03(struct PerfBench* pb, uint64_t* bytes) {
+  uint32_t i;
+  for (i = 0; i < pb->nal_count; i++)
+    remove_03(pb->scratch + pb->nals[i].offset, pb->nals[i].size);
+  *bytes += pb->escaped_size;
+  return pb->nal_count;
+}
+
+static uint64_t RunBsGet(struct PerfBench* pb, uint64_t* bytes) {
+  // field widths as they come in the syntax, mostly flags
+  static const uint8_t kWidths[16] = {1, 1, 4, 1, 2, 8, 1, 1,
+                                      3, 1, 16, 1, 5, 1, 32, 6};
+  uint64_t items = 0;
+  uint32_t i, sum = 0;
+  for (i = 0; i < pb->nal_count; i++) {
+    struct BitStream bs;
+    uint32_t n = 0;
+    BsInit(&bs, pb->rbsp + pb->nals[i].offset, pb->nals[i].rbsp_size);
+    while (BsRemain(&bs) >= 32) {
+      sum += BsGet(&bs, kWidths[n++ & 15]);
+      items++;
+    }
+    *bytes += pb->nals[i].rbsp_size;
+  }
+  pb->checksum += sum;
+  return items;
+}
+
+static uint64_t RunBsUe(struct PerfBench* pb, uint64_t* bytes) {
+  struct BitStream bs;
+  uint32_t i, sum = 0;
+  BsInit(&bs, pb->ue, pb->ue_size);
+  for (i = 0; i < UE_CODES; i++)
+    sum += BsUe(&bs);
+  pb->checksum += sum;
+  *bytes += pb->ue_size;
+  return UE_CODES;
+}
+
+static uint64_t RunSyntax(struct PerfBench* pb,
+                          uint64_t* bytes,
+                          int (*match)(enum H265NalType type),
+                          SyntaxFunction fn) {
+  struct OutputContextDict out[1];
+  uint64_t items = 0;
+  uint32_t i;
+  OutputContextInitDict(out, NULL, -1, &pb->out_cfg);
+  for (i = 0; i < pb->nal_count; i++) {
+    struct PerfNal* nal = &pb->nals[i];
+    struct BitStream bs;
+    if (!match(nal->header.nal_unit_type))
+      continue;
+    pb->dec->nal_unit_header = nal->header;
+    BsInit(&bs, pb->rbsp + nal->offset + 2, nal->rbsp_size - 2);
+    if (fn(pb->dec, &bs, out) != 0)
+      pb->errors++;
+    *bytes += nal->size;
+    items++;
+  }
+  return items;
+}
+
+// The same for the *_decode and *_binary variants of h265-syntax.h.
+static uint64_t RunDecode(struct PerfBench* pb,
+                          uint64_t* bytes,
+                          int (*match)(enum H265NalType type),
+                          DecodeFunction fn) {
+  uint64_t items = 0;
+  uint32_t i;
+  for (i = 0; i < pb->nal_count; i++) {
+    struct PerfNal* nal = &pb->nals[i];
+    struct BitStream bs;
+    if (!match(nal->header.nal_unit_type))
+      continue;
+    pb->dec->nal_unit_header = nal->header;
+    BsInit(&bs, pb->rbsp + nal->offset + 2, nal->rbsp_size - 2);
+    if (fn(pb->dec, &bs) != 0)
+      pb->errors++;
+    *bytes += nal->size;
+    items++;
+  }
+  return items;
+}
+
+static uint64_t RunBinary(struct PerfBench* pb,
+                          uint64_t* bytes,
+                          int (*match)(enum H265NalType type),
+                          BinaryFunction fn) {
+  uint8_t buf[16384];
+  uint64_t items = 0;
+  uint32_t i;
+  for (i = 0; i < pb->nal_count; i++) {
+    struct PerfNal* nal = &pb->nals[i];
+    struct BitStream bs;
+    struct H265SyntaxBin bin;
+    if (!match(nal->header.nal_unit_type))
+      continue;
+    pb->dec->nal_unit_header = nal->header;
+    BsInit(&bs, pb->rbsp + nal->offset + 2, nal->rbsp_size - 2);
+    H265SyntaxBinInit(&bin, buf, sizeof(buf));
+    if (fn(pb->dec, &bs, &bin) != 0 || bin.overflow)
+      pb->errors++;
+    pb->checksum += (uint32_t)bin.pos;
+    *bytes += nal->size;
+    items++;
+  }
+  return items;
+}
+
+static int IsVps(enum H265NalType type) {
+  return type == H265_NAL_TYPE_VPS_NUT;
+}
+
+static int IsSps(enum H265NalType type) {
+  return type == H265_NAL_TYPE_SPS_NUT;
+}
+
+static int IsPps(enum H265NalType type) {
+  return type == H265_NAL_TYPE_PPS_NUT;
+}
+
+static int IsSei(enum H265NalType type) {
+  return type == H265_NAL_TYPE_PREFIX_SEI_NUT ||
+         type == H265_NAL_TYPE_SUFFIX_SEI_NUT;
+}
+
+static int IsSlice(enum H265NalType type) {
+  // the types h265_parse_nal parses a slice segment header for
+  return type <= H265_NAL_TYPE_RASL_R ||
+         (type >= H265_NAL_TYPE_BLA_W_LP && type <= H265_NAL_TYPE_CRA_NUT);
+}
+
+static uint64_t RunNalUnitHeader(struct PerfBench* pb, uint64_t* bytes) {
+  struct OutputContextDict out[1];
+  uint32_t i;
+  OutputContextInitDict(out, NULL, -1, &pb->out_cfg);
+  for (i = 0; i < pb->nal_count; i++) {
+    struct BitStream bs;
+    BsInit(&bs, pb->rbsp + pb->nals[i].offset, pb->nals[i].rbsp_size);
+    if (h265_nal_unit_header(pb->dec, &bs, out) != 0)
+      pb->errors++;
+    *bytes += pb->nals[i].size;
+  }
+  return pb->nal_count;
+}
+
+static uint64_t RunVps(struct PerfBench* pb, uint64_t* bytes) {
+  return RunSyntax(pb, bytes, IsVps, h265_video_parameter_set);
+}
+
+static uint64_t RunSps(struct PerfBench* pb, uint64_t* bytes) {
+  return RunSyntax(pb, bytes, IsSps, h265_seq_parameter_set);
+}
+
+static uint64_t RunPps(struct PerfBench* pb, uint64_t* bytes) {
+  return RunSyntax(pb, bytes, IsPps, h265_pic_parameter_set);
+}
+
+static uint64_t RunVpsDecode(struct PerfBench* pb, uint64_t* bytes) {
+  return RunDecode(pb, bytes, IsVps, h265_video_parameter_set_decode);
+}
+
+static uint64_t RunSpsDecode(struct PerfBench* pb, uint64_t* bytes) {
+  return RunDecode(pb, bytes, IsSps, h265_seq_parameter_set_decode);
+}
+
+static uint64_t RunPpsDecode(struct PerfBench* pb, uint64_t* bytes) {
+  return RunDecode(pb, bytes, IsPps, h265_pic_parameter_set_decode);
+}
+
+static uint64_t RunVpsBinary(struct PerfBench* pb, uint64_t* bytes) {
+  return RunBinary(pb, bytes, IsVps, h265_video_parameter_set_binary);
+}
+
+static uint64_t RunSpsBinary(struct PerfBench* pb, uint64_t* bytes) {
+  return RunBinary(pb, bytes, IsSps, h265_seq_parameter_set_binary);
+}
+
+static uint64_t RunPpsBinary(struct PerfBench* pb, uint64_t* bytes) {
+  return RunBinary(pb, bytes, IsPps, h265_pic_parameter_set_binary);
+}
+
+static uint64_t RunSei(struct PerfBench* pb, uint64_t* bytes) {
+  return RunSyntax(pb, bytes, IsSei, h265_sei_rbsp);
+}
+
+static uint64_t RunSliceHeader(struct PerfBench* pb, uint64_t* bytes) {
+  return RunSyntax(pb, bytes, IsSlice, h265_slice_segment_header);
+}
+
+// h265_parse_nal over the unescaped NAL units; |indent| < 0 disables output.
+static uint64_t RunParse(struct PerfBench* pb, uint64_t* bytes, int indent) {
+  struct OutputContextList out_list[1];
+  uint32_t i;
+  if (indent >= 0)
+    OutputContextInitList(out_list, pb->sink, indent, &pb->out_cfg);
+  for (i = 0; i < pb->nal_count; i++) {
+    struct PerfNal* nal = &pb->nals[i];
+    struct OutputContextDict out_dict[1];
+    struct BitStream bs;
+    if (indent >= 0) {
+      out_list->put_dict(out_list, out_dict);
+      out_dict->put_uint(out_dict, "nal_length", nal->rbsp_size);
+    } else {
+      OutputContextInitDict(out_dict, NULL, -1, &pb->out_cfg);
+    }
+    BsInit(&bs, pb->rbsp + nal->offset, nal->rbsp_size);
+    if (h265_parse_nal(pb->dec, &bs, out_dict) != 0)
+      pb->errors++;
+    out_dict->end(out_dict);
+    *bytes += nal->size;
+  }
+  if (indent >= 0) {
+    out_list->end(out_list);
+    fflush(pb->sink);
+  }
+  return pb->nal_count;
+}
+
+static uint64_t RunParseNal(struct PerfBench* pb, uint64_t* bytes) {
+  return RunParse(pb, bytes, -1);
+}
+
+static uint64_t RunOutputJson(struct PerfBench* pb, uint64_t* bytes) {
+  return RunParse(pb, bytes, 1);
+}
+
+static uint64_t RunOutputCompact(struct PerfBench* pb, uint64_t* bytes) {
+  return RunParse(pb, bytes, 0);
+}
+
+// Reading, unescaping and parsing the file as the command line tool does.
+static uint64_t RunFile(struct PerfBench* pb, uint64_t* bytes, int indent) {
+  struct NalInput input;
+  struct NalUnit nal;
+  struct OutputContextList out_list[1];
+  uint64_t items = 0;
+  FILE* fp = fopen(pb->path, "rb");
+  if (!fp || NalInputOpenAnnexB(&input, fp) != 0) {
+    if (fp)
+      fclose(fp);
+    pb->errors++;
+    return 0;
+  }
+  memset(pb->dec, 0, sizeof(*pb->dec));
+  if (indent >= 0)
+    OutputContextInitList(out_list, pb->sink, indent, &pb->out_cfg);
+  while (input.next(&input, &nal) > 0) {
+    struct OutputContextDict out_dict[1];
+    struct BitStream bs;
+    uint32_t nal_len = remove_03(nal.data, nal.size);
+    if (indent >= 0) {
+      out_list->put_dict(out_list, out_dict);
+      out_dict->put_uint(out_dict, "nal_length", nal_len);
+    } else {
+      OutputContextInitDict(out_dict, NULL, -1, &pb->out_cfg);
+    }
+    BsInit(&bs, nal.data, nal_len);
+    if (h265_parse_nal(pb->dec, &bs, out_dict) != 0)
+      pb->errors++;
+    out_dict->end(out_dict);
+    *bytes += nal.prefix_bytes + nal.size;
+    items++;
+  }
+  if (indent >= 0) {
+    out_list->end(out_list);
+    fflush(pb->sink);
+  }
+  NalInputClose(&input);
+  fclose(fp);
+  return items;
+}
+
+static uint64_t RunEndToEnd(struct PerfBench* pb, uint64_t* bytes) {
+  return RunFile(pb, bytes, -1);
+}
+
+static uint64_t RunEndToEndJson(struct PerfBench* pb, uint64_t* bytes) {
+  return RunFile(pb, bytes, 1);
+}
+
+static const struct PerfCase kCases[] = {
+    {"find_start_code", RunFindStartCode, NULL},
+    {"remove_03", RunRemove03, PrepareRemove03},
+    {"bs_get", RunBsGet, NULL},
+    {"bs_ue", RunBsUe, NULL},
+    {"nal_unit_header", RunNalUnitHeader, NULL},
+    {"video_parameter_set", RunVps, NULL},
+    {"seq_parameter_set", RunSps, NULL},
+    {"pic_parameter_set", RunPps, NULL},
+    {"video_parameter_set_decode", RunVpsDecode, NULL},
+    {"seq_parameter_set_decode", RunSpsDecode, NULL},
+    {"pic_parameter_set_decode", RunPpsDecode, NULL},
+    {"video_parameter_set_binary", RunVpsBinary, NULL},
+    {"seq_parameter_set_binary", RunSpsBinary, NULL},
+    {"pic_parameter_set_binary", RunPpsBinary, NULL},
+    {"sei_rbsp", RunSei, NULL},
+    {"slice_segment_header", RunSliceHeader, NULL},
+    {"parse_nal", RunParseNal, NULL},
+    {"output_json", RunOutputJson, NULL},
+    {"output_compact", RunOutputCompact, NULL},
+    {"end_to_end", RunEndToEnd, NULL},
+    {"end_to_end_json", RunEndToEndJson, NULL},
+};
+
+static int Load(struct PerfBench* pb) {
+  struct NalInput input;
+  struct NalUnit nal;
+  struct BitWriter bw;
+  uint32_t capacity = 0, i;
+  long size;
+  int ret;
+  FILE* fp = fopen(pb->path, "rb");
+  if (!fp) {
+    fprintf(stderr, "couldn't open %s\n", pb->path);
+    return -1;
+  }
+  fseek(fp, 0, SEEK_END);
+  size = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+  if (size <= 0 || size > PERF_BENCH_MAX_CORPUS) {
+    fprintf(stderr, "%s: corpus must be 1 to %u bytes\n", pb->path,
+            PERF_BENCH_MAX_CORPUS);
+    fclose(fp);
+    return -1;
+  }
+  pb->raw_size = (uint32_t)size;
+  pb->raw = (uint8_t*)malloc(pb->raw_size);
+  pb->escaped = (uint8_t*)malloc(pb->raw_size);
+  pb->rbsp = (uint8_t*)malloc(pb->raw_size);
+  pb->scratch = (uint8_t*)malloc(pb->raw_size);
+  if (!pb->raw || !pb->escaped || !pb->rbsp || !pb->scratch ||
+      fread(pb->raw, 1, pb->raw_size, fp) != pb->raw_size) {
+    fprintf(stderr, "couldn't read %s\n", pb->path);
+    fclose(fp);
+    return -1;
+  }
+  fseek(fp, 0, SEEK_SET);
+  ret = NalInputOpenAnnexB(&input, fp);
+  while (ret == 0 && (ret = input.next(&input, &nal)) > 0) {
+    struct PerfNal* p;
+    struct BitStream bs;
+    struct OutputContextDict out[1];
+    ret = 0;
+    if (nal.size < 2)
+      continue;
+    if (pb->nal_count == capacity) {
+      capacity = capacity ? capacity * 2 : 1024;
+      p = (struct PerfNal*)realloc(pb->nals, capacity * sizeof(*p));
+      if (!p) {
+        ret = -1;
+        break;
+      }
+      pb->nals = p;
+    }
+    p = &pb->nals[pb->nal_count++];
+    p->offset = pb->escaped_size;
+    p->size = nal.size;
+    memcpy(pb->escaped + p->offset, nal.data, nal.size);
+    memcpy(pb->rbsp + p->offset, nal.data, nal.size);
+    p->rbsp_size = remove_03(pb->rbsp + p->offset, nal.size);
+    pb->escaped_size += nal.size;
+    OutputContextInitDict(out, NULL, -1, &pb->out_cfg);
+    BsInit(&bs, pb->rbsp + p->offset, p->rbsp_size);
+    h265_nal_unit_header(pb->dec, &bs, out);
+    p->header = pb->dec->nal_unit_header;
+  }
+  NalInputClose(&input);
+  fclose(fp);
+  if (ret < 0 || !pb->nal_count) {
+    fprintf(stderr, "%s: no NAL units\n", pb->path);
+    return -1;
+  }
+
+  // values as the syntax has them: mostly 0 to a few, now and then larger
+  pb->ue_size = UE_CODES * 8;
+  pb->ue = (uint8_t*)malloc(pb->ue_size);
+  if (!pb->ue)
+    return -1;
+  BsWriterInit(&bw, pb->ue, pb->ue_size);
+  for (i = 0; i < UE_CODES; i++)
+    BsPutUe(&bw, (i & 7) ? i % 5 : i % 1000);
+  BsPutTrailingBits(&bw);
+  pb->ue_size = BsBytes(&bw);
+
+  // parameter sets in place for the syntax cases
+  memset(pb->dec, 0, sizeof(*pb->dec));
+  {
+    uint64_t bytes = 0;
+    RunParseNal(pb, &bytes);
+  }
+  return 0;
+}
+
+static void Free(struct PerfBench* pb) {
+  free(pb->raw);
+  free(pb->escaped);
+  free(pb->rbsp);
+  free(pb->scratch);
+  free(pb->nals);
+  free(pb->ue);
+  free(pb->dec);
+  if (pb->sink)
+    fclose(pb->sink);
+}
+
+// Runs |passes| passes as one sample.
+static uint64_t Sample(struct PerfBench* pb,
+                       const struct PerfCase* c,
+                       struct PerfCounters* pc,
+                       uint32_t passes,
+                       uint64_t* bytes,
+                       struct PerfSample* sample) {
+  uint64_t items = 0;
+  uint32_t pass, i;
+  *bytes = 0;
+  pb->errors = 0;
+  if (!c->prepare) {
+    PerfStart(pc);
+    for (pass = 0; pass < passes; pass++)
+      items += c->run(pb, bytes);
+    PerfStop(pc, sample);
+    return items;
+  }
+  memset(sample, 0, sizeof(*sample));
+  for (pass = 0; pass < passes; pass++) {
+    struct PerfSample s;
+    c->prepare(pb);
+    PerfStart(pc);
+    items += c->run(pb, bytes);
+    PerfStop(pc, &s);
+    sample->seconds += s.seconds;
+    for (i = 0; i < PERF_COUNTERS; i++)
+      sample->value[i] += s.value[i];
+  }
+  return items;
+}
+
+static int Better(const struct PerfCounters* pc,
+                  const struct PerfSample* a,
+                  const struct PerfSample* b) {
+  if (pc->fd[PERF_CYCLES] >= 0)
+    return a->value[PERF_CYCLES] < b->value[PERF_CYCLES];
+  return a->seconds < b->seconds;
+}
+
+static void Report(FILE* out,
+                   const struct PerfCase* c,
+                   const struct PerfCounters* pc,
+                   uint32_t passes,
+                   uint64_t items,
+                   uint64_t bytes,
+                   uint64_t errors,
+                   const struct PerfSample* best) {
+  double seconds = best->seconds / passes;
+  uint32_t i;
+  items /= passes;
+  bytes /= passes;
+  fprintf(out,
+          "{\"case\":\"%s\",\"passes\":%u,\"items\":%llu,\"bytes\":%llu,"
+          "\"errors\":%llu,\"seconds\":%.9f,\"ns_per_item\":%.2f,"
+          "\"mb_per_s\":%.1f",
+          c->name, passes, (unsigned long long)items,
+          (unsigned long long)bytes, (unsigned long long)(errors / passes),
+          seconds, items ? seconds * 1e9 / items : 0.0,
+          seconds > 0 ? bytes / seconds / 1e6 : 0.0);
+  for (i = 0; i < PERF_COUNTERS; i++) {
+    if (pc->fd[i] >= 0) {
+      fprintf(out, ",\"%s\":%llu", kPerfCounterNames[i],
+              (unsigned long long)(best->value[i] / passes));
+    } else {
+      fprintf(out, ",\"%s\":null", kPerfCounterNames[i]);
+    }
+  }
+  fprintf(out, "}\n");
+  fflush(out);
+}
+
+int PerfBenchRun(const struct PerfBenchConfig* cfg, FILE* out) {
+  struct PerfBench pb;
+  struct PerfCounters pc;
+  const char* name;
+  uint32_t i, s;
+  memset(&pb, 0, sizeof(pb));
+  pb.path = cfg->corpus;
+  pb.out_cfg.print_hex = 1;
+  pb.out_cfg.explain_enum = 1;
+  pb.dec = (struct h265_decode_t*)malloc(sizeof(*pb.dec));
+  pb.sink = fopen(NULL_DEVICE, "w");
+  if (!pb.dec || !pb.sink || Load(&pb) != 0) {
+    Free(&pb);
+    return -1;
+  }
+  PerfOpen(&pc);
+  name = strrchr(cfg->corpus, '/');
+  name = name ? name + 1 : cfg->corpus;
+  fprintf(out,
+          "{\"corpus\":\"%s\",\"bytes\":%u,\"nal_units\":%u,"
+          "\"counters\":\"%s\",\"samples\":%u}\n",
+          name, pb.raw_size, pb.nal_count,
+          pc.available ? "perf_event" : "wall-clock", cfg->samples);
+
+  for (i = 0; i < sizeof(kCases) / sizeof(kCases[0]); i++) {
+    const struct PerfCase* c = &kCases[i];
+    struct PerfSample best, sample;
+    uint64_t items, bytes, errors;
+    uint32_t passes = 1;
+    // calibration: more passes until a sample takes |min_seconds|; the
+    // first, cold pass alone would underestimate them
+    for (;;) {
+      double n;
+      items = Sample(&pb, c, &pc, passes, &bytes, &sample);
+      if (!items || sample.seconds >= cfg->min_seconds ||
+          passes == MAX_PASSES)
+        break;
+      n = sample.seconds > 0
+              ? passes * cfg->min_seconds / sample.seconds * 1.2
+              : passes * 10.0;
+      if (n < passes * 2.0)
+        n = passes * 2.0;
+      passes = n < MAX_PASSES ? (uint32_t)n : MAX_PASSES;
+    }
+    if (!items)
+      continue;  // nothing of this kind in the corpus
+    memset(&best, 0, sizeof(best));
+    errors = 0;
+    for (s = 0; s < cfg->samples; s++) {
+      items = Sample(&pb, c, &pc, passes, &bytes, &sample);
+      errors = pb.errors;
+      if (s == 0 || Better(&pc, &sample, &best))
+        best = sample;
+    }
+    Report(out, c, &pc, passes, items, bytes, errors, &best);
+  }
+
+  PerfClose(&pc);
+  Free(&pb);
+  return 0;
+}
+
+// Returns 1 and the value of |key| on a line of PerfBenchRun output, or 0 if
+// it is absent or null.
+static int FindNumber(const char* line, const char* key, double* value) {
+  char pattern[64];
+  const char* p;
+  char* end;
+  snprintf(pattern, sizeof(pattern), "\"%s\":", key);
+  p = strstr(line, pattern);
+  if (!p)
+    return 0;
+  p += strlen(pattern);
+  *value = strtod(p, &end);
+  return end != p;
+}
+
+static int FindString(const char* line,
+                      const char* key,
+                      char* value,
+                      size_t size) {
+  char pattern[64];
+  const char* p;
+  size_t n;
+  snprintf(pattern, sizeof(pattern), "\"%s\":\"", key);
+  p = strstr(line, pattern);
+  if (!p)
+    return 0;
+  p += strlen(pattern);
+  n = strcspn(p, "\"");
+  if (n >= size)
+    n = size - 1;
+  memcpy(value, p, n);
+  value[n] = 0;
+  return 1;
+}
+
+// Finds the line of case |name| in |fp|, from the start.
+static int FindCase(FILE* fp, const char* name, char* line, size_t size) {
+  char c[64];
+  rewind(fp);
+  while (fgets(line, (int)size, fp)) {
+    if (FindString(line, "case", c, sizeof(c)) && strcmp(c, name) == 0)
+      return 1;
+  }
+  return 0;
+}
+
+int PerfBenchCompare(const char* base,
+                     const char* current,
+                     double threshold,
+                     FILE* out) {
+  FILE* fb = fopen(base, "r");
+  FILE* fc = fopen(current, "r");
+  char line[1024], base_line[1024], name[64];
+  double base_bytes = 0, bytes = 0;
+  uint32_t regressions = 0;
+  if (!fb || !fc) {
+    fprintf(stderr, "couldn't open %s\n", fb ? current : base);
+    if (fb)
+      fclose(fb);
+    if (fc)
+      fclose(fc);
+    return -1;
+  }
+  // the header lines carry the corpus size
+  if (fgets(line, sizeof(line), fb))
+    FindNumber(line, "bytes", &base_bytes);
+  if (fgets(line, sizeof(line), fc))
+    FindNumber(line, "bytes", &bytes);
+  if (base_bytes != bytes)
+    fprintf(out, "warning: the corpora differ in size\n");
+  fprintf(out, "%-22s %8s %14s %14s %8s\n", "case", "metric", "base",
+          "current", "change");
+  while (fgets(line, sizeof(line), fc)) {
+    const char* metric = "cycles";
+    double b, c, change;
+    if (!FindString(line, "case", name, sizeof(name)))
+      continue;
+    if (!FindCase(fb, name, base_line, sizeof(base_line))) {
+      fprintf(out, "%-22s %8s %14s %14s %8s\n", name, "", "-", "-", "new");
+      continue;
+    }
+    if (!FindNumber(base_line, metric, &b) || !FindNumber(line, metric, &c)) {
+      metric = "seconds";
+      if (!FindNumber(base_line, metric, &b) ||
+          !FindNumber(line, metric, &c))
+        continue;
+    }
+    change = b > 0 ? (c - b) / b * 100 : 0;
+    fprintf(out, "%-22s %8s %14.9g %14.9g %+7.1f%%%s\n", name, metric, b, c,
+            change,
+            change > threshold ? "  REGRESSION"
+                               : change < -threshold ? "  improved" : "");
+    if (change > threshold)
+      regressions++;
+  }
+  fclose(fb);
+  fclose(fc);
+  if (regressions)
+    fprintf(out, "%u regression%s over %.1f%%\n", regressions,
+            regressions == 1 ? "" : "s", threshold);
+  return regressions ? 1 : 0;
+}
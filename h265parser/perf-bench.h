@@ -0,0 +1,40 @@
+#ifndef PERF_BENCH_H_
+#define PERF_BENCH_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+// Micro-benchmarks of the parse stages on one Annex B corpus held in memory:
+// start code search, remove_03, BsGet/BsUe, each syntax structure, the
+// output backends and the whole pipeline from the file. Writes a header line
+// and then one JSON object per line and case to |out|:
+//
+//   {"corpus":"...","bytes":N,"nal_units":N,"counters":"perf_event",...}
+//   {"case":"remove_03","passes":N,"items":N,"bytes":N,"errors":N,
+//    "seconds":S,"ns_per_item":X,"mb_per_s":Y,"cycles":N,"instructions":N,
+//    "branch_misses":N,"l1d_misses":N,"llc_misses":N}
+//
+// Times and counters are per pass over the corpus, from the best sample
+// (fewest cycles, or shortest time without counters). Counters the machine
+// does not provide are null. Such output saved as a baseline can later be
+// compared with PerfBenchCompare.
+
+#define PERF_BENCH_MAX_CORPUS (1024 * 1024 * 1024)
+
+struct PerfBenchConfig {
+  const char* corpus;   // Annex B file
+  uint32_t samples;     // per case, the best counts
+  double min_seconds;   // passes are repeated until a sample takes this long
+};
+
+int PerfBenchRun(const struct PerfBenchConfig* cfg, FILE* out);
+// Prints the cases of |current| next to those of |base|, both PerfBenchRun
+// output, comparing cycles where both have them and time otherwise. Returns
+// 1 if a case got slower by more than |threshold| percent, 0 if none did and
+// -1 on error.
+int PerfBenchCompare(const char* base,
+                     const char* current,
+                     double threshold,
+                     FILE* out);
+
+#endif
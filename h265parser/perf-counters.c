@@ -0,0 +1,120 @@
+#include <string.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#include "perf-counters.h"
+
+const char* kPerfCounterNames[PERF_COUNTERS] = {
+    "cycles", "instructions", "branch_misses", "l1d_misses", "llc_misses"};
+
+double PerfNow(void) {
+#ifdef _WIN32
+  LARGE_INTEGER count, frequency;
+  QueryPerformanceCounter(&count);
+  QueryPerformanceFrequency(&frequency);
+  return (double)count.QuadPart / frequency.QuadPart;
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+#endif
+}
+
+#ifdef __linux__
+static int OpenEvent(uint32_t type, uint64_t config) {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = type;
+  attr.config = config;
+  attr.disabled = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  // counters are multiplexed when there are more than the PMU has
+  attr.read_format =
+      PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+  return (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static uint64_t CacheMiss(uint64_t cache) {
+  return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+         (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+}
+#endif
+
+void PerfOpen(struct PerfCounters* pc) {
+  uint32_t i;
+  memset(pc, 0, sizeof(*pc));
+  for (i = 0; i < PERF_COUNTERS; i++)
+    pc->fd[i] = -1;
+#ifdef __linux__
+  pc->fd[PERF_CYCLES] =
+      OpenEvent(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+  pc->fd[PERF_INSTRUCTIONS] =
+      OpenEvent(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+  pc->fd[PERF_BRANCH_MISSES] =
+      OpenEvent(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+  pc->fd[PERF_L1D_MISSES] =
+      OpenEvent(PERF_TYPE_HW_CACHE, CacheMiss(PERF_COUNT_HW_CACHE_L1D));
+  pc->fd[PERF_LLC_MISSES] =
+      OpenEvent(PERF_TYPE_HW_CACHE, CacheMiss(PERF_COUNT_HW_CACHE_LL));
+  for (i = 0; i < PERF_COUNTERS; i++) {
+    if (pc->fd[i] >= 0)
+      pc->available = 1;
+  }
+#endif
+}
+
+void PerfStart(struct PerfCounters* pc) {
+#ifdef __linux__
+  uint32_t i;
+  for (i = 0; i < PERF_COUNTERS; i++) {
+    if (pc->fd[i] >= 0) {
+      ioctl(pc->fd[i], PERF_EVENT_IOC_RESET, 0);
+      ioctl(pc->fd[i], PERF_EVENT_IOC_ENABLE, 0);
+    }
+  }
+#endif
+  pc->start = PerfNow();
+}
+
+void PerfStop(struct PerfCounters* pc, struct PerfSample* sample) {
+  uint32_t i;
+  double now = PerfNow();
+  memset(sample, 0, sizeof(*sample));
+#ifdef __linux__
+  for (i = 0; i < PERF_COUNTERS; i++) {
+    if (pc->fd[i] >= 0)
+      ioctl(pc->fd[i], PERF_EVENT_IOC_DISABLE, 0);
+  }
+  for (i = 0; i < PERF_COUNTERS; i++) {
+    uint64_t v[3];  // value, time enabled, time running
+    if (pc->fd[i] < 0 || read(pc->fd[i], v, sizeof(v)) != sizeof(v))
+      continue;
+    sample->value[i] =
+        v[2] && v[2] < v[1] ? (uint64_t)((double)v[0] * v[1] / v[2]) : v[0];
+  }
+#else
+  (void)i;
+#endif
+  sample->seconds = now - pc->start;
+}
+
+void PerfClose(struct PerfCounters* pc) {
+#ifdef __linux__
+  uint32_t i;
+  for (i = 0; i < PERF_COUNTERS; i++) {
+    if (pc->fd[i] >= 0)
+      close(pc->fd[i]);
+    pc->fd[i] = -1;
+  }
+#endif
+}
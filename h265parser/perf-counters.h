@@ -0,0 +1,38 @@
+#ifndef PERF_COUNTERS_H_
+#define PERF_COUNTERS_H_
+
+#include <stdint.h>
+
+// Hardware event counters of the calling thread through perf_event_open on
+// Linux. Counters the kernel or the (virtual) CPU does not provide are left
+// out; without any, only wall-clock time is measured.
+
+enum PerfCounter {
+  PERF_CYCLES = 0,
+  PERF_INSTRUCTIONS = 1,
+  PERF_BRANCH_MISSES = 2,
+  PERF_L1D_MISSES = 3,  // L1 data cache read misses
+  PERF_LLC_MISSES = 4,  // last level cache read misses
+  PERF_COUNTERS = 5
+};
+
+extern const char* kPerfCounterNames[PERF_COUNTERS];
+
+struct PerfSample {
+  double seconds;
+  uint64_t value[PERF_COUNTERS];  // valid where PerfCounters.fd >= 0
+};
+
+struct PerfCounters {
+  int fd[PERF_COUNTERS];
+  uint8_t available;  // at least one counter opened
+  double start;
+};
+
+void PerfOpen(struct PerfCounters* pc);
+void PerfStart(struct PerfCounters* pc);
+void PerfStop(struct PerfCounters* pc, struct PerfSample* sample);
+void PerfClose(struct PerfCounters* pc);
+double PerfNow(void);
+
+#endif
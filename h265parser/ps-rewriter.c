@@ -0,0 +1,621 @@
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <io.h>
+#define open _open
+#define close _close
+#define fstat _fstat64
+#define stat _stat64
+#else
+#include <unistd.h>
+#define O_BINARY 0
+#endif
+#include "ps-rewriter.h"
+#include "bitstream.h"
+#include "bitwriter.h"
+#include "file-copy.h"
+#include "h265const.h"
+#include "output-context.h"
+
+// The presence flags of the VUI, each covering the values of its group
+enum VuiGroup {
+  GROUP_NONE,
+  GROUP_ASPECT,
+  GROUP_OVERSCAN,
+  GROUP_SIGNAL,
+  GROUP_COLOUR,
+  GROUP_CHROMA_LOC,
+  GROUP_WINDOW,
+  GROUP_TIMING,
+  GROUP_POC,
+  GROUP_RESTRICTION,
+  GROUP_COUNT
+};
+
+#define VUI_OFFSET(m) offsetof(struct H265VuiParameters, m)
+
+static const struct {
+  size_t flag;
+  uint8_t parent;
+} kGroups[GROUP_COUNT] = {
+    {0, GROUP_NONE},
+    {VUI_OFFSET(aspect_ratio_info_present_flag), GROUP_NONE},
+    {VUI_OFFSET(overscan_info_present_flag), GROUP_NONE},
+    {VUI_OFFSET(video_signal_type_present_flag), GROUP_NONE},
+    {VUI_OFFSET(colour_description_present_flag), GROUP_SIGNAL},
+    {VUI_OFFSET(chroma_loc_info_present_flag), GROUP_NONE},
+    {VUI_OFFSET(default_display_window_flag), GROUP_NONE},
+    {VUI_OFFSET(vui_timing_info_present_flag), GROUP_NONE},
+    {VUI_OFFSET(vui_poc_proportional_to_timing_flag), GROUP_TIMING},
+    {VUI_OFFSET(bitstream_restriction_flag), GROUP_NONE},
+};
+
+struct VuiField {
+  const char* name;
+  size_t offset;
+  uint8_t size;
+  uint8_t bits;   // 0: ue(v)
+  uint8_t group;  // the group it is in, or the flag of
+  uint8_t is_flag;
+};
+
+#define VUI_FIELD(m, bits, group, is_flag)                                \
+  {#m, VUI_OFFSET(m), sizeof(((struct H265VuiParameters*)0)->m), bits, \
+   group, is_flag}
+#define VUI_VALUE(m, bits, group) VUI_FIELD(m, bits, group, 0)
+#define VUI_FLAG(m, group) VUI_FIELD(m, 1, group, 1)
+
+static const struct VuiField kFields[] = {
+    VUI_FLAG(aspect_ratio_info_present_flag, GROUP_ASPECT),
+    VUI_VALUE(aspect_ratio_idc, 8, GROUP_ASPECT),
+    VUI_VALUE(sar_width, 16, GROUP_ASPECT),
+    VUI_VALUE(sar_height, 16, GROUP_ASPECT),
+    VUI_FLAG(overscan_info_present_flag, GROUP_OVERSCAN),
+    VUI_VALUE(overscan_appropriate_flag, 1, GROUP_OVERSCAN),
+    VUI_FLAG(video_signal_type_present_flag, GROUP_SIGNAL),
+    VUI_VALUE(video_format, 3, GROUP_SIGNAL),
+    VUI_VALUE(video_full_range_flag, 1, GROUP_SIGNAL),
+    VUI_FLAG(colour_description_present_flag, GROUP_COLOUR),
+    VUI_VALUE(colour_primaries, 8, GROUP_COLOUR),
+    VUI_VALUE(transfer_characteristics, 8, GROUP_COLOUR),
+    VUI_VALUE(matrix_coeffs, 8, GROUP_COLOUR),
+    VUI_FLAG(chroma_loc_info_present_flag, GROUP_CHROMA_LOC),
+    VUI_VALUE(chroma_sample_loc_type_top_field, 0, GROUP_CHROMA_LOC),
+    VUI_VALUE(chroma_sample_loc_type_bottom_field, 0, GROUP_CHROMA_LOC),
+    VUI_VALUE(neutral_chroma_indication_flag, 1, GROUP_NONE),
+    VUI_VALUE(field_seq_flag, 1, GROUP_NONE),
+    VUI_VALUE(frame_field_info_present_flag, 1, GROUP_NONE),
+    VUI_FLAG(default_display_window_flag, GROUP_WINDOW),
+    VUI_VALUE(def_disp_win_left_offset, 0, GROUP_WINDOW),
+    VUI_VALUE(def_disp_win_right_offset, 0, GROUP_WINDOW),
+    VUI_VALUE(def_disp_win_top_offset, 0, GROUP_WINDOW),
+    VUI_VALUE(def_disp_win_bottom_offset, 0, GROUP_WINDOW),
+    VUI_FLAG(vui_timing_info_present_flag, GROUP_TIMING),
+    VUI_VALUE(vui_num_units_in_tick, 32, GROUP_TIMING),
+    VUI_VALUE(vui_time_scale, 32, GROUP_TIMING),
+    VUI_FLAG(vui_poc_proportional_to_timing_flag, GROUP_POC),
+    VUI_VALUE(vui_num_ticks_poc_diff_one_minus1, 0, GROUP_POC),
+    VUI_FLAG(bitstream_restriction_flag, GROUP_RESTRICTION),
+};
+
+#define FIELD_COUNT (sizeof(kFields) / sizeof(kFields[0]))
+
+static void SetField(struct H265VuiParameters* vui, uint32_t f, uint32_t v) {
+  uint8_t* p = (uint8_t*)vui + kFields[f].offset;
+  uint16_t v16 = (uint16_t)v;
+  switch (kFields[f].size) {
+  case 1:
+    *p = (uint8_t)v;
+    break;
+  case 2:
+    memcpy(p, &v16, 2);
+    break;
+  default:
+    memcpy(p, &v, 4);
+    break;
+  }
+}
+
+int PsRewriterAddEdit(struct PsRewriterConfig* cfg, const char* edit) {
+  const char* eq = strchr(edit, '=');
+  unsigned long long value;
+  char* end;
+  uint32_t f;
+  if (!eq) {
+    fprintf(stderr, "--set %s: expected NAME=VALUE\n", edit);
+    return -1;
+  }
+  for (f = 0; f < FIELD_COUNT; f++) {
+    if (strlen(kFields[f].name) == (size_t)(eq - edit) &&
+        strncmp(kFields[f].name, edit, eq - edit) == 0)
+      break;
+  }
+  if (f == FIELD_COUNT) {
+    fprintf(stderr, "--set %s: not a VUI field that can be set\n", edit);
+    return -1;
+  }
+  value = strtoull(eq + 1, &end, 0);
+  if (end == eq + 1 || *end ||
+      (kFields[f].bits && kFields[f].bits < 32 &&
+       value >> kFields[f].bits) ||
+      value > 0xFFFFFFFEULL + (kFields[f].bits == 32)) {
+    fprintf(stderr, "--set %s: invalid value\n", edit);
+    return -1;
+  }
+  if (cfg->edit_count == PS_REWRITER_MAX_EDITS) {
+    fprintf(stderr, "at most %d --set\n", PS_REWRITER_MAX_EDITS);
+    return -1;
+  }
+  cfg->edits[cfg->edit_count].field = f;
+  cfg->edits[cfg->edit_count].value = (uint32_t)value;
+  cfg->edit_count++;
+  return 0;
+}
+
+static uint8_t* GroupFlag(struct H265VuiParameters* vui, uint32_t group) {
+  return (uint8_t*)vui + kGroups[group].flag;
+}
+
+// Sets the flag of |group| and those it depends on, the values under a
+// flag that was off to their unspecified or inferred values.
+static void EnableGroup(struct H265VuiParameters* vui, uint32_t group) {
+  if (group == GROUP_NONE)
+    return;
+  EnableGroup(vui, kGroups[group].parent);
+  if (*GroupFlag(vui, group))
+    return;
+  *GroupFlag(vui, group) = 1;
+  switch (group) {
+  case GROUP_SIGNAL:
+    vui->video_format = 5;  // unspecified
+    break;
+  case GROUP_COLOUR:
+    vui->colour_primaries = 2;
+    vui->transfer_characteristics = 2;
+    vui->matrix_coeffs = 2;
+    break;
+  case GROUP_RESTRICTION:
+    // E.3.1 inferred values
+    vui->motion_vectors_over_pic_boundaries_flag = 1;
+    vui->max_bytes_per_pic_denom = 2;
+    vui->max_bits_per_min_cu_denom = 1;
+    vui->log2_max_mv_length_horizontal = 15;
+    vui->log2_max_mv_length_vertical = 15;
+    break;
+  }
+}
+
+// Zeroes what the flags leave out, as a parse into a cleared struct has it.
+static void NormalizeVui(struct H265VuiParameters* vui) {
+  if (!vui->aspect_ratio_info_present_flag)
+    vui->aspect_ratio_idc = 0;
+  if (vui->aspect_ratio_idc != EXTENDED_SAR)
+    vui->sar_width = vui->sar_height = 0;
+  if (!vui->overscan_info_present_flag)
+    vui->overscan_appropriate_flag = 0;
+  if (!vui->video_signal_type_present_flag) {
+    vui->video_format = 0;
+    vui->video_full_range_flag = 0;
+    vui->colour_description_present_flag = 0;
+  }
+  if (!vui->colour_description_present_flag) {
+    vui->colour_primaries = 0;
+    vui->transfer_characteristics = 0;
+    vui->matrix_coeffs = 0;
+  }
+  if (!vui->chroma_loc_info_present_flag) {
+    vui->chroma_sample_loc_type_top_field = 0;
+    vui->chroma_sample_loc_type_bottom_field = 0;
+  }
+  if (!vui->default_display_window_flag) {
+    vui->def_disp_win_left_offset = 0;
+    vui->def_disp_win_right_offset = 0;
+    vui->def_disp_win_top_offset = 0;
+    vui->def_disp_win_bottom_offset = 0;
+  }
+  if (!vui->vui_timing_info_present_flag) {
+    vui->vui_num_units_in_tick = 0;
+    vui->vui_time_scale = 0;
+    vui->vui_poc_proportional_to_timing_flag = 0;
+    vui->vui_hrd_parameters_present_flag = 0;
+  }
+  if (!vui->vui_poc_proportional_to_timing_flag)
+    vui->vui_num_ticks_poc_diff_one_minus1 = 0;
+  if (!vui->vui_hrd_parameters_present_flag)
+    memset(&vui->hrd_parameters, 0, sizeof(vui->hrd_parameters));
+  if (!vui->bitstream_restriction_flag) {
+    vui->tiles_fixed_structure_flag = 0;
+    vui->motion_vectors_over_pic_boundaries_flag = 0;
+    vui->restricted_ref_pic_lists_flag = 0;
+    vui->min_spatial_segmentation_idc = 0;
+    vui->max_bytes_per_pic_denom = 0;
+    vui->max_bits_per_min_cu_denom = 0;
+    vui->log2_max_mv_length_horizontal = 0;
+    vui->log2_max_mv_length_vertical = 0;
+  }
+}
+
+// The SPS as the rewritten one parses: the VUI of |sps| with the edits.
+static int EditSps(const struct PsRewriterConfig* cfg,
+                   const struct H265SeqParameterSet* sps,
+                   struct H265SeqParameterSet* edited) {
+  struct H265VuiParameters* vui = &edited->vui_param;
+  uint32_t i;
+  *edited = *sps;
+  // the struct keeps what an earlier SPS had where this one has nothing
+  if (!sps->vui_parameters_present_flag)
+    memset(vui, 0, sizeof(*vui));
+  else if (!vui->vui_timing_info_present_flag)
+    vui->vui_hrd_parameters_present_flag = 0;
+  NormalizeVui(vui);
+  edited->vui_parameters_present_flag = 1;
+  for (i = 0; i < cfg->edit_count; i++) {
+    const struct VuiField* f = &kFields[cfg->edits[i].field];
+    uint32_t value = cfg->edits[i].value;
+    if (f->is_flag && !value) {
+      *GroupFlag(vui, f->group) = 0;
+      continue;
+    }
+    EnableGroup(vui, f->group);
+    if (!f->is_flag)
+      SetField(vui, cfg->edits[i].field, value);
+    if (f->offset == VUI_OFFSET(sar_width) ||
+        f->offset == VUI_OFFSET(sar_height))
+      vui->aspect_ratio_idc = EXTENDED_SAR;
+  }
+  NormalizeVui(vui);
+  if (vui->vui_timing_info_present_flag &&
+      (!vui->vui_num_units_in_tick || !vui->vui_time_scale)) {
+    fprintf(stderr, "VUI timing needs vui_num_units_in_tick and "
+            "vui_time_scale\n");
+    return -1;
+  }
+  return 0;
+}
+
+// The VPS with the edited timing; 0 if the edits leave it as it is.
+static int EditVps(const struct PsRewriterConfig* cfg,
+                   const struct H265VideoParameterSet* vps,
+                   struct H265VideoParameterSet* edited) {
+  uint32_t i;
+  *edited = *vps;
+  if (!vps->vps_timing_info_present_flag)
+    return 0;
+  for (i = 0; i < cfg->edit_count; i++) {
+    size_t offset = kFields[cfg->edits[i].field].offset;
+    if (offset == VUI_OFFSET(vui_num_units_in_tick))
+      edited->vps_num_units_in_tick = cfg->edits[i].value;
+    else if (offset == VUI_OFFSET(vui_time_scale))
+      edited->vps_time_scale = cfg->edits[i].value;
+  }
+  return edited->vps_num_units_in_tick != vps->vps_num_units_in_tick ||
+         edited->vps_time_scale != vps->vps_time_scale;
+}
+
+// Bit position of rbsp_stop_one_bit, 0 if there is none.
+static uint32_t StopBit(const uint8_t* rbsp, uint32_t size) {
+  uint32_t pos;
+  uint8_t b;
+  while (size && rbsp[size - 1] == 0)
+    size--;
+  if (!size)
+    return 0;
+  b = rbsp[size - 1];
+  pos = size * 8 - 1;
+  while (!(b & 1)) {
+    b >>= 1;
+    pos--;
+  }
+  return pos;
+}
+
+static void CopyBits(struct BitWriter* bw,
+                     uint8_t* rbsp,
+                     uint32_t size,
+                     uint32_t from,
+                     uint32_t to) {
+  struct BitStream bs;
+  BsInit(&bs, rbsp, size);
+  BsSeek(&bs, from);
+  while (from < to) {
+    uint32_t n = to - from < 32 ? to - from : 32;
+    BsPut(bw, BsGet(&bs, n), n);
+    from += n;
+  }
+}
+
+// E.2.1 vui_parameters(), with hrd_parameters() copied from |rbsp|
+static void PutVui(struct BitWriter* bw,
+                   const struct H265VuiParameters* vui,
+                   const struct H265VuiParameters* old,
+                   uint8_t* rbsp,
+                   uint32_t size) {
+  BsPut(bw, vui->aspect_ratio_info_present_flag, 1);
+  if (vui->aspect_ratio_info_present_flag) {
+    BsPut(bw, vui->aspect_ratio_idc, 8);
+    if (vui->aspect_ratio_idc == EXTENDED_SAR) {
+      BsPut(bw, vui->sar_width, 16);
+      BsPut(bw, vui->sar_height, 16);
+    }
+  }
+  BsPut(bw, vui->overscan_info_present_flag, 1);
+  if (vui->overscan_info_present_flag)
+    BsPut(bw, vui->overscan_appropriate_flag, 1);
+  BsPut(bw, vui->video_signal_type_present_flag, 1);
+  if (vui->video_signal_type_present_flag) {
+    BsPut(bw, vui->video_format, 3);
+    BsPut(bw, vui->video_full_range_flag, 1);
+    BsPut(bw, vui->colour_description_present_flag, 1);
+    if (vui->colour_description_present_flag) {
+      BsPut(bw, vui->colour_primaries, 8);
+      BsPut(bw, vui->transfer_characteristics, 8);
+      BsPut(bw, vui->matrix_coeffs, 8);
+    }
+  }
+  BsPut(bw, vui->chroma_loc_info_present_flag, 1);
+  if (vui->chroma_loc_info_present_flag) {
+    BsPutUe(bw, vui->chroma_sample_loc_type_top_field);
+    BsPutUe(bw, vui->chroma_sample_loc_type_bottom_field);
+  }
+  BsPut(bw, vui->neutral_chroma_indication_flag, 1);
+  BsPut(bw, vui->field_seq_flag, 1);
+  BsPut(bw, vui->frame_field_info_present_flag, 1);
+  BsPut(bw, vui->default_display_window_flag, 1);
+  if (vui->default_display_window_flag) {
+    BsPutUe(bw, vui->def_disp_win_left_offset);
+    BsPutUe(bw, vui->def_disp_win_right_offset);
+    BsPutUe(bw, vui->def_disp_win_top_offset);
+    BsPutUe(bw, vui->def_disp_win_bottom_offset);
+  }
+  BsPut(bw, vui->vui_timing_info_present_flag, 1);
+  if (vui->vui_timing_info_present_flag) {
+    BsPut(bw, vui->vui_num_units_in_tick, 32);
+    BsPut(bw, vui->vui_time_scale, 32);
+    BsPut(bw, vui->vui_poc_proportional_to_timing_flag, 1);
+    if (vui->vui_poc_proportional_to_timing_flag)
+      BsPutUe(bw, vui->vui_num_ticks_poc_diff_one_minus1);
+    BsPut(bw, vui->vui_hrd_parameters_present_flag, 1);
+    if (vui->vui_hrd_parameters_present_flag)
+      CopyBits(bw, rbsp, size, old->hrd_parameters_pos,
+               old->hrd_parameters_end);
+  }
+  BsPut(bw, vui->bitstream_restriction_flag, 1);
+  if (vui->bitstream_restriction_flag) {
+    BsPut(bw, vui->tiles_fixed_structure_flag, 1);
+    BsPut(bw, vui->motion_vectors_over_pic_boundaries_flag, 1);
+    BsPut(bw, vui->restricted_ref_pic_lists_flag, 1);
+    BsPutUe(bw, vui->min_spatial_segmentation_idc);
+    BsPutUe(bw, vui->max_bytes_per_pic_denom);
+    BsPutUe(bw, vui->max_bits_per_min_cu_denom);
+    BsPutUe(bw, vui->log2_max_mv_length_horizontal);
+    BsPutUe(bw, vui->log2_max_mv_length_vertical);
+  }
+}
+
+// Writes the RBSP of the rewritten parameter set, the NAL unit header
+// included. Returns its size, 0 if it is the same as |rbsp| or the edits
+// don't go with it.
+static uint32_t Rewrite(struct PsRewriter* rw,
+                        const struct h265_decode_t* dec,
+                        uint8_t* rbsp,
+                        uint32_t size) {
+  uint32_t type = dec->nal_unit_header.nal_unit_type;
+  uint32_t stop = StopBit(rbsp, size);
+  struct BitWriter bw;
+  BsWriterInit(&bw, rw->buffer, rw->capacity);
+  if (type == H265_NAL_TYPE_SPS_NUT) {
+    const struct H265SeqParameterSet* sps = &dec->seq_param_set;
+    struct H265SeqParameterSet edited;
+    if (EditSps(&rw->config, sps, &edited) != 0) {
+      rw->failed = 1;
+      return 0;
+    }
+    CopyBits(&bw, rbsp, size, 0, sps->vui_parameters_pos);
+    BsPut(&bw, 1, 1);
+    PutVui(&bw, &edited.vui_param, &sps->vui_param, rbsp, size);
+    CopyBits(&bw, rbsp, size, sps->vui_parameters_end, stop);
+  } else {
+    const struct H265VideoParameterSet* vps = &dec->video_param_set;
+    struct H265VideoParameterSet edited;
+    if (!EditVps(&rw->config, vps, &edited))
+      return 0;
+    CopyBits(&bw, rbsp, size, 0, vps->vps_timing_info_pos);
+    BsPut(&bw, edited.vps_num_units_in_tick, 32);
+    BsPut(&bw, edited.vps_time_scale, 32);
+    CopyBits(&bw, rbsp, size, vps->vps_timing_info_pos + 64, stop);
+  }
+  BsPutTrailingBits(&bw);
+  if (bw.overflow || !stop)
+    return 0;
+  if (BsBytes(&bw) == stop / 8 + 1 &&
+      memcmp(rw->buffer, rbsp, stop / 8 + 1) == 0)
+    return 0;
+  return BsBytes(&bw);
+}
+
+int PsRewriterOpen(struct PsRewriter* rw,
+                   const struct PsRewriterConfig* cfg,
+                   const char* input_path) {
+  memset(rw, 0, sizeof(*rw));
+  rw->config = *cfg;
+  rw->in_fd = open(input_path, O_RDONLY | O_BINARY);
+  if (rw->in_fd < 0) {
+    fprintf(stderr, "couldn't open %s\n", input_path);
+    return -1;
+  }
+  rw->out_fd =
+      open(cfg->output, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0644);
+  if (rw->out_fd < 0) {
+    fprintf(stderr, "couldn't create %s\n", cfg->output);
+    close(rw->in_fd);
+    return -1;
+  }
+  return 0;
+}
+
+int PsRewriterPushNal(struct PsRewriter* rw,
+                      const struct h265_decode_t* dec,
+                      const struct NalUnit* nal,
+                      uint32_t rbsp_size,
+                      int err) {
+  uint32_t type = dec->nal_unit_header.nal_unit_type;
+  uint64_t start = nal->offset + nal->prefix_bytes;
+  uint32_t size, escaped, zeros = 0;
+  if (rw->failed)
+    return -1;
+  if (err != 0 ||
+      (type != H265_NAL_TYPE_VPS_NUT && type != H265_NAL_TYPE_SPS_NUT))
+    return 0;
+  // room for a grown VUI, then for the escaped NAL unit
+  if (rw->capacity < rbsp_size + 256) {
+    uint8_t* p = (uint8_t*)realloc(rw->buffer,
+                                   (rbsp_size + 256) * 5 / 2 + 1);
+    if (!p) {
+      fprintf(stderr, "out of memory\n");
+      rw->failed = 1;
+      return -1;
+    }
+    rw->buffer = p;
+    rw->capacity = rbsp_size + 256;
+  }
+  size = Rewrite(rw, dec, nal->data, rbsp_size);
+  if (rw->failed)
+    return -1;
+  if (!size) {
+    rw->unchanged++;
+    return 0;
+  }
+  escaped = BsEscape(rw->buffer + rw->capacity, rw->buffer, size, &zeros);
+  if (FileCopyRange(rw->in_fd, rw->out_fd, rw->copied,
+                    start - rw->copied) != 0 ||
+      FileWriteAll(rw->out_fd, rw->buffer + rw->capacity, escaped) != 0) {
+    fprintf(stderr, "couldn't write %s\n", rw->config.output);
+    rw->failed = 1;
+    return -1;
+  }
+  rw->bytes_copied += start - rw->copied;
+  rw->bytes_written += escaped;
+  rw->copied = start + nal->size;
+  if (type == H265_NAL_TYPE_SPS_NUT)
+    rw->sps_rewritten++;
+  else
+    rw->vps_rewritten++;
+  return 0;
+}
+
+int PsRewriterClose(struct PsRewriter* rw) {
+  struct stat st;
+  int ret = rw->failed ? -1 : 0;
+  if (ret == 0 && (fstat(rw->in_fd, &st) != 0 ||
+                   FileCopyRange(rw->in_fd, rw->out_fd, rw->copied,
+                                 (uint64_t)st.st_size - rw->copied) != 0)) {
+    fprintf(stderr, "couldn't write %s\n", rw->config.output);
+    ret = -1;
+  }
+  if (ret == 0)
+    rw->bytes_copied += (uint64_t)st.st_size - rw->copied;
+  if (close(rw->out_fd) != 0)
+    ret = -1;
+  close(rw->in_fd);
+  free(rw->buffer);
+  rw->buffer = NULL;
+  return ret;
+}
+
+// Parses one parameter set into a cleared decoder.
+static void ParseFresh(struct h265_decode_t* dec, struct NalUnit* nal) {
+  struct OutputConfig config;
+  struct OutputContextDict none[1];
+  struct BitStream bs;
+  memset(dec, 0, sizeof(*dec));
+  memset(&config, 0, sizeof(config));
+  OutputContextInitDict(none, NULL, -1, &config);
+  BsInit(&bs, nal->data, remove_03(nal->data, nal->size));
+  h265_parse_nal(dec, &bs, none);
+  none->end(none);
+}
+
+// Whether the rewritten parameter set in |out| parses as the one in |in|
+// with the edits.
+static int SameAsEdited(const struct PsRewriterConfig* cfg,
+                        struct h265_decode_t* in,
+                        struct h265_decode_t* out) {
+  if (in->nal_unit_header.nal_unit_type == H265_NAL_TYPE_SPS_NUT) {
+    struct H265SeqParameterSet edited, *sps = &out->seq_param_set;
+    if (EditSps(cfg, &in->seq_param_set, &edited) != 0)
+      return 0;
+    edited.vui_parameters_end = sps->vui_parameters_end;
+    edited.vui_param.hrd_parameters_pos = sps->vui_param.hrd_parameters_pos;
+    edited.vui_param.hrd_parameters_end = sps->vui_param.hrd_parameters_end;
+    return memcmp(&edited, sps, sizeof(edited)) == 0;
+  } else {
+    struct H265VideoParameterSet edited;
+    EditVps(cfg, &in->video_param_set, &edited);
+    return memcmp(&edited, &out->video_param_set, sizeof(edited)) == 0;
+  }
+}
+
+int PsRewriterVerify(const struct PsRewriterConfig* cfg,
+                     const char* input_path,
+                     struct PsRewriterCheck* check) {
+  FILE* fi = fopen(input_path, "rb");
+  FILE* fo = fopen(cfg->output, "rb");
+  struct NalInput in, out;
+  struct h265_decode_t *in_dec, *out_dec;
+  int ret = -1, ri = 0, ro = 0;
+  memset(check, 0, sizeof(*check));
+  in_dec = (struct h265_decode_t*)malloc(sizeof(*in_dec));
+  out_dec = (struct h265_decode_t*)malloc(sizeof(*out_dec));
+  if (!fi || !fo || !in_dec || !out_dec ||
+      NalInputOpenAnnexB(&in, fi) != 0) {
+    fprintf(stderr, "couldn't verify %s\n", cfg->output);
+    goto done;
+  }
+  if (NalInputOpenAnnexB(&out, fo) != 0) {
+    NalInputClose(&in);
+    goto done;
+  }
+  for (;;) {
+    struct NalUnit a, b;
+    uint32_t type;
+    ri = in.next(&in, &a);
+    ro = out.next(&out, &b);
+    if (ri <= 0 || ro <= 0)
+      break;
+    check->nal_units++;
+    if (a.size == b.size && memcmp(a.data, b.data, a.size) == 0)
+      continue;
+    type = a.size ? a.data[0] >> 1 & 63 : 0;
+    if (type == H265_NAL_TYPE_VPS_NUT || type == H265_NAL_TYPE_SPS_NUT) {
+      check->parameter_sets++;
+      ParseFresh(in_dec, &a);
+      ParseFresh(out_dec, &b);
+      if (SameAsEdited(cfg, in_dec, out_dec))
+        continue;
+    }
+    fprintf(stderr, "%s: NAL unit at 0x%llX doesn't match the input at "
+            "0x%llX\n", cfg->output, (unsigned long long)b.offset,
+            (unsigned long long)a.offset);
+    check->mismatches++;
+  }
+  if (ri > 0 || ro > 0) {
+    fprintf(stderr, "%s: NAL unit count doesn't match the input\n",
+            cfg->output);
+    check->mismatches++;
+  }
+  ret = ri < 0 || ro < 0 ? -1 : 0;
+  NalInputClose(&in);
+  NalInputClose(&out);
+done:
+  if (fi)
+    fclose(fi);
+  if (fo)
+    fclose(fo);
+  free(in_dec);
+  free(out_dec);
+  return ret;
+}
@@ -0,0 +1,101 @@
+#ifndef PS_REWRITER_H_
+#define PS_REWRITER_H_
+
+#include <stdint.h>
+#include "h265parser.h"
+#include "nal-input.h"
+
+// Rewrites the VUI of every SPS of an Annex B file while it is parsed, for
+// fixes like a wrong SAR, colour description or frame rate without a
+// remux. Edits are NAME=VALUE with NAME one of
+//
+//   aspect_ratio_info_present_flag aspect_ratio_idc sar_width sar_height
+//   overscan_info_present_flag overscan_appropriate_flag
+//   video_signal_type_present_flag video_format video_full_range_flag
+//   colour_description_present_flag colour_primaries
+//   transfer_characteristics matrix_coeffs
+//   chroma_loc_info_present_flag chroma_sample_loc_type_top_field
+//   chroma_sample_loc_type_bottom_field neutral_chroma_indication_flag
+//   field_seq_flag frame_field_info_present_flag
+//   default_display_window_flag def_disp_win_left_offset
+//   def_disp_win_right_offset def_disp_win_top_offset
+//   def_disp_win_bottom_offset vui_timing_info_present_flag
+//   vui_num_units_in_tick vui_time_scale
+//   vui_poc_proportional_to_timing_flag vui_num_ticks_poc_diff_one_minus1
+//   bitstream_restriction_flag
+//
+// Setting a value sets the presence flags it depends on, with the other
+// values under them at their unspecified or inferred defaults; setting a
+// flag to 0 drops what it covers, hrd_parameters() with the timing. SAR
+// values set aspect_ratio_idc to EXTENDED_SAR. A VPS with timing gets the
+// edited vui_num_units_in_tick and vui_time_scale as well.
+//
+// The SPS is spliced at bit level: its syntax ahead of
+// vui_parameters_present_flag and after vui_parameters() is copied as it is,
+// the VUI is written again from the edited H265VuiParameters with its
+// hrd_parameters() copied, and the NAL unit escaped again. Every other NAL
+// unit, PPS included, and a parameter set the edits leave as it was, is
+// copied from the input file by offset (copy_file_range on Linux), so the
+// output is written at about the speed of the start code scan.
+//
+// PsRewriterVerify reads the output back next to the input: each NAL unit
+// has to be the same bytes, or a parameter set that parses to the structs
+// of the input one with the edits applied.
+
+#define PS_REWRITER_MAX_EDITS 32
+
+struct PsRewriterEdit {
+  uint32_t field;  // in the table of ps-rewriter.c
+  uint32_t value;
+};
+
+struct PsRewriterConfig {
+  const char* output;
+  struct PsRewriterEdit edits[PS_REWRITER_MAX_EDITS];
+  uint32_t edit_count;
+};
+
+struct PsRewriter {
+  struct PsRewriterConfig config;
+  int in_fd;
+  int out_fd;
+  uint64_t copied;  // input offset copied up to
+  uint8_t* buffer;  // the RBSP written, then escaped
+  uint32_t capacity;
+  int failed;
+
+  uint64_t sps_rewritten;
+  uint64_t vps_rewritten;
+  uint64_t unchanged;  // parameter sets the edits left as they were
+  uint64_t bytes_copied;
+  uint64_t bytes_written;  // of rewritten NAL units
+};
+
+struct PsRewriterCheck {
+  uint64_t nal_units;
+  uint64_t parameter_sets;  // rewritten ones parsed and compared
+  uint64_t mismatches;
+};
+
+// Adds an edit NAME=VALUE. Returns -1 for an unknown name or a value the
+// syntax element can't hold.
+int PsRewriterAddEdit(struct PsRewriterConfig* cfg, const char* edit);
+
+int PsRewriterOpen(struct PsRewriter* rw,
+                   const struct PsRewriterConfig* cfg,
+                   const char* input_path);
+// Called after h265_parse_nal with each NAL unit, |rbsp_size| bytes of
+// RBSP in nal->data, and what h265_parse_nal returned.
+int PsRewriterPushNal(struct PsRewriter* rw,
+                      const struct h265_decode_t* dec,
+                      const struct NalUnit* nal,
+                      uint32_t rbsp_size,
+                      int err);
+// Copies the rest of the input and closes the output.
+int PsRewriterClose(struct PsRewriter* rw);
+
+int PsRewriterVerify(const struct PsRewriterConfig* cfg,
+                     const char* input_path,
+                     struct PsRewriterCheck* check);
+
+#endif
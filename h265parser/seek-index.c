@@ -0,0 +1,192 @@
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <windows.h>
+#define fileno _fileno
+#define fseeko _fseeki64
+#define fstat _fstat64
+#define stat _stat64
+#endif
+#include "seek-index.h"
+#include "bitstream.h"
+#include "h265parser.h"
+#include "output-context.h"
+
+static const char kMagic[8] = {'H', '2', '6', '5', 'S', 'I', 'D', 'X'};
+#define SEEK_INDEX_VERSION 1
+
+int SeekIndexOpen(struct SeekIndex* idx, const char* path, FILE* input) {
+  struct SeekIndexHeader h;
+  struct stat st;
+  memset(idx, 0, sizeof(*idx));
+  idx->path = path;
+  if (fstat(fileno(input), &st) != 0 || !(st.st_mode & S_IFREG))
+    return -1;
+  memcpy(idx->header.magic, kMagic, sizeof(kMagic));
+  idx->header.version = SEEK_INDEX_VERSION;
+  idx->header.entry_size = sizeof(struct SeekIndexEntry);
+  idx->header.input_size = (uint64_t)st.st_size;
+  idx->header.input_mtime = (int64_t)st.st_mtime;
+  idx->fp = fopen(path, "rb");
+  if (!idx->fp)
+    return 0;
+  if (fread(&h, sizeof(h), 1, idx->fp) != 1 ||
+      memcmp(h.magic, kMagic, sizeof(kMagic)) != 0 ||
+      h.version != SEEK_INDEX_VERSION ||
+      h.entry_size != idx->header.entry_size ||
+      h.input_size != idx->header.input_size ||
+      h.input_mtime != idx->header.input_mtime) {
+    fclose(idx->fp);
+    idx->fp = NULL;
+    return 0;
+  }
+  idx->header.count = h.count;
+  return 1;
+}
+
+static int IsIrap(uint32_t type) {
+  return type >= H265_NAL_TYPE_BLA_W_LP && type <= H265_NAL_TYPE_CRA_NUT;
+}
+
+int SeekIndexBuild(struct SeekIndex* idx, struct NalInput* in) {
+  struct h265_decode_t* dec;
+  struct AuTimestamps ts;
+  struct SeekIndexEntry entry, pending;
+  struct OutputConfig config;
+  struct NalUnit nal;
+  uint64_t nal_count = 0;
+  char* tmp;
+  FILE* fp;
+  int i, ret = 0, ok;
+  if (idx->fp)
+    fclose(idx->fp);
+  idx->fp = NULL;
+  idx->header.count = 0;
+  tmp = (char*)malloc(strlen(idx->path) + 5);
+  dec = (struct h265_decode_t*)malloc(sizeof(*dec));
+  fp = tmp ? fopen(strcat(strcpy(tmp, idx->path), ".tmp"), "wb") : NULL;
+  if (!fp || !dec) {
+    fprintf(stderr, "couldn't create %s.tmp\n", idx->path);
+    if (fp)
+      fclose(fp);
+    free(tmp);
+    free(dec);
+    return -1;
+  }
+  memset(dec, 0, sizeof(*dec));
+  memset(&config, 0, sizeof(config));
+  memset(&pending, 0, sizeof(pending));
+  for (i = 0; i < 3; i++)
+    pending.set_offsets[i] = SEEK_INDEX_NONE;
+  entry = pending;
+  AuTimestampsInit(&ts, NULL);
+  ok = fwrite(&idx->header, sizeof(idx->header), 1, fp) == 1;
+  while (ok && (ret = in->next(in, &nal)) > 0) {
+    struct BitStream bs;
+    struct OutputContextDict none[1];
+    uint32_t type;
+    int err;
+    OutputContextInitDict(none, NULL, -1, &config);
+    BsInit(&bs, nal.data, remove_03(nal.data, nal.size));
+    err = h265_parse_nal(dec, &bs, none);
+    none->end(none);
+    type = dec->nal_unit_header.nal_unit_type;
+    // what a run resumed at this access unit starts from
+    if (dec->new_access_unit || nal_count++ == 0) {
+      memcpy(entry.set_offsets, pending.set_offsets,
+             sizeof(entry.set_offsets));
+      entry.timestamps = ts.state;
+    }
+    if (err == 0 && type >= H265_NAL_TYPE_VPS_NUT &&
+        type <= H265_NAL_TYPE_PPS_NUT)
+      pending.set_offsets[type - H265_NAL_TYPE_VPS_NUT] = nal.offset;
+    if (AuTimestampsPushNal(&ts, dec, &nal, err) > 0 &&
+        IsIrap(ts.last.nal_unit_type) && ts.last.timed) {
+      entry.offset = ts.last.offset;
+      entry.dts = ts.last.dts;
+      entry.pts = ts.last.pts;
+      ok = fwrite(&entry, sizeof(entry), 1, fp) == 1;
+      idx->header.count++;
+    }
+  }
+  if (ret < 0)
+    ok = 0;
+  ok = ok && fseeko(fp, 0, SEEK_SET) == 0 &&
+       fwrite(&idx->header, sizeof(idx->header), 1, fp) == 1;
+  if (fclose(fp) != 0)
+    ok = 0;
+#ifdef _WIN32
+  ok = ok && MoveFileExA(tmp, idx->path, MOVEFILE_REPLACE_EXISTING);
+#else
+  ok = ok && rename(tmp, idx->path) == 0;
+#endif
+  if (!ok) {
+    fprintf(stderr, "couldn't write %s\n", idx->path);
+    remove(tmp);
+  }
+  free(tmp);
+  free(dec);
+  if (ok)
+    idx->fp = fopen(idx->path, "rb");
+  return ok && idx->fp ? 0 : -1;
+}
+
+static int ReadEntry(struct SeekIndex* idx,
+                     uint64_t i,
+                     struct SeekIndexEntry* entry) {
+  idx->reads++;
+  if (fseeko(idx->fp, (int64_t)(sizeof(idx->header) + i * sizeof(*entry)),
+             SEEK_SET) != 0 ||
+      fread(entry, sizeof(*entry), 1, idx->fp) != 1) {
+    fprintf(stderr, "couldn't read %s\n", idx->path);
+    return -1;
+  }
+  return 0;
+}
+
+int SeekIndexFind(struct SeekIndex* idx,
+                  int64_t pts,
+                  int64_t end_pts,
+                  struct SeekIndexEntry* entry,
+                  uint64_t* end_offset) {
+  uint64_t lo = 0, hi = idx->header.count, found;
+  idx->reads = 0;
+  if (!idx->fp || !idx->header.count)
+    return -1;
+  // IRAP pictures are presented in decoding order
+  while (lo < hi) {
+    uint64_t mid = lo + (hi - lo) / 2;
+    if (ReadEntry(idx, mid, entry) != 0)
+      return -1;
+    if (entry->pts <= pts)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  found = lo ? lo - 1 : 0;
+  lo = found + 1;
+  hi = idx->header.count;
+  while (lo < hi) {
+    uint64_t mid = lo + (hi - lo) / 2;
+    if (ReadEntry(idx, mid, entry) != 0)
+      return -1;
+    if (entry->pts < end_pts)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  *end_offset = SEEK_INDEX_NONE;
+  if (lo < idx->header.count) {
+    if (ReadEntry(idx, lo, entry) != 0)
+      return -1;
+    *end_offset = entry->offset;
+  }
+  return ReadEntry(idx, found, entry);
+}
+
+void SeekIndexClose(struct SeekIndex* idx) {
+  if (idx->fp)
+    fclose(idx->fp);
+  idx->fp = NULL;
+}
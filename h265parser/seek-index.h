@@ -0,0 +1,62 @@
+#ifndef SEEK_INDEX_H_
+#define SEEK_INDEX_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include "au-timestamps.h"
+#include "nal-input.h"
+
+// Index of the IRAP access units of an input file by presentation time, for
+// seeking: a header followed by one fixed size entry per IRAP access unit in
+// decoding order, found by binary search with a few reads however large the
+// input. An entry holds where the access unit starts, where the VPS, SPS and
+// PPS last seen before it are, and the AuTimestamps state as it starts, so a
+// run resumed there stamps the same times as one from the start.
+//
+// The index is built by one pass over the input without output and is used
+// while the size and modification time of the input match. Entries are raw
+// structures, so indexes are only read by the build that wrote them.
+
+#define SEEK_INDEX_NONE ((uint64_t)-1)
+
+struct SeekIndexEntry {
+  uint64_t offset;          // of the first NAL unit of the access unit
+  uint64_t set_offsets[3];  // VPS, SPS and PPS, or SEEK_INDEX_NONE
+  int64_t dts;              // of the IRAP picture, 90 kHz
+  int64_t pts;
+  struct AuTimestampsState timestamps;
+};
+
+struct SeekIndexHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t entry_size;
+  uint64_t input_size;
+  int64_t input_mtime;
+  uint64_t count;
+};
+
+struct SeekIndex {
+  const char* path;
+  FILE* fp;
+  struct SeekIndexHeader header;
+  uint32_t reads;  // entries read by the last SeekIndexFind
+};
+
+// Opens the index at |path| of the input file |input|: 1 if it exists and
+// matches the input, 0 if it has to be built, -1 if |input| isn't a file.
+int SeekIndexOpen(struct SeekIndex* idx, const char* path, FILE* input);
+// Reads |in| from where it is, its start, to the end and writes the index.
+int SeekIndexBuild(struct SeekIndex* idx, struct NalInput* in);
+// Finds the last IRAP access unit presented at or before |pts|, or the
+// first one, and the offset of the first IRAP access unit after it that is
+// presented at or after |end_pts|, SEEK_INDEX_NONE if none. Returns -1 if
+// the index has no entries.
+int SeekIndexFind(struct SeekIndex* idx,
+                  int64_t pts,
+                  int64_t end_pts,
+                  struct SeekIndexEntry* entry,
+                  uint64_t* end_offset);
+void SeekIndexClose(struct SeekIndex* idx);
+
+#endif
@@ -0,0 +1,280 @@
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <io.h>
+#define open _open
+#define close _close
+#else
+#include <unistd.h>
+#define O_BINARY 0
+#endif
+#include "segmenter.h"
+#include "file-copy.h"
+#include "h265const.h"
+
+static int IsIrap(uint32_t type) {
+  return type >= H265_NAL_TYPE_BLA_W_LP && type <= H265_NAL_TYPE_CRA_NUT;
+}
+
+static int IsRasl(uint32_t type) {
+  return type == H265_NAL_TYPE_RASL_N || type == H265_NAL_TYPE_RASL_R;
+}
+
+// the slice segment types h265_parse_nal parses
+static int IsSlice(uint32_t type) {
+  return type <= H265_NAL_TYPE_RASL_R || IsIrap(type);
+}
+
+static int AddRange(struct SegmenterRanges* r,
+                    uint64_t offset,
+                    uint64_t size,
+                    int merge) {
+  struct SegmenterRange* last = r->count ? &r->ranges[r->count - 1] : NULL;
+  if (merge && last && last->offset + last->size == offset) {
+    last->size += size;
+    return 0;
+  }
+  if (r->count == r->capacity) {
+    uint32_t capacity = r->capacity ? r->capacity * 2 : 64;
+    struct SegmenterRange* p = (struct SegmenterRange*)realloc(
+        r->ranges, capacity * sizeof(*p));
+    if (!p)
+      return -1;
+    r->ranges = p;
+    r->capacity = capacity;
+  }
+  r->ranges[r->count].offset = offset;
+  r->ranges[r->count].size = size;
+  r->count++;
+  return 0;
+}
+
+static void StartChunk(struct Segmenter* seg) {
+  seg->chunk.count = 0;
+  seg->chunk_bytes = 0;
+  seg->chunk_pictures = 0;
+  seg->chunk_seconds = 0;
+  seg->chunk_has_irap = 0;
+  seg->chunk_irap_type = 0;
+  seg->dropping_rasl = 0;
+  seg->dropped_pictures = 0;
+  seg->poc_min = 0;
+  seg->poc_max = 0;
+}
+
+static int WriteChunk(struct Segmenter* seg) {
+  struct OutputContextDict dict[1];
+  char* name;
+  uint64_t bytes = 0;
+  uint32_t i;
+  int out_fd, ret = 0;
+
+  if (seg->chunk.count == 0)
+    return 0;
+  name = (char*)malloc(strlen(seg->config.prefix) + 16);
+  if (!name)
+    return -1;
+  sprintf(name, "%s-%05u.hevc", seg->config.prefix, seg->chunk_index);
+  out_fd = open(name, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0644);
+  if (out_fd < 0) {
+    fprintf(stderr, "couldn't create %s\n", name);
+    free(name);
+    return -1;
+  }
+  // parameter sets the chunk doesn't carry itself
+  for (i = 0; i < SEGMENTER_SETS && ret == 0; i++) {
+    const struct SegmenterRange* r = &seg->chunk_sets[i];
+    if (r->size && r->offset < seg->chunk_offset) {
+      ret = FileCopyRange(seg->in_fd, out_fd, r->offset, r->size);
+      bytes += r->size;
+    }
+  }
+  for (i = 0; i < seg->chunk.count && ret == 0; i++) {
+    const struct SegmenterRange* r = &seg->chunk.ranges[i];
+    ret = FileCopyRange(seg->in_fd, out_fd, r->offset, r->size);
+  }
+  bytes += seg->chunk_bytes;
+  if (close(out_fd) != 0)
+    ret = -1;
+  if (ret != 0)
+    fprintf(stderr, "couldn't write %s\n", name);
+
+  seg->manifest->put_dict(seg->manifest, dict);
+  dict->put_str(dict, "file", name);
+  dict->put_uint(dict, "offset", seg->chunk_offset);
+  dict->put_uint(dict, "input_bytes", seg->chunk_bytes);
+  dict->put_uint(dict, "bytes", bytes);
+  dict->put_uint(dict, "pictures", seg->chunk_pictures);
+  dict->put_uint(dict, "duration_us",
+                 (uint64_t)(seg->chunk_seconds * 1e6 + 0.5));
+  if (seg->chunk_has_irap)
+    dict->put_enum(dict, "irap_type", GetH265NalType(seg->chunk_irap_type),
+                   seg->chunk_irap_type);
+  dict->put_int(dict, "poc_min", seg->poc_min);
+  dict->put_int(dict, "poc_max", seg->poc_max);
+  dict->put_uint(dict, "dropped_rasl_pictures", seg->dropped_pictures);
+  dict->end(dict);
+  free(name);
+  seg->chunk_index++;
+  StartChunk(seg);
+  return ret;
+}
+
+// Moves the access unit collected so far to the chunk.
+static int EndAccessUnit(struct Segmenter* seg) {
+  uint32_t i;
+  for (i = 0; i < seg->au.count; i++) {
+    const struct SegmenterRange* r = &seg->au.ranges[i];
+    if (seg->chunk.count == 0) {
+      seg->chunk_offset = r->offset;
+      memcpy(seg->chunk_sets, seg->sets, sizeof(seg->sets));
+    }
+    if (AddRange(&seg->chunk, r->offset, r->size, 1) != 0)
+      return -1;
+    seg->chunk_bytes += r->size;
+  }
+  seg->au.count = 0;
+  seg->au_dropped = 0;
+  return 0;
+}
+
+static int IsParameterSet(const struct Segmenter* seg,
+                          const struct SegmenterRange* r) {
+  uint32_t i;
+  for (i = 0; i < SEGMENTER_SETS; i++) {
+    if (seg->sets[i].size && seg->sets[i].offset == r->offset)
+      return 1;
+  }
+  return 0;
+}
+
+// Drops the access unit so far but its parameter sets.
+static void DropAccessUnit(struct Segmenter* seg) {
+  uint32_t i, n = 0;
+  for (i = 0; i < seg->au.count; i++) {
+    if (IsParameterSet(seg, &seg->au.ranges[i]))
+      seg->au.ranges[n++] = seg->au.ranges[i];
+  }
+  seg->au.count = n;
+  seg->au_dropped = 1;
+}
+
+static int CutDue(const struct Segmenter* seg) {
+  const struct SegmenterConfig* c = &seg->config;
+  if (seg->chunk_pictures == 0)
+    return 0;
+  if (!c->target_seconds && !c->target_bytes)
+    return 1;
+  return (c->target_seconds && seg->chunk_seconds >= c->target_seconds) ||
+         (c->target_bytes && seg->chunk_bytes >= c->target_bytes);
+}
+
+int SegmenterOpen(struct Segmenter* seg,
+                  const struct SegmenterConfig* config,
+                  const char* input_path) {
+  char* name;
+  memset(seg, 0, sizeof(*seg));
+  seg->config = *config;
+  seg->in_fd = open(input_path, O_RDONLY | O_BINARY);
+  if (seg->in_fd < 0) {
+    fprintf(stderr, "couldn't open %s\n", input_path);
+    return -1;
+  }
+  name = (char*)malloc(strlen(config->prefix) + 8);
+  if (!name)
+    return -1;
+  sprintf(name, "%s.json", config->prefix);
+  seg->manifest_fp = fopen(name, "w");
+  if (!seg->manifest_fp) {
+    fprintf(stderr, "couldn't create %s\n", name);
+    free(name);
+    close(seg->in_fd);
+    return -1;
+  }
+  free(name);
+  seg->manifest_cfg.explain_enum = 1;
+  seg->manifest_cfg.print_hex = 0;
+  OutputContextInitList(seg->manifest, seg->manifest_fp, 1,
+                        &seg->manifest_cfg);
+  StartChunk(seg);
+  return 0;
+}
+
+int SegmenterPushNal(struct Segmenter* seg,
+                     const struct h265_decode_t* dec,
+                     const struct NalUnit* nal) {
+  const struct H265SliceSegmentHeader* sh = &dec->slice_segment.header;
+  uint32_t type = dec->nal_unit_header.nal_unit_type;
+  uint64_t size = (uint64_t)nal->prefix_bytes + nal->size;
+  struct SegmenterRange* set = NULL;
+  int32_t poc;
+
+  if (seg->failed)
+    return -1;
+  if (dec->new_access_unit && EndAccessUnit(seg) != 0)
+    goto fail;
+  if (type == H265_NAL_TYPE_VPS_NUT)
+    set = &seg->sets[dec->video_param_set.vps_video_parameter_set_id & 15];
+  else if (type == H265_NAL_TYPE_SPS_NUT)
+    set = &seg->sets[SEGMENTER_SPS_BASE +
+                     (dec->seq_param_set.sps_seq_parameter_set_id & 15)];
+  else if (type == H265_NAL_TYPE_PPS_NUT)
+    set = &seg->sets[SEGMENTER_PPS_BASE +
+                     (dec->pic_param_set.pps_pic_parameter_set_id & 63)];
+  if (set) {
+    set->offset = nal->offset;
+    set->size = size;
+  }
+
+  if (IsSlice(type) && sh->first_slice_segment_in_pic_flag) {
+    if (IsIrap(type)) {
+      if (CutDue(seg) && WriteChunk(seg) != 0)
+        goto fail;
+      // leading pictures of later IRAP pictures decode within the chunk
+      seg->dropping_rasl = !seg->chunk_has_irap && !seg->config.keep_rasl &&
+                           type != H265_NAL_TYPE_IDR_W_RADL &&
+                           type != H265_NAL_TYPE_IDR_N_LP;
+      if (!seg->chunk_has_irap) {
+        seg->chunk_has_irap = 1;
+        seg->chunk_irap_type = type;
+      }
+    }
+    poc = h265_pic_order_cnt(&seg->poc, dec);
+    if (IsRasl(type) && seg->dropping_rasl) {
+      DropAccessUnit(seg);
+      seg->dropped_pictures++;
+    } else {
+      if (seg->chunk_pictures == 0 || poc < seg->poc_min)
+        seg->poc_min = poc;
+      if (seg->chunk_pictures == 0 || poc > seg->poc_max)
+        seg->poc_max = poc;
+      seg->chunk_pictures++;
+      seg->chunk_seconds += h265_clock_tick(dec);
+    }
+  }
+  // a dropped picture keeps only the parameter sets of its access unit
+  if (seg->au_dropped && !set)
+    return 0;
+  if (AddRange(&seg->au, nal->offset, size, 0) != 0)
+    goto fail;
+  return 0;
+
+fail:
+  seg->failed = 1;
+  return -1;
+}
+
+int SegmenterClose(struct Segmenter* seg) {
+  int ret = seg->failed ? -1 : 0;
+  if (ret == 0 && (EndAccessUnit(seg) != 0 || WriteChunk(seg) != 0))
+    ret = -1;
+  seg->manifest->end(seg->manifest);
+  fputc('\n', seg->manifest_fp);
+  if (fclose(seg->manifest_fp) != 0)
+    ret = -1;
+  close(seg->in_fd);
+  free(seg->au.ranges);
+  free(seg->chunk.ranges);
+  return ret;
+}
@@ -0,0 +1,91 @@
+#ifndef SEGMENTER_H_
+#define SEGMENTER_H_
+
+#include <stdint.h>
+#include "h265parser.h"
+#include "nal-input.h"
+#include "output-context.h"
+
+// Splits an Annex B file into independently decodable chunks while it is
+// parsed. A chunk ends at the first access unit starting with an IRAP
+// picture after the chunk reached the target duration or size, and is
+// written at once by copying its NAL units from the input file by offset
+// (copy_file_range on Linux), prefixed with every VPS, SPS and PPS seen so
+// far. RASL pictures of the IRAP picture a chunk starts with can't be
+// decoded without the previous chunk and are dropped unless kept.
+//
+// Durations come from the VUI timing of the active SPS, or the VPS timing,
+// one tick per picture; without either only the size target applies. POC
+// values are PicOrderCntVal of 8.3.1.
+
+// parameter sets by id, VPS, then SPS, then PPS
+#define SEGMENTER_SPS_BASE 16
+#define SEGMENTER_PPS_BASE 32
+#define SEGMENTER_SETS 96
+
+struct SegmenterConfig {
+  // chunks are written to PREFIX-00000.hevc on, the manifest to PREFIX.json
+  const char* prefix;
+  double target_seconds;  // 0: no duration target
+  uint64_t target_bytes;  // 0: no size target; neither: cut at every IRAP
+  uint8_t keep_rasl;
+};
+
+// Byte range of the input: a NAL unit with its start code, or NAL units
+// adjacent in the input
+struct SegmenterRange {
+  uint64_t offset;
+  uint64_t size;
+};
+
+struct SegmenterRanges {
+  struct SegmenterRange* ranges;
+  uint32_t count;
+  uint32_t capacity;
+};
+
+struct Segmenter {
+  struct SegmenterConfig config;
+  int in_fd;
+  struct OutputContextList manifest[1];
+  FILE* manifest_fp;
+  struct OutputConfig manifest_cfg;
+  int failed;
+
+  // the latest parameter set NAL unit of each id
+  struct SegmenterRange sets[SEGMENTER_SETS];
+
+  // the access unit being collected
+  struct SegmenterRanges au;
+  uint8_t au_dropped;  // a dropped RASL picture
+
+  // the chunk being collected
+  struct SegmenterRanges chunk;
+  uint32_t chunk_index;
+  uint64_t chunk_offset;  // input offset of its first NAL unit
+  // the parameter sets when it started, written ahead of it
+  struct SegmenterRange chunk_sets[SEGMENTER_SETS];
+  uint64_t chunk_bytes;
+  uint64_t chunk_pictures;
+  double chunk_seconds;
+  uint32_t chunk_irap_type;
+  uint8_t chunk_has_irap;
+  uint8_t dropping_rasl;
+  uint64_t dropped_pictures;
+  int32_t poc_min;
+  int32_t poc_max;
+
+  struct H265PocState poc;
+};
+
+int SegmenterOpen(struct Segmenter* seg,
+                  const struct SegmenterConfig* config,
+                  const char* input_path);
+// Called after h265_parse_nal with each NAL unit of the input.
+int SegmenterPushNal(struct Segmenter* seg,
+                     const struct h265_decode_t* dec,
+                     const struct NalUnit* nal);
+// Writes the last chunk and the manifest.
+int SegmenterClose(struct Segmenter* seg);
+
+#endif
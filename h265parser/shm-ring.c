@@ -0,0 +1,393 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+#include "shm-ring.h"
+
+#ifdef _WIN32
+
+int ShmRingCreate(struct ShmRing* ring, const char* name, uint64_t capacity) {
+  fprintf(stderr, "shared memory rings are not supported on Windows\n");
+  return -1;
+}
+
+int ShmRingAttach(struct ShmRing* ring, const char* name) {
+  fprintf(stderr, "shared memory rings are not supported on Windows\n");
+  return -1;
+}
+
+int ShmRingOpenInput(struct ShmRing* ring, struct NalInput* in) {
+  return -1;
+}
+
+void ShmRingClose(struct ShmRing* ring) {}
+
+int ShmRingProduce(const struct ShmProducerConfig* config,
+                   struct ShmProducerStats* stats) {
+  fprintf(stderr, "shared memory rings are not supported on Windows\n");
+  return -1;
+}
+
+#else
+
+#define AtomicLoad(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define AtomicStore(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+// polls with the processor handed to the other side, then sleeps
+#define SHM_RING_SPINS 64
+#define SHM_RING_SLEEP_NS 50000
+
+static double Now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void Pause(uint32_t* spins) {
+  if (++*spins < SHM_RING_SPINS) {
+    sched_yield();
+  } else {
+    struct timespec ts = {0, SHM_RING_SLEEP_NS};
+    nanosleep(&ts, NULL);
+  }
+}
+
+static int Map(struct ShmRing* ring, int fd, uint64_t header_size,
+               uint64_t capacity) {
+  // reserve the whole range, then map the object over it and its data again
+  // right after
+  uint8_t* base;
+  ring->map_size = header_size + 2 * capacity;
+  base = (uint8_t*)mmap(NULL, ring->map_size, PROT_NONE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (base == MAP_FAILED)
+    return -1;
+  if (mmap(base, header_size + capacity, PROT_READ | PROT_WRITE,
+           MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+      mmap(base + header_size + capacity, capacity, PROT_READ | PROT_WRITE,
+           MAP_SHARED | MAP_FIXED, fd, (off_t)header_size) == MAP_FAILED) {
+    munmap(base, ring->map_size);
+    return -1;
+  }
+  ring->header = (struct ShmRingHeader*)base;
+  ring->data = base + header_size;
+  ring->mask = capacity - 1;
+  return 0;
+}
+
+int ShmRingCreate(struct ShmRing* ring, const char* name, uint64_t capacity) {
+  uint64_t page = (uint64_t)sysconf(_SC_PAGESIZE), size, header_size;
+  int fd;
+  memset(ring, 0, sizeof(*ring));
+  header_size = page > 4096 ? page : 4096;
+  for (size = page; size < capacity; size <<= 1) {
+  }
+  fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd < 0) {
+    fprintf(stderr, "couldn't create the ring %s: %s\n", name,
+            strerror(errno));
+    return -1;
+  }
+  if (ftruncate(fd, (off_t)(header_size + size)) != 0 ||
+      Map(ring, fd, header_size, size) != 0) {
+    fprintf(stderr, "couldn't map the ring %s: %s\n", name, strerror(errno));
+    close(fd);
+    shm_unlink(name);
+    return -1;
+  }
+  close(fd);
+  strncpy(ring->name, name, sizeof(ring->name) - 1);
+  ring->owner = 1;
+  ring->header->capacity = size;
+  ring->header->header_size = header_size;
+  ring->header->version = SHM_RING_VERSION;
+  AtomicStore(&ring->header->magic, SHM_RING_MAGIC);
+  return 0;
+}
+
+int ShmRingAttach(struct ShmRing* ring, const char* name) {
+  struct ShmRingHeader header;
+  void* p;
+  uint32_t spins = 0;
+  int fd;
+  memset(ring, 0, sizeof(*ring));
+  for (;;) {
+    fd = shm_open(name, O_RDWR, 0);
+    if (fd >= 0)
+      break;
+    if (errno != ENOENT) {
+      fprintf(stderr, "couldn't open the ring %s: %s\n", name,
+              strerror(errno));
+      return -1;
+    }
+    if (!spins)
+      fprintf(stderr, "waiting for the ring %s\n", name);
+    Pause(&spins);
+  }
+  // the header is written last by the producer
+  for (;;) {
+    struct stat st;
+    if (fstat(fd, &st) == 0 && (uint64_t)st.st_size >= sizeof(header)) {
+      p = mmap(NULL, sizeof(header), PROT_READ, MAP_SHARED, fd, 0);
+      if (p == MAP_FAILED) {
+        fprintf(stderr, "couldn't map the ring %s: %s\n", name,
+                strerror(errno));
+        close(fd);
+        return -1;
+      }
+      header.magic = AtomicLoad(&((struct ShmRingHeader*)p)->magic);
+      if (header.magic == SHM_RING_MAGIC)
+        memcpy(&header, p, sizeof(header));
+      munmap(p, sizeof(header));
+      if (header.magic == SHM_RING_MAGIC)
+        break;
+    }
+    Pause(&spins);
+  }
+  if (header.version != SHM_RING_VERSION ||
+      !header.capacity || (header.capacity & (header.capacity - 1)) ||
+      Map(ring, fd, header.header_size, header.capacity) != 0) {
+    fprintf(stderr, "%s is not a ring of this version\n", name);
+    close(fd);
+    return -1;
+  }
+  close(fd);
+  strncpy(ring->name, name, sizeof(ring->name) - 1);
+  ring->pos = AtomicLoad(&ring->header->read);
+  AtomicStore(&ring->header->attached, 1);
+  return 0;
+}
+
+void ShmRingClose(struct ShmRing* ring) {
+  // a consumer that stops, at the end or on an error, lets the producer go
+  if (ring->header && !ring->owner)
+    AtomicStore(&ring->header->attached, 0);
+  if (ring->header)
+    munmap(ring->header, ring->map_size);
+  if (ring->owner)
+    shm_unlink(ring->name);
+  ring->header = NULL;
+}
+
+static uint32_t StartCodeBytes(const uint8_t* p, uint64_t avail) {
+  if (avail >= 3 && p[0] == 0 && p[1] == 0 && p[2] == 1)
+    return 3;
+  if (avail >= 4 && p[0] == 0 && p[1] == 0 && p[2] == 0 && p[3] == 1)
+    return 4;
+  return 0;
+}
+
+// Offset of the first 00 00 01 at or after |from|, or |size|.
+static uint64_t FindStartCode(const uint8_t* p, uint64_t from, uint64_t size) {
+  uint64_t i;
+  for (i = from; i + 3 <= size; i++) {
+    if (p[i + 2] > 1)
+      i += 2;
+    else if (p[i] == 0 && p[i + 1] == 0 && p[i + 2] == 1)
+      return i;
+  }
+  return size;
+}
+
+static int RingNext(struct NalInput* in, struct NalUnit* nal) {
+  // B.2 as in the file reader: a NAL unit runs to the next start code, or to
+  // the end of the data once the producer closed the ring
+  struct ShmRing* ring = (struct ShmRing*)in->opaque;
+  struct ShmRingHeader* h = ring->header;
+  uint32_t spins = 0;
+  // the previous NAL unit goes back to the producer
+  AtomicStore(&h->read, ring->pos);
+  for (;;) {
+    uint32_t closed = AtomicLoad(&h->closed);
+    uint64_t avail = AtomicLoad(&h->write) - ring->pos, next;
+    uint8_t* p = ring->data + (ring->pos & ring->mask);
+    uint32_t sc;
+    if (avail < 4 && !closed) {
+      ring->waits++;
+      Pause(&spins);
+      continue;
+    }
+    sc = StartCodeBytes(p, avail);
+    if (sc == 0) {
+      // leading zero_byte or garbage before the first start code
+      if (avail == 0)
+        return 0;
+      ring->pos++;
+      ring->scanned = 0;
+      AtomicStore(&h->read, ring->pos);
+      continue;
+    }
+    next = FindStartCode(p, ring->scanned > sc ? ring->scanned : sc, avail);
+    if (next == avail && !closed) {
+      if (avail > ring->mask) {
+        fprintf(stderr, "NAL unit at 0x%llX exceeds the %llu byte ring\n",
+                (unsigned long long)ring->pos,
+                (unsigned long long)ring->mask + 1);
+        return -1;
+      }
+      // the last two bytes may start one
+      ring->scanned = avail > 2 ? avail - 2 : 0;
+      ring->waits++;
+      Pause(&spins);
+      continue;
+    }
+    // a zero_byte before the next start code belongs to it
+    if (next < avail && next > sc && p[next - 1] == 0)
+      next--;
+    ring->scanned = 0;
+    nal->data = p + sc;
+    nal->size = (uint32_t)(next - sc);
+    nal->prefix_bytes = sc;
+    nal->offset = ring->pos;
+    nal->from_config = 0;
+    nal->partial = 0;
+    nal->pts = nal->dts = -1;
+    ring->pos += next;
+    if (nal->size == 0)
+      continue;
+    return 1;
+  }
+}
+
+int ShmRingOpenInput(struct ShmRing* ring, struct NalInput* in) {
+  memset(in, 0, sizeof(*in));
+  in->format = NAL_INPUT_ANNEXB;
+  in->next = RingNext;
+  in->opaque = ring;
+  return 0;
+}
+
+// Producer side of the test tool: write times of the chunks the consumer
+// hasn't handed back yet
+struct Pending {
+  uint64_t end[SHM_RING_MAX_CHUNKS];
+  double time[SHM_RING_MAX_CHUNKS];
+  uint32_t head;
+  uint32_t tail;
+};
+
+static void Collect(struct ShmRing* ring,
+                    struct Pending* pending,
+                    struct ShmProducerStats* stats) {
+  uint64_t read = AtomicLoad(&ring->header->read);
+  double now = Now();
+  while (pending->head != pending->tail &&
+         pending->end[pending->head % SHM_RING_MAX_CHUNKS] <= read) {
+    double t = pending->time[pending->head % SHM_RING_MAX_CHUNKS];
+    StatsHistogramAdd(&stats->latency_us, (uint64_t)((now - t) * 1e6));
+    pending->head++;
+  }
+}
+
+int ShmRingProduce(const struct ShmProducerConfig* config,
+                   struct ShmProducerStats* stats) {
+  struct ShmRing ring;
+  struct ShmRingHeader* h;
+  struct Pending* pending;
+  uint64_t write = 0, capacity, want, ask = 0;
+  uint32_t loop, spins = 0;
+  double start;
+  int ret = 0;
+  FILE* fp = fopen(config->input, "rb");
+  memset(stats, 0, sizeof(*stats));
+  if (!fp) {
+    fprintf(stderr, "couldn't open %s\n", config->input);
+    return -1;
+  }
+  pending = (struct Pending*)calloc(1, sizeof(*pending));
+  if (!pending || ShmRingCreate(&ring, config->name, config->capacity) != 0) {
+    free(pending);
+    fclose(fp);
+    return -1;
+  }
+  h = ring.header;
+  capacity = ring.mask + 1;
+  want = config->chunk < capacity ? config->chunk : capacity;
+  fprintf(stderr, "waiting for a consumer of %s (%llu bytes)\n", config->name,
+          (unsigned long long)capacity);
+  while (!AtomicLoad(&h->attached))
+    Pause(&spins);
+  start = Now();
+  for (loop = 0; loop < config->loops && ret == 0; loop++) {
+    size_t n;
+    rewind(fp);
+    do {
+      uint64_t space;
+      spins = 0;
+      // Wait for room and a slot to time the write. A whole chunk may never
+      // fit: the consumer holds on to an unfinished NAL unit until the ring
+      // is full, so whatever room there is gets written.
+      for (;;) {
+        uint32_t attached = AtomicLoad(&h->attached);
+        Collect(&ring, pending, stats);
+        space = capacity - (write - AtomicLoad(&h->read));
+        if (space > 0 &&
+            pending->tail - pending->head < SHM_RING_MAX_CHUNKS)
+          break;
+        if (!attached) {
+          fprintf(stderr, "the consumer of %s stopped\n", config->name);
+          ret = -1;
+          break;
+        }
+        if (!spins)
+          stats->full_waits++;
+        Pause(&spins);
+      }
+      if (ret != 0)
+        break;
+      ask = space < want ? space : want;
+      if (config->rate > 0) {
+        double due = start + stats->bytes / (config->rate * 1e6);
+        while (Now() < due) {
+          Collect(&ring, pending, stats);
+          Pause(&spins);
+        }
+      }
+      // contiguous thanks to the mirror
+      n = fread(ring.data + (write & ring.mask), 1, (size_t)ask, fp);
+      if (n == 0)
+        break;
+      write += n;
+      pending->end[pending->tail % SHM_RING_MAX_CHUNKS] = write;
+      pending->time[pending->tail % SHM_RING_MAX_CHUNKS] = Now();
+      pending->tail++;
+      AtomicStore(&h->write, write);
+      stats->bytes += n;
+      stats->writes++;
+    } while (n == ask);
+    if (ret == 0 && ferror(fp)) {
+      fprintf(stderr, "couldn't read %s\n", config->input);
+      ret = -1;
+    }
+  }
+  AtomicStore(&h->closed, 1);
+  // the consumer hands everything back once it reached the end, unless it
+  // stopped first
+  spins = 0;
+  while (ret == 0) {
+    uint32_t attached = AtomicLoad(&h->attached);
+    Collect(&ring, pending, stats);
+    if (pending->head == pending->tail)
+      break;
+    if (!attached) {
+      fprintf(stderr, "the consumer of %s stopped\n", config->name);
+      ret = -1;
+    }
+    Pause(&spins);
+  }
+  stats->seconds = Now() - start;
+  ShmRingClose(&ring);
+  free(pending);
+  fclose(fp);
+  return ret;
+}
+
+#endif
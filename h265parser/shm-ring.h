@@ -0,0 +1,99 @@
+#ifndef SHM_RING_H_
+#define SHM_RING_H_
+
+#include <stdint.h>
+#include "nal-input.h"
+#include "stream-stats.h"
+
+// Single producer, single consumer ring buffer in POSIX shared memory, for
+// parsing an Annex B byte stream straight from the memory of a capture
+// process. The shared memory object (shm_open) is laid out as
+//
+//   0            struct ShmRingHeader, padded to header_size
+//   header_size  capacity bytes of data
+//
+// header_size is a multiple of the page size and capacity a power of two
+// multiple of it. Cursors count the bytes since the ring was created; byte n
+// is at data[n & (capacity - 1)].
+//
+// The producer fills data[write, read + capacity), then stores |write| with
+// release ordering; the consumer loads |write| with acquire ordering, uses
+// data[read, write), then stores |read| with release ordering to hand the
+// bytes back. |closed| is set by the producer after its last |write|. Each
+// side writes only its own cache line; neither takes a lock.
+//
+// Both sides map the data twice, back to back, so that data[i] and
+// data[i + capacity] are the same byte: anything up to capacity bytes long is
+// contiguous in memory wherever it starts. NAL units are handed to the parser
+// in place and must fit in the ring; the consumer fails on one that fills it
+// without a start code after it, and clears |attached| when it stops.
+
+#define SHM_RING_MAGIC 0x52353632  // "265R"
+#define SHM_RING_VERSION 1
+#define SHM_RING_MAX_CHUNKS 4096
+
+struct ShmRingHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t capacity;
+  uint64_t header_size;
+  uint8_t pad0[40];
+  // written by the producer
+  uint64_t write;
+  uint32_t closed;
+  uint8_t pad1[52];
+  // written by the consumer
+  uint64_t read;
+  uint32_t attached;  // a consumer attached
+  uint8_t pad2[52];
+};
+
+struct ShmRing {
+  struct ShmRingHeader* header;
+  uint8_t* data;  // 2 * capacity bytes, the second half mirroring the first
+  uint64_t mask;
+  uint64_t map_size;
+  char name[256];
+  uint8_t owner;  // created the object, and removes it
+
+  // consumer: the NAL unit handed out last ends at |pos|, |scanned| bytes
+  // after it have no start code
+  uint64_t pos;
+  uint64_t scanned;
+  uint64_t waits;
+};
+
+// Producer: creates the ring |name| ("/name") with at least |capacity| bytes.
+int ShmRingCreate(struct ShmRing* ring, const char* name, uint64_t capacity);
+// Consumer: attaches to the ring |name|, waiting for it to be created.
+int ShmRingAttach(struct ShmRing* ring, const char* name);
+// Delivers the NAL units of an attached ring through |in|, in place. A NAL
+// unit stays in the ring until the next one is asked for.
+int ShmRingOpenInput(struct ShmRing* ring, struct NalInput* in);
+void ShmRingClose(struct ShmRing* ring);
+
+// Producer test tool: writes |input| into a new ring |loops| times in writes
+// of up to |chunk| bytes, at |rate| MB/s or as fast as the consumer takes
+// them. Fails if the consumer stops before taking everything.
+// Latency runs from a write to the consumer handing its last byte back.
+struct ShmProducerConfig {
+  const char* name;
+  const char* input;
+  uint64_t capacity;
+  uint32_t chunk;
+  uint32_t loops;
+  double rate;  // 0: unlimited
+};
+
+struct ShmProducerStats {
+  uint64_t bytes;
+  uint64_t writes;
+  uint64_t full_waits;  // writes that waited for the consumer
+  double seconds;       // from the consumer attaching to it handing all back
+  struct StatsHistogram latency_us;
+};
+
+int ShmRingProduce(const struct ShmProducerConfig* config,
+                   struct ShmProducerStats* stats);
+
+#endif
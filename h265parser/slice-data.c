@@ -0,0 +1,2045 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#endif
+#include "slice-data.h"
+#include "h265const.h"
+
+// threads and the atomics the substreams synchronize with, and inlining of
+// the decoding engine
+#ifdef _WIN32
+typedef HANDLE Thread;
+typedef CRITICAL_SECTION Mutex;
+typedef CONDITION_VARIABLE Cond;
+#define THREAD_FUNC DWORD WINAPI
+#define MutexInit(m) InitializeCriticalSection(m)
+#define MutexDestroy(m) DeleteCriticalSection(m)
+#define MutexLock(m) EnterCriticalSection(m)
+#define MutexUnlock(m) LeaveCriticalSection(m)
+#define CondInit(c) InitializeConditionVariable(c)
+#define CondDestroy(c) ((void)(c))
+#define CondWait(c, m) SleepConditionVariableCS((c), (m), INFINITE)
+#define CondBroadcast(c) WakeAllConditionVariable(c)
+#define AtomicLoad(p) (*(volatile LONG*)(p))
+#define AtomicStore(p, v) InterlockedExchange((volatile LONG*)(p), (v))
+#define AtomicAdd(p, v) InterlockedExchangeAdd((volatile LONG*)(p), (v))
+#define YieldThread() SwitchToThread()
+#define ALWAYS_INLINE __forceinline
+#else
+typedef pthread_t Thread;
+typedef pthread_mutex_t Mutex;
+typedef pthread_cond_t Cond;
+#define THREAD_FUNC void*
+#define MutexInit(m) pthread_mutex_init((m), NULL)
+#define MutexDestroy(m) pthread_mutex_destroy(m)
+#define MutexLock(m) pthread_mutex_lock(m)
+#define MutexUnlock(m) pthread_mutex_unlock(m)
+#define CondInit(c) pthread_cond_init((c), NULL)
+#define CondDestroy(c) pthread_cond_destroy(c)
+#define CondWait(c, m) pthread_cond_wait((c), (m))
+#define CondBroadcast(c) pthread_cond_broadcast(c)
+#define AtomicLoad(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define AtomicStore(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define AtomicAdd(p, v) __atomic_fetch_add((p), (v), __ATOMIC_ACQ_REL)
+#define YieldThread() sched_yield()
+#define ALWAYS_INLINE __attribute__((always_inline)) __inline__
+#endif
+
+// context variables of each syntax element, Table 9-4
+enum {
+  CTX_SAO_MERGE = 0,
+  CTX_SAO_TYPE = 1,
+  CTX_SPLIT_CU = 2,
+  CTX_TRANSQUANT_BYPASS = 5,
+  CTX_SKIP = 6,
+  CTX_PRED_MODE = 9,
+  CTX_PART_MODE = 10,
+  CTX_PREV_INTRA_LUMA = 14,
+  CTX_INTRA_CHROMA = 15,
+  CTX_RQT_ROOT_CBF = 16,
+  CTX_MERGE_FLAG = 17,
+  CTX_MERGE_IDX = 18,
+  CTX_INTER_PRED = 19,
+  CTX_REF_IDX = 24,
+  CTX_MVP = 26,
+  CTX_SPLIT_TRANSFORM = 27,
+  CTX_CBF_LUMA = 30,
+  CTX_CBF_CHROMA = 32,
+  CTX_MVD_GREATER0 = 37,
+  CTX_MVD_GREATER1 = 38,
+  CTX_CU_QP_DELTA = 39,
+  CTX_TRANSFORM_SKIP = 41,
+  CTX_LAST_X = 43,
+  CTX_LAST_Y = 61,
+  CTX_CODED_SUB_BLOCK = 79,
+  CTX_SIG_COEFF = 83,
+  CTX_GREATER1 = 127,
+  CTX_GREATER2 = 151,
+  CTX_COUNT = 157
+};
+
+// initValue of each context variable by initType, Tables 9-5 to 9-37
+static const uint8_t kInitValues[3][CTX_COUNT] = {
+    {153, 200, 139, 141, 157, 154, 154, 154, 154, 154, 184, 154, 154, 154,
+     184, 63,  154, 154, 154, 154, 154, 154, 154, 154, 154, 154, 154, 153,
+     138, 138, 111, 141, 94,  138, 182, 154, 154, 154, 154, 154, 154, 139,
+     139, 110, 110, 124, 125, 140, 153, 125, 127, 140, 109, 111, 143, 127,
+     111, 79,  108, 123, 63,  110, 110, 124, 125, 140, 153, 125, 127, 140,
+     109, 111, 143, 127, 111, 79,  108, 123, 63,  91,  171, 134, 141, 111,
+     111, 125, 110, 110, 94,  124, 108, 124, 107, 125, 141, 179, 153, 125,
+     107, 125, 141, 179, 153, 125, 107, 125, 141, 179, 153, 125, 140, 139,
+     182, 182, 152, 136, 152, 136, 153, 136, 139, 111, 136, 139, 111, 141,
+     111, 140, 92,  137, 138, 140, 152, 138, 139, 153, 74,  149, 92,  139,
+     107, 122, 152, 140, 179, 166, 182, 140, 227, 122, 197, 138, 153, 136,
+     167, 152, 152},
+    {153, 185, 107, 139, 126, 154, 197, 185, 201, 149, 154, 139, 154, 154,
+     154, 152, 79,  110, 122, 95,  79,  63,  31,  31,  153, 153, 168, 124,
+     138, 94,  153, 111, 149, 107, 167, 154, 154, 140, 198, 154, 154, 139,
+     139, 125, 110, 94,  110, 95,  79,  125, 111, 110, 78,  110, 111, 111,
+     95,  94,  108, 123, 108, 125, 110, 94,  110, 95,  79,  125, 111, 110,
+     78,  110, 111, 111, 95,  94,  108, 123, 108, 121, 140, 61,  154, 155,
+     154, 139, 153, 139, 123, 123, 63,  153, 166, 183, 140, 136, 153, 154,
+     166, 183, 140, 136, 153, 154, 166, 183, 140, 136, 153, 154, 170, 153,
+     123, 123, 107, 121, 107, 121, 167, 151, 183, 140, 151, 183, 140, 140,
+     140, 154, 196, 196, 167, 154, 152, 167, 182, 182, 134, 149, 136, 153,
+     121, 136, 137, 169, 194, 166, 167, 154, 167, 137, 182, 107, 167, 91,
+     122, 107, 167},
+    {153, 160, 107, 139, 126, 154, 197, 185, 201, 134, 154, 139, 154, 154,
+     183, 152, 79,  154, 137, 95,  79,  63,  31,  31,  153, 153, 168, 224,
+     167, 122, 153, 111, 149, 92,  167, 154, 154, 169, 198, 154, 154, 139,
+     139, 125, 110, 124, 110, 95,  94,  125, 111, 111, 79,  125, 126, 111,
+     111, 79,  108, 123, 93,  125, 110, 124, 110, 95,  94,  125, 111, 111,
+     79,  125, 126, 111, 111, 79,  108, 123, 93,  121, 140, 61,  154, 170,
+     154, 139, 153, 139, 123, 123, 63,  124, 166, 183, 140, 136, 153, 154,
+     166, 183, 140, 136, 153, 154, 166, 183, 140, 136, 153, 154, 170, 153,
+     138, 138, 122, 121, 122, 121, 167, 151, 183, 140, 151, 183, 140, 140,
+     140, 154, 196, 167, 167, 154, 152, 167, 182, 182, 134, 149, 136, 153,
+     121, 136, 122, 169, 208, 166, 167, 154, 152, 167, 182, 107, 167, 91,
+     107, 107, 167}};
+
+// Table 9-46, by pStateIdx and qRangeIdx
+static const uint8_t kRangeTabLps[64][4] = {
+    {128, 176, 208, 240}, {128, 167, 197, 227}, {128, 158, 187, 216},
+    {123, 150, 178, 205}, {116, 142, 169, 195}, {111, 135, 160, 185},
+    {105, 128, 152, 175}, {100, 122, 144, 166}, {95, 116, 137, 158},
+    {90, 110, 130, 150},  {85, 104, 123, 142},  {81, 99, 117, 135},
+    {77, 94, 111, 128},   {73, 89, 105, 122},   {69, 85, 100, 116},
+    {66, 80, 95, 110},    {62, 76, 90, 104},    {59, 72, 86, 99},
+    {56, 69, 81, 94},     {53, 65, 77, 89},     {51, 62, 73, 85},
+    {48, 59, 69, 80},     {46, 56, 66, 76},     {43, 53, 63, 72},
+    {41, 50, 59, 69},     {39, 48, 56, 65},     {37, 45, 54, 62},
+    {35, 43, 51, 59},     {33, 41, 48, 56},     {32, 39, 46, 53},
+    {30, 37, 43, 50},     {29, 35, 41, 48},     {27, 33, 39, 45},
+    {26, 31, 37, 43},     {24, 30, 35, 41},     {23, 28, 33, 39},
+    {22, 27, 32, 37},     {21, 26, 30, 35},     {20, 24, 29, 33},
+    {19, 23, 27, 31},     {18, 22, 26, 30},     {17, 21, 25, 28},
+    {16, 20, 23, 27},     {15, 19, 22, 25},     {14, 18, 21, 24},
+    {14, 17, 20, 23},     {13, 16, 19, 22},     {12, 15, 18, 21},
+    {12, 14, 17, 20},     {11, 14, 16, 19},     {11, 13, 15, 18},
+    {10, 12, 15, 17},     {10, 12, 14, 16},     {9, 11, 13, 15},
+    {9, 11, 12, 14},      {8, 10, 12, 14},      {8, 9, 11, 13},
+    {7, 9, 11, 12},       {7, 9, 10, 12},       {7, 8, 10, 11},
+    {6, 8, 9, 11},        {6, 7, 9, 10},        {6, 7, 8, 9},
+    {2, 2, 2, 2}};
+
+// Table 9-47
+static const uint8_t kTransIdxLps[64] = {
+    0,  0,  1,  2,  2,  4,  4,  5,  6,  7,  8,  9,  9,  11, 11, 12,
+    13, 13, 15, 15, 16, 16, 18, 18, 19, 19, 21, 21, 22, 22, 23, 24,
+    24, 25, 26, 26, 27, 27, 28, 29, 29, 30, 30, 30, 31, 32, 32, 33,
+    33, 33, 34, 34, 35, 35, 35, 36, 36, 36, 37, 37, 37, 38, 38, 63};
+
+// Tables of the engine below, built from the two above: rangeTabLps by
+// qRangeIdx << 7 | state, the state after a bin by 128 + state for the most
+// probable symbol and 127 - state for the least probable one, and the
+// renormalization shift of a range by its value
+static uint8_t kLpsRange[512];
+static uint8_t kNextState[256];
+static uint8_t kNormShift[512];
+
+// 9.3.4.3 arithmetic decoding engine, reading 16 bits at a time. |low| is
+// ivlOffset << 17 with the bits read ahead below it, then a marker bit: the
+// bits left are 16 less the marker position, and the next two bytes are
+// read when it reaches bit 16. States are pStateIdx << 1 | valMps.
+struct Cabac {
+  const uint8_t* base;  // start of the substream, for positions
+  const uint8_t* cur;
+  const uint8_t* end;
+  uint32_t low;
+  uint32_t range;
+  uint32_t overrun;  // bytes read past the end, as zeros
+};
+
+static uint32_t CabacByte(struct Cabac* c) {
+  if (c->cur < c->end)
+    return *c->cur++;
+  c->overrun++;
+  return 0;
+}
+
+static void CabacRefill(struct Cabac* c) {
+  // the marker is at bit 16 + shift
+  uint32_t shift = 7 - kNormShift[(c->low ^ (c->low - 1)) >> 15], bits;
+  if (c->end - c->cur >= 2) {
+    bits = (uint32_t)c->cur[0] << 8 | c->cur[1];
+    c->cur += 2;
+  } else {
+    bits = CabacByte(c) << 8;
+    bits |= CabacByte(c);
+  }
+  c->low += ((bits << 1) - 0xffff) << shift;
+}
+
+// 9.3.2.5, at |start| of the substream at |base|
+static void CabacStart(struct Cabac* c,
+                       const uint8_t* base,
+                       const uint8_t* start,
+                       const uint8_t* end) {
+  c->base = base;
+  c->cur = start;
+  c->end = end;
+  c->overrun = 0;
+  c->range = 510;
+  c->low = CabacByte(c) << 18;
+  c->low |= CabacByte(c) << 10;
+  c->low |= 1 << 9;
+}
+
+// Bits of the substream read by the engine of 9.3.4.3, which reads 9 at
+// initialization.
+static uint32_t CabacPosition(const struct Cabac* c) {
+  uint32_t marker = 0, low = c->low;
+  while (!(low & 1)) {
+    low >>= 1;
+    marker++;
+  }
+  return (uint32_t)(c->cur - c->base + c->overrun) * 8 + marker - 16;
+}
+
+// 9.3.4.3.2. The context is stored first: as a uint8_t it may alias the
+// engine state, which is then kept in registers from bin to bin.
+static ALWAYS_INLINE uint32_t CabacBin(struct Cabac* c, uint8_t* ctx) {
+  int32_t state = *ctx, lps_mask;
+  uint32_t range = c->range, low = c->low, scaled, lps, shift;
+  lps = kLpsRange[((range & 0xc0) << 1) + state];
+  range -= lps;
+  scaled = range << 17;
+  lps_mask = (int32_t)(scaled - low) >> 31;
+  low -= scaled & lps_mask;
+  range += (lps - range) & lps_mask;
+  state ^= lps_mask;
+  *ctx = kNextState[128 + state];
+  shift = kNormShift[range];
+  c->range = range << shift;
+  c->low = low << shift;
+  if (!(c->low & 0xffff))
+    CabacRefill(c);
+  return state & 1;
+}
+
+// 9.3.4.3.4
+static ALWAYS_INLINE uint32_t CabacBypass(struct Cabac* c) {
+  uint32_t scaled;
+  c->low <<= 1;
+  if (!(c->low & 0xffff))
+    CabacRefill(c);
+  scaled = c->range << 17;
+  if (c->low >= scaled) {
+    c->low -= scaled;
+    return 1;
+  }
+  return 0;
+}
+
+static uint32_t CabacBypassBits(struct Cabac* c, uint32_t n) {
+  uint32_t v = 0;
+  while (n--)
+    v = (v << 1) | CabacBypass(c);
+  return v;
+}
+
+// 9.3.4.3.5
+static uint32_t CabacTerminate(struct Cabac* c) {
+  c->range -= 2;
+  if (c->low >= c->range << 17)
+    return 1;
+  if (c->range < 256) {
+    c->range <<= 1;
+    c->low <<= 1;
+    if (!(c->low & 0xffff))
+      CabacRefill(c);
+  }
+  return 0;
+}
+
+// After a terminating bin of 1 the last bit the engine read is the
+// rbsp_stop_one_bit, alignment_bit_equal_to_one or the bit before
+// pcm_alignment_zero_bits: the rest of its byte must be zeros. Returns the
+// byte after it, or 0 if the bits differ.
+static uint32_t CabacAlignedEnd(const struct Cabac* c) {
+  uint32_t last = CabacPosition(c) - 1;
+  if (last / 8 >= (uint32_t)(c->end - c->base))
+    return 0;
+  if (((c->base[last / 8] << (last % 8)) & 0xff) != 0x80)
+    return 0;
+  return last / 8 + 1;
+}
+
+static int32_t Clip3(int32_t lo, int32_t hi, int32_t v) {
+  return v < lo ? lo : v > hi ? hi : v;
+}
+
+// 9.3.2.2
+static void InitContexts(uint8_t* ctx, uint32_t init_type, int32_t qp) {
+  const uint8_t* init = kInitValues[init_type];
+  uint32_t i;
+  qp = Clip3(0, 51, qp);
+  for (i = 0; i < CTX_COUNT; i++) {
+    int32_t m = (init[i] >> 4) * 5 - 45, n = ((init[i] & 15) << 3) - 16;
+    int32_t pre = Clip3(1, 126, ((m * qp) >> 4) + n);
+    ctx[i] = pre <= 63 ? (uint8_t)((63 - pre) << 1)
+                       : (uint8_t)(((pre - 64) << 1) | 1);
+  }
+}
+
+// sigCtx of 9.3.4.2.5 for 4x4 transform blocks, and by prevCsbf otherwise
+static const uint8_t kSigCtx4x4[16] = {0, 1, 4, 5, 2, 3, 4, 5,
+                                       6, 6, 8, 8, 7, 7, 8, 8};
+static const uint8_t kSigCtxPattern[4][16] = {
+    {2, 1, 1, 0, 1, 1, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0},
+    {2, 2, 2, 2, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0},
+    {2, 1, 0, 0, 2, 1, 0, 0, 2, 1, 0, 0, 2, 1, 0, 0},
+    {2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2}};
+
+// 6.5.3 to 6.5.5 scans of 1x1 to 8x8 blocks, by log2 size and scanIdx:
+// positions as x | y << 3, and the scan position of each y * size + x
+static uint8_t kScan[4][3][64];
+static uint8_t kScanPos[4][3][64];
+// the sigCtx patterns above by scanIdx and scan position in a sub-block,
+// kSigCtxPattern first and kSigCtx4x4 last
+static uint8_t kSigCtxScan[5][3][16];
+static int tables_built;
+
+static void BuildTables(void) {
+  uint32_t log2, size, i, x, y;
+  if (tables_built)
+    return;
+  for (i = 0; i < 512; i++) {
+    kLpsRange[i] = kRangeTabLps[(i & 127) >> 1][i >> 7];
+    for (x = i, y = 9; x; x >>= 1)
+      y--;
+    kNormShift[i] = (uint8_t)y;
+  }
+  for (i = 0; i < 128; i++) {
+    uint32_t state = i >> 1, mps = i & 1;
+    kNextState[128 + i] = (uint8_t)((state < 62 ? state + 1 : 62) << 1 | mps);
+    kNextState[127 - i] = (uint8_t)(kTransIdxLps[state] << 1 |
+                                    (state == 0 ? !mps : mps));
+  }
+  for (log2 = 0; log2 < 4; log2++) {
+    size = 1u << log2;
+    // up-right diagonal
+    i = 0;
+    for (x = 0; x < 2 * size - 1; x++) {
+      for (y = x + 1; y-- > 0;) {
+        if (y < size && x - y < size)
+          kScan[log2][0][i++] = (uint8_t)((x - y) | y << 3);
+      }
+    }
+    for (i = 0; i < size * size; i++) {
+      kScan[log2][1][i] = (uint8_t)(i % size | (i / size) << 3);
+      kScan[log2][2][i] = (uint8_t)(i / size | (i % size) << 3);
+    }
+    for (i = 0; i < 3 * size * size; i++) {
+      uint32_t scan = i / (size * size), n = i % (size * size);
+      uint8_t p = kScan[log2][scan][n];
+      kScanPos[log2][scan][(p >> 3) * size + (p & 7)] = (uint8_t)n;
+    }
+  }
+  for (i = 0; i < 5 * 3 * 16; i++) {
+    uint32_t scan = i / 16 % 3, n = i % 16, p = kScan[2][scan][n];
+    const uint8_t* pattern = i < 4 * 48 ? kSigCtxPattern[i / 48] : kSigCtx4x4;
+    kSigCtxScan[i / 48][scan][n] = pattern[(p >> 3) * 4 + (p & 7)];
+  }
+  tables_built = 1;
+}
+
+// Table 8-3, mode 4:2:2 chroma is predicted with
+static const uint8_t kChroma422[35] = {
+    0,  1,  2,  2,  2,  2,  3,  5,  7,  8,  10, 11, 13, 15, 16, 18, 19, 20,
+    21, 22, 23, 23, 24, 24, 25, 25, 26, 27, 27, 28, 28, 29, 29, 30, 31};
+
+enum {
+  PART_2Nx2N,
+  PART_2NxN,
+  PART_Nx2N,
+  PART_NxN,
+  PART_2NxnU,
+  PART_2NxnD,
+  PART_nLx2N,
+  PART_nRx2N
+};
+
+enum { PRED_L0, PRED_L1, PRED_BI };
+
+// SliceData.cb_info bits of a minimum coding block
+#define CB_DEPTH 3    // CtDepth
+#define CB_SKIP 4     // cu_skip_flag
+#define CB_INTRA 8    // MODE_INTRA without pcm_flag, for 8.4.2
+#define SUBSTREAM_FINISHED 0x7fffffff
+
+struct SliceDataSubstream {
+  const uint8_t* data;
+  uint32_t size;
+  uint32_t first_ts;
+  uint32_t end_ts;
+  int32_t above;  // WPP: the substream of the CTB row above, or -1
+  uint32_t first_x;
+  long done;  // CTUs walked, SUBSTREAM_FINISHED once it stops
+};
+
+// The slice segment being walked, read-only to the workers but for the
+// counters.
+struct SliceDataJob {
+  struct SliceData* sd;
+  const struct H265SeqParameterSet* sps;
+  const struct H265PicParameterSet* pps;
+  const struct H265SliceSegmentHeader* ssh;
+  uint8_t contexts[SLICE_DATA_CONTEXTS];  // initialized for the slice
+  uint32_t count;                         // substreams
+  uint32_t slice_addr_rs;
+  uint32_t first_ts;
+  uint32_t min_tb_log2;
+  uint32_t max_tb_log2;
+  uint32_t min_qp_delta_log2;  // Log2MinCuQpDeltaSize
+  uint32_t max_merge_cand;
+  uint32_t pcm_min_log2;
+  uint32_t pcm_max_log2;
+  uint32_t pcm_bits_luma;
+  uint32_t pcm_bits_chroma;
+  uint32_t sao_offset_max[3];
+  uint8_t sao;
+  uint8_t wpp;
+  long next;  // the next substream to claim
+  long failed;
+};
+
+// State of the CU being walked
+struct SliceDataCu {
+  uint8_t bypass;
+  uint8_t intra;
+  uint8_t part_mode;
+  uint8_t merge;  // merge_flag of the first PU
+  uint8_t max_trafo_depth;
+  uint8_t intra_split;
+  uint8_t inter_split;
+  uint8_t luma_modes[4];
+  uint8_t chroma_modes[4];
+  uint32_t x0;
+  uint32_t y0;
+  uint32_t log2;
+};
+
+struct SliceDataWorker {
+  struct SliceData* sd;
+  struct SliceDataJob* job;
+  struct Cabac cabac;
+  uint8_t ctx[SLICE_DATA_CONTEXTS];
+  struct SliceDataStats stats;
+  struct SliceDataCtu ctu;
+  const char* error;
+  uint32_t error_addr;
+
+  // the CTB being walked
+  uint32_t ctb_x;
+  uint32_t ctb_y;
+  uint8_t avail_left;
+  uint8_t avail_up;
+  uint8_t qp_delta_coded;  // IsCuQpDeltaCoded
+};
+
+struct SliceDataPool {
+  uint32_t threads;  // besides the calling one
+  Thread* handles;
+  Mutex mutex;
+  Cond wake;
+  Cond done;
+  uint32_t generation;
+  uint32_t running;
+  uint8_t quit;
+  struct SliceDataJob* job;
+};
+
+static void Fail(struct SliceDataWorker* w, const char* error) {
+  if (!w->error)
+    w->error = error;
+}
+
+// 6.4.1 for the left and above neighbours of the block at |x|, |y| of the
+// CTB being walked
+static int Available(const struct SliceDataWorker* w, int32_t x, int32_t y) {
+  uint32_t cx, cy;
+  if (x < 0 || y < 0)
+    return 0;
+  cx = (uint32_t)x >> w->sd->ctb_log2;
+  cy = (uint32_t)y >> w->sd->ctb_log2;
+  if (cy == w->ctb_y)
+    return cx == w->ctb_x || w->avail_left;
+  return w->avail_up;
+}
+
+static uint8_t CbInfo(const struct SliceDataWorker* w, uint32_t x, uint32_t y) {
+  const struct SliceData* sd = w->sd;
+  return sd->cb_info[(y >> sd->min_cb_log2) * sd->width_min_cbs +
+                     (x >> sd->min_cb_log2)];
+}
+
+static void SetCbInfo(struct SliceDataWorker* w,
+                      uint32_t x0,
+                      uint32_t y0,
+                      uint32_t log2,
+                      uint8_t info) {
+  struct SliceData* sd = w->sd;
+  uint32_t n = 1u << (log2 - sd->min_cb_log2), i;
+  uint8_t* p = sd->cb_info + (y0 >> sd->min_cb_log2) * sd->width_min_cbs +
+               (x0 >> sd->min_cb_log2);
+  for (i = 0; i < n; i++, p += sd->width_min_cbs)
+    memset(p, info, n);
+}
+
+// 7.3.8.3
+static void SaoSyntax(struct SliceDataWorker* w, uint32_t rx, uint32_t ry) {
+  struct SliceData* sd = w->sd;
+  const struct SliceDataJob* job = w->job;
+  const struct H265SliceSegmentHeader* ssh = job->ssh;
+  struct Cabac* c = &w->cabac;
+  uint32_t rs = ry * sd->width_ctbs + rx, cidx, type = 0, i;
+  uint32_t components = job->sps->ChromaArrayType ? 3 : 1;
+  if (rx > 0 && rs > job->slice_addr_rs &&
+      sd->tile_id[rs - 1] == sd->tile_id[rs]) {
+    if (CabacBin(c, &w->ctx[CTX_SAO_MERGE]))
+      return;
+  }
+  if (ry > 0 && rs - sd->width_ctbs >= job->slice_addr_rs &&
+      sd->tile_id[rs - sd->width_ctbs] == sd->tile_id[rs]) {
+    if (CabacBin(c, &w->ctx[CTX_SAO_MERGE]))
+      return;
+  }
+  for (cidx = 0; cidx < components; cidx++) {
+    if (cidx == 0 ? !ssh->slice_sao_luma_flag : !ssh->slice_sao_chroma_flag)
+      continue;
+    // sao_type_idx_luma, sao_type_idx_chroma; Cr shares the Cb one
+    if (cidx < 2) {
+      type = 0;
+      if (CabacBin(c, &w->ctx[CTX_SAO_TYPE]))
+        type = CabacBypass(c) ? 2 : 1;
+    }
+    if (type == 0)
+      continue;
+    {
+      uint32_t abs[4];
+      for (i = 0; i < 4; i++) {
+        abs[i] = 0;
+        while (abs[i] < job->sao_offset_max[cidx] && CabacBypass(c))
+          abs[i]++;
+      }
+      if (type == 1) {
+        for (i = 0; i < 4; i++) {
+          if (abs[i])
+            CabacBypass(c);  // sao_offset_sign
+        }
+        CabacBypassBits(c, 5);  // sao_band_position
+      } else if (cidx < 2) {
+        CabacBypassBits(c, 2);  // sao_eo_class_luma, sao_eo_class_chroma
+      }
+    }
+  }
+}
+
+// k-th order Exp-Golomb bypass bins, 9.3.3.3
+static uint32_t ExpGolombBypass(struct SliceDataWorker* w, uint32_t k) {
+  uint32_t v = 0;
+  while (CabacBypass(&w->cabac)) {
+    v += 1u << k;
+    if (++k == 32) {
+      Fail(w, "Exp-Golomb prefix too long");
+      return 0;
+    }
+  }
+  return v + CabacBypassBits(&w->cabac, k);
+}
+
+// 7.3.8.9
+static void MvdCoding(struct SliceDataWorker* w) {
+  struct Cabac* c = &w->cabac;
+  uint32_t gt0x = CabacBin(c, &w->ctx[CTX_MVD_GREATER0]);
+  uint32_t gt0y = CabacBin(c, &w->ctx[CTX_MVD_GREATER0]);
+  uint32_t gt1x = gt0x ? CabacBin(c, &w->ctx[CTX_MVD_GREATER1]) : 0;
+  uint32_t gt1y = gt0y ? CabacBin(c, &w->ctx[CTX_MVD_GREATER1]) : 0;
+  if (gt0x) {
+    if (gt1x)
+      ExpGolombBypass(w, 1);  // abs_mvd_minus2
+    CabacBypass(c);           // mvd_sign_flag
+  }
+  if (gt0y) {
+    if (gt1y)
+      ExpGolombBypass(w, 1);
+    CabacBypass(c);
+  }
+}
+
+// merge_idx, TR with cMax MaxNumMergeCand - 1
+static void MergeIdx(struct SliceDataWorker* w) {
+  uint32_t cmax = w->job->max_merge_cand - 1, idx;
+  if (cmax == 0 || !CabacBin(&w->cabac, &w->ctx[CTX_MERGE_IDX]))
+    return;
+  for (idx = 1; idx < cmax && CabacBypass(&w->cabac); idx++) {
+  }
+}
+
+// ref_idx_l0, ref_idx_l1, TR with cMax num_ref_idx_active_minus1
+static void RefIdx(struct SliceDataWorker* w, uint32_t cmax) {
+  uint32_t idx;
+  for (idx = 0; idx < cmax; idx++) {
+    uint32_t bin = idx < 2 ? CabacBin(&w->cabac, &w->ctx[CTX_REF_IDX + idx])
+                           : CabacBypass(&w->cabac);
+    if (!bin)
+      break;
+  }
+}
+
+// 7.3.8.6
+static void PredictionUnit(struct SliceDataWorker* w,
+                           struct SliceDataCu* cu,
+                           uint32_t width,
+                           uint32_t height,
+                           uint32_t depth,
+                           int first) {
+  const struct H265SliceSegmentHeader* ssh = w->job->ssh;
+  struct Cabac* c = &w->cabac;
+  uint32_t merge = CabacBin(c, &w->ctx[CTX_MERGE_FLAG]), pred = PRED_L0;
+  if (first)
+    cu->merge = (uint8_t)merge;
+  if (merge) {
+    w->stats.merge_pus++;
+    MergeIdx(w);
+    return;
+  }
+  w->stats.amvp_pus++;
+  if (ssh->slice_type == H265_SLICE_TYPE_B) {
+    // inter_pred_idc, 9.3.4.2.2
+    if (width + height != 12 &&
+        CabacBin(c, &w->ctx[CTX_INTER_PRED + depth]))
+      pred = PRED_BI;
+    else
+      pred = CabacBin(c, &w->ctx[CTX_INTER_PRED + 4]) ? PRED_L1 : PRED_L0;
+  }
+  if (pred != PRED_L1) {
+    RefIdx(w, ssh->num_ref_idx_l0_active_minus1);
+    MvdCoding(w);
+    CabacBin(c, &w->ctx[CTX_MVP]);  // mvp_l0_flag
+  }
+  if (pred != PRED_L0) {
+    RefIdx(w, ssh->num_ref_idx_l1_active_minus1);
+    if (!(ssh->mvd_l1_zero_flag && pred == PRED_BI))
+      MvdCoding(w);
+    CabacBin(c, &w->ctx[CTX_MVP]);  // mvp_l1_flag
+  }
+}
+
+// part_mode, 9.3.3.7
+static uint32_t PartMode(struct SliceDataWorker* w,
+                         const struct SliceDataCu* cu) {
+  struct Cabac* c = &w->cabac;
+  uint8_t* ctx = &w->ctx[CTX_PART_MODE];
+  if (CabacBin(c, &ctx[0]))
+    return PART_2Nx2N;
+  if (cu->intra)
+    return PART_NxN;
+  if (cu->log2 == w->sd->min_cb_log2) {
+    if (CabacBin(c, &ctx[1]))
+      return PART_2NxN;
+    if (cu->log2 == 3)
+      return PART_Nx2N;
+    return CabacBin(c, &ctx[2]) ? PART_Nx2N : PART_NxN;
+  }
+  if (!w->job->sps->amp_enabled_flag)
+    return CabacBin(c, &ctx[1]) ? PART_2NxN : PART_Nx2N;
+  if (CabacBin(c, &ctx[1])) {
+    if (CabacBin(c, &ctx[3]))
+      return PART_2NxN;
+    return CabacBypass(c) ? PART_2NxnD : PART_2NxnU;
+  }
+  if (CabacBin(c, &ctx[3]))
+    return PART_Nx2N;
+  return CabacBypass(c) ? PART_nRx2N : PART_nLx2N;
+}
+
+// candIntraPredModeX of 8.4.2
+static uint32_t NeighbourMode(const struct SliceDataWorker* w,
+                              int32_t x,
+                              int32_t y) {
+  const struct SliceData* sd = w->sd;
+  if (!Available(w, x, y) || !(CbInfo(w, x, y) & CB_INTRA))
+    return 1;
+  return sd->intra_mode[(y >> 2) * sd->width_4x4 + (x >> 2)];
+}
+
+// intra_chroma_pred_mode to IntraPredModeC, 8.4.3
+static uint8_t ChromaMode(struct SliceDataWorker* w, uint32_t luma) {
+  static const uint8_t kModes[4] = {0, 26, 10, 1};
+  struct Cabac* c = &w->cabac;
+  uint32_t mode = luma;
+  if (CabacBin(c, &w->ctx[CTX_INTRA_CHROMA])) {
+    mode = kModes[CabacBypassBits(c, 2)];
+    if (mode == luma)
+      mode = 34;
+  }
+  if (w->job->sps->ChromaArrayType == 2)
+    mode = kChroma422[mode];
+  return (uint8_t)mode;
+}
+
+// The intra prediction modes of 7.3.8.5 and 8.4.2
+static void IntraModes(struct SliceDataWorker* w, struct SliceDataCu* cu) {
+  struct SliceData* sd = w->sd;
+  struct Cabac* c = &w->cabac;
+  uint32_t pbs = cu->part_mode == PART_NxN ? 4 : 1;
+  uint32_t size = pbs == 4 ? 1u << (cu->log2 - 1) : 1u << cu->log2;
+  uint32_t prev[4], i, j, k;
+  for (k = 0; k < pbs; k++)
+    prev[k] = CabacBin(c, &w->ctx[CTX_PREV_INTRA_LUMA]);
+  for (k = 0; k < pbs; k++) {
+    uint32_t x = cu->x0 + (k & 1) * size, y = cu->y0 + (k >> 1) * size;
+    uint32_t a = NeighbourMode(w, (int32_t)x - 1, (int32_t)y), b = 1;
+    uint32_t cand[3], mode;
+    uint8_t* row;
+    // B only within the CTB
+    if (y & ((1u << sd->ctb_log2) - 1))
+      b = NeighbourMode(w, (int32_t)x, (int32_t)y - 1);
+    if (a == b) {
+      if (a < 2) {
+        cand[0] = 0;
+        cand[1] = 1;
+        cand[2] = 26;
+      } else {
+        cand[0] = a;
+        cand[1] = 2 + ((a + 29) % 32);
+        cand[2] = 2 + ((a - 2 + 1) % 32);
+      }
+    } else {
+      cand[0] = a;
+      cand[1] = b;
+      cand[2] = a != 0 && b != 0 ? 0 : a != 1 && b != 1 ? 1 : 26;
+    }
+    if (prev[k]) {
+      // mpm_idx, TR with cMax 2
+      i = CabacBypass(c) ? 1 + CabacBypass(c) : 0;
+      mode = cand[i];
+    } else {
+      uint32_t t;
+      mode = CabacBypassBits(c, 5);  // rem_intra_luma_pred_mode
+      if (cand[0] > cand[1]) {
+        t = cand[0], cand[0] = cand[1], cand[1] = t;
+      }
+      if (cand[0] > cand[2]) {
+        t = cand[0], cand[0] = cand[2], cand[2] = t;
+      }
+      if (cand[1] > cand[2]) {
+        t = cand[1], cand[1] = cand[2], cand[2] = t;
+      }
+      for (i = 0; i < 3; i++) {
+        if (mode >= cand[i])
+          mode++;
+      }
+    }
+    cu->luma_modes[k] = (uint8_t)mode;
+    row = sd->intra_mode + (y >> 2) * sd->width_4x4 + (x >> 2);
+    for (j = 0; j < size >> 2; j++, row += sd->width_4x4)
+      memset(row, (int)mode, size >> 2);
+  }
+  if (w->job->sps->ChromaArrayType == 3) {
+    for (k = 0; k < pbs; k++)
+      cu->chroma_modes[k] = ChromaMode(w, cu->luma_modes[k]);
+  } else if (w->job->sps->ChromaArrayType != 0) {
+    cu->chroma_modes[0] = ChromaMode(w, cu->luma_modes[0]);
+  }
+}
+
+// pcm_sample(), past the pcm_alignment_zero_bits; the engine restarts
+// after it
+static void PcmSample(struct SliceDataWorker* w, const struct SliceDataCu* cu) {
+  const struct SliceDataJob* job = w->job;
+  const struct H265SeqParameterSet* sps = job->sps;
+  struct Cabac* c = &w->cabac;
+  uint64_t bits = (uint64_t)job->pcm_bits_luma << (2 * cu->log2);
+  if (sps->ChromaArrayType) {
+    bits += 2 * (uint64_t)job->pcm_bits_chroma *
+            (((1u << cu->log2) / sps->SubWidthC) *
+             ((1u << cu->log2) / sps->SubHeightC));
+  }
+  uint32_t start = CabacAlignedEnd(c);
+  if (!start) {
+    Fail(w, "pcm_flag not followed by the alignment bits");
+    return;
+  }
+  if ((uint64_t)(c->end - c->base) - start < (bits + 7) / 8) {
+    Fail(w, "pcm_sample past the end of the substream");
+    return;
+  }
+  CabacStart(c, c->base, c->base + start + (bits + 7) / 8, c->end);
+}
+
+// 7.3.8.11
+static void ResidualCoding(struct SliceDataWorker* w,
+                           const struct SliceDataCu* cu,
+                           uint32_t x0,
+                           uint32_t y0,
+                           uint32_t log2,
+                           uint32_t cidx) {
+  const struct SliceDataJob* job = w->job;
+  struct Cabac* c = &w->cabac;
+  uint8_t* ctx = w->ctx;
+  uint32_t scan = 0, last_x, last_y, prefix_x, prefix_y, cmax = 2 * log2 - 1;
+  uint32_t offset, shift, sb_log2 = log2 - 2, last_sb, last_pos, i;
+  uint32_t greater1 = 1, rs_offset, chroma = cidx > 0;
+  uint64_t coded = 0;  // coded_sub_block_flag of each sub-block, y * 8 + x
+  const uint8_t* scan_sb;
+
+  if (cu->intra &&
+      (log2 == 2 ||
+       (log2 == 3 && (cidx == 0 || job->sps->ChromaArrayType == 3)))) {
+    uint32_t k = 0, mode;
+    if (cu->part_mode == PART_NxN && (cidx == 0 ||
+                                      job->sps->ChromaArrayType == 3)) {
+      uint32_t half = 1u << (cu->log2 - 1);
+      k = (x0 >= cu->x0 + half) + 2 * (y0 >= cu->y0 + half);
+    }
+    mode = cidx == 0 ? cu->luma_modes[k] : cu->chroma_modes[k];
+    if (mode >= 6 && mode <= 14)
+      scan = 2;
+    else if (mode >= 22 && mode <= 30)
+      scan = 1;
+  }
+
+  if (job->pps->transform_skip_enabled_flag && !cu->bypass && log2 == 2) {
+    if (CabacBin(c, &ctx[CTX_TRANSFORM_SKIP + chroma]))
+      w->stats.transform_skip_blocks++;
+  }
+
+  // last_sig_coeff_{x,y}_{prefix,suffix}, 9.3.4.2.3
+  if (chroma) {
+    offset = 15;
+    shift = log2 - 2;
+  } else {
+    offset = 3 * (log2 - 2) + ((log2 - 1) >> 2);
+    shift = (log2 + 1) >> 2;
+  }
+  for (prefix_x = 0;
+       prefix_x < cmax &&
+       CabacBin(c, &ctx[CTX_LAST_X + offset + (prefix_x >> shift)]);
+       prefix_x++) {
+  }
+  for (prefix_y = 0;
+       prefix_y < cmax &&
+       CabacBin(c, &ctx[CTX_LAST_Y + offset + (prefix_y >> shift)]);
+       prefix_y++) {
+  }
+  last_x = prefix_x;
+  if (prefix_x > 3) {
+    uint32_t n = (prefix_x >> 1) - 1;
+    last_x = (1u << n) * (2 + (prefix_x & 1)) + CabacBypassBits(c, n);
+  }
+  last_y = prefix_y;
+  if (prefix_y > 3) {
+    uint32_t n = (prefix_y >> 1) - 1;
+    last_y = (1u << n) * (2 + (prefix_y & 1)) + CabacBypassBits(c, n);
+  }
+  if (scan == 2) {
+    uint32_t t = last_x;
+    last_x = last_y;
+    last_y = t;
+  }
+
+  scan_sb = kScan[sb_log2][scan];
+  last_sb = kScanPos[sb_log2][scan][(last_y >> 2 << sb_log2) + (last_x >> 2)];
+  last_pos = kScanPos[2][scan][((last_y & 3) << 2) + (last_x & 3)];
+  rs_offset = chroma ? 27 : 0;
+
+  for (i = last_sb + 1; i-- > 0;) {
+    uint32_t xs = scan_sb[i] & 7, ys = scan_sb[i] >> 3;
+    uint32_t prev = 0, sig = 0, infer_dc = 0, n, start;
+    uint32_t ctx_set, g1_count = 0, first_g1 = 16, nsig, hidden;
+    uint32_t rice = 0, processed = 0;
+    const uint8_t* pattern;
+    uint8_t* sig_ctx;
+
+    if (xs + 1 < (1u << sb_log2))
+      prev |= (uint32_t)(coded >> (ys * 8 + xs + 1)) & 1;
+    if (ys + 1 < (1u << sb_log2))
+      prev |= ((uint32_t)(coded >> ((ys + 1) * 8 + xs)) & 1) << 1;
+    if (i < last_sb && i > 0) {
+      uint32_t inc = (prev ? 1 : 0) + (chroma ? 2 : 0);
+      if (!CabacBin(c, &ctx[CTX_CODED_SUB_BLOCK + inc]))
+        continue;
+      infer_dc = 1;
+    }
+    coded |= 1ULL << (ys * 8 + xs);
+
+    if (i == last_sb) {
+      start = last_pos;
+      sig = 1u << last_pos;
+    } else {
+      start = 16;
+    }
+    if (log2 == 2) {
+      sig_ctx = ctx + CTX_SIG_COEFF + rs_offset;
+      pattern = kSigCtxScan[4][scan];
+    } else {
+      pattern = kSigCtxScan[prev][scan];
+      if (chroma)
+        sig_ctx = ctx + CTX_SIG_COEFF + rs_offset + (log2 == 3 ? 9 : 12);
+      else
+        sig_ctx = ctx + CTX_SIG_COEFF + (i > 0 ? 3 : 0) +
+                  (log2 == 3 ? (scan == 0 ? 9 : 15) : 21);
+    }
+    for (n = start; n-- > 1;) {
+      if (CabacBin(c, &sig_ctx[pattern[n]]))
+        sig |= 1u << n;
+    }
+    // the DC coefficient, inferred after a coded_sub_block_flag if no other
+    if (start > 0) {
+      if (infer_dc && !sig)
+        sig = 1;
+      else if (CabacBin(c, log2 > 2 && i == 0
+                               ? &ctx[CTX_SIG_COEFF + rs_offset]
+                               : &sig_ctx[pattern[0]]))
+        sig |= 1;
+    }
+    if (!sig)
+      continue;
+
+    // coeff_abs_level_greater1_flag, 9.3.4.2.6
+    ctx_set = (i == 0 || chroma) ? 0 : 2;
+    if (greater1 == 0)
+      ctx_set++;
+    greater1 = 1;
+    {
+      uint32_t g1 = 0, g2 = 0;
+      for (n = 16; n-- > 0 && g1_count < 8;) {
+        if (!(sig >> n & 1))
+          continue;
+        g1_count++;
+        if (CabacBin(c, &ctx[CTX_GREATER1 + ctx_set * 4 + greater1 +
+                             (chroma ? 16 : 0)])) {
+          g1 |= 1u << n;
+          greater1 = 0;
+          if (first_g1 == 16)
+            first_g1 = n;
+        } else if (greater1 > 0 && greater1 < 3) {
+          greater1++;
+        }
+      }
+      if (first_g1 < 16)
+        g2 = CabacBin(c, &ctx[CTX_GREATER2 + ctx_set + (chroma ? 4 : 0)]);
+
+      // coeff_sign_flag; the first one in scan order may be hidden
+      hidden = 0;
+      if (job->pps->sign_data_hiding_enabled_flag && !cu->bypass) {
+        uint32_t last = 31, first = 0;
+        while (!(sig >> last & 1))
+          last--;
+        while (!(sig >> first & 1))
+          first++;
+        hidden = last - first > 3;
+      }
+      for (nsig = 0, n = sig; n; n &= n - 1)
+        nsig++;
+      CabacBypassBits(c, nsig - hidden);
+      w->stats.coefficients += nsig;
+
+      // coeff_abs_level_remaining, 9.3.3.11
+      for (n = 16; n-- > 0;) {
+        uint32_t level, threshold;
+        if (!(sig >> n & 1))
+          continue;
+        level = 1 + (g1 >> n & 1) + (n == first_g1 ? g2 : 0);
+        threshold = processed < 8 ? (n == first_g1 ? 3 : 2) : 1;
+        processed++;
+        if (level == threshold) {
+          uint32_t prefix = 0, rem;
+          while (CabacBypass(c)) {
+            if (++prefix > 24) {
+              Fail(w, "coeff_abs_level_remaining prefix too long");
+              return;
+            }
+          }
+          if (prefix < 3)
+            rem = (prefix << rice) + CabacBypassBits(c, rice);
+          else
+            rem = (((1u << (prefix - 3)) + 2) << rice) +
+                  CabacBypassBits(c, prefix - 3 + rice);
+          if (level + rem > 3u << rice && rice < 4)
+            rice++;
+        }
+      }
+    }
+  }
+}
+
+// 7.3.8.10; |cbf| is the chroma cbf flags: Cb, Cr, then the second Cb and
+// Cr blocks of 4:2:2
+static void TransformUnit(struct SliceDataWorker* w,
+                          const struct SliceDataCu* cu,
+                          uint32_t x0,
+                          uint32_t y0,
+                          uint32_t x_base,
+                          uint32_t y_base,
+                          uint32_t log2,
+                          uint32_t blk_idx,
+                          uint32_t cbf_luma,
+                          uint32_t cbf) {
+  const struct SliceDataJob* job = w->job;
+  uint32_t cat = job->sps->ChromaArrayType, log2c, t;
+  w->stats.tus[log2 - 2]++;
+  w->ctu.tus++;
+  if (cbf_luma)
+    w->stats.coded_tus++;
+  if (!cbf_luma && !cbf)
+    return;
+  if (job->pps->cu_qp_delta_enabled_flag && !w->qp_delta_coded) {
+    // cu_qp_delta_abs: TR prefix with cMax 5, then EG0
+    struct Cabac* c = &w->cabac;
+    uint32_t v = 0;
+    while (v < 5 && CabacBin(c, &w->ctx[CTX_CU_QP_DELTA + (v > 0)]))
+      v++;
+    if (v == 5)
+      v += ExpGolombBypass(w, 0);
+    if (v)
+      CabacBypass(c);  // cu_qp_delta_sign_flag
+    w->qp_delta_coded = 1;
+  }
+  if (cbf_luma)
+    ResidualCoding(w, cu, x0, y0, log2, 0);
+  if (cat == 0 || !cbf)
+    return;
+  if (log2 > 2 || cat == 3) {
+    log2c = cat == 3 ? log2 : log2 - 1;
+  } else if (blk_idx == 3) {
+    // the chroma of four 4x4 luma blocks follows the last one
+    log2c = 2;
+    x0 = x_base;
+    y0 = y_base;
+  } else {
+    return;
+  }
+  for (t = 0; t < (cat == 2 ? 2u : 1u); t++) {
+    if (cbf & (t ? 4 : 1))
+      ResidualCoding(w, cu, x0, y0 + (t << log2c), log2c, 1);
+  }
+  for (t = 0; t < (cat == 2 ? 2u : 1u); t++) {
+    if (cbf & (t ? 8 : 2))
+      ResidualCoding(w, cu, x0, y0 + (t << log2c), log2c, 2);
+  }
+}
+
+// 7.3.8.8
+static void TransformTree(struct SliceDataWorker* w,
+                          const struct SliceDataCu* cu,
+                          uint32_t x0,
+                          uint32_t y0,
+                          uint32_t x_base,
+                          uint32_t y_base,
+                          uint32_t log2,
+                          uint32_t depth,
+                          uint32_t blk_idx,
+                          uint32_t parent_cbf) {
+  const struct SliceDataJob* job = w->job;
+  struct Cabac* c = &w->cabac;
+  uint32_t cat = job->sps->ChromaArrayType, split, cbf = 0, cbf_luma = 1;
+  if (w->error)
+    return;
+  if (log2 <= job->max_tb_log2 && log2 > job->min_tb_log2 &&
+      depth < cu->max_trafo_depth && !(cu->intra_split && depth == 0)) {
+    split = CabacBin(c, &w->ctx[CTX_SPLIT_TRANSFORM + 5 - log2]);
+  } else {
+    split = log2 > job->max_tb_log2 || (cu->intra_split && depth == 0) ||
+            (cu->inter_split && depth == 0);
+  }
+  if ((log2 > 2 && cat != 0) || cat == 3) {
+    uint8_t* ctx = &w->ctx[CTX_CBF_CHROMA + depth];
+    uint32_t second = cat == 2 && (!split || log2 == 3);
+    if (depth == 0 || (parent_cbf & 1)) {
+      cbf |= CabacBin(c, ctx);
+      if (second)
+        cbf |= CabacBin(c, ctx) << 2;
+    }
+    if (depth == 0 || (parent_cbf & 2)) {
+      cbf |= CabacBin(c, ctx) << 1;
+      if (second)
+        cbf |= CabacBin(c, ctx) << 3;
+    }
+  } else if (cat != 0) {
+    // 4x4 luma blocks: chroma of the parent, coded with the last one
+    cbf = parent_cbf;
+  }
+  if (split) {
+    uint32_t x1 = x0 + (1u << (log2 - 1)), y1 = y0 + (1u << (log2 - 1));
+    TransformTree(w, cu, x0, y0, x0, y0, log2 - 1, depth + 1, 0, cbf);
+    TransformTree(w, cu, x1, y0, x0, y0, log2 - 1, depth + 1, 1, cbf);
+    TransformTree(w, cu, x0, y1, x0, y0, log2 - 1, depth + 1, 2, cbf);
+    TransformTree(w, cu, x1, y1, x0, y0, log2 - 1, depth + 1, 3, cbf);
+    return;
+  }
+  if (cu->intra || depth != 0 || cbf)
+    cbf_luma = CabacBin(c, &w->ctx[CTX_CBF_LUMA + (depth == 0)]);
+  TransformUnit(w, cu, x0, y0, x_base, y_base, log2, blk_idx, cbf_luma, cbf);
+}
+
+// 7.3.8.5
+static void CodingUnit(struct SliceDataWorker* w,
+                       uint32_t x0,
+                       uint32_t y0,
+                       uint32_t log2,
+                       uint32_t depth) {
+  struct SliceData* sd = w->sd;
+  const struct SliceDataJob* job = w->job;
+  const struct H265SeqParameterSet* sps = job->sps;
+  struct Cabac* c = &w->cabac;
+  struct SliceDataCu cu;
+  uint32_t size = 1u << log2, skip = 0, pcm = 0;
+  memset(&cu, 0, sizeof(cu));
+  cu.x0 = x0;
+  cu.y0 = y0;
+  cu.log2 = log2;
+  cu.intra = job->ssh->slice_type == H265_SLICE_TYPE_I;
+
+  if (job->pps->transquant_bypass_enabled_flag)
+    cu.bypass = (uint8_t)CabacBin(c, &w->ctx[CTX_TRANSQUANT_BYPASS]);
+  if (job->ssh->slice_type != H265_SLICE_TYPE_I) {
+    uint32_t inc = 0;
+    if (Available(w, (int32_t)x0 - 1, (int32_t)y0) &&
+        (CbInfo(w, x0 - 1, y0) & CB_SKIP))
+      inc++;
+    if (Available(w, (int32_t)x0, (int32_t)y0 - 1) &&
+        (CbInfo(w, x0, y0 - 1) & CB_SKIP))
+      inc++;
+    skip = CabacBin(c, &w->ctx[CTX_SKIP + inc]);
+  }
+
+  if (skip) {
+    SetCbInfo(w, x0, y0, log2, (uint8_t)(depth | CB_SKIP));
+    MergeIdx(w);
+    w->stats.skip_cus++;
+    w->ctu.skip_cus++;
+  } else {
+    if (job->ssh->slice_type != H265_SLICE_TYPE_I)
+      cu.intra = (uint8_t)CabacBin(c, &w->ctx[CTX_PRED_MODE]);
+    if (!cu.intra || log2 == sd->min_cb_log2)
+      cu.part_mode = (uint8_t)PartMode(w, &cu);
+    w->stats.part_modes[cu.part_mode]++;
+    if (cu.intra) {
+      if (cu.part_mode == PART_2Nx2N && sps->pcm_enabled_flag &&
+          log2 >= job->pcm_min_log2 && log2 <= job->pcm_max_log2)
+        pcm = CabacTerminate(c);
+      SetCbInfo(w, x0, y0, log2, (uint8_t)(depth | (pcm ? 0 : CB_INTRA)));
+      if (pcm) {
+        w->stats.pcm_cus++;
+        PcmSample(w, &cu);
+      } else {
+        IntraModes(w, &cu);
+      }
+      w->stats.intra_cus++;
+      w->ctu.intra_cus++;
+    } else {
+      uint32_t half = size / 2, quarter = size / 4;
+      SetCbInfo(w, x0, y0, log2, (uint8_t)depth);
+      switch (cu.part_mode) {
+        case PART_2Nx2N:
+          PredictionUnit(w, &cu, size, size, depth, 1);
+          break;
+        case PART_2NxN:
+          PredictionUnit(w, &cu, size, half, depth, 1);
+          PredictionUnit(w, &cu, size, half, depth, 0);
+          break;
+        case PART_Nx2N:
+          PredictionUnit(w, &cu, half, size, depth, 1);
+          PredictionUnit(w, &cu, half, size, depth, 0);
+          break;
+        case PART_2NxnU:
+          PredictionUnit(w, &cu, size, quarter, depth, 1);
+          PredictionUnit(w, &cu, size, size - quarter, depth, 0);
+          break;
+        case PART_2NxnD:
+          PredictionUnit(w, &cu, size, size - quarter, depth, 1);
+          PredictionUnit(w, &cu, size, quarter, depth, 0);
+          break;
+        case PART_nLx2N:
+          PredictionUnit(w, &cu, quarter, size, depth, 1);
+          PredictionUnit(w, &cu, size - quarter, size, depth, 0);
+          break;
+        case PART_nRx2N:
+          PredictionUnit(w, &cu, size - quarter, size, depth, 1);
+          PredictionUnit(w, &cu, quarter, size, depth, 0);
+          break;
+        default:
+          PredictionUnit(w, &cu, half, half, depth, 1);
+          PredictionUnit(w, &cu, half, half, depth, 0);
+          PredictionUnit(w, &cu, half, half, depth, 0);
+          PredictionUnit(w, &cu, half, half, depth, 0);
+          break;
+      }
+    }
+    if (!pcm) {
+      uint32_t rqt_root_cbf = 1;
+      if (!cu.intra && !(cu.part_mode == PART_2Nx2N && cu.merge))
+        rqt_root_cbf = CabacBin(c, &w->ctx[CTX_RQT_ROOT_CBF]);
+      if (rqt_root_cbf) {
+        if (cu.intra) {
+          cu.intra_split = cu.part_mode == PART_NxN;
+          cu.max_trafo_depth =
+              (uint8_t)(sps->max_transform_hierarchy_depth_intra +
+                        cu.intra_split);
+        } else {
+          cu.max_trafo_depth = sps->max_transform_hierarchy_depth_inter;
+          cu.inter_split = sps->max_transform_hierarchy_depth_inter == 0 &&
+                           cu.part_mode != PART_2Nx2N;
+        }
+        TransformTree(w, &cu, x0, y0, x0, y0, log2, 0, 0, 0);
+      }
+    }
+  }
+  if (cu.bypass)
+    w->stats.bypass_cus++;
+  w->stats.cus[log2 - 3]++;
+  w->ctu.cus++;
+}
+
+// 7.3.8.4
+static void CodingQuadtree(struct SliceDataWorker* w,
+                           uint32_t x0,
+                           uint32_t y0,
+                           uint32_t log2,
+                           uint32_t depth) {
+  struct SliceData* sd = w->sd;
+  const struct SliceDataJob* job = w->job;
+  uint32_t size = 1u << log2, split;
+  if (w->error)
+    return;
+  if (x0 + size <= sd->width && y0 + size <= sd->height &&
+      log2 > sd->min_cb_log2) {
+    uint32_t inc = 0;
+    if (Available(w, (int32_t)x0 - 1, (int32_t)y0) &&
+        (CbInfo(w, x0 - 1, y0) & CB_DEPTH) > depth)
+      inc++;
+    if (Available(w, (int32_t)x0, (int32_t)y0 - 1) &&
+        (CbInfo(w, x0, y0 - 1) & CB_DEPTH) > depth)
+      inc++;
+    split = CabacBin(&w->cabac, &w->ctx[CTX_SPLIT_CU + inc]);
+  } else {
+    split = log2 > sd->min_cb_log2;
+  }
+  if (job->pps->cu_qp_delta_enabled_flag && log2 >= job->min_qp_delta_log2)
+    w->qp_delta_coded = 0;
+  if (split) {
+    uint32_t x1 = x0 + size / 2, y1 = y0 + size / 2;
+    CodingQuadtree(w, x0, y0, log2 - 1, depth + 1);
+    if (x1 < sd->width)
+      CodingQuadtree(w, x1, y0, log2 - 1, depth + 1);
+    if (y1 < sd->height)
+      CodingQuadtree(w, x0, y1, log2 - 1, depth + 1);
+    if (x1 < sd->width && y1 < sd->height)
+      CodingQuadtree(w, x1, y1, log2 - 1, depth + 1);
+  } else {
+    CodingUnit(w, x0, y0, log2, depth);
+  }
+}
+
+static int CtbInSlice(const struct SliceData* sd,
+                      uint32_t rs,
+                      uint32_t other,
+                      uint32_t slice_addr_rs) {
+  return sd->tile_id[other] == sd->tile_id[rs] &&
+         sd->ctb_slice[other] == (int32_t)slice_addr_rs;
+}
+
+// Waits until the substream above walked the CTBs up to the one above and
+// right of the CTB at |x|.
+static int WaitAbove(struct SliceDataWorker* w,
+                     const struct SliceDataSubstream* sub,
+                     uint32_t x) {
+  const struct SliceData* sd = w->sd;
+  struct SliceDataJob* job = w->job;
+  const struct SliceDataSubstream* above = &sd->substreams[sub->above];
+  uint32_t col_end = sd->col_bd[sd->tile_column[x] + 1];
+  uint32_t target = x + 1 < col_end ? x + 1 : col_end - 1;
+  long need;
+  if (target < above->first_x)
+    return 0;
+  need = (long)(target - above->first_x + 1);
+  while (AtomicLoad(&above->done) < need)
+    YieldThread();
+  if (AtomicLoad(&job->failed)) {
+    Fail(w, "the substream above failed");
+    return -1;
+  }
+  return 0;
+}
+
+// 7.3.8.1 for one substream: its CTUs, then end_of_subset_one_bit or
+// end_of_slice_segment_flag
+static void WalkSubstream(struct SliceDataWorker* w, uint32_t k) {
+  struct SliceData* sd = w->sd;
+  struct SliceDataJob* job = w->job;
+  struct SliceDataSubstream* sub = &sd->substreams[k];
+  struct Cabac* c = &w->cabac;
+  uint32_t ts = sub->first_ts, rs = sd->ts_to_rs[ts];
+  uint32_t x = rs % sd->width_ctbs, y = rs / sd->width_ctbs;
+  uint32_t col_start = sd->col_bd[sd->tile_column[x]];
+  uint32_t tile_first;
+
+  CabacStart(c, sub->data, sub->data, sub->data + sub->size);
+  w->error = NULL;
+
+  // 9.3.1 contexts at the start of the substream
+  if (sub->above >= 0 && WaitAbove(w, sub, x) != 0)
+    goto done;
+  {
+    uint32_t tile = sd->tile_id[rs];
+    uint32_t tx = sd->col_bd[tile % sd->tile_columns];
+    uint32_t ty = sd->row_bd[tile / sd->tile_columns];
+    tile_first = rs == ty * sd->width_ctbs + tx;
+  }
+  if (tile_first) {
+    memcpy(w->ctx, job->contexts, CTX_COUNT);
+  } else if (job->wpp && x == col_start) {
+    uint32_t tr = rs - sd->width_ctbs + 1;
+    if (y > 0 && x + 1 < sd->width_ctbs &&
+        CtbInSlice(sd, rs, tr, job->slice_addr_rs))
+      memcpy(w->ctx,
+             sd->wpp_contexts +
+                 (sd->tile_column[x] * sd->height_ctbs + y - 1) *
+                     SLICE_DATA_CONTEXTS,
+             CTX_COUNT);
+    else
+      memcpy(w->ctx, job->contexts, CTX_COUNT);
+  } else if (k == 0 && job->ssh->dependent_slice_segment_flag) {
+    if (!sd->ds_valid) {
+      Fail(w, "dependent slice segment without a slice segment before");
+      goto done;
+    }
+    memcpy(w->ctx, sd->ds_contexts, CTX_COUNT);
+  } else {
+    memcpy(w->ctx, job->contexts, CTX_COUNT);
+  }
+
+  for (;;) {
+    uint32_t start = CabacPosition(c), bits, end;
+    if (sub->above >= 0 && x != col_start && WaitAbove(w, sub, x) != 0)
+      break;
+    sd->ctb_slice[rs] = (int32_t)job->slice_addr_rs;
+    w->ctb_x = x;
+    w->ctb_y = y;
+    w->avail_left = x > 0 && CtbInSlice(sd, rs, rs - 1, job->slice_addr_rs);
+    w->avail_up = y > 0 &&
+                  CtbInSlice(sd, rs, rs - sd->width_ctbs, job->slice_addr_rs);
+    memset(&w->ctu, 0, sizeof(w->ctu));
+    w->ctu.addr = rs;
+
+    if (job->sao)
+      SaoSyntax(w, x, y);
+    CodingQuadtree(w, x << sd->ctb_log2, y << sd->ctb_log2, sd->ctb_log2, 0);
+    end = CabacTerminate(c);  // end_of_slice_segment_flag
+
+    bits = CabacPosition(c) - start;
+    w->ctu.bits = bits;
+    w->stats.ctus++;
+    w->stats.bits += bits;
+    StatsHistogramAdd(&w->stats.ctu_bits, bits);
+    if (sd->config.ctus)
+      sd->ctus[ts - job->first_ts] = w->ctu;
+    if (w->error)
+      break;
+    if (CabacPosition(c) > 8 * sub->size) {
+      Fail(w, "read past the end of the substream");
+      break;
+    }
+    // 9.3.2.4 WPP storage after the second CTB of a row of a tile
+    if (job->wpp && x == col_start + 1)
+      memcpy(sd->wpp_contexts +
+                 (sd->tile_column[x] * sd->height_ctbs + y) *
+                     SLICE_DATA_CONTEXTS,
+             w->ctx, CTX_COUNT);
+    AtomicStore(&sub->done, (long)(ts - sub->first_ts + 1));
+    ts++;
+
+    if (end) {
+      uint32_t i;
+      if (k + 1 != job->count) {
+        Fail(w, "end_of_slice_segment_flag before the last entry point");
+        break;
+      }
+      i = CabacAlignedEnd(c);
+      if (!i) {
+        Fail(w, "end_of_slice_segment_flag not followed by the stop bit");
+        break;
+      }
+      for (; i < sub->size; i++) {
+        if (sub->data[i]) {
+          Fail(w, "data after end_of_slice_segment_flag");
+          break;
+        }
+      }
+      if (job->pps->dependent_slice_segments_enabled_flag) {
+        memcpy(sd->ds_contexts, w->ctx, CTX_COUNT);
+        sd->ds_valid = 1;
+      }
+      break;
+    }
+    if (ts == sd->size_ctbs) {
+      Fail(w, "no end_of_slice_segment_flag in the picture");
+      break;
+    }
+    if (ts == sub->end_ts) {
+      if (k + 1 == job->count) {
+        Fail(w, "slice data continues past its last entry point");
+        break;
+      }
+      if (!CabacTerminate(c) || !CabacAlignedEnd(c)) {
+        Fail(w, "no end_of_subset_one_bit at the end of a substream");
+        break;
+      }
+      if (CabacAlignedEnd(c) != sub->size) {
+        Fail(w, "substream size differs from its entry point");
+        break;
+      }
+      break;
+    }
+    rs = sd->ts_to_rs[ts];
+    x = rs % sd->width_ctbs;
+    y = rs / sd->width_ctbs;
+  }
+
+done:
+  if (w->error) {
+    w->error_addr = rs;
+    AtomicStore(&job->failed, 1);
+  }
+  AtomicStore(&sub->done, SUBSTREAM_FINISHED);
+}
+
+// Claims substreams until there are none left.
+static void RunJob(struct SliceDataWorker* w, struct SliceDataJob* job) {
+  long k;
+  w->job = job;
+  memset(&w->stats, 0, sizeof(w->stats));
+  w->error = NULL;
+  while ((k = AtomicAdd(&job->next, 1)) < (long)job->count) {
+    WalkSubstream(w, (uint32_t)k);
+    if (w->error)
+      break;
+  }
+}
+
+static THREAD_FUNC PoolThread(void* arg) {
+  struct SliceDataWorker* w = (struct SliceDataWorker*)arg;
+  struct SliceDataPool* pool = w->sd->pool;
+  uint32_t generation = 0;
+  for (;;) {
+    struct SliceDataJob* job;
+    MutexLock(&pool->mutex);
+    while (!pool->quit && pool->generation == generation)
+      CondWait(&pool->wake, &pool->mutex);
+    if (pool->quit) {
+      MutexUnlock(&pool->mutex);
+      break;
+    }
+    generation = pool->generation;
+    job = pool->job;
+    MutexUnlock(&pool->mutex);
+
+    RunJob(w, job);
+
+    MutexLock(&pool->mutex);
+    if (--pool->running == 0)
+      CondBroadcast(&pool->done);
+    MutexUnlock(&pool->mutex);
+  }
+  return 0;
+}
+
+static int StartPool(struct SliceData* sd) {
+  struct SliceDataPool* pool;
+  uint32_t i;
+  pool = (struct SliceDataPool*)calloc(1, sizeof(*pool));
+  if (!pool)
+    return -1;
+  pool->threads = sd->config.threads - 1;
+  pool->handles = (Thread*)calloc(pool->threads, sizeof(Thread));
+  if (!pool->handles) {
+    free(pool);
+    return -1;
+  }
+  MutexInit(&pool->mutex);
+  CondInit(&pool->wake);
+  CondInit(&pool->done);
+  sd->pool = pool;
+  for (i = 0; i < pool->threads; i++) {
+    void* arg = &sd->workers[i + 1];
+#ifdef _WIN32
+    pool->handles[i] = CreateThread(NULL, 0, PoolThread, arg, 0, NULL);
+    if (!pool->handles[i])
+      break;
+#else
+    if (pthread_create(&pool->handles[i], NULL, PoolThread, arg) != 0)
+      break;
+#endif
+  }
+  pool->threads = i;
+  return 0;
+}
+
+static void StopPool(struct SliceData* sd) {
+  struct SliceDataPool* pool = sd->pool;
+  uint32_t i;
+  if (!pool)
+    return;
+  MutexLock(&pool->mutex);
+  pool->quit = 1;
+  CondBroadcast(&pool->wake);
+  MutexUnlock(&pool->mutex);
+  for (i = 0; i < pool->threads; i++) {
+#ifdef _WIN32
+    WaitForSingleObject(pool->handles[i], INFINITE);
+    CloseHandle(pool->handles[i]);
+#else
+    pthread_join(pool->handles[i], NULL);
+#endif
+  }
+  CondDestroy(&pool->wake);
+  CondDestroy(&pool->done);
+  MutexDestroy(&pool->mutex);
+  free(pool->handles);
+  free(pool);
+  sd->pool = NULL;
+}
+
+// Walks the substreams of |job| on the pool and the calling thread, and
+// returns the workers that took part.
+static uint32_t Run(struct SliceData* sd, struct SliceDataJob* job) {
+  struct SliceDataPool* pool = sd->pool;
+  if (pool && job->count > 1) {
+    MutexLock(&pool->mutex);
+    pool->job = job;
+    pool->running = pool->threads;
+    pool->generation++;
+    CondBroadcast(&pool->wake);
+    MutexUnlock(&pool->mutex);
+  }
+  RunJob(&sd->workers[0], job);
+  if (pool && job->count > 1) {
+    MutexLock(&pool->mutex);
+    while (pool->running)
+      CondWait(&pool->done, &pool->mutex);
+    MutexUnlock(&pool->mutex);
+    // every thread ran it, some found nothing left
+    return pool->threads + 1;
+  }
+  return 1;
+}
+
+static void FreeLayout(struct SliceData* sd) {
+  free(sd->rs_to_ts);
+  free(sd->ts_to_rs);
+  free(sd->tile_id);
+  free(sd->tile_column);
+  free(sd->ctb_slice);
+  free(sd->cb_info);
+  free(sd->intra_mode);
+  free(sd->wpp_contexts);
+  free(sd->ctus);
+  sd->rs_to_ts = sd->ts_to_rs = NULL;
+  sd->tile_id = NULL;
+  sd->tile_column = NULL;
+  sd->ctb_slice = NULL;
+  sd->cb_info = sd->intra_mode = sd->wpp_contexts = NULL;
+  sd->ctus = NULL;
+  sd->size_ctbs = 0;
+}
+
+// 6.5.1 CTB raster and tile scanning conversion, kept until the picture
+// size, CTB size or tiles change
+static const char* UpdateLayout(struct SliceData* sd,
+                                const struct H265SeqParameterSet* sps,
+                                const struct H265PicParameterSet* pps) {
+  uint32_t col_bd[H265_MAX_TILE_COLUMNS + 1], row_bd[H265_MAX_TILE_ROWS + 1];
+  uint32_t cols = 1, rows = 1, w = sps->PicWidthInCtbsY;
+  uint32_t h = sps->PicHeightInCtbsY, i, j, rs, ts, tile;
+  if (pps->tiles_enabled_flag) {
+    cols = pps->num_tile_columns_minus1 + 1;
+    rows = pps->num_tile_rows_minus1 + 1;
+    if (cols > H265_MAX_TILE_COLUMNS || rows > H265_MAX_TILE_ROWS ||
+        cols > w || rows > h)
+      return "too many tiles";
+  }
+  col_bd[0] = row_bd[0] = 0;
+  for (i = 0; i < cols; i++) {
+    if (pps->tiles_enabled_flag && !pps->uniform_spacing_flag && i + 1 < cols)
+      col_bd[i + 1] = col_bd[i] + pps->column_width_minus1[i] + 1;
+    else if (i + 1 < cols)
+      col_bd[i + 1] = ((i + 1) * w) / cols;
+    else
+      col_bd[i + 1] = w;
+    if (col_bd[i + 1] <= col_bd[i] || col_bd[i + 1] > w)
+      return "tile columns don't fit the picture";
+  }
+  for (j = 0; j < rows; j++) {
+    if (pps->tiles_enabled_flag && !pps->uniform_spacing_flag && j + 1 < rows)
+      row_bd[j + 1] = row_bd[j] + pps->row_height_minus1[j] + 1;
+    else if (j + 1 < rows)
+      row_bd[j + 1] = ((j + 1) * h) / rows;
+    else
+      row_bd[j + 1] = h;
+    if (row_bd[j + 1] <= row_bd[j] || row_bd[j + 1] > h)
+      return "tile rows don't fit the picture";
+  }
+  if (sd->size_ctbs && sd->width == sps->pic_width_in_luma_samples &&
+      sd->height == sps->pic_height_in_luma_samples &&
+      sd->ctb_log2 == sps->CtbLog2SizeY &&
+      sd->min_cb_log2 == sps->MinCbLog2SizeY && sd->tile_columns == cols &&
+      sd->tile_rows == rows &&
+      memcmp(sd->col_bd, col_bd, (cols + 1) * sizeof(col_bd[0])) == 0 &&
+      memcmp(sd->row_bd, row_bd, (rows + 1) * sizeof(row_bd[0])) == 0)
+    return NULL;
+
+  FreeLayout(sd);
+  sd->width = sps->pic_width_in_luma_samples;
+  sd->height = sps->pic_height_in_luma_samples;
+  sd->ctb_log2 = sps->CtbLog2SizeY;
+  sd->min_cb_log2 = sps->MinCbLog2SizeY;
+  sd->tile_columns = cols;
+  sd->tile_rows = rows;
+  memcpy(sd->col_bd, col_bd, sizeof(col_bd));
+  memcpy(sd->row_bd, row_bd, sizeof(row_bd));
+  sd->width_ctbs = w;
+  sd->height_ctbs = h;
+  sd->width_min_cbs = sps->PicWidthInMinCbsY;
+  sd->width_4x4 = sd->width >> 2;
+  sd->rs_to_ts = (uint32_t*)malloc((size_t)w * h * sizeof(uint32_t));
+  sd->ts_to_rs = (uint32_t*)malloc((size_t)w * h * sizeof(uint32_t));
+  sd->tile_id = (uint16_t*)malloc((size_t)w * h * sizeof(uint16_t));
+  sd->tile_column = (uint8_t*)malloc(w);
+  sd->ctb_slice = (int32_t*)malloc((size_t)w * h * sizeof(int32_t));
+  sd->cb_info = (uint8_t*)calloc((size_t)sps->PicWidthInMinCbsY *
+                                     sps->PicHeightInMinCbsY,
+                                 1);
+  sd->intra_mode = (uint8_t*)calloc((size_t)sd->width_4x4 * (sd->height >> 2),
+                                    1);
+  sd->wpp_contexts =
+      (uint8_t*)malloc((size_t)cols * h * SLICE_DATA_CONTEXTS);
+  sd->ctus = (struct SliceDataCtu*)malloc((size_t)w * h *
+                                          sizeof(struct SliceDataCtu));
+  if (!sd->rs_to_ts || !sd->ts_to_rs || !sd->tile_id || !sd->tile_column ||
+      !sd->ctb_slice || !sd->cb_info || !sd->intra_mode ||
+      !sd->wpp_contexts || !sd->ctus) {
+    FreeLayout(sd);
+    return "out of memory";
+  }
+  for (i = 0; i < cols; i++) {
+    for (rs = col_bd[i]; rs < col_bd[i + 1]; rs++)
+      sd->tile_column[rs] = (uint8_t)i;
+  }
+  // (6-5)
+  for (rs = 0; rs < w * h; rs++) {
+    uint32_t x = rs % w, y = rs / w, tx = sd->tile_column[x], ty = 0;
+    while (y >= row_bd[ty + 1])
+      ty++;
+    ts = 0;
+    for (i = 0; i < tx; i++)
+      ts += (row_bd[ty + 1] - row_bd[ty]) * (col_bd[i + 1] - col_bd[i]);
+    for (j = 0; j < ty; j++)
+      ts += w * (row_bd[j + 1] - row_bd[j]);
+    ts += (y - row_bd[ty]) * (col_bd[tx + 1] - col_bd[tx]) + x - col_bd[tx];
+    sd->rs_to_ts[rs] = ts;
+    sd->ts_to_rs[ts] = rs;
+  }
+  // (6-7)
+  for (j = 0, tile = 0; j < rows; j++) {
+    for (i = 0; i < cols; i++, tile++) {
+      uint32_t x, y;
+      for (y = row_bd[j]; y < row_bd[j + 1]; y++) {
+        for (x = col_bd[i]; x < col_bd[i + 1]; x++)
+          sd->tile_id[y * w + x] = (uint16_t)tile;
+      }
+    }
+  }
+  sd->size_ctbs = w * h;
+  memset(sd->ctb_slice, 0xff, (size_t)w * h * sizeof(int32_t));
+  return NULL;
+}
+
+// The RBSP offset of each substream from the escaped entry point offsets:
+// emulation prevention bytes removed before one don't count
+static const char* MapEntryPoints(const struct H265SliceSegmentHeader* ssh,
+                                  const uint8_t* rbsp,
+                                  uint32_t size,
+                                  uint32_t count,
+                                  uint32_t* starts) {
+  uint32_t k = 1, r, epbs = 0, zeros = 0;
+  uint64_t target = ssh->slice_data_byte_offset;
+  target += ssh->entry_point_offset_minus1[0] + 1;
+  for (r = 0; r < size && k < count; r++) {
+    if (zeros >= 2 && rbsp[r] <= 3) {
+      epbs++;
+      zeros = 0;
+    }
+    // an entry point on the emulation prevention byte starts after it
+    while (k < count && r + epbs >= target) {
+      starts[k] = r;
+      if (++k < count)
+        target += ssh->entry_point_offset_minus1[k - 1] + 1;
+    }
+    zeros = rbsp[r] == 0 ? zeros + 1 : 0;
+  }
+  if (k < count)
+    return "entry point past the end of the NAL unit";
+  return NULL;
+}
+
+// Splits the slice segment into substreams, 7.4.7.1: each starts at a tile
+// or, with WPP, at a CTB row of a tile.
+static const char* PrepareSubstreams(struct SliceData* sd,
+                                     struct SliceDataJob* job,
+                                     const uint8_t* rbsp,
+                                     uint32_t size) {
+  const struct H265SliceSegmentHeader* ssh = job->ssh;
+  uint32_t starts[H265_MAX_ENTRY_POINTS + 1];
+  uint32_t count = 1, k, ts = job->first_ts;
+  const char* error;
+  if (job->pps->tiles_enabled_flag || job->wpp)
+    count = ssh->num_entry_point_offsets + 1;
+  if (count > H265_MAX_ENTRY_POINTS + 1)
+    return "too many entry points";
+  starts[0] = ssh->slice_data_bit_offset / 8;
+  if (count > 1) {
+    error = MapEntryPoints(ssh, rbsp, size, count, starts);
+    if (error)
+      return error;
+  }
+  for (k = 0; k < count; k++) {
+    struct SliceDataSubstream* sub = &sd->substreams[k];
+    uint32_t end = k + 1 < count ? starts[k + 1] : size, rs;
+    if (end < starts[k] || end > size)
+      return "entry points out of order";
+    sub->data = rbsp + starts[k];
+    sub->size = end - starts[k];
+    sub->first_ts = ts;
+    sub->above = -1;
+    sub->done = 0;
+    rs = sd->ts_to_rs[ts];
+    sub->first_x = rs % sd->width_ctbs;
+    if (job->wpp && k > 0) {
+      const struct SliceDataSubstream* prev = &sd->substreams[k - 1];
+      uint32_t prev_rs = sd->ts_to_rs[prev->first_ts];
+      if (sd->tile_id[prev_rs] == sd->tile_id[rs] &&
+          prev_rs / sd->width_ctbs + 1 == rs / sd->width_ctbs)
+        sub->above = (int32_t)(k - 1);
+    }
+    // the next substream starts at the next tile or CTB row of a tile
+    for (ts++; ts < sd->size_ctbs; ts++) {
+      uint32_t next = sd->ts_to_rs[ts];
+      if (sd->tile_id[next] != sd->tile_id[sd->ts_to_rs[ts - 1]])
+        break;
+      if (job->wpp && next % sd->width_ctbs ==
+                          sd->col_bd[sd->tile_column[next % sd->width_ctbs]])
+        break;
+    }
+    sub->end_ts = ts;
+    if (k + 1 < count && ts == sd->size_ctbs)
+      return "more entry points than tiles or CTB rows";
+  }
+  job->count = count;
+  return NULL;
+}
+
+// Tiles, WPP and CTB sizes are checked by the walk itself; this refuses
+// what it doesn't know to walk.
+static const char* Unsupported(const struct H265SeqParameterSet* sps,
+                               const struct H265PicParameterSet* pps) {
+  if (sps->sps_range_extension_flag || pps->pps_range_extension_flag)
+    return "range extensions are not supported";
+  if (sps->sps_extension_6bits || pps->pps_extension_6bits)
+    return "SPS or PPS extensions are not supported";
+  if (sps->separate_colour_plane_flag)
+    return "separate colour planes are not supported";
+  if (sps->CtbLog2SizeY < 4 || sps->CtbLog2SizeY > 6 ||
+      sps->MinCbLog2SizeY < 3 || sps->MinCbLog2SizeY > sps->CtbLog2SizeY)
+    return "invalid coding block sizes";
+  // the CB and intra mode maps hold whole minimum coding blocks
+  if (sps->pic_width_in_luma_samples == 0 ||
+      sps->pic_height_in_luma_samples == 0 ||
+      sps->pic_width_in_luma_samples > SLICE_DATA_MAX_PICTURE_SIZE ||
+      sps->pic_height_in_luma_samples > SLICE_DATA_MAX_PICTURE_SIZE ||
+      sps->pic_width_in_luma_samples % sps->MinCbSizeY ||
+      sps->pic_height_in_luma_samples % sps->MinCbSizeY)
+    return "invalid picture size";
+  return NULL;
+}
+
+static const char* PrepareJob(struct SliceData* sd,
+                              struct SliceDataJob* job,
+                              const struct h265_decode_t* dec,
+                              const uint8_t* rbsp,
+                              uint32_t size) {
+  const struct H265SeqParameterSet* sps = &dec->seq_param_set;
+  const struct H265PicParameterSet* pps = &dec->pic_param_set;
+  const struct H265SliceSegmentHeader* ssh = &dec->slice_segment.header;
+  uint32_t init_type = 0, i;
+  const char* error = Unsupported(sps, pps);
+  if (error)
+    return error;
+  error = UpdateLayout(sd, sps, pps);
+  if (error)
+    return error;
+  if (ssh->slice_segment_address >= sd->size_ctbs)
+    return "slice_segment_address past the picture";
+  if (ssh->first_slice_segment_in_pic_flag) {
+    memset(sd->ctb_slice, 0xff, sd->size_ctbs * sizeof(int32_t));
+    sd->ds_valid = 0;
+  }
+  if (!ssh->dependent_slice_segment_flag)
+    sd->slice_addr_rs = ssh->slice_segment_address;
+
+  memset(job, 0, sizeof(*job));
+  job->sd = sd;
+  job->sps = sps;
+  job->pps = pps;
+  job->ssh = ssh;
+  job->slice_addr_rs = sd->slice_addr_rs;
+  job->first_ts = sd->rs_to_ts[ssh->slice_segment_address];
+  job->min_tb_log2 = sps->log2_min_luma_transform_block_size_minus2 + 2;
+  job->max_tb_log2 =
+      job->min_tb_log2 + sps->log2_diff_max_min_luma_transform_block_size;
+  job->min_qp_delta_log2 = sps->CtbLog2SizeY - pps->diff_cu_qp_delta_depth;
+  job->max_merge_cand = 5 - ssh->five_minus_max_num_merge_cand;
+  job->pcm_min_log2 = sps->log2_min_pcm_luma_coding_block_size_minus3 + 3;
+  job->pcm_max_log2 =
+      job->pcm_min_log2 + sps->log2_diff_max_min_pcm_luma_coding_block_size;
+  job->pcm_bits_luma = sps->pcm_sample_bit_depth_luma_minus1 + 1;
+  job->pcm_bits_chroma = sps->pcm_sample_bit_depth_chroma_minus1 + 1;
+  for (i = 0; i < 3; i++) {
+    uint32_t depth = 8 + (i ? sps->bit_depth_chroma_minus8
+                            : sps->bit_depth_luma_minus8);
+    job->sao_offset_max[i] = (1u << ((depth < 10 ? depth : 10) - 5)) - 1;
+  }
+  job->sao = ssh->slice_sao_luma_flag || ssh->slice_sao_chroma_flag;
+  job->wpp = pps->entropy_coding_sync_enabled_flag;
+  if (job->max_tb_log2 > 5 || job->max_tb_log2 > sps->CtbLog2SizeY)
+    return "invalid transform block sizes";
+  if (job->max_merge_cand < 1 || job->max_merge_cand > 5)
+    return "invalid five_minus_max_num_merge_cand";
+
+  // 9.3.2.2 initType
+  if (ssh->slice_type == H265_SLICE_TYPE_P)
+    init_type = ssh->cabac_init_flag ? 2 : 1;
+  else if (ssh->slice_type == H265_SLICE_TYPE_B)
+    init_type = ssh->cabac_init_flag ? 1 : 2;
+  else if (ssh->slice_type != H265_SLICE_TYPE_I)
+    return "invalid slice_type";
+  InitContexts(job->contexts, init_type,
+               26 + pps->init_qp_minus26 + ssh->slice_qp_delta);
+
+  if (ssh->slice_data_bit_offset / 8 >= size)
+    return "no slice data";
+  return PrepareSubstreams(sd, job, rbsp, size);
+}
+
+int SliceDataInit(struct SliceData* sd, const struct SliceDataConfig* config) {
+  uint32_t i;
+  memset(sd, 0, sizeof(*sd));
+  sd->config = *config;
+  if (sd->config.threads < 1)
+    sd->config.threads = 1;
+  BuildTables();
+  sd->workers = (struct SliceDataWorker*)calloc(sd->config.threads,
+                                                sizeof(struct SliceDataWorker));
+  sd->substreams = (struct SliceDataSubstream*)calloc(
+      H265_MAX_ENTRY_POINTS + 1, sizeof(struct SliceDataSubstream));
+  if (!sd->workers || !sd->substreams) {
+    SliceDataClose(sd);
+    return -1;
+  }
+  for (i = 0; i < sd->config.threads; i++)
+    sd->workers[i].sd = sd;
+  if (sd->config.threads > 1 && StartPool(sd) != 0) {
+    SliceDataClose(sd);
+    return -1;
+  }
+  return 0;
+}
+
+static int IsSlice(uint32_t type) {
+  return type <= H265_NAL_TYPE_RASL_R ||
+         (type >= H265_NAL_TYPE_BLA_W_LP && type <= H265_NAL_TYPE_CRA_NUT);
+}
+
+static void WriteCtus(const struct SliceData* sd,
+                      uint32_t count,
+                      struct OutputContextDict* out) {
+  struct OutputContextList list[1], ctu[1];
+  uint32_t i;
+  // [[CtbAddrInRs, bits, cus, skip_cus, intra_cus, tus], ...]
+  out->put_list(out, "ctu", list);
+  for (i = 0; i < count; i++) {
+    const struct SliceDataCtu* c = &sd->ctus[i];
+    list->put_list(list, ctu);
+    ctu->put_uint(ctu, c->addr);
+    ctu->put_uint(ctu, c->bits);
+    ctu->put_uint(ctu, c->cus);
+    ctu->put_uint(ctu, c->skip_cus);
+    ctu->put_uint(ctu, c->intra_cus);
+    ctu->put_uint(ctu, c->tus);
+    ctu->end(ctu);
+  }
+  list->end(list);
+}
+
+int SliceDataWalk(struct SliceData* sd,
+                  const struct h265_decode_t* dec,
+                  const uint8_t* rbsp,
+                  uint32_t size,
+                  struct OutputContextDict* out) {
+  const struct H265SliceSegmentHeader* ssh = &dec->slice_segment.header;
+  struct SliceDataJob job;
+  struct OutputContextDict dict[1];
+  const char* error;
+  uint32_t workers = 0, i, error_addr = 0;
+
+  if (!IsSlice(dec->nal_unit_header.nal_unit_type) ||
+      dec->nal_unit_header.nuh_layer_id > 0 || !ssh->slice_data_bit_offset)
+    return 0;
+  memset(&sd->slice, 0, sizeof(sd->slice));
+  sd->slice.slices = 1;
+  error = PrepareJob(sd, &job, dec, rbsp, size);
+  if (!error) {
+    workers = Run(sd, &job);
+    for (i = 0; i < workers; i++) {
+      struct SliceDataWorker* w = &sd->workers[i];
+      SliceDataStatsMerge(&sd->slice, &w->stats);
+      if (w->error && !error) {
+        error = w->error;
+        error_addr = w->error_addr;
+      }
+    }
+  }
+  if (error) {
+    sd->slice.errors = 1;
+    fprintf(stderr, "slice_data: %s (slice segment at CTB %u, CTB %u)\n",
+            error, ssh->slice_segment_address, error_addr);
+  }
+  SliceDataStatsMerge(&sd->total, &sd->slice);
+
+  out->put_dict(out, "slice_data", dict);
+  if (error)
+    dict->put_str(dict, "error", error);
+  SliceDataStatsWrite(&sd->slice, dict, 0);
+  if (sd->config.ctus && !error)
+    WriteCtus(sd, (uint32_t)sd->slice.ctus, dict);
+  dict->end(dict);
+  return error ? -1 : 0;
+}
+
+void SliceDataClose(struct SliceData* sd) {
+  StopPool(sd);
+  FreeLayout(sd);
+  free(sd->workers);
+  free(sd->substreams);
+  sd->workers = NULL;
+  sd->substreams = NULL;
+}
+
+void SliceDataStatsMerge(struct SliceDataStats* dst,
+                         const struct SliceDataStats* src) {
+  uint32_t i;
+  dst->slices += src->slices;
+  dst->errors += src->errors;
+  dst->ctus += src->ctus;
+  dst->bits += src->bits;
+  for (i = 0; i < SLICE_DATA_CU_SIZES; i++)
+    dst->cus[i] += src->cus[i];
+  dst->skip_cus += src->skip_cus;
+  dst->intra_cus += src->intra_cus;
+  dst->pcm_cus += src->pcm_cus;
+  dst->bypass_cus += src->bypass_cus;
+  for (i = 0; i < SLICE_DATA_PART_MODES; i++)
+    dst->part_modes[i] += src->part_modes[i];
+  dst->merge_pus += src->merge_pus;
+  dst->amvp_pus += src->amvp_pus;
+  for (i = 0; i < SLICE_DATA_TU_SIZES; i++)
+    dst->tus[i] += src->tus[i];
+  dst->coded_tus += src->coded_tus;
+  dst->transform_skip_blocks += src->transform_skip_blocks;
+  dst->coefficients += src->coefficients;
+  StatsHistogramMerge(&dst->ctu_bits, &src->ctu_bits);
+}
+
+void SliceDataStatsWrite(const struct SliceDataStats* stats,
+                         struct OutputContextDict* out,
+                         int histogram) {
+  static const char* kPartModes[SLICE_DATA_PART_MODES] = {
+      "PART_2Nx2N", "PART_2NxN",  "PART_Nx2N",  "PART_NxN",
+      "PART_2NxnU", "PART_2NxnD", "PART_nLx2N", "PART_nRx2N"};
+  struct OutputContextList list[1], pair[1];
+  uint32_t i;
+  out->put_uint(out, "slices", stats->slices);
+  out->put_uint(out, "errors", stats->errors);
+  out->put_uint(out, "ctus", stats->ctus);
+  out->put_uint(out, "bits", stats->bits);
+  // [[size, count], ...] of the sizes present
+  out->put_list(out, "cu_sizes", list);
+  for (i = 0; i < SLICE_DATA_CU_SIZES; i++) {
+    if (!stats->cus[i])
+      continue;
+    list->put_list(list, pair);
+    pair->put_uint(pair, 8u << i);
+    pair->put_uint(pair, stats->cus[i]);
+    pair->end(pair);
+  }
+  list->end(list);
+  out->put_uint(out, "skip_cus", stats->skip_cus);
+  out->put_uint(out, "intra_cus", stats->intra_cus);
+  out->put_uint(out, "pcm_cus", stats->pcm_cus);
+  out->put_uint(out, "transquant_bypass_cus", stats->bypass_cus);
+  out->put_list(out, "part_modes", list);
+  for (i = 0; i < SLICE_DATA_PART_MODES; i++) {
+    if (!stats->part_modes[i])
+      continue;
+    list->put_list(list, pair);
+    pair->put_str(pair, kPartModes[i]);
+    pair->put_uint(pair, stats->part_modes[i]);
+    pair->end(pair);
+  }
+  list->end(list);
+  out->put_uint(out, "merge_pus", stats->merge_pus);
+  out->put_uint(out, "amvp_pus", stats->amvp_pus);
+  out->put_list(out, "tu_sizes", list);
+  for (i = 0; i < SLICE_DATA_TU_SIZES; i++) {
+    if (!stats->tus[i])
+      continue;
+    list->put_list(list, pair);
+    pair->put_uint(pair, 4u << i);
+    pair->put_uint(pair, stats->tus[i]);
+    pair->end(pair);
+  }
+  list->end(list);
+  out->put_uint(out, "coded_tus", stats->coded_tus);
+  out->put_uint(out, "transform_skip_blocks", stats->transform_skip_blocks);
+  out->put_uint(out, "coefficients", stats->coefficients);
+  if (histogram)
+    StatsHistogramWrite(out, "ctu_bits", &stats->ctu_bits);
+}
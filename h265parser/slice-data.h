@@ -0,0 +1,130 @@
+#ifndef SLICE_DATA_H_
+#define SLICE_DATA_H_
+
+#include <stdint.h>
+#include "h265parser.h"
+#include "output-context.h"
+#include "stream-stats.h"
+
+// Walks slice_segment_data() (7.3.8) with the CABAC parsing process of 9.3
+// and nothing else: no prediction, transform or loop filter. Coding
+// quadtrees, prediction units, transform trees and residual coefficients
+// are parsed to count what the encoder chose and how many bits each CTU
+// took.
+//
+// The substreams given by entry points, one per tile or WPP row, are walked
+// by a pool of threads. Tiles are independent; a WPP row waits until the row
+// above is two CTUs ahead, as its contexts start from that CTU and split and
+// skip flags look at the CTU above.
+//
+// Slices of an SPS or PPS with range extensions change the syntax and are
+// not walked, nor are separate colour planes.
+
+#define SLICE_DATA_CU_SIZES 4     // 8x8 to 64x64
+#define SLICE_DATA_TU_SIZES 4     // 4x4 to 32x32
+#define SLICE_DATA_PART_MODES 8   // PartMode, Table 7-10
+#define SLICE_DATA_CONTEXTS 160   // context variables, padded
+// picture width and height walked at most, that of level 6.2, sqrt(8 *
+// MaxLumaPs)
+#define SLICE_DATA_MAX_PICTURE_SIZE 16888
+
+struct SliceDataStats {
+  uint64_t slices;  // slice segments walked
+  uint64_t errors;  // slice segments whose data didn't parse to the end
+  uint64_t ctus;
+  uint64_t bits;  // arithmetic coded bits of the CTUs, PCM samples included
+  uint64_t cus[SLICE_DATA_CU_SIZES];
+  uint64_t skip_cus;
+  uint64_t intra_cus;
+  uint64_t pcm_cus;
+  uint64_t bypass_cus;  // cu_transquant_bypass_flag
+  uint64_t part_modes[SLICE_DATA_PART_MODES];
+  uint64_t merge_pus;  // merge_flag; skipped CUs are not counted
+  uint64_t amvp_pus;
+  uint64_t tus[SLICE_DATA_TU_SIZES];  // transform units by luma size
+  uint64_t coded_tus;                 // cbf_luma
+  uint64_t transform_skip_blocks;
+  uint64_t coefficients;  // nonzero levels of all colour components
+  struct StatsHistogram ctu_bits;
+};
+
+// One CTU for SliceDataConfig.ctus
+struct SliceDataCtu {
+  uint32_t addr;  // CtbAddrInRs
+  uint32_t bits;
+  uint16_t cus;
+  uint16_t skip_cus;
+  uint16_t intra_cus;
+  uint16_t tus;
+};
+
+struct SliceDataConfig {
+  uint32_t threads;  // 1: substreams are walked on the calling thread
+  uint8_t ctus;      // also write a record per CTU
+};
+
+struct SliceDataWorker;
+struct SliceDataPool;
+
+struct SliceData {
+  struct SliceDataConfig config;
+  struct SliceDataStats slice;  // the slice segment walked last
+  struct SliceDataStats total;
+
+  // private:
+  struct SliceDataWorker* workers;
+  struct SliceDataPool* pool;
+
+  // picture layout of 6.5.1, rebuilt when the SPS or PPS changes it
+  uint32_t width;
+  uint32_t height;
+  uint32_t ctb_log2;
+  uint32_t min_cb_log2;
+  uint32_t tile_columns;
+  uint32_t tile_rows;
+  uint32_t col_bd[H265_MAX_TILE_COLUMNS + 1];
+  uint32_t row_bd[H265_MAX_TILE_ROWS + 1];
+  uint32_t width_ctbs;
+  uint32_t height_ctbs;
+  uint32_t size_ctbs;
+  uint32_t* rs_to_ts;
+  uint32_t* ts_to_rs;
+  uint16_t* tile_id;     // by CtbAddrInRs
+  uint8_t* tile_column;  // of each CTB column
+
+  // the picture being walked
+  int32_t* ctb_slice;   // SliceAddrRs of each CTB walked, -1 before
+  uint8_t* cb_info;     // each minimum coding block, see slice-data.c
+  uint8_t* intra_mode;  // IntraPredModeY of each 4x4 block
+  uint32_t width_min_cbs;
+  uint32_t width_4x4;
+  uint8_t* wpp_contexts;  // storage of each tile column and CTB row
+  uint8_t ds_contexts[SLICE_DATA_CONTEXTS];
+  uint32_t slice_addr_rs;
+  uint8_t ds_valid;
+
+  // per slice segment
+  struct SliceDataSubstream* substreams;
+  struct SliceDataCtu* ctus;
+};
+
+int SliceDataInit(struct SliceData* sd, const struct SliceDataConfig* config);
+// Called after h265_parse_nal with the NAL unit it parsed, all of it and
+// without emulation prevention bytes. Walks the slice data of a slice
+// segment and writes "slice_data" into |out|; other NAL units are ignored.
+// Returns 0, or -1 if the slice data didn't parse.
+int SliceDataWalk(struct SliceData* sd,
+                  const struct h265_decode_t* dec,
+                  const uint8_t* rbsp,
+                  uint32_t size,
+                  struct OutputContextDict* out);
+void SliceDataClose(struct SliceData* sd);
+
+void SliceDataStatsMerge(struct SliceDataStats* dst,
+                         const struct SliceDataStats* src);
+// Writes the counters; the CTU bits histogram only if |histogram| is set.
+void SliceDataStatsWrite(const struct SliceDataStats* stats,
+                         struct OutputContextDict* out,
+                         int histogram);
+
+#endif
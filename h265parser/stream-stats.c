@@ -0,0 +1,280 @@
+#include <string.h>
+#include "stream-stats.h"
+#include "h265const.h"
+
+static uint32_t Log2(uint64_t v) {
+  uint32_t n = 0;
+  if (v >> 32) {
+    v >>= 32;
+    n += 32;
+  }
+  if (v >> 16) {
+    v >>= 16;
+    n += 16;
+  }
+  if (v >> 8) {
+    v >>= 8;
+    n += 8;
+  }
+  if (v >> 4) {
+    v >>= 4;
+    n += 4;
+  }
+  if (v >> 2) {
+    v >>= 2;
+    n += 2;
+  }
+  return n + (uint32_t)(v >> 1);
+}
+
+static uint32_t Bucket(uint64_t v) {
+  uint32_t e;
+  if (v < STATS_SUB_BUCKETS)
+    return (uint32_t)v;
+  e = Log2(v);
+  return (e - STATS_SUB_BITS + 1) * STATS_SUB_BUCKETS +
+         (uint32_t)((v >> (e - STATS_SUB_BITS)) & (STATS_SUB_BUCKETS - 1));
+}
+
+static uint64_t BucketLow(uint32_t b) {
+  uint32_t shift;
+  if (b < STATS_SUB_BUCKETS)
+    return b;
+  shift = b / STATS_SUB_BUCKETS - 1;
+  return (uint64_t)(STATS_SUB_BUCKETS + b % STATS_SUB_BUCKETS) << shift;
+}
+
+static uint64_t BucketWidth(uint32_t b) {
+  return b < STATS_SUB_BUCKETS ? 1 : 1ULL << (b / STATS_SUB_BUCKETS - 1);
+}
+
+void StatsHistogramAdd(struct StatsHistogram* h, uint64_t val) {
+  if (h->count == 0 || val < h->min)
+    h->min = val;
+  if (val > h->max)
+    h->max = val;
+  h->count++;
+  h->sum += val;
+  h->buckets[Bucket(val)]++;
+}
+
+uint64_t StatsHistogramQuantile(const struct StatsHistogram* h, double q) {
+  uint64_t rank, seen = 0, val;
+  uint32_t b;
+  if (h->count == 0)
+    return 0;
+  rank = (uint64_t)(q * h->count + 0.5);
+  if (rank < 1)
+    rank = 1;
+  for (b = 0; b < STATS_BUCKETS; b++) {
+    seen += h->buckets[b];
+    if (seen >= rank)
+      break;
+  }
+  if (b == STATS_BUCKETS)
+    return h->max;
+  val = BucketLow(b) + (BucketWidth(b) - 1) / 2;
+  if (val < h->min)
+    return h->min;
+  return val > h->max ? h->max : val;
+}
+
+void StatsHistogramMerge(struct StatsHistogram* dst,
+                         const struct StatsHistogram* src) {
+  uint32_t b;
+  if (src->count == 0)
+    return;
+  if (dst->count == 0 || src->min < dst->min)
+    dst->min = src->min;
+  if (src->max > dst->max)
+    dst->max = src->max;
+  dst->count += src->count;
+  dst->sum += src->sum;
+  for (b = 0; b < STATS_BUCKETS; b++)
+    dst->buckets[b] += src->buckets[b];
+}
+
+void StreamStatsInit(struct StreamStats* stats) {
+  memset(stats, 0, sizeof(*stats));
+}
+
+// Starts a picture; intervals are counted from the picture that opens them.
+static void Interval(struct StatsHistogram* h,
+                     uint64_t* since,
+                     uint8_t* seen,
+                     uint8_t opens) {
+  if (opens) {
+    if (*seen)
+      StatsHistogramAdd(h, *since);
+    *since = 0;
+    *seen = 1;
+  }
+  (*since)++;
+}
+
+static void EndAccessUnit(struct StreamStats* stats) {
+  if (stats->au_bytes == 0)
+    return;
+  stats->access_units++;
+  StatsHistogramAdd(&stats->au_size, stats->au_bytes);
+  stats->au_bytes = 0;
+}
+
+void StreamStatsPushNal(struct StreamStats* stats,
+                        const struct h265_decode_t* dec,
+                        uint32_t nal_bytes,
+                        uint32_t prefix_bytes,
+                        int err) {
+  const struct H265SliceSegmentHeader* sh = &dec->slice_segment.header;
+  uint32_t type = dec->nal_unit_header.nal_unit_type;
+  uint32_t tid = dec->nal_unit_header.nuh_temporal_id_plus1 - 1u;
+  int32_t qp;
+
+  if (dec->new_access_unit)
+    EndAccessUnit(stats);
+  stats->nal_units++;
+  stats->bytes += nal_bytes + prefix_bytes;
+  stats->au_bytes += nal_bytes + prefix_bytes;
+  stats->nal_types[type & 63]++;
+  StatsHistogramAdd(&stats->nal_size, nal_bytes);
+  if (err < 0 && err > -H265_ERROR_TYPES)
+    stats->errors[-err]++;
+
+  // slice segments of the types h265_parse_nal parses, parsed
+  if (err != 0 || type > H265_NAL_TYPE_CRA_NUT ||
+      (type > H265_NAL_TYPE_RASL_R && type < H265_NAL_TYPE_BLA_W_LP))
+    return;
+  if (sh->first_slice_segment_in_pic_flag) {
+    stats->pictures++;
+    Interval(&stats->irap_interval, &stats->since_irap, &stats->seen_irap,
+             type >= H265_NAL_TYPE_BLA_W_LP);
+    Interval(&stats->gop_length, &stats->since_tid0, &stats->seen_tid0,
+             tid == 0);
+  }
+  // dependent slice segments repeat the values of the independent one
+  if (sh->dependent_slice_segment_flag)
+    return;
+  if (tid < STATS_TEMPORAL_LAYERS && sh->slice_type < STATS_SLICE_TYPES)
+    stats->slice_types[tid][sh->slice_type]++;
+  qp = 26 + dec->pic_param_set.init_qp_minus26 + sh->slice_qp_delta +
+       STATS_QP_OFFSET;
+  if (qp >= 0 && qp < STATS_QP_VALUES)
+    stats->slice_qp[qp]++;
+}
+
+void StreamStatsFinish(struct StreamStats* stats) {
+  EndAccessUnit(stats);
+}
+
+void StreamStatsMerge(struct StreamStats* dst, const struct StreamStats* src) {
+  uint32_t i, j;
+  dst->nal_units += src->nal_units;
+  dst->bytes += src->bytes;
+  dst->access_units += src->access_units;
+  dst->pictures += src->pictures;
+  for (i = 0; i < 64; i++)
+    dst->nal_types[i] += src->nal_types[i];
+  for (i = 0; i < H265_ERROR_TYPES; i++)
+    dst->errors[i] += src->errors[i];
+  for (i = 0; i < STATS_TEMPORAL_LAYERS; i++) {
+    for (j = 0; j < STATS_SLICE_TYPES; j++)
+      dst->slice_types[i][j] += src->slice_types[i][j];
+  }
+  for (i = 0; i < STATS_QP_VALUES; i++)
+    dst->slice_qp[i] += src->slice_qp[i];
+  StatsHistogramMerge(&dst->nal_size, &src->nal_size);
+  StatsHistogramMerge(&dst->au_size, &src->au_size);
+  StatsHistogramMerge(&dst->irap_interval, &src->irap_interval);
+  StatsHistogramMerge(&dst->gop_length, &src->gop_length);
+}
+
+void StatsHistogramWrite(struct OutputContextDict* out,
+                         const char* key,
+                         const struct StatsHistogram* h) {
+  struct OutputContextDict dict[1];
+  struct OutputContextList list[1], pair[1];
+  uint32_t b;
+  out->put_dict(out, key, dict);
+  dict->put_uint(dict, "count", h->count);
+  dict->put_uint(dict, "sum", h->sum);
+  dict->put_uint(dict, "min", h->min);
+  dict->put_uint(dict, "max", h->max);
+  dict->put_uint(dict, "p50", StatsHistogramQuantile(h, 0.5));
+  dict->put_uint(dict, "p90", StatsHistogramQuantile(h, 0.9));
+  dict->put_uint(dict, "p99", StatsHistogramQuantile(h, 0.99));
+  dict->put_list(dict, "buckets", list);
+  for (b = 0; b < STATS_BUCKETS; b++) {
+    if (!h->buckets[b])
+      continue;
+    list->put_list(list, pair);
+    pair->put_uint(pair, BucketLow(b));
+    pair->put_uint(pair, h->buckets[b]);
+    pair->end(pair);
+  }
+  list->end(list);
+  dict->end(dict);
+}
+
+void StreamStatsWrite(const struct StreamStats* stats,
+                      struct OutputContextDict* out) {
+  static const char* kSliceTypes[STATS_SLICE_TYPES] = {"B", "P", "I"};
+  struct OutputContextDict dict[1];
+  struct OutputContextList list[1], pair[1];
+  uint32_t i, j;
+
+  out->put_uint(out, "nal_units", stats->nal_units);
+  out->put_uint(out, "bytes", stats->bytes);
+  out->put_uint(out, "access_units", stats->access_units);
+  out->put_uint(out, "pictures", stats->pictures);
+  out->put_list(out, "nal_unit_types", list);
+  for (i = 0; i < 64; i++) {
+    if (!stats->nal_types[i])
+      continue;
+    list->put_dict(list, dict);
+    dict->put_enum(dict, "nal_unit_type", GetH265NalType(i), i);
+    dict->put_uint(dict, "count", stats->nal_types[i]);
+    dict->end(dict);
+  }
+  list->end(list);
+
+  for (i = 1, j = 0; i < H265_ERROR_TYPES; i++)
+    j += stats->errors[i] != 0;
+  if (j) {
+    out->put_dict(out, "errors", dict);
+    for (i = 1; i < H265_ERROR_TYPES; i++) {
+      if (stats->errors[i])
+        dict->put_uint(dict, h265_error_name(-(int)i), stats->errors[i]);
+    }
+    dict->end(dict);
+  }
+
+  out->put_list(out, "slice_types", list);
+  for (i = 0; i < STATS_TEMPORAL_LAYERS; i++) {
+    const uint64_t* n = stats->slice_types[i];
+    if (!n[0] && !n[1] && !n[2])
+      continue;
+    list->put_dict(list, dict);
+    dict->put_uint(dict, "temporal_id", i);
+    for (j = 0; j < STATS_SLICE_TYPES; j++)
+      dict->put_uint(dict, kSliceTypes[j], n[j]);
+    dict->end(dict);
+  }
+  list->end(list);
+
+  // [[SliceQpY, slices], ...]
+  out->put_list(out, "slice_qp", list);
+  for (i = 0; i < STATS_QP_VALUES; i++) {
+    if (!stats->slice_qp[i])
+      continue;
+    list->put_list(list, pair);
+    pair->put_int(pair, (int64_t)i - STATS_QP_OFFSET);
+    pair->put_uint(pair, stats->slice_qp[i]);
+    pair->end(pair);
+  }
+  list->end(list);
+
+  StatsHistogramWrite(out, "nal_size", &stats->nal_size);
+  StatsHistogramWrite(out, "au_size", &stats->au_size);
+  StatsHistogramWrite(out, "irap_interval", &stats->irap_interval);
+  StatsHistogramWrite(out, "gop_length", &stats->gop_length);
+}
@@ -0,0 +1,86 @@
+#ifndef STREAM_STATS_H_
+#define STREAM_STATS_H_
+
+#include <stdint.h>
+#include "h265parser.h"
+#include "output-context.h"
+
+// Per-stream distributions collected while parsing, in constant memory:
+// counters and histograms are updated NAL by NAL and no per-NAL state is
+// kept. Finished StreamStats of several threads or files merge by adding
+// them up.
+
+// Log-linear histogram: values below STATS_SUB_BUCKETS are exact, larger
+// ones fall into STATS_SUB_BUCKETS buckets per power of two, so a bucket is
+// within 1/STATS_SUB_BUCKETS of every value in it.
+#define STATS_SUB_BITS 5
+#define STATS_SUB_BUCKETS (1 << STATS_SUB_BITS)
+#define STATS_BUCKETS ((64 - STATS_SUB_BITS + 1) * STATS_SUB_BUCKETS)
+
+struct StatsHistogram {
+  uint64_t count;
+  uint64_t sum;
+  uint64_t min;
+  uint64_t max;
+  uint64_t buckets[STATS_BUCKETS];
+};
+
+// SliceQpY of 8.6.1, offset so the lowest for 16-bit video is 0
+#define STATS_QP_OFFSET 48
+#define STATS_QP_VALUES (STATS_QP_OFFSET + 52)
+#define STATS_TEMPORAL_LAYERS 7
+#define STATS_SLICE_TYPES 3  // B, P, I
+
+struct StreamStats {
+  uint64_t nal_units;
+  uint64_t bytes;
+  uint64_t access_units;
+  uint64_t pictures;
+  uint64_t nal_types[64];
+  // NAL units h265_parse_nal failed, by -H265Error
+  uint64_t errors[H265_ERROR_TYPES];
+  uint64_t slice_types[STATS_TEMPORAL_LAYERS][STATS_SLICE_TYPES];
+  uint64_t slice_qp[STATS_QP_VALUES];
+  struct StatsHistogram nal_size;
+  struct StatsHistogram au_size;
+  // pictures from an IRAP picture to the next one
+  struct StatsHistogram irap_interval;
+  // pictures from a TemporalId 0 picture to the next one, the size of the
+  // hierarchical GOP
+  struct StatsHistogram gop_length;
+
+  // the access unit and intervals in progress
+  uint64_t au_bytes;
+  uint64_t since_irap;
+  uint64_t since_tid0;
+  uint8_t seen_irap;
+  uint8_t seen_tid0;
+};
+
+void StatsHistogramAdd(struct StatsHistogram* h, uint64_t val);
+// The value below which |q| (0 to 1) of the values are, within the bucket
+// precision.
+uint64_t StatsHistogramQuantile(const struct StatsHistogram* h, double q);
+void StatsHistogramMerge(struct StatsHistogram* dst,
+                         const struct StatsHistogram* src);
+// {"count", "sum", "min", "max", "p50", "p90", "p99",
+//  "buckets": [[lowest value, count], ...]} with the non-empty buckets
+void StatsHistogramWrite(struct OutputContextDict* out,
+                         const char* key,
+                         const struct StatsHistogram* h);
+
+void StreamStatsInit(struct StreamStats* stats);
+// Called after h265_parse_nal with what it returned; sizes as for
+// HrdSimPushNal.
+void StreamStatsPushNal(struct StreamStats* stats,
+                        const struct h265_decode_t* dec,
+                        uint32_t nal_bytes,
+                        uint32_t prefix_bytes,
+                        int err);
+// Counts the access unit in progress; call before merging or writing.
+void StreamStatsFinish(struct StreamStats* stats);
+void StreamStatsMerge(struct StreamStats* dst, const struct StreamStats* src);
+void StreamStatsWrite(const struct StreamStats* stats,
+                      struct OutputContextDict* out);
+
+#endif
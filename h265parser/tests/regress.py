@@ -0,0 +1,242 @@
+#!/usr/bin/env python3
+# Regression checks that drive a built h265parser end to end:
+#
+#   python3 tests/regress.py path/to/h265parser
+#
+# Inputs are made with --generate in a temporary directory. Each check prints
+# one line; the exit status is the number of failures.
+
+import json
+import os
+import re
+import subprocess
+import sys
+import tempfile
+import time
+
+TIMEOUT = 60
+
+
+def run(args, **kwargs):
+    return subprocess.run(args, stdout=subprocess.PIPE, stderr=subprocess.PIPE,
+                          timeout=TIMEOUT, **kwargs)
+
+
+def generate(tool, path, *settings):
+    args = [tool, "--generate", path]
+    for i in range(0, len(settings), 2):
+        args += ["--gen-" + settings[i], str(settings[i + 1])]
+    run(args, check=True)
+    with open(path, "rb") as f:
+        return f.read()
+
+
+def nal_units(data):
+    # (start, nal_unit_type, first byte after the header) of each NAL unit,
+    # start including a zero_byte
+    units = []
+    for m in re.finditer(b"\x00\x00\x01", data):
+        start = m.start() - 1 if m.start() and data[m.start() - 1] == 0 \
+            else m.start()
+        header = m.end()
+        units.append((start, (data[header] >> 1) & 0x3F,
+                      data[header + 2] if header + 2 < len(data) else 0))
+    return units
+
+
+def access_units(data):
+    # 7.4.2.4.4: a VCL NAL unit with first_slice_segment_in_pic_flag, or a
+    # parameter set, prefix SEI or AUD after a VCL NAL unit starts one
+    starts = []
+    after_vcl = True
+    for start, nal_type, first in nal_units(data):
+        if nal_type < 32:
+            if first & 0x80 and (after_vcl or not starts):
+                starts.append(start)
+            after_vcl = True
+        elif 32 <= nal_type <= 39 and nal_type != 38 and after_vcl:
+            starts.append(start)
+            after_vcl = False
+    return [data[a:b] for a, b in zip(starts, starts[1:] + [len(data)])]
+
+
+def ts_packet(pid, cc, payload, pusi):
+    # one 188 byte packet of |payload|, stuffed through the adaptation field
+    header = bytes([0x47, (0x40 if pusi else 0) | pid >> 8, pid & 0xFF])
+    if len(payload) >= 184:
+        return header + bytes([0x10 | cc]) + payload[:184], payload[184:]
+    stuffing = 183 - len(payload)
+    af = bytes([stuffing]) + (b"\x00" + b"\xff" * (stuffing - 1)
+                              if stuffing else b"")
+    return header + bytes([0x30 | cc]) + af + payload, b""
+
+
+def pes_timestamp(value, prefix):
+    return bytes([prefix << 4 | (value >> 29) & 0x0E | 1, (value >> 22) & 0xFF,
+                  (value >> 14) & 0xFE | 1, (value >> 7) & 0xFF,
+                  (value << 1) & 0xFE | 1])
+
+
+def mux(aus, pts):
+    # PAT, PMT with one HEVC stream on PID 0x101, one PES packet per access
+    # unit; the demuxer doesn't check CRC_32
+    pat = bytes([0, 0, 0xB0, 13, 0, 1, 0xC1, 0, 0, 0, 1, 0xE1, 0x00,
+                 0, 0, 0, 0])
+    pmt = bytes([0, 2, 0xB0, 18, 0, 1, 0xC1, 0, 0, 0xE1, 0x01, 0xF0, 0,
+                 0x24, 0xE1, 0x01, 0xF0, 0, 0, 0, 0, 0])
+    out = bytearray(ts_packet(0, 0, pat + b"\xff" * (184 - len(pat)), 1)[0])
+    out += ts_packet(0x100, 0, pmt + b"\xff" * (184 - len(pmt)), 1)[0]
+    cc = 0
+    for au, t in zip(aus, pts):
+        pes = b"\x00\x00\x01\xe0\x00\x00\x80\x80\x05" + \
+            pes_timestamp(t, 2) + au
+        pusi = 1
+        while pes:
+            packet, pes = ts_packet(0x101, cc, pes, pusi)
+            out += packet
+            cc = (cc + 1) & 0x0F
+            pusi = 0
+    return bytes(out)
+
+
+def check_ts_timestamps(tool, tmp):
+    # More PES packets than the demuxer's timestamp ring holds: each access
+    # unit keeps its own PTS.
+    es = generate(tool, os.path.join(tmp, "ts.hevc"), "size", 200000,
+                  "intra-bytes", 2000, "inter-bytes", 500)
+    aus = access_units(es)
+    pts = [90000 + 3003 * i for i in range(len(aus))]
+    path = os.path.join(tmp, "ts.ts")
+    with open(path, "wb") as f:
+        f.write(mux(aus, pts))
+    r = run([tool, path])
+    seen = [int(v) for v in re.findall(rb'"pts": (\d+)', r.stdout)]
+    if r.returncode != 0 or seen != pts or b"dropped" in r.stderr:
+        return "%d of %d PES timestamps, first %s" % (
+            len(seen), len(pts), seen[0] if seen else None)
+    return None
+
+
+def shm_run(tool, path, name):
+    # producer and consumer of a 64 KB ring written in 3000 byte chunks
+    producer = subprocess.Popen(
+        [tool, "--shm-produce", name, "--shm-size", "65536", "--shm-chunk",
+         "3000", path], stdout=subprocess.DEVNULL, stderr=subprocess.PIPE)
+    try:
+        consumer = run([tool, "--shm", name])
+        producer.wait(timeout=TIMEOUT)
+    finally:
+        if producer.poll() is None:
+            producer.kill()
+            producer.wait()
+            # a killed producer leaves the ring behind
+            if os.path.exists("/dev/shm" + name):
+                os.remove("/dev/shm" + name)
+    return consumer, producer.returncode
+
+
+def check_shm_ring(tool, tmp):
+    # A NAL unit that fits the ring but not once a whole chunk is added still
+    # goes through; one larger than the ring fails both sides instead of
+    # leaving them waiting for each other.
+    if os.name == "nt":
+        return None
+    name = "/h265-regress-%d" % os.getpid()
+    path = os.path.join(tmp, "fits.hevc")
+    generate(tool, path, "size", 400000, "intra-bytes", 63000,
+             "inter-bytes", 500, "jitter", 0)
+    consumer, producer = shm_run(tool, path, name)
+    if consumer.returncode != 0 or producer != 0 or \
+            consumer.stdout != run([tool, path]).stdout:
+        return "63000 byte NAL units: consumer %d, producer %d" % (
+            consumer.returncode, producer)
+    path = os.path.join(tmp, "exceeds.hevc")
+    generate(tool, path, "size", 400000, "intra-bytes", 100000,
+             "inter-bytes", 500)
+    consumer, producer = shm_run(tool, path, name)
+    if consumer.returncode == 0 or producer == 0 or \
+            b"exceeds the 65536 byte ring" not in consumer.stderr:
+        return "100000 byte NAL units: consumer %d, producer %d" % (
+            consumer.returncode, producer)
+    return None
+
+
+RECORD = re.compile(rb'"nal_length": (\d+),\s*"start_code_bytes": \d+,\s*'
+                    rb'"offset": (0x[0-9A-F]+)(,\s*"partial": 1)?')
+
+
+def check_follow_partial(tool, tmp):
+    # The writer pauses inside a NAL unit for longer than --latency: the
+    # bytes so far come out as a partial record, then the whole NAL unit,
+    # and every other record is that of the finished file.
+    path = os.path.join(tmp, "follow.hevc")
+    data = generate(tool, path, "size", 100000, "intra-bytes", 5000,
+                    "inter-bytes", 800)
+    cut = 40000
+    growing = os.path.join(tmp, "growing.hevc")
+    with open(growing, "wb") as f:
+        f.write(data[:cut])
+    # stdout goes to a file, so that the parser never waits on a pipe
+    with open(os.path.join(tmp, "follow.out"), "w+b") as out:
+        follower = subprocess.Popen(
+            [tool, "--follow", "--latency", "50", "--idle", "1000", growing],
+            stdout=out, stderr=subprocess.DEVNULL)
+        time.sleep(0.5)
+        with open(growing, "ab") as f:
+            f.write(data[cut:])
+        follower.wait(timeout=TIMEOUT)
+        out.seek(0)
+        records = RECORD.findall(out.read())
+    whole = [r for r in records if not r[2]]
+    partial = [int(r[1], 16) for r in records if r[2]]
+    if follower.returncode != 0 or \
+            whole != RECORD.findall(run([tool, path]).stdout) or \
+            not any(o < cut < o + 1000 for o in partial):
+        return "%d records, partial at %s" % (len(records), partial)
+    return None
+
+
+def check_stats_inputs(tool, tmp):
+    # one summary per input, the same as for the input alone, and their
+    # merged total
+    paths = [os.path.join(tmp, "stats%d.hevc" % i) for i in range(2)]
+    for i, path in enumerate(paths):
+        generate(tool, path, "size", 50000 * (i + 1), "seed", i + 1)
+    r = run([tool, "--stats"] + paths)
+    summaries = json.loads(r.stdout) if r.returncode == 0 else []
+    alone = [json.loads(run([tool, "--stats", p]).stdout)[0] for p in paths]
+    if summaries[:-1] != alone or summaries[-1].get("files") != 2 or \
+            summaries[-1]["nal_units"] != sum(s["nal_units"] for s in alone):
+        return "%d summaries" % len(summaries)
+    return None
+
+
+CHECKS = [
+    ("ts timestamps, more PES packets than TS_MAX_TIMESTAMPS",
+     check_ts_timestamps),
+    ("shm ring of 64 KB, NAL units near and over its size", check_shm_ring),
+    ("follow, writer pausing inside a NAL unit", check_follow_partial),
+    ("stats over several inputs", check_stats_inputs),
+]
+
+
+def main():
+    if len(sys.argv) != 2:
+        sys.stderr.write("usage: %s path/to/h265parser\n" % sys.argv[0])
+        return 2
+    tool = os.path.abspath(sys.argv[1])
+    failures = 0
+    with tempfile.TemporaryDirectory() as tmp:
+        for name, check in CHECKS:
+            try:
+                problem = check(tool, tmp)
+            except subprocess.TimeoutExpired:
+                problem = "timed out after %d s" % TIMEOUT
+            print("%s: %s" % ("FAIL" if problem else "ok", name) +
+                  (" (%s)" % problem if problem else ""))
+            failures += problem is not None
+    return failures
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,256 @@
+#include <string.h>
+#include "ts-demux.h"
+
+static const uint32_t kPacketSizes[3] = {188, 192, 204};
+static const uint32_t kSyncOffsets[3] = {0, 4, 0};
+
+void TsDemuxInit(struct TsDemux* ts, FILE* fp) {
+  memset(ts, 0, sizeof(*ts));
+  ts->fp = fp;
+  ts->pmt_pid = -1;
+  ts->hevc_pid = -1;
+  ts->last_cc = -1;
+}
+
+static int Fill(struct TsDemux* ts) {
+  size_t n;
+  if (ts->eof)
+    return 0;
+  if (ts->begin != 0) {
+    memmove(ts->buffer, ts->buffer + ts->begin, ts->end - ts->begin);
+    ts->end -= ts->begin;
+    ts->begin = 0;
+  }
+  n = fread(ts->buffer + ts->end, 1, sizeof(ts->buffer) - ts->end, ts->fp);
+  ts->end += (uint32_t)n;
+  ts->input_bytes += n;
+  if (n == 0)
+    ts->eof = 1;
+  return (int)n;
+}
+
+static int Lock(struct TsDemux* ts) {
+  // Candidate sync bytes come from memchr (vectorized in the C library); a
+  // candidate locks when the following sync bytes repeat at one of the
+  // packet sizes.
+  uint32_t need = (TS_SYNC_CHECK - 1) * 204 + 4 + 1;
+  for (;;) {
+    uint8_t* p;
+    uint32_t pos, i, k;
+    if (ts->end - ts->begin < need && Fill(ts) > 0)
+      continue;
+    if (ts->begin == ts->end)
+      return 0;
+    p = memchr(ts->buffer + ts->begin, TS_SYNC_BYTE, ts->end - ts->begin);
+    if (!p) {
+      ts->begin = ts->end;
+      continue;
+    }
+    pos = (uint32_t)(p - ts->buffer);
+    for (i = 0; i < 3; i++) {
+      uint32_t size = kPacketSizes[i];
+      for (k = 1; k < TS_SYNC_CHECK && pos + k * size < ts->end; k++) {
+        if (ts->buffer[pos + k * size] != TS_SYNC_BYTE)
+          break;
+      }
+      if (k == TS_SYNC_CHECK || (ts->eof && pos + k * size >= ts->end)) {
+        ts->packet_size = size;
+        ts->sync_offset = kSyncOffsets[i];
+        // an M2TS packet whose prefix precedes the buffer is dropped
+        ts->begin = pos >= ts->begin + ts->sync_offset
+                        ? pos - ts->sync_offset
+                        : pos - ts->sync_offset + size;
+        return 1;
+      }
+    }
+    ts->begin = pos + 1;
+  }
+}
+
+static const uint8_t* NextPacket(struct TsDemux* ts) {
+  const uint8_t* pkt;
+  for (;;) {
+    if (ts->packet_size == 0 && !Lock(ts))
+      return NULL;
+    if (ts->end - ts->begin < ts->packet_size) {
+      if (Fill(ts) > 0)
+        continue;
+      return NULL;
+    }
+    pkt = ts->buffer + ts->begin + ts->sync_offset;
+    if (pkt[0] != TS_SYNC_BYTE) {
+      ts->resyncs++;
+      ts->packet_size = 0;
+      ts->begin++;
+      continue;
+    }
+    ts->begin += ts->packet_size;
+    ts->packets++;
+    return pkt;
+  }
+}
+
+static const uint8_t* Section(const uint8_t* p,
+                              const uint8_t* end,
+                              uint8_t table_id,
+                              const uint8_t** section_end) {
+  // pointer_field, then the section; sections are assumed to fit in the
+  // packet that starts them, which holds for PAT and PMT in practice.
+  uint32_t section_length;
+  p += 1 + p[0];
+  if (p + 3 > end || p[0] != table_id)
+    return NULL;
+  section_length = ((p[1] & 0x0F) << 8) | p[2];
+  *section_end = p + 3 + section_length - 4;  // CRC_32
+  if (*section_end > end)
+    *section_end = end;
+  return p;
+}
+
+static void ParsePat(struct TsDemux* ts,
+                     const uint8_t* p,
+                     const uint8_t* end) {
+  const uint8_t* sec_end;
+  const uint8_t* sec = Section(p, end, 0x00, &sec_end);
+  if (!sec)
+    return;
+  for (p = sec + 8; p + 4 <= sec_end; p += 4) {
+    uint32_t program_number = (p[0] << 8) | p[1];
+    if (program_number != 0) {
+      ts->pmt_pid = ((p[2] & 0x1F) << 8) | p[3];
+      return;
+    }
+  }
+}
+
+static void ParsePmt(struct TsDemux* ts,
+                     const uint8_t* p,
+                     const uint8_t* end) {
+  const uint8_t* sec_end;
+  const uint8_t* sec = Section(p, end, 0x02, &sec_end);
+  uint32_t program_info_length;
+  if (!sec || sec + 12 > sec_end)
+    return;
+  program_info_length = ((sec[10] & 0x0F) << 8) | sec[11];
+  for (p = sec + 12 + program_info_length; p + 5 <= sec_end;) {
+    uint32_t es_info_length = ((p[3] & 0x0F) << 8) | p[4];
+    if (p[0] == TS_STREAM_TYPE_HEVC) {
+      ts->hevc_pid = ((p[1] & 0x1F) << 8) | p[2];
+      return;
+    }
+    p += 5 + es_info_length;
+  }
+}
+
+static int64_t Timestamp(const uint8_t* p) {
+  return ((int64_t)((p[0] >> 1) & 7) << 30) | (p[1] << 22) |
+         ((p[2] >> 1) << 15) | (p[3] << 7) | (p[4] >> 1);
+}
+
+static const uint8_t* ParsePesHeader(struct TsDemux* ts,
+                                     const uint8_t* p,
+                                     const uint8_t* end) {
+  uint8_t pts_dts_flags;
+  const uint8_t* payload;
+  if (p + 9 > end || p[0] != 0 || p[1] != 0 || p[2] != 1)
+    return NULL;
+  pts_dts_flags = p[7] >> 6;
+  payload = p + 9 + p[8];
+  if (payload > end)
+    return NULL;
+  ts->pes_packets++;
+  if (pts_dts_flags & 2) {
+    struct TsTimestamp* t = &ts->timestamps[ts->ts_tail % TS_MAX_TIMESTAMPS];
+    t->es_offset = ts->es_bytes;
+    t->pts = Timestamp(p + 9);
+    t->dts = pts_dts_flags == 3 ? Timestamp(p + 14) : t->pts;
+    ts->ts_tail++;
+    if (ts->ts_tail - ts->ts_head > TS_MAX_TIMESTAMPS) {
+      ts->ts_head++;
+      ts->dropped_timestamps++;
+    }
+  }
+  return payload;
+}
+
+static void ParsePacket(struct TsDemux* ts, const uint8_t* pkt) {
+  const uint8_t* end = pkt + TS_PACKET_SIZE;
+  const uint8_t* p = pkt + 4;
+  uint8_t pusi = (pkt[1] >> 6) & 1;
+  uint32_t pid = ((pkt[1] & 0x1F) << 8) | pkt[2];
+  uint8_t adaptation_field_control = (pkt[3] >> 4) & 3;
+  uint8_t continuity_counter = pkt[3] & 0x0F;
+
+  if (pkt[1] & 0x80)  // transport_error_indicator
+    return;
+  if (adaptation_field_control & 2)
+    p += 1 + p[0];
+  if (!(adaptation_field_control & 1) || p >= end)
+    return;
+
+  if (pid == 0 && pusi) {
+    ParsePat(ts, p, end);
+  } else if ((int32_t)pid == ts->pmt_pid && pusi) {
+    ParsePmt(ts, p, end);
+  } else if ((int32_t)pid == ts->hevc_pid) {
+    if (ts->last_cc >= 0) {
+      if (continuity_counter == ts->last_cc)
+        return;  // duplicate packet
+      if (continuity_counter != ((ts->last_cc + 1) & 0x0F))
+        ts->cc_errors++;
+    }
+    ts->last_cc = continuity_counter;
+    if (pusi) {
+      p = ParsePesHeader(ts, p, end);
+      ts->in_pes = p != NULL;
+    }
+    if (ts->in_pes) {
+      ts->pending = p;
+      ts->pending_size = (uint32_t)(end - p);
+    }
+  }
+}
+
+size_t TsDemuxRead(void* opaque, uint8_t* dst, size_t size) {
+  // PES payloads are copied straight into the NalInput buffer. The read
+  // ends early once the timestamp ring is full, so that the NAL units read
+  // so far claim their timestamps before the next PES header needs a slot;
+  // only a NAL unit spanning more than TS_MAX_TIMESTAMPS of them loses one.
+  struct TsDemux* ts = (struct TsDemux*)opaque;
+  size_t n = 0;
+  while (n < size) {
+    size_t copy;
+    if (ts->pending_size == 0) {
+      const uint8_t* pkt;
+      if (n > 0 && ts->ts_tail - ts->ts_head == TS_MAX_TIMESTAMPS)
+        break;
+      pkt = NextPacket(ts);
+      if (!pkt)
+        break;
+      ParsePacket(ts, pkt);
+      continue;
+    }
+    copy = size - n < ts->pending_size ? size - n : ts->pending_size;
+    memcpy(dst + n, ts->pending, copy);
+    ts->pending += copy;
+    ts->pending_size -= (uint32_t)copy;
+    ts->es_bytes += copy;
+    n += copy;
+  }
+  return n;
+}
+
+void TsDemuxStamp(void* opaque, struct NalUnit* nal) {
+  // A PES timestamp belongs to the access unit that starts in its payload,
+  // i.e. to the NAL unit containing the first payload byte.
+  struct TsDemux* ts = (struct TsDemux*)opaque;
+  uint64_t nal_end = nal->offset + nal->prefix_bytes + nal->size;
+  while (ts->ts_head != ts->ts_tail) {
+    struct TsTimestamp* t = &ts->timestamps[ts->ts_head % TS_MAX_TIMESTAMPS];
+    if (t->es_offset >= nal_end)
+      break;
+    nal->pts = t->pts;
+    nal->dts = t->dts;
+    ts->ts_head++;
+  }
+}
@@ -0,0 +1,64 @@
+#ifndef TS_DEMUX_H_
+#define TS_DEMUX_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include "nal-input.h"
+
+// MPEG-2 transport stream (ISO/IEC 13818-1) front-end. Finds the HEVC
+// elementary stream through the PAT and PMT and hands its PES payloads to a
+// NalInput as an Annex B byte stream. Packets may be 188 bytes, 192 bytes
+// (M2TS, 4-byte timestamp prefix) or 204 bytes (16 bytes of parity).
+
+#define TS_PACKET_SIZE 188
+#define TS_SYNC_BYTE 0x47
+#define TS_STREAM_TYPE_HEVC 0x24
+#define TS_READ_PACKETS 512
+#define TS_SYNC_CHECK 5  // consecutive sync bytes needed to lock
+// PES timestamps not yet claimed by a NAL unit; TsDemuxRead stops short
+// rather than run further ahead than this
+#define TS_MAX_TIMESTAMPS 64
+
+struct TsTimestamp {
+  uint64_t es_offset;  // elementary stream offset of the PES payload
+  int64_t pts;
+  int64_t dts;
+};
+
+struct TsDemux {
+  FILE* fp;
+  uint32_t packet_size;  // 188, 192 or 204, 0 until locked
+  uint32_t sync_offset;  // position of the sync byte in a packet
+  uint8_t buffer[TS_READ_PACKETS * 204];
+  uint32_t begin;
+  uint32_t end;
+  uint8_t eof;
+
+  int32_t pmt_pid;   // -1 until found in the PAT
+  int32_t hevc_pid;  // -1 until found in the PMT
+  int32_t last_cc;   // -1 before the first HEVC packet
+  uint8_t in_pes;
+
+  // payload of the current packet not yet handed out
+  const uint8_t* pending;
+  uint32_t pending_size;
+  uint64_t es_bytes;
+
+  struct TsTimestamp timestamps[TS_MAX_TIMESTAMPS];
+  uint32_t ts_head;
+  uint32_t ts_tail;
+
+  uint64_t packets;
+  uint64_t input_bytes;
+  uint64_t pes_packets;
+  uint64_t cc_errors;
+  uint64_t resyncs;
+  uint64_t dropped_timestamps;  // overwritten before a NAL unit claimed them
+};
+
+void TsDemuxInit(struct TsDemux* ts, FILE* fp);
+// NalInput callbacks, |opaque| is the TsDemux
+size_t TsDemuxRead(void* opaque, uint8_t* dst, size_t size);
+void TsDemuxStamp(void* opaque, struct NalUnit* nal);
+
+#endif